@@ -50,6 +50,9 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <set>
 
 #include <OpenCL/opencl.h>
 
@@ -247,6 +250,78 @@ ReportBuildLog(cl_program kProgram, cl_device_id kDeviceId)
     DEBUG_CL_printf(SEPARATOR);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+static const char kProgramCacheMagic[8] = {'T', 'T', 'C', 'L', 'B', 'I', 'N', '1'};
+
+/// 64-bit FNV-1a
+static uint64_t
+HashString(const std::string& kText)
+{
+    uint64_t uiHash = 14695981039346656037ull;
+    for(size_t i = 0; i < kText.size(); i++)
+    {
+        uiHash ^= (uint8_t) kText[i];
+        uiHash *= 1099511628211ull;
+    }
+    return uiHash;
+}
+
+/// Appends "acSource" to "rkExpanded" with every '#include "file"' replaced
+///     by that file, read relative to the working directory as "-I./" does.
+///     Each file is only expanded once; this is only hashed, never built.
+static void
+ExpandIncludes(
+    const char* acSource,
+    std::set<std::string>& rkIncluded,
+    std::string& rkExpanded)
+{
+    const char* acLine = acSource;
+    while(*acLine)
+    {
+        const char* acLineEnd = strchr(acLine, '\n');
+        size_t uiLineLength = acLineEnd ? (size_t) (acLineEnd - acLine) : strlen(acLine);
+        std::string kLine(acLine, uiLineLength);
+        acLine += acLineEnd ? uiLineLength + 1 : uiLineLength;
+        
+        size_t uiDirective = kLine.find_first_not_of(" \t");
+        size_t uiOpenQuote = kLine.find('"');
+        size_t uiCloseQuote = uiOpenQuote == std::string::npos ? std::string::npos : kLine.find('"', uiOpenQuote + 1);
+        if(uiDirective == std::string::npos || kLine.compare(uiDirective, 8, "#include") != 0 || uiCloseQuote == std::string::npos)
+        {
+            rkExpanded += kLine;
+            rkExpanded += '\n';
+            continue;
+        }
+        
+        std::string kFileName = kLine.substr(uiOpenQuote + 1, uiCloseQuote - uiOpenQuote - 1);
+        if(!rkIncluded.insert(kFileName).second)
+            continue;
+        
+        char* acIncludedSource = 0;
+        size_t uiIncludedLength = 0;
+        if(LoadProgramSourceFromFile(kFileName.c_str(), &acIncludedSource, &uiIncludedLength) == 0 && acIncludedSource)
+        {
+            ExpandIncludes(acIncludedSource, rkIncluded, rkExpanded);
+            delete [] acIncludedSource;
+        }
+        else
+        {
+            /// Still part of the key, so the build that fails on it is retried
+            rkExpanded += kLine;
+            rkExpanded += '\n';
+        }
+    }
+}
+
+static std::string
+GetDeviceInfoString(cl_device_id kDeviceId, cl_device_info kParam)
+{
+    char acValue[1024] = {0};
+    clGetDeviceInfo(kDeviceId, kParam, sizeof(acValue) - 1, acValue, NULL);
+    return std::string(acValue);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
     
 static bool
@@ -422,7 +497,8 @@ ComputeEngine::ComputeEngine() :
     m_uiDeviceCount(0),
     m_kContext(0),
     m_akDeviceIds(0),
-    m_akCommandQueues(0)
+    m_akCommandQueues(0),
+    profilingEnabled(false)
 {
     m_akPrograms.clear();
     m_akKernels.clear();
@@ -558,7 +634,12 @@ ComputeEngine::connect(
         DEBUG_CL_printf(SEPARATOR);
         printf("Creating command queue for %s %s...\n", acVendorName, acDeviceName);
         
-        m_akCommandQueues[i] = clCreateCommandQueue(m_kContext, m_akDeviceIds[i], allowOutOfOrderCommands? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0, &iError);
+        cl_command_queue_properties properties = allowOutOfOrderCommands? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0;
+        if (profilingEnabled) {
+            properties |= CL_QUEUE_PROFILING_ENABLE;
+        }
+        
+        m_akCommandQueues[i] = clCreateCommandQueue(m_kContext, m_akDeviceIds[i], properties, &iError);
         if (!m_akCommandQueues[i] || iError)
         {
             DEBUG_CL_printf("Error: Failed to create a command queue!\n");
@@ -587,6 +668,9 @@ bool ComputeEngine::createCommandQueue(
     if (allowOutOfOrderCommands) {
         properties = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
     }
+    if (profilingEnabled) {
+        properties |= CL_QUEUE_PROFILING_ENABLE;
+    }
     
     if (commandQueues.count(deviceId) == 0) {
         commandQueues[deviceId] = std::map<uint, cl_command_queue>();
@@ -609,6 +693,53 @@ bool ComputeEngine::createCommandQueue(
     
     
 
+void
+ComputeEngine::setProfilingEnabled(bool enabled, const std::function<double()> & hostClock) {
+    assert(!enabled || hostClock);
+    profilingEnabled = enabled;
+    profilingClock = hostClock;
+}
+
+void
+ComputeEngine::recordKernelEvent(const char * kernelName, uint deviceIndex, double enqueueSeconds, cl_event event) {
+    PendingKernelEvent pending;
+    pending.kernelName = kernelName;
+    pending.deviceIndex = deviceIndex;
+    pending.enqueueSeconds = enqueueSeconds;
+    pending.event = event;
+    pendingKernelEvents.push_back(pending);
+}
+
+std::vector<ComputeEngine::KernelTiming>
+ComputeEngine::collectKernelTimings() {
+    std::vector<KernelTiming> timings;
+    
+    for (auto itr = pendingKernelEvents.begin(); itr != pendingKernelEvents.end(); itr++) {
+        cl_ulong queued = 0, start = 0, end = 0;
+        int iError = clWaitForEvents(1, &itr->event);
+        iError |= clGetEventProfilingInfo(itr->event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        iError |= clGetEventProfilingInfo(itr->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        iError |= clGetEventProfilingInfo(itr->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+        clReleaseEvent(itr->event);
+        
+        if (iError != CL_SUCCESS) {
+            continue;
+        }
+        
+        /// The device clock has its own epoch, so place the kernel relative to
+        ///     when the host enqueued it (profiling times are nanoseconds)
+        KernelTiming timing;
+        timing.kernelName = itr->kernelName;
+        timing.deviceIndex = itr->deviceIndex;
+        timing.startSeconds = itr->enqueueSeconds + 1.0e-9 * (double) (start - queued);
+        timing.endSeconds = itr->enqueueSeconds + 1.0e-9 * (double) (end - queued);
+        timings.push_back(timing);
+    }
+    pendingKernelEvents.clear();
+    
+    return timings;
+}
+
 bool
 ComputeEngine::disconnect()
 {
@@ -619,6 +750,11 @@ ComputeEngine::disconnect()
         for(i = 0; i < m_uiDeviceCount; i++)
             clFinish(m_akCommandQueues[i]);
     }
+    
+    for (auto itr = pendingKernelEvents.begin(); itr != pendingKernelEvents.end(); itr++) {
+        clReleaseEvent(itr->event);
+    }
+    pendingKernelEvents.clear();
         
     MemObjectMapIter pkMemObjIter;
     for(pkMemObjIter = m_akMemObjects.begin(); pkMemObjIter != m_akMemObjects.end(); pkMemObjIter++)
@@ -677,11 +813,19 @@ ComputeEngine::disconnect()
     return true;
 }
 
+void
+ComputeEngine::setProgramCacheDirectory(
+    const char* acDirectory)
+{
+    m_kProgramCacheDirectory = acDirectory ? acDirectory : "";
+}
+
 bool
 ComputeEngine::createProgramFromFile(
     const char* acProgramName,
     const char* acFileName,
-    const char* acMacroDefinitions)
+    const char* acMacroDefinitions,
+    const char* acBuildOptions)
 {
     char* acSourceString = 0;
     size_t uiStringLength;
@@ -705,7 +849,7 @@ ComputeEngine::createProgramFromFile(
     bool bSuccess = false;
     if(acSourceString)
     {
-        bSuccess = createProgramFromSourceString(acProgramName, acSourceString, acMacroDefinitions);
+        bSuccess = createProgramFromSourceString(acProgramName, acSourceString, acMacroDefinitions, acBuildOptions);
         delete [] acSourceString;
     }
     
@@ -716,7 +860,8 @@ bool
 ComputeEngine::createProgramFromSourceString(
     const char* acProgramName,
     const char* acSourceString,
-    const char* acMacroDefinitions)    
+    const char* acMacroDefinitions,
+    const char* acBuildOptions)    
 {
     ProgramMapIter pkPgmIter = m_akPrograms.find(acProgramName);
     if(pkPgmIter != m_akPrograms.end())
@@ -749,6 +894,26 @@ ComputeEngine::createProgramFromSourceString(
         sprintf(acProgramSource, "%s\n", acSourceString);
     }
 
+    std::string kBuildOptions = "-I./";
+    if(acBuildOptions && acBuildOptions[0])
+    {
+        kBuildOptions += " ";
+        kBuildOptions += acBuildOptions;
+    }
+    
+    std::string kCacheKey;
+    if(!m_kProgramCacheDirectory.empty())
+    {
+        kCacheKey = programCacheKey(acProgramSource, kBuildOptions.c_str());
+        cl_program kCachedProgram = loadCachedProgram(acProgramName, kCacheKey, kBuildOptions.c_str());
+        if(kCachedProgram)
+        {
+            delete [] acProgramSource;
+            m_akPrograms[acProgramName] = kCachedProgram;
+            return true;
+        }
+    }
+
     int iError = CL_SUCCESS;
     cl_program kProgram = clCreateProgramWithSource(m_kContext, 1, (const char **) & acProgramSource, NULL, &iError);
     delete [] acProgramSource;
@@ -764,42 +929,218 @@ ComputeEngine::createProgramFromSourceString(
 
     DEBUG_CL_printf(SEPARATOR);
     DEBUG_CL_printf("Building compute program '%s'...\n", acProgramName);
-    iError = clBuildProgram(kProgram, m_uiDeviceCount, m_akDeviceIds, "-I./", NULL, NULL);
-    
-    for(uint i = 0; i < m_uiDeviceCount; i++) {
-        printf("Build log for device '%d':\n", i);
-        ReportBuildLog(kProgram, m_akDeviceIds[i]);
-    }
+    iError = clBuildProgram(kProgram, m_uiDeviceCount, m_akDeviceIds, kBuildOptions.c_str(), NULL, NULL);
     
     if (iError != CL_SUCCESS)
     {
-        DEBUG_CL_printf("Error: Failed to build program executable!\n");
-//        for(uint i = 0; i < m_uiDeviceCount; i++)
-//        {
-//            DEBUG_CL_printf("Build log for device '%d':\n", i);
-//            ReportBuildLog(kProgram, m_akDeviceIds[i]);
-//        }
+        printf("Error: Failed to build program '%s'!\n", acProgramName);
+        for(uint i = 0; i < m_uiDeviceCount; i++)
+        {
+            printf("Build log for device '%d':\n", i);
+            ReportBuildLog(kProgram, m_akDeviceIds[i]);
+        }
         ReportError(iError);
         clReleaseProgram(kProgram);
         return false;
     }
 
     DEBUG_CL_printf(SEPARATOR);
+    if(!kCacheKey.empty() && !saveCachedProgram(acProgramName, kCacheKey, kProgram))
+    {
+        DEBUG_CL_printf("Compute Engine: Couldn't cache the binary of program '%s'\n", acProgramName);
+    }
+    
     m_akPrograms[acProgramName] = kProgram;
     return true;
 }
 
+std::string
+ComputeEngine::programCacheKey(
+    const char* acProgramSource,
+    const char* acBuildOptions)
+{
+    std::set<std::string> akIncluded;
+    std::string kExpandedSource;
+    ExpandIncludes(acProgramSource, akIncluded, kExpandedSource);
+    
+    char acSourceHash[32];
+    snprintf(acSourceHash, sizeof(acSourceHash), "%016llx", (unsigned long long) HashString(kExpandedSource));
+    
+    std::string kKey = std::string("source ") + acSourceHash + "\n";
+    kKey += std::string("options ") + acBuildOptions + "\n";
+    for(uint i = 0; i < m_uiDeviceCount; i++)
+    {
+        kKey += "device " + GetDeviceInfoString(m_akDeviceIds[i], CL_DEVICE_NAME) + "\n";
+        kKey += "driver " + GetDeviceInfoString(m_akDeviceIds[i], CL_DRIVER_VERSION) + "\n";
+    }
+    return kKey;
+}
+
+std::string
+ComputeEngine::programCachePath(
+    const char* acProgramName,
+    const std::string& kKey)
+{
+    char acKeyHash[32];
+    snprintf(acKeyHash, sizeof(acKeyHash), "%016llx", (unsigned long long) HashString(kKey));
+    return m_kProgramCacheDirectory + "/" + acProgramName + "-" + acKeyHash + ".clbin";
+}
+
+cl_program
+ComputeEngine::loadCachedProgram(
+    const char* acProgramName,
+    const std::string& kKey,
+    const char* acBuildOptions)
+{
+    std::string kPath = programCachePath(acProgramName, kKey);
+    FILE* pkFile = fopen(kPath.c_str(), "rb");
+    if(!pkFile)
+        return 0;
+
+    /// Magic, the full key (the file name only has its hash), then the size
+    ///     and bytes of every device's binary
+    bool bValid = true;
+    char acMagic[sizeof(kProgramCacheMagic)];
+    uint32_t uiKeyLength = 0;
+    bValid = bValid && fread(acMagic, sizeof(acMagic), 1, pkFile) == 1 && memcmp(acMagic, kProgramCacheMagic, sizeof(acMagic)) == 0;
+    bValid = bValid && fread(&uiKeyLength, sizeof(uiKeyLength), 1, pkFile) == 1 && uiKeyLength == kKey.size();
+    
+    std::string kFileKey(bValid ? uiKeyLength : 0, '\0');
+    bValid = bValid && (uiKeyLength == 0 || fread(&kFileKey[0], uiKeyLength, 1, pkFile) == 1) && kFileKey == kKey;
+    
+    uint32_t uiBinaryCount = 0;
+    bValid = bValid && fread(&uiBinaryCount, sizeof(uiBinaryCount), 1, pkFile) == 1 && uiBinaryCount == m_uiDeviceCount;
+    
+    std::vector<std::vector<unsigned char> > akBinaries(bValid ? uiBinaryCount : 0);
+    std::vector<size_t> akBinarySizes(akBinaries.size());
+    std::vector<const unsigned char*> akBinaryPointers(akBinaries.size());
+    for(size_t i = 0; bValid && i < akBinaries.size(); i++)
+    {
+        uint64_t uiSize = 0;
+        bValid = fread(&uiSize, sizeof(uiSize), 1, pkFile) == 1 && uiSize > 0;
+        if(bValid)
+        {
+            akBinaries[i].resize((size_t) uiSize);
+            bValid = fread(&akBinaries[i][0], (size_t) uiSize, 1, pkFile) == 1;
+            akBinarySizes[i] = (size_t) uiSize;
+            akBinaryPointers[i] = &akBinaries[i][0];
+        }
+    }
+    fclose(pkFile);
+    
+    if(!bValid || akBinaries.empty())
+    {
+        DEBUG_CL_printf("Compute Engine: Ignoring stale program cache '%s'\n", kPath.c_str());
+        return 0;
+    }
+
+    int iError = CL_SUCCESS;
+    std::vector<cl_int> aiBinaryStatus(akBinaries.size(), CL_SUCCESS);
+    cl_program kProgram = clCreateProgramWithBinary(m_kContext, m_uiDeviceCount, m_akDeviceIds, &akBinarySizes[0], &akBinaryPointers[0], &aiBinaryStatus[0], &iError);
+    if(!kProgram || iError != CL_SUCCESS)
+    {
+        DEBUG_CL_printf("Compute Engine: Driver rejected program cache '%s'\n", kPath.c_str());
+        if(kProgram)
+            clReleaseProgram(kProgram);
+        return 0;
+    }
+    
+    /// Binaries still have to be built, which only links them
+    iError = clBuildProgram(kProgram, m_uiDeviceCount, m_akDeviceIds, acBuildOptions, NULL, NULL);
+    if(iError != CL_SUCCESS)
+    {
+        DEBUG_CL_printf("Compute Engine: Failed to build program cache '%s'\n", kPath.c_str());
+        clReleaseProgram(kProgram);
+        return 0;
+    }
+    
+    DEBUG_CL_printf("Compute Engine: Loaded program '%s' from '%s'\n", acProgramName, kPath.c_str());
+    return kProgram;
+}
+
+bool
+ComputeEngine::saveCachedProgram(
+    const char* acProgramName,
+    const std::string& kKey,
+    cl_program kProgram)
+{
+    /// Binaries come back in the program's device order, which has to be
+    ///     the order "loadCachedProgram" passes them in
+    cl_uint uiDeviceCount = 0;
+    int iError = clGetProgramInfo(kProgram, CL_PROGRAM_NUM_DEVICES, sizeof(uiDeviceCount), &uiDeviceCount, NULL);
+    if(iError != CL_SUCCESS || uiDeviceCount != m_uiDeviceCount || uiDeviceCount == 0)
+        return false;
+    
+    std::vector<cl_device_id> akDeviceIds(uiDeviceCount);
+    iError = clGetProgramInfo(kProgram, CL_PROGRAM_DEVICES, sizeof(cl_device_id) * uiDeviceCount, &akDeviceIds[0], NULL);
+    if(iError != CL_SUCCESS || memcmp(&akDeviceIds[0], m_akDeviceIds, sizeof(cl_device_id) * uiDeviceCount) != 0)
+        return false;
+    
+    std::vector<size_t> akBinarySizes(uiDeviceCount);
+    iError = clGetProgramInfo(kProgram, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * uiDeviceCount, &akBinarySizes[0], NULL);
+    if(iError != CL_SUCCESS)
+        return false;
+    
+    std::vector<std::vector<unsigned char> > akBinaries(uiDeviceCount);
+    std::vector<unsigned char*> akBinaryPointers(uiDeviceCount);
+    for(uint i = 0; i < uiDeviceCount; i++)
+    {
+        if(akBinarySizes[i] == 0)
+            return false;
+        akBinaries[i].resize(akBinarySizes[i]);
+        akBinaryPointers[i] = &akBinaries[i][0];
+    }
+    iError = clGetProgramInfo(kProgram, CL_PROGRAM_BINARIES, sizeof(unsigned char*) * uiDeviceCount, &akBinaryPointers[0], NULL);
+    if(iError != CL_SUCCESS)
+        return false;
+    
+    /// The directory may not exist yet; if it still can't be created the
+    ///     open below fails
+    mkdir(m_kProgramCacheDirectory.c_str(), 0755);
+    
+    std::string kPath = programCachePath(acProgramName, kKey);
+    std::string kPartialPath = kPath + ".partial";
+    FILE* pkFile = fopen(kPartialPath.c_str(), "wb");
+    if(!pkFile)
+        return false;
+    
+    uint32_t uiKeyLength = (uint32_t) kKey.size();
+    uint32_t uiBinaryCount = (uint32_t) uiDeviceCount;
+    bool bWritten = fwrite(kProgramCacheMagic, sizeof(kProgramCacheMagic), 1, pkFile) == 1;
+    bWritten = bWritten && fwrite(&uiKeyLength, sizeof(uiKeyLength), 1, pkFile) == 1;
+    bWritten = bWritten && fwrite(kKey.data(), kKey.size(), 1, pkFile) == 1;
+    bWritten = bWritten && fwrite(&uiBinaryCount, sizeof(uiBinaryCount), 1, pkFile) == 1;
+    for(uint i = 0; bWritten && i < uiDeviceCount; i++)
+    {
+        uint64_t uiSize = (uint64_t) akBinarySizes[i];
+        bWritten = fwrite(&uiSize, sizeof(uiSize), 1, pkFile) == 1;
+        bWritten = bWritten && fwrite(&akBinaries[i][0], akBinarySizes[i], 1, pkFile) == 1;
+    }
+    bWritten = (fclose(pkFile) == 0) && bWritten;
+    
+    /// Renamed into place so a half-written file is never loaded
+    if(!bWritten || rename(kPartialPath.c_str(), kPath.c_str()) != 0)
+    {
+        unlink(kPartialPath.c_str());
+        return false;
+    }
+    
+    DEBUG_CL_printf("Compute Engine: Cached program '%s' in '%s'\n", acProgramName, kPath.c_str());
+    return true;
+}
+
 bool
 ComputeEngine::createKernel(
     const char* acProgramName,
     const char* acKernelName)
 {
+    /// The entry itself stays, since handles point into it
     KernelMapIter pkKernelIter = m_akKernels.find(acKernelName);
-    if(pkKernelIter != m_akKernels.end())
+    if(pkKernelIter != m_akKernels.end() && pkKernelIter->second)
     {
         DEBUG_CL_printf("Compute Engine: Releasing existing kernel '%s'...\n", acKernelName);
         clReleaseKernel(pkKernelIter->second);
-        m_akKernels.erase(pkKernelIter);
+        pkKernelIter->second = 0;
     }    
     
     ProgramMapIter pkPgmIter = m_akPrograms.find(acProgramName);
@@ -823,6 +1164,18 @@ ComputeEngine::createKernel(
     return true;
 }
 
+ComputeEngine::KernelHandle
+ComputeEngine::getKernelHandle(
+    const char* acKernelName)
+{
+    KernelMapIter pkKernelIter = m_akKernels.insert(std::make_pair(std::string(acKernelName), (cl_kernel) 0)).first;
+    
+    KernelHandle kHandle;
+    kHandle.name_ = &pkKernelIter->first;
+    kHandle.kernel_ = &pkKernelIter->second;
+    return kHandle;
+}
+
 uint 
 ComputeEngine::getKernelArgCount(
     const char* acKernelName)
@@ -866,6 +1219,24 @@ ComputeEngine::setKernelArg(
     return true;
 }
 
+bool
+ComputeEngine::bindArg(
+    const KernelHandle & kernel,
+    uint argIndex,
+    const void * value,
+    size_t size)
+{
+    int iError = clSetKernelArg(kernel.kernel(), argIndex, size, value);
+    if(iError != CL_SUCCESS)
+    {
+        DEBUG_CL_printf("Compute Engine: Error setting kernel argument '%d' for '%s'\n", argIndex, kernel.name());
+        ReportError(iError);
+        return false;
+    }
+    
+    return true;
+}
+
 bool
 ComputeEngine::setKernelArgs(
     const char* acKernelName,
@@ -904,9 +1275,32 @@ ComputeEngine::executeKernel(
     if(pkKernelIter == m_akKernels.end()) {
         assert(false);
     }
-                
-    cl_kernel kKernel = pkKernelIter->second;
     
+    return enqueueKernel(pkKernelIter->second, acKernelName, uiDeviceIndex, auiGlobalDim, auiLocalDim, uiDimCount);
+}
+
+bool
+ComputeEngine::executeKernel(
+    const KernelHandle & kernel,
+    uint deviceID,
+    const std::vector<size_t> & globalDims,
+    const std::vector<size_t> & localDims)
+{
+    assert(kernel.isValid());
+    assert(localDims.empty() || localDims.size() == globalDims.size());
+    
+    return enqueueKernel(kernel.kernel(), kernel.name(), deviceID, &globalDims[0], localDims.empty() ? NULL : &localDims[0], (uint) globalDims.size());
+}
+
+bool
+ComputeEngine::enqueueKernel(
+    cl_kernel kKernel,
+    const char* acKernelName,
+    uint uiDeviceIndex,
+    const size_t* auiGlobalDim,
+    const size_t* auiLocalDim,
+    uint uiDimCount)
+{
 //#ifdef DEBUG    
 //    DEBUG_CL_printf("Compute Engine: Execute Kernel '%s': Global[%zu, %zu]  Local[%zu, %zu]\n",
 //        acKernelName, 
@@ -915,9 +1309,14 @@ ComputeEngine::executeKernel(
 //#endif
 
     int iError = CL_SUCCESS;
+    cl_event kEvent = NULL;
+    double enqueueSeconds = profilingEnabled ? profilingClock() : 0.0;
     iError = clEnqueueNDRangeKernel(m_akCommandQueues[uiDeviceIndex], kKernel, 
                                     uiDimCount, NULL, auiGlobalDim, auiLocalDim, 
-                                    0, NULL, NULL);
+                                    0, NULL, profilingEnabled ? &kEvent : NULL);
+    
+    if(iError == CL_SUCCESS && kEvent != NULL)
+        recordKernelEvent(acKernelName, uiDeviceIndex, enqueueSeconds, kEvent);
 
     if(iError != CL_SUCCESS)
 	{
@@ -944,9 +1343,15 @@ ComputeEngine::executeKernelWithQueueId(
     cl_kernel kKernel = pkKernelIter->second;
 
     int iError = CL_SUCCESS;
+    cl_event kEvent = NULL;
+    double enqueueSeconds = profilingEnabled ? profilingClock() : 0.0;
     iError = clEnqueueNDRangeKernel(commandQueues[deviceId][queueId], kKernel,
                                     (int) globalDims.size(), NULL, &globalDims[0], NULL,
-                                    0, NULL, NULL);
+                                    0, NULL, profilingEnabled ? &kEvent : NULL);
+    
+    if (iError == CL_SUCCESS && kEvent != NULL) {
+        recordKernelEvent(kernelName.c_str(), deviceId, enqueueSeconds, kEvent);
+    }
 
     if(iError != CL_SUCCESS)
     {
@@ -968,12 +1373,13 @@ ComputeEngine::createBuffer(
     DEBUG_CL_printf("Compute Engine: Creating Buffer '%s' with %d bytes (%5.2f Mbytes) total)...\n",
         acMemObjName, (int)kBytes, (float)kBytes / 1024.0f / 1024.0f);
         
+    /// The entry itself stays, since handles point into it
     MemObjectMapIter pkMemObjIter = m_akMemObjects.find(acMemObjName);
-    if(pkMemObjIter != m_akMemObjects.end())
+    if(pkMemObjIter != m_akMemObjects.end() && pkMemObjIter->second)
     {
         DEBUG_CL_printf("Compute Engine: Releasing Existing Buffer\n");
         clReleaseMemObject(pkMemObjIter->second);
-        m_akMemObjects.erase(pkMemObjIter);
+        pkMemObjIter->second = 0;
     }
     
     int iError = CL_SUCCESS;
@@ -997,7 +1403,29 @@ ComputeEngine::readBuffer(
     size_t kBytes,
     void* pvData)
 {
-    cl_mem kBuffer = getMemObject(acMemObjName);
+    return readBuffer(getMemObject(acMemObjName), acMemObjName, uiDeviceIndex, uiStart, kBytes, pvData);
+}
+
+bool
+ComputeEngine::readBuffer(
+    const BufferHandle & buffer,
+    uint uiDeviceIndex,
+    uint uiStart,
+    size_t kBytes,
+    void* pvData)
+{
+    return readBuffer(buffer.memObject(), buffer.name(), uiDeviceIndex, uiStart, kBytes, pvData);
+}
+
+bool
+ComputeEngine::readBuffer(
+    cl_mem kBuffer,
+    const char* acMemObjName,
+    uint uiDeviceIndex,
+    uint uiStart,
+    size_t kBytes,
+    void* pvData)
+{
     if(kBuffer == 0) {
         assert(false);
     }
@@ -1030,7 +1458,29 @@ ComputeEngine::writeBuffer(
     size_t kBytes,
     void* pvData)
 {
-    cl_mem kBuffer = getMemObject(acMemObjName);
+    return writeBuffer(getMemObject(acMemObjName), acMemObjName, uiDeviceIndex, uiStart, kBytes, pvData);
+}
+
+bool
+ComputeEngine::writeBuffer(
+    const BufferHandle & buffer,
+    uint uiDeviceIndex,
+    uint uiStart,
+    size_t kBytes,
+    void* pvData)
+{
+    return writeBuffer(buffer.memObject(), buffer.name(), uiDeviceIndex, uiStart, kBytes, pvData);
+}
+
+bool
+ComputeEngine::writeBuffer(
+    cl_mem kBuffer,
+    const char* acMemObjName,
+    uint uiDeviceIndex,
+    uint uiStart,
+    size_t kBytes,
+    void* pvData)
+{
     if(kBuffer == 0)
         return false;
 
@@ -1165,6 +1615,18 @@ ComputeEngine::getBuffer(
 {
     return getMemObject(acMemObjName);
 }
+
+ComputeEngine::BufferHandle
+ComputeEngine::getBufferHandle(
+    const char* acMemObjName)
+{
+    MemObjectMapIter pkMemObjIter = m_akMemObjects.insert(std::make_pair(std::string(acMemObjName), (cl_mem) 0)).first;
+    
+    BufferHandle kHandle;
+    kHandle.name_ = &pkMemObjIter->first;
+    kHandle.memObject_ = &pkMemObjIter->second;
+    return kHandle;
+}
     
 cl_kernel
 ComputeEngine::getKernelObject(
@@ -1191,11 +1653,11 @@ ComputeEngine::createImage2D(
     void* pvData)
 {
     MemObjectMapIter pkMemObjIter = m_akMemObjects.find(acMemObjName);
-    if(pkMemObjIter != m_akMemObjects.end())
+    if(pkMemObjIter != m_akMemObjects.end() && pkMemObjIter->second)
     {
         DEBUG_CL_printf("Compute Engine: Releasing Existing Image '%s'\n", acMemObjName);
         clReleaseMemObject(pkMemObjIter->second);
-        m_akMemObjects.erase(pkMemObjIter);
+        pkMemObjIter->second = 0;
     }
 
     uint uiChannelCount = getChannelCount(eOrder);
@@ -1367,11 +1829,11 @@ ComputeEngine::createGLBufferReference(
         acMemObjName, uiBufferId);
         
     MemObjectMapIter pkMemObjIter = m_akMemObjects.find(acMemObjName);
-    if(pkMemObjIter != m_akMemObjects.end())
+    if(pkMemObjIter != m_akMemObjects.end() && pkMemObjIter->second)
     {
         DEBUG_CL_printf("Compute Engine: Releasing existing memory object '%s'...\n", acMemObjName);
         clReleaseMemObject(pkMemObjIter->second);
-        m_akMemObjects.erase(pkMemObjIter);
+        pkMemObjIter->second = 0;
     }
 
     int iError = CL_SUCCESS;
@@ -1499,11 +1961,11 @@ ComputeEngine::createGLTextureReference(
         acMemObjName, uiBufferId);
         
     MemObjectMapIter pkMemObjIter = m_akMemObjects.find(acMemObjName);
-    if(pkMemObjIter != m_akMemObjects.end())
+    if(pkMemObjIter != m_akMemObjects.end() && pkMemObjIter->second)
     {
         DEBUG_CL_printf("Compute Engine: Releasing existing memory object '%s'...\n", acMemObjName);
         clReleaseMemObject(pkMemObjIter->second);
-        m_akMemObjects.erase(pkMemObjIter);
+        pkMemObjIter->second = 0;
     }
 
     int iError = CL_SUCCESS;
@@ -1699,3 +2161,50 @@ ComputeEngine::dumpBuffer(
     delete [] acBuffer;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+bool
+KernelLaunch::launch(
+    uint deviceIndex,
+    const std::vector<size_t> & globalDims,
+    const std::vector<size_t> & localDims)
+{
+    assert(engine_ != nullptr && kernel_.isValid());
+    
+    /// A kernel created again has lost all of its arguments
+    if(kernel_.kernel() != boundKernel_)
+    {
+        for(auto itr = args_.begin(); itr != args_.end(); itr++)
+            itr->isBound = false;
+        boundKernel_ = kernel_.kernel();
+    }
+    
+    argsBoundLastLaunch_ = 0;
+    for(uint argIndex = 0; argIndex < (uint) args_.size(); argIndex++)
+    {
+        Arg & arg = args_[argIndex];
+        if(!arg.isSet)
+        {
+            DEBUG_CL_printf("Compute Engine: Kernel argument '%d' for '%s' was never set\n", argIndex, kernel_.name());
+            return false;
+        }
+        
+        if(arg.isBuffer)
+        {
+            cl_mem memObject = arg.buffer.memObject();
+            arg.value.assign((const unsigned char *) &memObject, (const unsigned char *) &memObject + sizeof(cl_mem));
+        }
+        
+        if(arg.isBound && arg.boundValue == arg.value)
+            continue;
+        
+        if(!engine_->bindArg(kernel_, argIndex, arg.value.data(), arg.value.size()))
+            return false;
+        
+        arg.boundValue = arg.value;
+        arg.isBound = true;
+        argsBoundLastLaunch_++;
+    }
+    
+    return engine_->executeKernel(kernel_, deviceIndex, globalDims, localDims);
+}
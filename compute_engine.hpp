@@ -58,7 +58,9 @@
 #include <sys/stat.h>
 #include <OpenGL/OpenGL.h>
 #include <OpenCL/opencl.h>
+#include <functional>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "compute_types.hpp"
@@ -114,9 +116,62 @@ public:
         FLOAT                      = CL_FLOAT
     };
 
+    /// When and where a kernel ran, on the clock given to "setProfilingEnabled"
+    struct KernelTiming {
+        std::string kernelName;
+        uint deviceIndex;
+        double startSeconds;
+        double endSeconds;
+    };
+
+    /// A kernel looked up once by name instead of on every call. It stays
+    ///     valid when the kernel is created again under the same name, until
+    ///     "disconnect".
+    class KernelHandle {
+    public:
+        KernelHandle() : name_(nullptr), kernel_(nullptr) {}
+        
+        cl_kernel kernel() const { return kernel_ != nullptr ? *kernel_ : (cl_kernel) 0; }
+        const char * name() const { return name_ != nullptr ? name_->c_str() : ""; }
+        bool isValid() const { return kernel() != 0; }
+        
+    private:
+        friend class ComputeEngine;
+        const std::string * name_;
+        const cl_kernel * kernel_;
+    };
+    
+    /// A buffer or image looked up once by name. It follows "createBuffer"
+    ///     reallocating it and "swapMemObjects" trading it, until
+    ///     "disconnect".
+    class BufferHandle {
+    public:
+        BufferHandle() : name_(nullptr), memObject_(nullptr) {}
+        
+        cl_mem memObject() const { return memObject_ != nullptr ? *memObject_ : (cl_mem) 0; }
+        const char * name() const { return name_ != nullptr ? name_->c_str() : ""; }
+        bool isValid() const { return memObject() != 0; }
+        
+    private:
+        friend class ComputeEngine;
+        const std::string * name_;
+        const cl_mem * memObject_;
+    };
+
     ComputeEngine();
     ~ComputeEngine();
     
+    /// Must be called before "connect". Command queues are then created with
+    ///     CL_QUEUE_PROFILING_ENABLE and every kernel launch is timed.
+    ///     "hostClock" returns seconds and is used to place the device's
+    ///     timestamps on the host's timeline.
+    void setProfilingEnabled(bool enabled, const std::function<double()> & hostClock);
+    bool isProfilingEnabled() const { return profilingEnabled; }
+    
+    /// Waits for every kernel launched since the last call and returns their
+    ///     timings
+    std::vector<KernelTiming> collectKernelTimings();
+    
     bool connect(
         DeviceType eDeviceType = DEVICE_TYPE_ALL, 
         uint uiCount = 1,
@@ -131,15 +186,25 @@ public:
     
     bool disconnect();
 
+    /// Programs built from source are saved to "acDirectory" and loaded
+    ///     back with "clCreateProgramWithBinary" for as long as their source
+    ///     (with its includes), build options, devices and drivers stay the
+    ///     same. Empty or null (the default) never caches.
+    void setProgramCacheDirectory(const char* acDirectory);
+
+    /// "acBuildOptions" are passed on to "clBuildProgram", e.g. "-D" flags
+    ///     that specialize the program.
     bool createProgramFromFile(
         const char* acProgramName,
         const char* acFileName,
-        const char* acMacroDefinitions = 0);
+        const char* acMacroDefinitions = 0,
+        const char* acBuildOptions = 0);
         
     bool createProgramFromSourceString(
         const char* acProgramName,
         const char* aSourceString,
-        const char* acMacroDefinitions = 0);        
+        const char* acMacroDefinitions = 0,
+        const char* acBuildOptions = 0);        
         
     bool setKernelArg(
         const char* acKernelName,
@@ -189,12 +254,33 @@ public:
         return setKernelArgs_(kernelName, 0, args...);
     }
 
+    /// Sets every argument of "kernel" in order, calling "clSetKernelArg"
+    ///     directly. Buffer handles are passed as their current "cl_mem".
+    template <typename... Args>
+    bool bind(
+        const KernelHandle & kernel,
+        const Args &... args) {
+        
+        return bind_(kernel, 0, args...);
+    }
+    
+    /// Sets one argument of "kernel" from raw bytes
+    bool bindArg(
+        const KernelHandle & kernel,
+        uint argIndex,
+        const void * value,
+        size_t size);
+
     uint getKernelArgCount(
         const char* acKernelName);
         
     bool createKernel(
         const char* acProgramName,
         const char* acKernelName);
+    
+    /// Works before the kernel is created, which then fills the handle in
+    KernelHandle getKernelHandle(
+        const char* acKernelName);
         
     bool executeKernel(
         const char* acKernelName,
@@ -249,6 +335,12 @@ public:
         return executeKernel(kernelName, deviceID, &globalDims[0], &localDims[0], (uint) globalDims.size());
     }
     
+    bool executeKernel(
+        const KernelHandle & kernel,
+        uint deviceID,
+        const std::vector<size_t> & globalDims,
+        const std::vector<size_t> & localDims = std::vector<size_t>());
+    
     bool executeKernelWithQueueId(
         std::string kernelName,
         uint deviceId,
@@ -277,6 +369,24 @@ public:
     cl_mem getBuffer(
         const char* acMemObjName);
     
+    /// Works before the buffer is created, which then fills the handle in
+    BufferHandle getBufferHandle(
+        const char* acMemObjName);
+
+    bool readBuffer(
+        const BufferHandle & buffer,
+        uint uiDeviceIndex,
+        uint uiStart,
+        size_t kBytes,
+        void* pvData);
+        
+    bool writeBuffer(
+        const BufferHandle & buffer,
+        uint uiDeviceIndex,
+        uint uiStart,
+        size_t kBytes,
+        void* pvData);
+    
     void dumpBuffer(
         const char* acMemObjName,
         uint uiDeviceIndex,
@@ -400,7 +510,76 @@ protected:
     cl_command_queue* m_akCommandQueues;
     
     std::map<uint, std::map<uint, cl_command_queue>> commandQueues;
-
+    
+    ///
+    struct PendingKernelEvent {
+        std::string kernelName;
+        uint deviceIndex;
+        /// "hostClock" when the kernel was enqueued
+        double enqueueSeconds;
+        cl_event event;
+    };
+    
+    ///
+    void recordKernelEvent(const char * kernelName, uint deviceIndex, double enqueueSeconds, cl_event event);
+    
+    ///
+    bool enqueueKernel(cl_kernel kernel, const char * kernelName, uint deviceIndex, const size_t * globalDims, const size_t * localDims, uint dimCount);
+    bool readBuffer(cl_mem buffer, const char * memObjName, uint deviceIndex, uint start, size_t bytes, void * data);
+    bool writeBuffer(cl_mem buffer, const char * memObjName, uint deviceIndex, uint start, size_t bytes, void * data);
+    
+    template <typename T = void>
+    bool bind_(
+        const KernelHandle & kernel,
+        uint argIndex) {
+        
+        return true;
+    }
+    
+    template <typename T, typename... Args>
+    bool bind_(
+        const KernelHandle & kernel,
+        uint argIndex,
+        const T & value,
+        const Args &... args) {
+        
+        return bindArg(kernel, argIndex, &value, sizeof(T)) && bind_(kernel, argIndex + 1, args...);
+    }
+    
+    template <typename... Args>
+    bool bind_(
+        const KernelHandle & kernel,
+        uint argIndex,
+        const BufferHandle & buffer,
+        const Args &... args) {
+        
+        cl_mem memObject = buffer.memObject();
+        return bindArg(kernel, argIndex, &memObject, sizeof(cl_mem)) && bind_(kernel, argIndex + 1, args...);
+    }
+    
+    bool profilingEnabled;
+    std::function<double()> profilingClock;
+    std::vector<PendingKernelEvent> pendingKernelEvents;
+
+    /// Key for the program binaries of "acProgramSource" built with
+    ///     "acBuildOptions" on the connected devices
+    std::string programCacheKey(
+        const char* acProgramSource,
+        const char* acBuildOptions);
+    std::string programCachePath(
+        const char* acProgramName,
+        const std::string& kKey);
+    /// Returns 0 when there's no cached binary for "kKey" or it won't build
+    cl_program loadCachedProgram(
+        const char* acProgramName,
+        const std::string& kKey,
+        const char* acBuildOptions);
+    bool saveCachedProgram(
+        const char* acProgramName,
+        const std::string& kKey,
+        cl_program kProgram);
+    
+    std::string m_kProgramCacheDirectory;
 	std::map<std::string, cl_program, ltstr> m_akPrograms;
 	std::map<std::string, cl_kernel, ltstr> m_akKernels;
 	std::map<std::string, cl_mem, ltstr> m_akMemObjects;
@@ -410,6 +589,93 @@ private:
     
 };
 
+/////////////////////////////////////////////////////////////////////////////
+
+///
+/// A kernel launch kept from frame to frame: its arguments are set once and
+///     "launch" only passes the ones whose value changed (or whose buffer was
+///     reallocated) to "clSetKernelArg". It should be the only thing setting
+///     its kernel's arguments, otherwise its idea of what is bound goes stale.
+///
+class KernelLaunch {
+public:
+
+    KernelLaunch() : engine_(nullptr), boundKernel_(0), argsBoundLastLaunch_(0) {}
+    KernelLaunch(ComputeEngine & engine, const ComputeEngine::KernelHandle & kernel) : engine_(&engine), kernel_(kernel), boundKernel_(0), argsBoundLastLaunch_(0) {}
+    
+    /// Sets every argument in order
+    template <typename... Args>
+    void setArgs(const Args &... args) {
+        setArgs_(0, args...);
+    }
+    
+    ///
+    template <typename T>
+    void setArg(uint argIndex, const T & value) {
+        Arg & arg = argAt(argIndex);
+        arg.isSet = true;
+        arg.isBuffer = false;
+        arg.value.assign((const unsigned char *) &value, (const unsigned char *) &value + sizeof(T));
+    }
+    
+    /// The buffer's "cl_mem" is read at every launch
+    void setArg(uint argIndex, const ComputeEngine::BufferHandle & buffer) {
+        Arg & arg = argAt(argIndex);
+        arg.isSet = true;
+        arg.isBuffer = true;
+        arg.buffer = buffer;
+    }
+    
+    /// Binds what changed and enqueues the kernel. Fails without launching if
+    ///     an argument below the highest one set was never set.
+    bool launch(uint deviceIndex, const std::vector<size_t> & globalDims, const std::vector<size_t> & localDims = std::vector<size_t>());
+    
+    /// Arguments the last "launch" had to pass to "clSetKernelArg"
+    uint argsBoundLastLaunch() const {
+        return argsBoundLastLaunch_;
+    }
+
+private:
+
+    ///
+    struct Arg {
+        /// False for the gaps left by setting a later argument first
+        bool isSet;
+        bool isBuffer;
+        ComputeEngine::BufferHandle buffer;
+        std::vector<unsigned char> value;
+        
+        /// What the kernel was last given, if anything
+        bool isBound;
+        std::vector<unsigned char> boundValue;
+        
+        Arg() : isSet(false), isBuffer(false), isBound(false) {}
+    };
+    
+    Arg & argAt(uint argIndex) {
+        if (argIndex >= args_.size()) {
+            args_.resize(argIndex + 1);
+        }
+        return args_[argIndex];
+    }
+    
+    template <typename T = void>
+    void setArgs_(uint argIndex) {}
+    
+    template <typename T, typename... Args>
+    void setArgs_(uint argIndex, const T & value, const Args &... args) {
+        setArg(argIndex, value);
+        setArgs_(argIndex + 1, args...);
+    }
+    
+    ComputeEngine * engine_;
+    ComputeEngine::KernelHandle kernel_;
+    /// The kernel object "args_" were bound to, which changes if it's created again
+    cl_kernel boundKernel_;
+    uint argsBoundLastLaunch_;
+    std::vector<Arg> args_;
+};
+
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -7,3 +7,69 @@
 //
 
 #include "BRDF.hpp"
+
+///
+BRDFHit::BRDFHit(const PovrayMaterial & material, const Eigen::Vector3f & surfaceNormal, const Eigen::Vector3f & toViewer) : surfaceNormal(surfaceNormal), toViewer(toViewer), color(material.pigment.color.block<3,1>(0,0)), finish(material.finish) {
+    
+}
+
+///
+BlinnPhongBRDF::Context
+BlinnPhongBRDF::prepare(const BRDFHit & hit) {
+    Context context;
+    context.surfaceNormal = hit.surfaceNormal;
+    context.toViewer = hit.toViewer;
+    context.ambient = hit.finish.ambient;
+    context.diffuse = hit.finish.diffuse;
+    context.specular = hit.finish.specular;
+    context.specularExponent = hit.finish.roughness > 0.001f ? (float) (1.0 / hit.finish.roughness) : 0.0f;
+    return context;
+}
+
+///
+OrenNayarBRDF::Context
+OrenNayarBRDF::prepare(const BRDFHit & hit) {
+    Context context;
+    context.surfaceNormal = hit.surfaceNormal;
+    context.cosViewer = hit.surfaceNormal.dot(hit.toViewer);
+    context.viewerTangent = hit.toViewer - hit.surfaceNormal * context.cosViewer;
+    
+    float roughnessSquared = hit.finish.roughness * hit.finish.roughness;
+    context.A = 1.0 - 0.5 * (roughnessSquared / (roughnessSquared + 0.57));
+    context.B = 0.45 * (roughnessSquared / (roughnessSquared + 0.09));
+    return context;
+}
+
+///
+BRDFAccumulator::BRDFAccumulator(RaytracingConfig::SupportedBRDF brdfType, const BRDFHit & hit) : brdfType_(brdfType), color_(hit.color), energy_(RGBf::Zero()) {
+    
+    switch (brdfType_) {
+    case RaytracingConfig::OrenNayar:
+        orenNayar_ = OrenNayarBRDF::prepare(hit);
+        break;
+    case RaytracingConfig::BlinnPhong:
+    default:
+        blinnPhong_ = BlinnPhongBRDF::prepare(hit);
+        break;
+    }
+}
+
+///
+void
+BRDFAccumulator::flush() {
+    if (samples_.count == 0) {
+        return;
+    }
+    
+    switch (brdfType_) {
+    case RaytracingConfig::OrenNayar:
+        energy_ += reflectedEnergy<OrenNayarBRDF>(orenNayar_, samples_);
+        break;
+    case RaytracingConfig::BlinnPhong:
+    default:
+        energy_ += reflectedEnergy<BlinnPhongBRDF>(blinnPhong_, samples_);
+        break;
+    }
+    
+    samples_.count = 0;
+}
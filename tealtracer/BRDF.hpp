@@ -9,93 +9,186 @@
 #ifndef BRDF_hpp
 #define BRDF_hpp
 
+#include <algorithm>
+#include <cmath>
 #include <Eigen/Dense>
+
 #include "JensenPhoton.hpp"
 #include "PovraySceneElement.hpp"
+#include "RaytracingConfig.hpp"
 
 ///
-class BRDF {
-public:
-    PovrayPigment pigment;
+/// The surface point being shaded: where it faces, where it is seen from,
+///     and its material.
+///
+struct BRDFHit {
+    Eigen::Vector3f surfaceNormal;
+    Eigen::Vector3f toViewer;
+    RGBf color;
     PovrayFinish finish;
 
-    BRDF() {}
-    BRDF(const PovrayFinish & finish) : finish(finish) {}
-    virtual ~BRDF() {}
-    
     ///
-    virtual RGBf computeColor(const RGBf & source, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const Eigen::Vector3f & surfaceNormal) = 0;
+    BRDFHit(const PovrayMaterial & material, const Eigen::Vector3f & surfaceNormal, const Eigen::Vector3f & toViewer);
 };
 
 ///
-class BlinnPhongBRDF : public BRDF {
-public:
-    virtual ~BlinnPhongBRDF() {}
-    
-    ///
-    virtual RGBf computeColor(const RGBf & source, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const Eigen::Vector3f & surfaceNormal) {
-        
-        RGBf output;
-        
-        float multiplier = 0.0;
-        
-        multiplier += finish.ambient;
-        multiplier += finish.diffuse * std::max<float>(0, surfaceNormal.dot(toLight));
-        
-        if (finish.roughness > 0.001f) {
-            Eigen::Vector3f halfwayVector = (toLight + toViewer).normalized();
-            multiplier += finish.specular * std::pow(std::max<float>(0, surfaceNormal.dot(halfwayVector)), 1.0 / finish.roughness);
+/// Light arriving at one hit, kept one array per component so a BRDF can
+///     weigh every sample in a single loop.
+///
+struct BRDFSamples {
+    static const int Capacity = 16;
+
+    float toLightX[Capacity], toLightY[Capacity], toLightZ[Capacity];
+    float energyR[Capacity], energyG[Capacity], energyB[Capacity];
+    int count;
+
+    BRDFSamples() : count(0) {}
+
+    /// "toLight" points back along the incoming light and is normalized
+    void add(const Eigen::Vector3f & toLight, const RGBf & energy) {
+        toLightX[count] = toLight.x();
+        toLightY[count] = toLight.y();
+        toLightZ[count] = toLight.z();
+        energyR[count] = energy.x();
+        energyG[count] = energy.y();
+        energyB[count] = energy.z();
+        count++;
+    }
+
+    bool full() const {return count == Capacity;}
+};
+
+///
+/// https://en.wikipedia.org/wiki/Blinn–Phong_shading_model
+///
+/// Like every model below this has no state: "prepare" works out what only
+///     depends on the hit, and "weigh" fills "weights[i]" with how much of
+///     sample i's energy is reflected toward the viewer.
+///
+struct BlinnPhongBRDF {
+    struct Context {
+        Eigen::Vector3f surfaceNormal, toViewer;
+        float ambient, diffuse, specular;
+        /// 0 turns the specular term off
+        float specularExponent;
+    };
+
+    static Context prepare(const BRDFHit & hit);
+
+    static void weigh(const Context & context, const BRDFSamples & samples, float * weights) {
+        const float nx = context.surfaceNormal.x(), ny = context.surfaceNormal.y(), nz = context.surfaceNormal.z();
+        const float vx = context.toViewer.x(), vy = context.toViewer.y(), vz = context.toViewer.z();
+
+        for (int i = 0; i < samples.count; i++) {
+            float cosLight = nx * samples.toLightX[i] + ny * samples.toLightY[i] + nz * samples.toLightZ[i];
+            weights[i] = context.ambient + context.diffuse * std::max<float>(0.0f, cosLight);
+        }
+
+        if (context.specularExponent > 0.0f) {
+            for (int i = 0; i < samples.count; i++) {
+                float hx = samples.toLightX[i] + vx, hy = samples.toLightY[i] + vy, hz = samples.toLightZ[i] + vz;
+                float halfwayLength = std::sqrt(hx * hx + hy * hy + hz * hz);
+                float cosHalfway = (nx * hx + ny * hy + nz * hz) / halfwayLength;
+                weights[i] += context.specular * std::pow(std::max<float>(0.0f, cosHalfway), context.specularExponent);
+            }
         }
-        
-        output = pigment.color.block<3,1>(0,0) * multiplier;
-        
-        output.x() *= source.x();
-        output.y() *= source.y();
-        output.z() *= source.z();
-        
-        return output;
     }
 };
 
-class OrenNayarBRDF : public BRDF {
+///
+/// https://en.wikipedia.org/wiki/Oren–Nayar_reflectance_model, after
+///     http://ruh.li/GraphicsOrenNayar.html
+///
+/// The angles only ever appear as sin(max) * tan(min), so they are worked
+///     out from the cosines instead of with "acos", "sin" and "tan".
+///
+struct OrenNayarBRDF {
+    struct Context {
+        Eigen::Vector3f surfaceNormal;
+        /// "toViewer" minus its part along the normal
+        Eigen::Vector3f viewerTangent;
+        float cosViewer;
+        float A, B;
+    };
+
+    static Context prepare(const BRDFHit & hit);
+
+    static void weigh(const Context & context, const BRDFSamples & samples, float * weights) {
+        const float nx = context.surfaceNormal.x(), ny = context.surfaceNormal.y(), nz = context.surfaceNormal.z();
+        const float tx = context.viewerTangent.x(), ty = context.viewerTangent.y(), tz = context.viewerTangent.z();
+        const float cosViewer = std::min<float>(1.0f, context.cosViewer);
+
+        for (int i = 0; i < samples.count; i++) {
+            float cosLight = std::min<float>(1.0f, nx * samples.toLightX[i] + ny * samples.toLightY[i] + nz * samples.toLightZ[i]);
+            float gamma = tx * samples.toLightX[i] + ty * samples.toLightY[i] + tz * samples.toLightZ[i];
+
+            /// alpha is the larger angle (smaller cosine), beta the smaller
+            float cosAlpha = std::min(cosViewer, cosLight);
+            float cosBeta = std::max(cosViewer, cosLight);
+            float sinAlpha = std::sqrt(std::max<float>(0.0f, 1.0f - cosAlpha * cosAlpha));
+            float sinBeta = std::sqrt(std::max<float>(0.0f, 1.0f - cosBeta * cosBeta));
+            /// Only used when the light is in front, and then cosBeta > 0
+            float tanBeta = sinBeta / std::max<float>(cosBeta, 1e-6f);
+
+            weights[i] = cosLight > 0.0f
+                ? cosLight * (context.A + context.B * std::max<float>(0.0f, gamma) * sinAlpha * tanBeta)
+                : 0.0f;
+        }
+    }
+};
+
+/// Energy "samples" reflect toward the viewer under "Model", before the
+///     pigment color is applied. Touches nothing but its arguments, so any
+///     number of threads can call it at once.
+template <class Model>
+RGBf reflectedEnergy(const typename Model::Context & context, const BRDFSamples & samples) {
+    float weights[BRDFSamples::Capacity];
+    Model::weigh(context, samples, weights);
+
+    float r = 0.0f, g = 0.0f, b = 0.0f;
+    for (int i = 0; i < samples.count; i++) {
+        r += weights[i] * samples.energyR[i];
+        g += weights[i] * samples.energyG[i];
+        b += weights[i] * samples.energyB[i];
+    }
+    return RGBf(r, g, b);
+}
+
+///
+/// Sums the light any number of samples reflect off one hit, using the BRDF
+///     picked by "config.brdfType". Samples are evaluated "BRDFSamples::Capacity"
+///     at a time, and the model is only looked up once per batch. Keep one
+///     per hit on the stack; it is not meant to be shared.
+///
+class BRDFAccumulator {
 public:
+    BRDFAccumulator(RaytracingConfig::SupportedBRDF brdfType, const BRDFHit & hit);
 
-    virtual ~OrenNayarBRDF() {}
-    
     ///
-    virtual RGBf computeColor(const RGBf & source, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const Eigen::Vector3f & surfaceNormal) {
-        
-        RGBf output;
-        
-        /// http://ruh.li/GraphicsOrenNayar.html
-        float angleVN = std::acos(surfaceNormal.dot(toViewer));
-        float angleLN = std::acos(surfaceNormal.dot(toLight));
-        
-        float alpha = std::max(angleVN, angleLN);
-        float beta = std::min(angleVN, angleLN);
-        
-        float gamma = (toViewer - surfaceNormal*toViewer.dot(surfaceNormal)).dot(toLight - surfaceNormal*toLight.dot(surfaceNormal));
-    
-        float roughnessSquared = finish.roughness * finish.roughness;
-    
-        // calculate A and B
-        float A = 1.0 - 0.5 * (roughnessSquared / (roughnessSquared + 0.57));
-        float B = 0.45 * (roughnessSquared / (roughnessSquared + 0.09));
-        float C = sin(alpha) * tan(beta);
-        
-        // put it all together
-        float multiplier = std::max<float>(0.0, surfaceNormal.dot(toLight)) * (A + B * std::max<float>(0.0, gamma) * C);
-        
-        ///
-        output = pigment.color.block<3,1>(0,0) * multiplier;
-        
-        output.x() *= source.x();
-        output.y() *= source.y();
-        output.z() *= source.z();
-        
-        return output;
+    void add(const Eigen::Vector3f & toLight, const RGBf & energy) {
+        samples_.add(toLight, energy);
+        if (samples_.full()) {
+            flush();
+        }
     }
-    
+
+    /// Everything added so far, tinted by the hit's pigment
+    RGBf total() {
+        flush();
+        return color_.cwiseProduct(energy_);
+    }
+
+private:
+
+    void flush();
+
+    RaytracingConfig::SupportedBRDF brdfType_;
+    BlinnPhongBRDF::Context blinnPhong_;
+    OrenNayarBRDF::Context orenNayar_;
+
+    RGBf color_;
+    RGBf energy_;
+    BRDFSamples samples_;
 };
 
 #endif /* BRDF_hpp */
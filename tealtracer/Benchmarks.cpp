@@ -0,0 +1,656 @@
+//
+//  Benchmarks.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/2/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "Benchmarks.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "TSClock.hpp"
+#include "stl_extensions.hpp"
+#include "PovrayScene.hpp"
+#include "RayPacket.hpp"
+#include "PhotonKDTree.hpp"
+#include "PhotonHashmap.hpp"
+#include "PhotonSpatialHashmap.hpp"
+#include "PhotonTiler.hpp"
+#include "PhotonArrays.hpp"
+#include "TSRandomValueGenerator.hpp"
+
+///
+static std::shared_ptr<PovrayScene>
+makeRandomSphereScene(TSRandomValueGenerator & generator, int numSpheres) {
+    auto scene = std::shared_ptr<PovrayScene>(new PovrayScene());
+
+    auto floor = std::shared_ptr<PovraySceneElement>(new PovrayPlane());
+    floor->parse("<0.0, 1.0, 0.0>, -60.0 pigment {color rgb <0.7, 0.7, 0.7>} finish {ambient 0.2 diffuse 1.0}");
+    scene->addElement(floor);
+
+    /// Keep the total volume of spheres about the same at every size
+    float radius = 0.5f * 50.0f / std::cbrt((float) numSpheres);
+    for (int i = 0; i < numSpheres; i++) {
+        auto sphere = std::shared_ptr<PovraySceneElement>(new PovraySphere());
+        sphere->parse(make_string(
+            "<", 100.0f * generator.randFloat() - 50.0f, ", ", 100.0f * generator.randFloat() - 50.0f, ", ", 100.0f * generator.randFloat() - 50.0f, ">, ",
+            radius, " pigment {color rgb <1.0, 1.0, 1.0>} finish {ambient 0.2 diffuse 1.0}"));
+        scene->addElement(sphere);
+    }
+
+    return scene;
+}
+
+///
+static Ray
+makeRandomRay(TSRandomValueGenerator & generator) {
+    Ray ray;
+    ray.origin = Eigen::Vector3f(0, 0, 120);
+    Eigen::Vector3f target(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+    ray.direction = (target - ray.origin).normalized();
+    return ray;
+}
+
+///
+int
+benchmarkSceneIntersections(std::ostream & out) {
+    const int sceneSizes[] = {10, 1000, 100000};
+    const int numRays = 200000;
+    /// The linear scan gets far fewer rays at the larger sizes
+    const long long linearBudget = 200000000;
+
+    int mismatches = 0;
+    for (int sizeItr = 0; sizeItr < 3; sizeItr++) {
+        int numSpheres = sceneSizes[sizeItr];
+        TSRandomValueGenerator generator;
+        generator.seed(1234);
+
+        auto scene = makeRandomSphereScene(generator, numSpheres);
+        double buildStart = TSClock::now();
+        scene->buildAccelerationStructure();
+        double buildTime = TSClock::now() - buildStart;
+
+        std::vector<Ray> rays(numRays);
+        for (int i = 0; i < numRays; i++) {
+            rays[i] = makeRandomRay(generator);
+        }
+        int numLinearRays = (int) std::max<long long>(100, std::min<long long>(numRays, linearBudget / (numSpheres + 1)));
+
+        std::vector<int> bvhElements(numRays, -1);
+        int bvhHits = 0;
+        double bvhStart = TSClock::now();
+        for (int i = 0; i < numRays; i++) {
+            bvhElements[i] = scene->closestIntersection(rays[i]).element;
+            bvhHits += bvhElements[i] >= 0;
+        }
+        double bvhTime = TSClock::now() - bvhStart;
+
+        std::vector<int> linearElements(numLinearRays, -1);
+        double linearStart = TSClock::now();
+        for (int i = 0; i < numLinearRays; i++) {
+            linearElements[i] = scene->closestIntersectionLinear(rays[i]).element;
+        }
+        double linearTime = TSClock::now() - linearStart;
+
+        for (int i = 0; i < numLinearRays; i++) {
+            mismatches += linearElements[i] != bvhElements[i];
+        }
+
+        double bvhRaysPerSecond = numRays / std::max<double>(bvhTime, 1e-9);
+        double linearRaysPerSecond = numLinearRays / std::max<double>(linearTime, 1e-9);
+
+        out << "[bvh] spheres=" << numSpheres
+            << " build=" << buildTime * 1000.0 << "ms"
+            << " bvh=" << bvhRaysPerSecond / 1.0e6 << "Mrays/s"
+            << " linear=" << linearRaysPerSecond / 1.0e6 << "Mrays/s"
+            << " speedup=" << bvhRaysPerSecond / linearRaysPerSecond << "x"
+            << " hitRate=" << (double) bvhHits / numRays << std::endl;
+    }
+
+    out << "[bvh] mismatched hits against the linear scan: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+/// Returns how many of the first "numChecked" "queries" gather different
+///     distances from "map" than from a brute-force search of its photons.
+static int
+countBruteForceMismatches(PhotonMap & map, int numNeighbours, float maxDistance, const std::vector<Eigen::Vector3f> & queries, int numChecked) {
+    std::vector<PhotonMap::PhotonIndexInfo> results(numNeighbours);
+    std::vector<float> expected, found;
+    int mismatches = 0;
+    for (int i = 0; i < numChecked; i++) {
+        expected.clear();
+        for (int p = 0; p < (int) map.photons.size(); p++) {
+            float squareDistance = (map.photons[p].position - queries[i]).squaredNorm();
+            if (squareDistance <= maxDistance * maxDistance) {
+                expected.push_back(squareDistance);
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.resize(std::min<int>(numNeighbours, (int) expected.size()));
+
+        int count = map.gatherPhotonsIndices(numNeighbours, maxDistance, queries[i], &results[0]);
+        found.clear();
+        for (int r = 0; r < count; r++) {
+            found.push_back(results[r].squareDistance);
+        }
+        std::sort(found.begin(), found.end());
+
+        /// Distances are computed in a different order, so allow an ulp or two
+        bool same = found.size() == expected.size();
+        for (int r = 0; same && r < (int) found.size(); r++) {
+            same = std::abs(found[r] - expected[r]) <= 1e-4f * std::max<float>(1.0f, expected[r]);
+        }
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+///
+int
+benchmarkPhotonKDTree(std::ostream & out) {
+    const int mapSizes[] = {200000, 2000000};
+    const int numQueries = 100000;
+    const int numNeighbours = 100;
+    const float maxDistance = 2.0f;
+    /// Only this many queries are repeated with the brute-force search
+    const int numChecked = 20;
+
+    int mismatches = 0;
+    for (int sizeItr = 0; sizeItr < 2; sizeItr++) {
+        int numPhotons = mapSizes[sizeItr];
+        TSRandomValueGenerator generator;
+        generator.seed(1234);
+
+        PhotonKDTree tree;
+        tree.photons.resize(numPhotons);
+        for (int i = 0; i < numPhotons; i++) {
+            tree.photons[i].position = Eigen::Vector3f(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+        }
+
+        double buildStart = TSClock::now();
+        tree.buildMap();
+        double buildTime = TSClock::now() - buildStart;
+
+        std::vector<Eigen::Vector3f> queries(numQueries);
+        for (int i = 0; i < numQueries; i++) {
+            queries[i] = Eigen::Vector3f(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+        }
+
+        std::vector<PhotonMap::PhotonIndexInfo> results(numNeighbours);
+        long long numFound = 0;
+        double queryStart = TSClock::now();
+        for (int i = 0; i < numQueries; i++) {
+            numFound += tree.gatherPhotonsIndices(numNeighbours, maxDistance, queries[i], &results[0]);
+        }
+        double queryTime = TSClock::now() - queryStart;
+
+        mismatches += countBruteForceMismatches(tree, numNeighbours, maxDistance, queries, numChecked);
+
+        out << "[kdtree] photons=" << numPhotons
+            << " build=" << buildTime * 1000.0 << "ms"
+            << " queries=" << numQueries / std::max<double>(queryTime, 1e-9) / 1.0e3 << "k/s"
+            << " (k=" << numNeighbours << ", r=" << maxDistance << ")"
+            << " avgFound=" << (double) numFound / numQueries << std::endl;
+    }
+
+    out << "[kdtree] mismatched queries against brute force: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+///
+int
+benchmarkPhotonSpatialHashmap(std::ostream & out) {
+    const int mapSizes[] = {200000, 2000000};
+    const int numQueries = 100000;
+    const int numNeighbours = 100;
+    const float maxDistance = 2.0f;
+    /// Only this many queries are repeated with the brute-force search
+    const int numChecked = 20;
+
+    /// One map for every size, so each build has to size its cells again
+    PhotonSpatialHashmap map;
+    int mismatches = 0;
+    for (int sizeItr = 0; sizeItr < 2; sizeItr++) {
+        int numPhotons = mapSizes[sizeItr];
+        TSRandomValueGenerator generator;
+        generator.seed(1234);
+
+        /// Photons on the six faces of a 100-unit box, as on a scene's walls
+        map.photons.resize(numPhotons);
+        for (int i = 0; i < numPhotons; i++) {
+            Eigen::Vector3f position(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+            position(i % 3) = (i % 2) ? 50.0f : -50.0f;
+            map.photons[i].position = position;
+        }
+
+        double buildStart = TSClock::now();
+        map.buildMap();
+        double buildTime = TSClock::now() - buildStart;
+
+        /// Half the queries on the walls, half in the empty middle
+        std::vector<Eigen::Vector3f> queries(numQueries);
+        for (int i = 0; i < numQueries; i++) {
+            queries[i] = Eigen::Vector3f(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+            if (i % 2) {
+                queries[i](i % 3) = (i % 4 == 1) ? 50.0f : -50.0f;
+            }
+        }
+
+        std::vector<PhotonMap::PhotonIndexInfo> results(numNeighbours);
+        long long numFound = 0;
+        double queryStart = TSClock::now();
+        for (int i = 0; i < numQueries; i++) {
+            numFound += map.gatherPhotonsIndices(numNeighbours, maxDistance, queries[i], &results[0]);
+        }
+        double queryTime = TSClock::now() - queryStart;
+
+        mismatches += countBruteForceMismatches(map, numNeighbours, maxDistance, queries, numChecked);
+        /// The picked size must not stick as the next build's override
+        mismatches += map.cellsize != 0.0f;
+
+        out << "[spatialhash] photons=" << numPhotons
+            << " cellsize=" << map.builtCellsize()
+            << " cells=" << map.numCells() << "/" << map.tableSize()
+            << " build=" << buildTime * 1000.0 << "ms"
+            << " queries=" << numQueries / std::max<double>(queryTime, 1e-9) / 1.0e3 << "k/s"
+            << " (k=" << numNeighbours << ", r=" << maxDistance << ")"
+            << " avgFound=" << (double) numFound / numQueries << std::endl;
+    }
+
+    out << "[spatialhash] mismatched queries against brute force: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+/// The build "PhotonHashmap" used before its counting sort: a comparison sort
+///     that re-hashes both photons on every comparison, then a pass for each
+///     photon's cell and one for each cell's first photon.
+static void
+buildHashmapWithComparisonSort(PhotonHashmap & map, std::vector<int> & gridIndices, std::vector<int> & gridFirstPhotonIndices) {
+    std::sort(map.photons.begin(), map.photons.end(), [&](const JensenPhoton & lhs, const JensenPhoton & rhs) {
+        return map.getCellIndexHash(lhs.position) < map.getCellIndexHash(rhs.position);
+    });
+    
+    gridIndices.assign(map.photons.size(), -1);
+    for (int index = 0; index < (int) map.photons.size(); index++) {
+        auto cellIndex = map.getCellIndex(map.photons[index].position);
+        if (cellIndex.x() >= 0 && cellIndex.x() < map.xdim
+         && cellIndex.y() >= 0 && cellIndex.y() < map.ydim
+         && cellIndex.z() >= 0 && cellIndex.z() < map.zdim) {
+            gridIndices[index] = map.photonHash(cellIndex);
+        }
+    }
+    
+    gridFirstPhotonIndices.assign(map.xdim * map.ydim * map.zdim, -1);
+    for (int index = 0; index < (int) map.photons.size(); index++) {
+        if (gridIndices[index] != -1 && (index == 0 || gridIndices[index] != gridIndices[index - 1])) {
+            gridFirstPhotonIndices[gridIndices[index]] = index;
+        }
+    }
+}
+
+///
+int
+benchmarkPhotonHashmapBuild(std::ostream & out) {
+    const int mapSizes[] = {200000, 2000000};
+    auto threadPool = std::shared_ptr<ThreadPool>(new ThreadPool());
+    
+    int mismatches = 0;
+    for (int sizeItr = 0; sizeItr < 2; sizeItr++) {
+        int numPhotons = mapSizes[sizeItr];
+        TSRandomValueGenerator generator;
+        generator.seed(1234);
+        
+        /// 100 x 100 x 100 cells, with a few photons landing outside the grid
+        PhotonHashmap map;
+        map.cellsize = 1.0f;
+        map.setDimensions(Eigen::Vector3f(-50, -50, -50), Eigen::Vector3f(50, 50, 50));
+        map.photons.resize(numPhotons);
+        for (int i = 0; i < numPhotons; i++) {
+            map.photons[i].position = Eigen::Vector3f(104.0f * generator.randFloat() - 52.0f, 104.0f * generator.randFloat() - 52.0f, 104.0f * generator.randFloat() - 52.0f);
+        }
+        std::vector<JensenPhoton> unsortedPhotons = map.photons;
+        
+        std::vector<int> sortGridIndices, sortGridFirstPhotonIndices;
+        double sortStart = TSClock::now();
+        buildHashmapWithComparisonSort(map, sortGridIndices, sortGridFirstPhotonIndices);
+        double sortTime = TSClock::now() - sortStart;
+        
+        std::vector<int> sortCellCounts(sortGridFirstPhotonIndices.size(), 0);
+        for (int index = 0; index < numPhotons; index++) {
+            if (sortGridIndices[index] != -1) {
+                sortCellCounts[sortGridIndices[index]]++;
+            }
+        }
+        
+        double buildTimes[2];
+        for (int threaded = 0; threaded < 2; threaded++) {
+            map.photons = unsortedPhotons;
+            map.threadPool = threaded ? threadPool : nullptr;
+            double buildStart = TSClock::now();
+            map.buildMap();
+            buildTimes[threaded] = TSClock::now() - buildStart;
+            
+            /// Same number of photons per cell as the comparison sort, and
+            ///     every photon sits in its own cell
+            for (int cell = 0; cell < (int) map.gridFirstPhotonIndices.size(); cell++) {
+                bool same = map.gridPhotonCounts[cell] == sortCellCounts[cell];
+                for (int pi = map.gridFirstPhotonIndices[cell]; same && pi < map.gridFirstPhotonIndices[cell] + map.gridPhotonCounts[cell]; pi++) {
+                    same = map.gridIndices[pi] == cell && map.getCellIndexHash(map.photons[pi].position) == cell;
+                }
+                mismatches += !same;
+            }
+        }
+        
+        out << "[hashmap] photons=" << numPhotons
+            << " cells=" << map.gridFirstPhotonIndices.size()
+            << " sort=" << sortTime * 1000.0 << "ms"
+            << " counting=" << buildTimes[0] * 1000.0 << "ms"
+            << " counting(" << threadPool->numWorkers() << " threads)=" << buildTimes[1] * 1000.0 << "ms"
+            << " speedup=" << sortTime / std::max<double>(buildTimes[0], 1e-9) << "x/"
+            << sortTime / std::max<double>(buildTimes[1], 1e-9) << "x" << std::endl;
+    }
+    
+    out << "[hashmap] mismatched cells against the comparison sort: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+///
+int
+benchmarkPhotonTiler(std::ostream & out) {
+    const int imageWidth = 1920, imageHeight = 1080;
+    const int tileSize = 32;
+    const int numPhotons = 200000;
+    const float effectRadius = 0.5f;
+    /// Only this many photons are checked against every tile's frustum
+    const int numChecked = 2000;
+    
+    TSRandomValueGenerator generator;
+    generator.seed(1234);
+    
+    Eigen::Vector3f cameraPosition(0, 0, 0);
+    FrenetFrame frame(Eigen::Vector3f(0, 0, -1), Eigen::Vector3f(0, 1, 0), Eigen::Vector3f((float) imageWidth / (float) imageHeight, 0, 0));
+    
+    PhotonTiler tiler;
+    tiler.photons.resize(numPhotons);
+    for (int i = 0; i < numPhotons; i++) {
+        tiler.photons[i].position = Eigen::Vector3f(80.0f * generator.randFloat() - 40.0f, 50.0f * generator.randFloat() - 25.0f, -10.0f - 50.0f * generator.randFloat());
+    }
+    tiler.generateTiles(imageWidth, imageHeight, tileSize, tileSize, cameraPosition, frame);
+    int numTiles = (int) tiler.tiles.size();
+    
+    /// Binning as it was done before: every photon against every tile's
+    ///     frustum, once to count and once to copy.
+    double frustumStart = TSClock::now();
+    std::vector<int> frustumCounts(numTiles, 0), nextPhotonIndex(numTiles, 0);
+    for (int p = 0; p < numPhotons; p++) {
+        for (int t = 0; t < numTiles; t++) {
+            frustumCounts[t] += tiler.tiles[t].frustum.intersectsOrContainsSphere(tiler.photons[p].position, effectRadius);
+        }
+    }
+    std::vector<std::vector<JensenPhoton>> frustumPhotons(numTiles);
+    for (int t = 0; t < numTiles; t++) {
+        frustumPhotons[t].resize(frustumCounts[t]);
+    }
+    for (int p = 0; p < numPhotons; p++) {
+        for (int t = 0; t < numTiles; t++) {
+            if (tiler.tiles[t].frustum.intersectsOrContainsSphere(tiler.photons[p].position, effectRadius)) {
+                frustumPhotons[t][nextPhotonIndex[t]++] = tiler.photons[p];
+            }
+        }
+    }
+    double frustumTime = TSClock::now() - frustumStart;
+    
+    const int numRepeats = 10;
+    double binStart = TSClock::now();
+    for (int repeat = 0; repeat < numRepeats; repeat++) {
+        tiler.buildMap(effectRadius);
+    }
+    double binTime = (TSClock::now() - binStart) / numRepeats;
+    
+    /// A photon must be binned into every tile whose frustum it clearly
+    ///     touches, and into no tile whose frustum it clearly misses.
+    int mismatches = 0;
+    std::vector<bool> binned(numTiles);
+    for (int p = 0; p < numChecked; p++) {
+        std::fill(binned.begin(), binned.end(), false);
+        for (int t = 0; t < numTiles; t++) {
+            for (int i = tiler.tilePhotonStarts[t]; i < tiler.tilePhotonStarts[t + 1]; i++) {
+                if (tiler.tilePhotonIndices[i] == p) {
+                    binned[t] = true;
+                }
+            }
+        }
+        
+        for (int t = 0; t < numTiles; t++) {
+            bool touches = tiler.tiles[t].frustum.intersectsOrContainsSphere(tiler.photons[p].position, effectRadius * 0.999f);
+            bool nearlyTouches = tiler.tiles[t].frustum.intersectsOrContainsSphere(tiler.photons[p].position, effectRadius * 1.001f);
+            mismatches += (touches && !binned[t]) || (binned[t] && !nearlyTouches);
+        }
+    }
+    
+    out << "[tiler] photons=" << numPhotons
+        << " tiles=" << numTiles
+        << " frustum=" << frustumTime * 1000.0 << "ms"
+        << " projected=" << binTime * 1000.0 << "ms"
+        << " speedup=" << frustumTime / std::max<double>(binTime, 1e-9) << "x"
+        << " binned=" << tiler.tilePhotonIndices.size() << std::endl;
+    out << "[tiler] mismatched photon/tile pairs: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+///
+int
+benchmarkPhotonGatherFilter(std::ostream & out) {
+    const int numPhotons = 200000;
+    const int numQueries = 2000;
+    const int numGeometries = 8;
+    const float effectRadius = 2.0f;
+    
+    TSRandomValueGenerator generator;
+    generator.seed(1234);
+    
+    std::vector<JensenPhoton> photons(numPhotons);
+    for (int i = 0; i < numPhotons; i++) {
+        photons[i].position = Eigen::Vector3f(20.0f * generator.randFloat() - 10.0f, 20.0f * generator.randFloat() - 10.0f, 20.0f * generator.randFloat() - 10.0f);
+        photons[i].flags.geometryIndex = (unsigned int) generator.randUInt() % numGeometries;
+    }
+    PhotonArrays arrays;
+    arrays.assign(photons);
+    
+    std::vector<Eigen::Vector3f> queries(numQueries);
+    std::vector<int> queryGeometries(numQueries);
+    for (int i = 0; i < numQueries; i++) {
+        queries[i] = Eigen::Vector3f(20.0f * generator.randFloat() - 10.0f, 20.0f * generator.randFloat() - 10.0f, 20.0f * generator.randFloat() - 10.0f);
+        queryGeometries[i] = (unsigned int) generator.randUInt() % numGeometries;
+    }
+    
+    float maxSquareDistance = effectRadius * effectRadius;
+    std::vector<int> scalarCounts(numQueries, 0), arrayCounts(numQueries, 0);
+    std::vector<float> scalarMax(numQueries, 0.0f), arrayMax(numQueries, 0.0f);
+    
+    /// The loop the tile and hash grid raytracers used to run per pixel
+    double scalarStart = TSClock::now();
+    for (int q = 0; q < numQueries; q++) {
+        for (int i = 0; i < numPhotons; i++) {
+            const JensenPhoton & photon = photons[i];
+            float distanceSqrd = (photon.position - queries[q]).dot(photon.position - queries[q]);
+            if (queryGeometries[q] == photon.flags.geometryIndex
+             && distanceSqrd <= maxSquareDistance) {
+                scalarCounts[q]++;
+                scalarMax[q] = std::max<float>(scalarMax[q], distanceSqrd);
+            }
+        }
+    }
+    double scalarTime = TSClock::now() - scalarStart;
+    
+    std::vector<int> candidates(numPhotons);
+    std::vector<float> candidateDistances(numPhotons);
+    double arrayStart = TSClock::now();
+    for (int q = 0; q < numQueries; q++) {
+        int numCandidates = arrays.filterCandidates(0, numPhotons, queries[q], maxSquareDistance, queryGeometries[q], candidates.data(), candidateDistances.data());
+        arrayCounts[q] = numCandidates;
+        for (int c = 0; c < numCandidates; c++) {
+            arrayMax[q] = std::max<float>(arrayMax[q], candidateDistances[c]);
+        }
+    }
+    double arrayTime = TSClock::now() - arrayStart;
+    
+    /// Distances may differ in the last bit, which can flip a photon right on
+    ///     the boundary, so allow the odd one.
+    int mismatches = 0;
+    for (int q = 0; q < numQueries; q++) {
+        mismatches += std::abs(scalarCounts[q] - arrayCounts[q]) > 1
+         || std::abs(scalarMax[q] - arrayMax[q]) > 1e-4f * maxSquareDistance;
+    }
+    
+    double photonsTested = (double) numPhotons * numQueries;
+    out << "[gather] photons=" << numPhotons
+        << " queries=" << numQueries
+        << " scalar=" << photonsTested / std::max<double>(scalarTime, 1e-9) / 1.0e6 << "Mphotons/s"
+        << " arrays=" << photonsTested / std::max<double>(arrayTime, 1e-9) / 1.0e6 << "Mphotons/s"
+        << " speedup=" << scalarTime / std::max<double>(arrayTime, 1e-9) << "x"
+#if defined(__AVX2__)
+        << " (AVX2)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << std::endl;
+    out << "[gather] mismatched queries: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+///
+int
+benchmarkRayPackets(std::ostream & out) {
+    const int sceneSizes[] = {10, 1000, 100000};
+    const int imageWidth = 512, imageHeight = 512;
+    const int numRays = imageWidth * imageHeight;
+
+    int mismatches = 0;
+    for (int sizeItr = 0; sizeItr < 3; sizeItr++) {
+        int numSpheres = sceneSizes[sizeItr];
+        TSRandomValueGenerator generator;
+        generator.seed(1234);
+
+        /// Add a triangle for every other sphere so all three kernels run
+        auto scene = makeRandomSphereScene(generator, numSpheres);
+        for (int i = 0; i < numSpheres / 2 + 1; i++) {
+            Eigen::Vector3f corner(100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f, 100.0f * generator.randFloat() - 50.0f);
+            Eigen::Vector3f edgeA(generator.randFloat() - 0.5f, generator.randFloat() - 0.5f, generator.randFloat() - 0.5f);
+            Eigen::Vector3f edgeB(generator.randFloat() - 0.5f, generator.randFloat() - 0.5f, generator.randFloat() - 0.5f);
+            float size = 100.0f / std::cbrt((float) numSpheres);
+            Eigen::Vector3f b = corner + size * edgeA, c = corner + size * edgeB;
+            auto triangle = std::shared_ptr<PovraySceneElement>(new PovrayTriangle());
+            triangle->parse(make_string(
+                "<", corner.x(), ", ", corner.y(), ", ", corner.z(), ">, <", b.x(), ", ", b.y(), ", ", b.z(), ">, <", c.x(), ", ", c.y(), ", ", c.z(), "> ",
+                "pigment {color rgb <1.0, 1.0, 1.0>} finish {ambient 0.2 diffuse 1.0}"));
+            scene->addElement(triangle);
+        }
+        scene->buildAccelerationStructure();
+
+        /// Camera rays of a "imageWidth" x "imageHeight" image looking down -z,
+        ///     grouped into packets along rows like "traceCameraRays" does
+        std::vector<Ray> rays(numRays);
+        for (int py = 0; py < imageHeight; py++) {
+            for (int px = 0; px < imageWidth; px++) {
+                Ray & ray = rays[py * imageWidth + px];
+                ray.origin = Eigen::Vector3f(0, 0, 120);
+                ray.direction = Eigen::Vector3f((px + 0.5f) / imageWidth - 0.5f, (py + 0.5f) / imageHeight - 0.5f, -1.0f).normalized();
+            }
+        }
+
+        std::vector<int> singleElements(numRays, -1);
+        std::vector<float> singleTimes(numRays, 0.0f);
+        int singleHits = 0;
+        double singleStart = TSClock::now();
+        for (int i = 0; i < numRays; i++) {
+            auto hitTest = scene->closestIntersection(rays[i]);
+            singleElements[i] = hitTest.element;
+            singleTimes[i] = hitTest.hit.timeOfIntersection;
+            singleHits += singleElements[i] >= 0;
+        }
+        double singleTime = TSClock::now() - singleStart;
+
+        std::vector<int> packetElements(numRays, -1);
+        std::vector<float> packetTimes(numRays, 0.0f);
+        PovrayScene::InstersectionResult results[RayPacket::Size];
+        double packetStart = TSClock::now();
+        for (int first = 0; first < numRays; first += RayPacket::Size) {
+            RayPacket packet;
+            int count = std::min<int>(RayPacket::Size, numRays - first);
+            for (int i = 0; i < count; i++) {
+                packet.setRay(i, rays[first + i]);
+            }
+
+            scene->closestIntersection(packet, results);
+            for (int i = 0; i < count; i++) {
+                packetElements[first + i] = results[i].element;
+                packetTimes[first + i] = results[i].hit.timeOfIntersection;
+            }
+        }
+        double packetTime = TSClock::now() - packetStart;
+
+        /// The kernels may round differently, so only count rays that end up
+        ///     on a different element at a noticeably different distance
+        for (int i = 0; i < numRays; i++) {
+            if (singleElements[i] != packetElements[i]
+             && !(singleElements[i] >= 0 && packetElements[i] >= 0 && std::abs(singleTimes[i] - packetTimes[i]) <= 1e-4f * singleTimes[i])) {
+                mismatches++;
+            }
+        }
+
+        double singleRaysPerSecond = numRays / std::max<double>(singleTime, 1e-9);
+        double packetRaysPerSecond = numRays / std::max<double>(packetTime, 1e-9);
+
+        out << "[packets] spheres=" << numSpheres << " triangles=" << numSpheres / 2 + 1
+            << " single=" << singleRaysPerSecond / 1.0e6 << "Mrays/s"
+            << " packet=" << packetRaysPerSecond / 1.0e6 << "Mrays/s"
+            << " speedup=" << packetRaysPerSecond / singleRaysPerSecond << "x"
+            << " hitRate=" << (double) singleHits / numRays << std::endl;
+    }
+
+    out << "[packets] " << RayPacket::Size << "-ray packets"
+#if defined(__AVX__)
+        << " (AVX)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << std::endl;
+    /// Rays that only graze a sphere can still round to opposite sides of
+    ///     its silhouette, so allow a handful of those
+    out << "[packets] mismatched hits against single rays: " << mismatches << " of " << 3 * numRays << std::endl;
+    return mismatches * 100000 <= 3 * numRays ? 0 : 1;
+}
+
+///
+int
+runBenchmark(const std::string & name, std::ostream & out) {
+    if (name == "bvh") {
+        return benchmarkSceneIntersections(out);
+    }
+    else if (name == "kdtree") {
+        return benchmarkPhotonKDTree(out);
+    }
+    else if (name == "hashmap") {
+        return benchmarkPhotonHashmapBuild(out);
+    }
+    else if (name == "spatialhash") {
+        return benchmarkPhotonSpatialHashmap(out);
+    }
+    else if (name == "tiler") {
+        return benchmarkPhotonTiler(out);
+    }
+    else if (name == "gather") {
+        return benchmarkPhotonGatherFilter(out);
+    }
+    else if (name == "packets") {
+        return benchmarkRayPackets(out);
+    }
+
+    out << "unknown benchmark \"" << name << "\"" << std::endl;
+    return 1;
+}
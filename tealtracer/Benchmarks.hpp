@@ -0,0 +1,59 @@
+//
+//  Benchmarks.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/2/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef Benchmarks_hpp
+#define Benchmarks_hpp
+
+#include <iostream>
+#include <string>
+
+///
+/// Standalone micro-benchmarks, run from the command line with
+///     "tealtracer --benchmark <name>". Each one writes a small report to
+///     "out" and returns 0 on success.
+///
+
+/// Runs the benchmark called "name" ("bvh", "kdtree", "spatialhash", "hashmap", "tiler", "gather", "packets", ...)
+int runBenchmark(const std::string & name, std::ostream & out);
+
+/// Casts random rays against 10, 1k and 100k spheres (plus a floor plane)
+///     and compares "PovrayScene::closestIntersection" against the linear scan.
+int benchmarkSceneIntersections(std::ostream & out);
+
+/// Builds "PhotonKDTree" over 200k and 2M random photons and reports the
+///     build time and nearest-neighbour queries per second, checking a few
+///     queries against a brute-force search.
+int benchmarkPhotonKDTree(std::ostream & out);
+
+/// Builds "PhotonSpatialHashmap" over 200k and 2M photons on the walls of a
+///     box, letting it size its own cells, and reports the build time and
+///     nearest-neighbour queries per second, checking a few queries against a
+///     brute-force search.
+int benchmarkPhotonSpatialHashmap(std::ostream & out);
+
+/// Builds "PhotonHashmap" over 200k and 2M random photons with its counting
+///     sort (on one thread and on every thread) and with the comparison sort
+///     it replaced, and checks that they agree on every cell.
+int benchmarkPhotonHashmapBuild(std::ostream & out);
+
+/// Bins 200k photons into the 32x32 tiles of a 1920x1080 image with
+///     "PhotonTiler::buildMap" and with the per-tile frustum tests it
+///     replaced, and checks a sample of photons against the tile frusta.
+int benchmarkPhotonTiler(std::ostream & out);
+
+/// Filters a 200k-photon tile by distance and geometry for many points,
+///     once with a scalar loop over "JensenPhoton"s and once with
+///     "PhotonArrays::filterCandidates".
+int benchmarkPhotonGatherFilter(std::ostream & out);
+
+/// Traces the camera rays of a 512x512 image through scenes of spheres,
+///     triangles and a floor plane, one ray at a time and in "RayPacket"s,
+///     and reports rays per second for both.
+int benchmarkRayPackets(std::ostream & out);
+
+#endif /* Benchmarks_hpp */
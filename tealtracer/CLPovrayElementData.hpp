@@ -135,6 +135,34 @@ struct CLPovrayPlaneData {
     }
 };
 
+///
+struct CLPovrayTriangleData {
+    float3 a, b, c;
+    
+    CLPovrayPigment pigment;
+    CLPovrayFinish finish;
+    
+    cl_float id;
+    
+    CLPovrayTriangleData() : a(0,0,0), b(0,0,0), c(0,0,0), pigment(), finish(), id(0) {}
+    CLPovrayTriangleData(const PovrayTriangleData & data) : a(data.a.x(), data.a.y(), data.a.z()), b(data.b.x(), data.b.y(), data.b.z()), c(data.c.x(), data.c.y(), data.c.z()), pigment(data.pigment), finish(data.finish), id(data.id) {}
+    
+    void writeOutData(std::vector<cl_float> & data) {
+        data.push_back(a.x);
+        data.push_back(a.y);
+        data.push_back(a.z);
+        data.push_back(b.x);
+        data.push_back(b.y);
+        data.push_back(b.z);
+        data.push_back(c.x);
+        data.push_back(c.y);
+        data.push_back(c.z);
+        pigment.writeOutData(data);
+        finish.writeOutData(data);
+        data.push_back(id);
+    }
+};
+
 ///
 packed_struct CLPackedPhoton {
     cl_float pos_x, pos_y, pos_z;
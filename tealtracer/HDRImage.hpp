@@ -0,0 +1,62 @@
+//
+//  HDRImage.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef HDRImage_hpp
+#define HDRImage_hpp
+
+#include <vector>
+
+#include "JensenPhoton.hpp"
+
+///
+/// Radiance per pixel, unclamped, where 1 is display white. Pixels are kept
+///     as Ward's shared-exponent "WardRGBE", so the image takes 4 bytes a
+///     pixel like an "Image<uint8_t>": each channel has 8 bits of precision
+///     relative to the brightest channel of its pixel. See "Tonemapper" for
+///     turning one into something displayable.
+///
+struct HDRImage {
+    std::vector<WardRGBE> pixels;
+    int width;
+    int height;
+    
+    ///
+    HDRImage() {
+        setDimensions(0, 0);
+    }
+    
+    /// Every pixel is black
+    void setDimensions(int width, int height) {
+        this->width = width;
+        this->height = height;
+        
+        pixels.assign(width * height, WardRGBE::Zero());
+    }
+    
+    ///
+    WardRGBE & pixel(int x, int y) {
+        return pixels[x + width * y];
+    }
+    
+    ///
+    const WardRGBE & pixel(int x, int y) const {
+        return pixels[x + width * y];
+    }
+    
+    ///
+    void setRadiance(int x, int y, const RGBf & radiance) {
+        pixel(x, y) = rgb2rgbe(radiance);
+    }
+    
+    ///
+    RGBf radiance(int x, int y) const {
+        return rgbe2rgb(pixel(x, y));
+    }
+};
+
+#endif /* HDRImage_hpp */
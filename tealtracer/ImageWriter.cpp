@@ -0,0 +1,122 @@
+//
+//  ImageWriter.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/6/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "ImageWriter.hpp"
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+/// CRC-32 as used by PNG chunks
+static uint32_t
+crc32(const uint8_t * data, size_t length, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool tableBuilt = false;
+    if (!tableBuilt) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        tableBuilt = true;
+    }
+    
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+///
+static void
+appendUInt32(std::vector<uint8_t> & bytes, uint32_t value) {
+    bytes.push_back((uint8_t) (value >> 24));
+    bytes.push_back((uint8_t) (value >> 16));
+    bytes.push_back((uint8_t) (value >> 8));
+    bytes.push_back((uint8_t) value);
+}
+
+/// Appends a chunk: its length, "type", "data", and the CRC of type and data
+static void
+appendChunk(std::vector<uint8_t> & png, const char * type, const std::vector<uint8_t> & data) {
+    appendUInt32(png, (uint32_t) data.size());
+    
+    size_t typeStart = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    
+    appendUInt32(png, crc32(&png[typeStart], png.size() - typeStart));
+}
+
+///
+bool
+ImageWriter::writePNG(const std::string & path, const Image<uint8_t> & image) {
+    
+    /// Scanlines, each starting with filter type 0 (none)
+    size_t rowBytes = 1 + 4 * (size_t) image.width;
+    std::vector<uint8_t> scanlines(rowBytes * image.height, 0);
+    for (int y = 0; y < image.height; y++) {
+        uint8_t * row = &scanlines[rowBytes * (image.height - 1 - y)];
+        for (int x = 0; x < image.width; x++) {
+            const Image<uint8_t>::Vector4 & pixel = image.pixels[x + image.width * y];
+            for (int c = 0; c < 4; c++) {
+                row[1 + 4 * x + c] = pixel(c);
+            }
+        }
+    }
+    
+    /// zlib stream made of uncompressed ("stored") deflate blocks, which
+    ///     every PNG reader supports and costs nothing to produce
+    std::vector<uint8_t> zlib;
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do {
+        size_t blockSize = std::min<size_t>(65535, scanlines.size() - offset);
+        bool lastBlock = offset + blockSize == scanlines.size();
+        zlib.push_back(lastBlock ? 1 : 0);
+        zlib.push_back((uint8_t) blockSize);
+        zlib.push_back((uint8_t) (blockSize >> 8));
+        zlib.push_back((uint8_t) ~blockSize);
+        zlib.push_back((uint8_t) (~blockSize >> 8));
+        zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < scanlines.size());
+    
+    uint32_t adlerA = 1, adlerB = 0;
+    for (size_t i = 0; i < scanlines.size(); i++) {
+        adlerA = (adlerA + scanlines[i]) % 65521;
+        adlerB = (adlerB + adlerA) % 65521;
+    }
+    appendUInt32(zlib, (adlerB << 16) | adlerA);
+    
+    std::vector<uint8_t> header;
+    appendUInt32(header, (uint32_t) image.width);
+    appendUInt32(header, (uint32_t) image.height);
+    header.push_back(8); // bits per channel
+    header.push_back(6); // RGBA
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // not interlaced
+    
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::vector<uint8_t> png(signature, signature + 8);
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", std::vector<uint8_t>());
+    
+    std::ofstream output(path.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!output) {
+        return false;
+    }
+    output.write((const char *) &png[0], png.size());
+    return (bool) output;
+}
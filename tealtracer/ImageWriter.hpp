@@ -0,0 +1,29 @@
+//
+//  ImageWriter.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/6/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef ImageWriter_hpp
+#define ImageWriter_hpp
+
+#include <string>
+#include <cstdint>
+
+#include "Image.hpp"
+
+///
+/// Saves rendered images to disk, without any image libraries.
+///
+struct ImageWriter {
+
+    /// Writes "image" to "path" as an 8-bit RGBA PNG. Row 0 of "image" is the
+    ///     bottom of the picture (as in the OpenGL texture it is displayed
+    ///     with), so rows are written last to first. Returns false if the
+    ///     file could not be written.
+    static bool writePNG(const std::string & path, const Image<uint8_t> & image);
+};
+
+#endif /* ImageWriter_hpp */
@@ -15,7 +15,7 @@ void
 OCLMonteCarloRaytracer::ocl_raytraceSetup() {
     OpenCLRaytracer::ocl_raytraceSetup();
 
-    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl");
+    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl", 0, raytraceBuildOptions().c_str());
     computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_direct");
 }
 
@@ -24,7 +24,6 @@ void
 OCLMonteCarloRaytracer::ocl_raytraceRays() {
     unsigned int imageWidth = outputImage.width;
     unsigned int imageHeight = outputImage.height;
-    void * imageData = outputImage.dataPtr();
         
     auto camera = config.scene->camera();
     auto cameraData = CLPovrayCameraData(camera->data());
@@ -43,10 +42,13 @@ OCLMonteCarloRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
         
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
+        
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
        
-        computeEngine.getBuffer("image_output"),
+        computeEngine.getBuffer("image_hdr"),
         (cl_uint) imageWidth,
         (cl_uint) imageHeight
     );
@@ -54,5 +56,5 @@ OCLMonteCarloRaytracer::ocl_raytraceRays() {
     computeEngine.executeKernel("raytrace_one_ray_direct", activeDevice, std::vector<size_t> {(size_t) imageWidth * imageHeight});
     computeEngine.finish(activeDevice);
     
-    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, imageWidth, imageHeight, 1, 0, 0, imageData);
+    ocl_tonemapAndReadImage();
 }
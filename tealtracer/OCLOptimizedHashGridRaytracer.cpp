@@ -9,6 +9,7 @@
 #include "OCLOptimizedHashGridRaytracer.hpp"
 
 #include "TSLogger.hpp"
+#include "TSProfiler.hpp"
 #include "stl_extensions.hpp"
 
 #include "CLPovrayElementData.hpp"
@@ -31,20 +32,12 @@ OCLOptimizedHashGridRaytracer::configure() {
 }
 
 ///
-void OCLOptimizedHashGridRaytracer::start() {
-
-    configure();
+void
+OCLOptimizedHashGridRaytracer::prepareFrames() {
 
-    jobPool.emplaceJob(JobPool::WorkItem("[GPU] setup ray trace", [=](){
-        ocl_raytraceSetup();
-        double t0 = glfwGetTime();
-        this->ocl_buildPhotonMap();
-        double tf = glfwGetTime();
-        TSLoggerLog(std::cout, "Done mapping photons: ", tf - t0);
-        
-    }, [=]() {
-        this->enqueueRaytrace();
-    }));
+    OpenCLRaytracer::prepareFrames();
+    
+    this->ocl_buildPhotonMap();
 }
 
 ///
@@ -53,15 +46,25 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceSetup() {
     
     OpenCLRaytracer::ocl_raytraceSetup();
     
-    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl");
+    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl", 0, raytraceBuildOptions().c_str());
     computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_hashgrid_modified");
     
     /// Photon mapping kernels
     computeEngine.createKernel("raytrace_prog", "emit_photon");
-    computeEngine.createKernel("raytrace_prog", "photonmap_mapPhotonToGrid");
     computeEngine.createKernel("raytrace_prog", "photonmap_initGridFirstPhoton");
     computeEngine.createKernel("raytrace_prog", "photonmap_computeGridFirstPhoton");
     
+    /// Photon sorting kernels
+    std::string sortMacros = make_string(
+        "#define RADIX_SORT_GROUP_SIZE ", kRadixSortGroupSize, "\n",
+        "#define RADIX_SORT_BLOCK_SIZE ", kRadixSortBlockSize);
+    computeEngine.createProgramFromFile("photon_sort_prog", "photon_sort.cl", sortMacros.c_str(), photonLayoutBuildOptions().c_str());
+    computeEngine.createKernel("photon_sort_prog", "photonsort_makeKeys");
+    computeEngine.createKernel("photon_sort_prog", "photonsort_permutePhotons");
+    computeEngine.createKernel("photon_sort_prog", "radixsort_histogram");
+    computeEngine.createKernel("photon_sort_prog", "radixsort_scan");
+    computeEngine.createKernel("photon_sort_prog", "radixsort_scatter");
+    
     auto camera = config.scene->camera();
     
     //////
@@ -72,6 +75,15 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceSetup() {
         //! TODO: We might need to multiply the number of lights
         computeEngine.createBuffer("photon_data", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(CLPackedPhoton) * config.raysPerLight);
         computeEngine.createBuffer("map_gridIndices", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * config.raysPerLight);
+        
+        /// Sorting scratch space
+        int numSortBlocks = (config.raysPerLight + kRadixSortBlockSize - 1) / kRadixSortBlockSize;
+        computeEngine.createBuffer("photon_dataSorted", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(CLPackedPhoton) * config.raysPerLight);
+        computeEngine.createBuffer("photon_sortKeys", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_uint) * config.raysPerLight);
+        computeEngine.createBuffer("photon_sortValues", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_uint) * config.raysPerLight);
+        computeEngine.createBuffer("photon_sortKeysSwap", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_uint) * config.raysPerLight);
+        computeEngine.createBuffer("photon_sortValuesSwap", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_uint) * config.raysPerLight);
+        computeEngine.createBuffer("photon_sortBlockHistograms", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_uint) * (1 << kRadixSortBits) * numSortBlocks);
     }
     
     int mapGridDimensions = photonHashmap->xdim * photonHashmap->ydim * photonHashmap->zdim;
@@ -84,15 +96,23 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceSetup() {
 void
 OCLOptimizedHashGridRaytracer::ocl_buildPhotonMap() {
     ocl_emitPhotons();
+    
+    double startTime = TSClock::now();
     ocl_sortPhotons();
-    ocl_mapPhotonsToGrid();
     ocl_computeGridFirstIndices();
+    
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("build photon map", "build", startTime, endTime);
+    
+    RenderStats stats;
+    stats.buildMap = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
 void
 OCLOptimizedHashGridRaytracer::ocl_emitPhotons() {
-    double startTime = glfwGetTime();
+    double startTime = TSClock::now();
     float luminosityPerPhoton = (((float) config.lumensPerLight) / (float) config.raysPerLight);
     float randFloat = generator.randFloat();
     unsigned int randVal = (int) (100000.0f * randFloat);
@@ -106,6 +126,9 @@ OCLOptimizedHashGridRaytracer::ocl_emitPhotons() {
         (cl_uint) numSpheres,
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
+        
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -120,35 +143,30 @@ OCLOptimizedHashGridRaytracer::ocl_emitPhotons() {
     computeEngine.executeKernel("emit_photon", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed emit time: ", endTime - startTime);
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+    
+    RenderStats stats;
+    stats.emit = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
 void
 OCLOptimizedHashGridRaytracer::ocl_sortPhotons() {
 
-    double startTime = glfwGetTime();
+    if (config.raysPerLight <= 0) {
+        return;
+    }
+
+    TSProfileScope("sort photons", "build");
     
-    std::vector<CLPackedPhoton> photons(config.raysPerLight, CLPackedPhoton());
-    computeEngine.readBuffer("photon_data", activeDevice, 0, sizeof(CLPackedPhoton) * config.raysPerLight, &photons[0]);
-    std::sort(photons.begin(), photons.end(), [&](const CLPackedPhoton & a, const CLPackedPhoton & b) {
-        return photonHashmap->getCellIndexHash(Eigen::Vector3f(a.pos_x, a.pos_y, a.pos_z)) < photonHashmap->getCellIndexHash(Eigen::Vector3f(b.pos_x, b.pos_y, b.pos_z));
-    });
-    computeEngine.writeBuffer("photon_data", activeDevice, 0, sizeof(CLPackedPhoton) * config.raysPerLight, &photons[0]);
-    ///
+    int numPhotons = config.raysPerLight;
+    int numCells = photonHashmap->xdim * photonHashmap->ydim * photonHashmap->zdim;
+    int numSortBlocks = (numPhotons + kRadixSortBlockSize - 1) / kRadixSortBlockSize;
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed sort time: ", endTime - startTime);
-}
-
-///
-void
-OCLOptimizedHashGridRaytracer::ocl_mapPhotonsToGrid() {
-
-    double startTime = glfwGetTime();
-
-    computeEngine.setKernelArgs("photonmap_mapPhotonToGrid",
+    /// (cell, photon index) pairs
+    computeEngine.setKernelArgs("photonsort_makeKeys",
         (cl_int) photonHashmap->spacing,
         (cl_float) photonHashmap->xmin,
         (cl_float) photonHashmap->ymin,
@@ -162,24 +180,74 @@ OCLOptimizedHashGridRaytracer::ocl_mapPhotonsToGrid() {
         (cl_float) photonHashmap->cellsize,
     
         computeEngine.getBuffer("photon_data"),
-        (cl_int) config.raysPerLight, // num_photons
-
-        computeEngine.getBuffer("map_gridIndices"),
-        computeEngine.getBuffer("map_gridFirstPhotonIndices")
+        (cl_int) numPhotons,
+        
+        computeEngine.getBuffer("photon_sortKeys"),
+        computeEngine.getBuffer("photon_sortValues")
     );
-
-    computeEngine.executeKernel("photonmap_mapPhotonToGrid", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
-    computeEngine.finish(activeDevice);
+    computeEngine.executeKernel("photonsort_makeKeys", activeDevice, std::vector<size_t> {(size_t) numPhotons});
+    
+    /// Keys go up to "numCells" (photons outside of the grid), so only the
+    ///     digits needed to cover that are sorted
+    int numPasses = 0;
+    while (numPasses * kRadixSortBits < 32 && (((unsigned int) numCells) >> (numPasses * kRadixSortBits)) != 0) {
+        numPasses++;
+    }
+    
+    for (int pass = 0; pass < numPasses; pass++) {
+        cl_int shift = pass * kRadixSortBits;
+        
+        computeEngine.setKernelArgs("radixsort_histogram",
+            computeEngine.getBuffer("photon_sortKeys"),
+            (cl_int) numPhotons,
+            shift,
+            computeEngine.getBuffer("photon_sortBlockHistograms")
+        );
+        computeEngine.executeKernel("radixsort_histogram", activeDevice, (size_t) (numSortBlocks * kRadixSortGroupSize), (size_t) kRadixSortGroupSize);
+        
+        computeEngine.setKernelArgs("radixsort_scan",
+            computeEngine.getBuffer("photon_sortBlockHistograms"),
+            (cl_int) ((1 << kRadixSortBits) * numSortBlocks)
+        );
+        computeEngine.executeKernel("radixsort_scan", activeDevice, (size_t) kRadixSortGroupSize, (size_t) kRadixSortGroupSize);
+        
+        computeEngine.setKernelArgs("radixsort_scatter",
+            computeEngine.getBuffer("photon_sortKeys"),
+            computeEngine.getBuffer("photon_sortValues"),
+            (cl_int) numPhotons,
+            shift,
+            computeEngine.getBuffer("photon_sortBlockHistograms"),
+            computeEngine.getBuffer("photon_sortKeysSwap"),
+            computeEngine.getBuffer("photon_sortValuesSwap")
+        );
+        computeEngine.executeKernel("radixsort_scatter", activeDevice, (size_t) (numSortBlocks * kRadixSortGroupSize), (size_t) kRadixSortGroupSize);
+        
+        /// The sorted pairs become the input of the next pass
+        computeEngine.swapMemObjects("photon_sortKeys", "photon_sortKeysSwap");
+        computeEngine.swapMemObjects("photon_sortValues", "photon_sortValuesSwap");
+    }
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed toGrid time: ", endTime - startTime);
+    /// Gather the photons into sorted order, writing their grid indices as well
+    computeEngine.setKernelArgs("photonsort_permutePhotons",
+        computeEngine.getBuffer("photon_data"),
+        computeEngine.getBuffer("photon_sortKeys"),
+        computeEngine.getBuffer("photon_sortValues"),
+        (cl_int) numPhotons,
+        (cl_int) numCells,
+        
+        computeEngine.getBuffer("photon_dataSorted"),
+        computeEngine.getBuffer("map_gridIndices")
+    );
+    computeEngine.executeKernel("photonsort_permutePhotons", activeDevice, std::vector<size_t> {(size_t) numPhotons});
+    computeEngine.swapMemObjects("photon_data", "photon_dataSorted");
+    computeEngine.finish(activeDevice);
 }
 
 ///
 void
 OCLOptimizedHashGridRaytracer::ocl_computeGridFirstIndices() {
 
-    double startTime = glfwGetTime();
+    TSProfileScope("find first photon per cell", "build");
 
     computeEngine.setKernelArgs("photonmap_initGridFirstPhoton",
         (cl_int) photonHashmap->xdim,
@@ -200,9 +268,6 @@ OCLOptimizedHashGridRaytracer::ocl_computeGridFirstIndices() {
 
     computeEngine.executeKernel("photonmap_computeGridFirstPhoton", activeDevice, std::vector<size_t> { (size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
-    
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed first index time: ", endTime - startTime);
 }
 
 ///
@@ -211,7 +276,6 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceRays() {
     
     unsigned int imageWidth = outputImage.width;
     unsigned int imageHeight = outputImage.height;
-    void * imageData = outputImage.dataPtr();
     
     unsigned int rayCount = imageWidth * imageHeight;
     
@@ -232,6 +296,9 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
         
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
+        
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -255,7 +322,7 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("map_gridIndices"),
         computeEngine.getBuffer("map_gridFirstPhotonIndices"),
        
-       computeEngine.getBuffer("image_output"),
+       computeEngine.getBuffer("image_hdr"),
        (cl_uint) imageWidth,
        (cl_uint) imageHeight
     );
@@ -263,6 +330,6 @@ OCLOptimizedHashGridRaytracer::ocl_raytraceRays() {
     computeEngine.executeKernel("raytrace_one_ray_hashgrid_modified", activeDevice, std::vector<size_t> { (size_t) rayCount});
     computeEngine.finish(activeDevice);
     
-    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, imageWidth, imageHeight, 1, 0, 0, imageData);
+    ocl_tonemapAndReadImage();
 }
 
@@ -21,8 +21,9 @@ public:
     ///
     OCLOptimizedHashGridRaytracer();
 
-    virtual void start();
     virtual void configure();
+    ///
+    virtual void prepareFrames();
     
     ///
     virtual void ocl_raytraceSetup();
@@ -35,17 +36,23 @@ private:
     void ocl_buildPhotonMap();
     ///
     void ocl_emitPhotons();
-    ///
+    /// Radix sorts "photon_data" by grid cell on the device and fills in
+    ///     "map_gridIndices" to match.
     void ocl_sortPhotons();
     ///
-    void ocl_mapPhotonsToGrid();
-    ///
     void ocl_computeGridFirstIndices();
 
 
     ///
     std::shared_ptr<PhotonHashmap> photonHashmap;
 
+    /// Work-items per group and keys per group of the photon radix sort.
+    ///     The group size has to be in [16, 255] and divide the block size.
+    static const int kRadixSortGroupSize = 64;
+    static const int kRadixSortBlockSize = 256;
+    /// Bits of the key sorted by each pass ("RADIX_SORT_BITS")
+    static const int kRadixSortBits = 4;
+
 };
 
 #endif /* OCLOptimizedHashGridRaytracer_hpp */
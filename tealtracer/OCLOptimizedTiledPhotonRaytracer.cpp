@@ -7,30 +7,26 @@
 //
 
 #include "OCLOptimizedTiledPhotonRaytracer.hpp"
+#include "TSProfiler.hpp"
+#include "stl_extensions.hpp"
 
 ///
 OCLOptimizedTiledPhotonRaytracer::OCLOptimizedTiledPhotonRaytracer() : OpenCLRaytracer() {
     photonTiler = std::shared_ptr<PhotonTiler>(new PhotonTiler());
-    photonEmissionSeed = generator.randUInt();
+    photonEmissionSeed = 0;
+    tilePhotonIndicesCapacity = 0;
 }
 
 ///
 void
-OCLOptimizedTiledPhotonRaytracer::start() {
-
-    configure();
+OCLOptimizedTiledPhotonRaytracer::prepareFrames() {
 
-    jobPool.emplaceJob(JobPool::WorkItem("[GPU] setup ray trace", [=](){
-        this->ocl_raytraceSetup();
-        
-        double t0 = glfwGetTime();
-        this->ocl_emitPhotons();
-        double tf = glfwGetTime();
-        TSLoggerLog(std::cout, "Done emitting photons: ", tf - t0);
-        
-    }, [=]() {
-        this->enqueueRaytrace();
-    }));
+    OpenCLRaytracer::prepareFrames();
+    
+    /// Drawn after "configure" has seeded ".generator"
+    photonEmissionSeed = generator.randUInt();
+    
+    this->ocl_emitPhotons();
 }
 
 ///
@@ -40,6 +36,13 @@ OCLOptimizedTiledPhotonRaytracer::enqueueRaytrace() {
     OpenCLRaytracer::enqueueRaytrace();
 }
 
+///
+void
+OCLOptimizedTiledPhotonRaytracer::renderFrame() {
+    cachedCameraData = config.scene->camera()->data();
+    OpenCLRaytracer::renderFrame();
+}
+
 ///
 void
 OCLOptimizedTiledPhotonRaytracer::PackedPlane::fromPlane(const PhotonTiler::Plane & plane) {
@@ -69,63 +72,100 @@ OCLOptimizedTiledPhotonRaytracer::ocl_raytraceSetup() {
 
     OpenCLRaytracer::ocl_raytraceSetup();
 
-    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl");
-    computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_one_tile");
+    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl", 0, raytraceBuildOptions().c_str());
+    computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_tile_indices");
     
     /// Photon mapping kernels
     computeEngine.createKernel("raytrace_prog", "emit_photon");
     computeEngine.createKernel("raytrace_prog", "countPhotonsInTile");
-    computeEngine.createKernel("raytrace_prog", "copyPhotonsIntoOneTile");
+    computeEngine.createKernel("raytrace_prog", "copyPhotonIndicesIntoTiles");
+    
+    /// Turns the tile counts into offsets
+    std::string scanMacros = make_string(
+        "#define RADIX_SORT_GROUP_SIZE ", kTileScanGroupSize, "\n",
+        "#define RADIX_SORT_BLOCK_SIZE ", kTileScanGroupSize);
+    computeEngine.createProgramFromFile("tile_scan_prog", "radix_sort.cl", scanMacros.c_str());
+    computeEngine.createKernel("tile_scan_prog", "radixsort_scan");
 
     computeEngine.createBuffer("photons", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(CLPackedPhoton) * config.raysPerLight);
     
     /// Now generate known tile buffers
     photonTiler->generateTiles(outputImage.width, outputImage.height, config.tile_width, config.tile_height, config.scene->camera()->location(), config.scene->camera()->basisVectors());
-    tilePhotonCount = std::vector<cl_int> (photonTiler->tiles.size(), 0);
     
     computeEngine.createBuffer("tiles", ComputeEngine::MemFlags::MEM_READ_ONLY, sizeof(PackedTile) * photonTiler->tiles.size());
-    computeEngine.createBuffer("tilePhotonCount", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * photonTiler->tiles.size());
+    /// One past the last tile holds the total once scanned
+    computeEngine.createBuffer("tilePhotonStarts", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * (photonTiler->tiles.size() + 1));
     computeEngine.createBuffer("nextPhotonIndex", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * photonTiler->tiles.size());
+    
+    /// Grown by "ocl_buildAndFillTiles" as needed
+    tilePhotonIndicesCapacity = std::max<int>(config.raysPerLight, 1);
+    computeEngine.createBuffer("tilePhotonIndices", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * tilePhotonIndicesCapacity);
+    
+    /// Everything launched per frame is looked up once here
+    photonsBuffer = computeEngine.getBufferHandle("photons");
+    tilesBuffer = computeEngine.getBufferHandle("tiles");
+    tilePhotonStartsBuffer = computeEngine.getBufferHandle("tilePhotonStarts");
+    nextPhotonIndexBuffer = computeEngine.getBufferHandle("nextPhotonIndex");
+    tilePhotonIndicesBuffer = computeEngine.getBufferHandle("tilePhotonIndices");
+    spheresBuffer = computeEngine.getBufferHandle("spheres");
+    planesBuffer = computeEngine.getBufferHandle("planes");
+    trianglesBuffer = computeEngine.getBufferHandle("triangles");
+    lightsBuffer = computeEngine.getBufferHandle("lights");
+    imageBuffer = computeEngine.getBufferHandle("image_hdr");
+    
+    emitPhotonKernel = computeEngine.getKernelHandle("emit_photon");
+    countPhotonsLaunch = KernelLaunch(computeEngine, computeEngine.getKernelHandle("countPhotonsInTile"));
+    scanTileCountsLaunch = KernelLaunch(computeEngine, computeEngine.getKernelHandle("radixsort_scan"));
+    copyPhotonIndicesLaunch = KernelLaunch(computeEngine, computeEngine.getKernelHandle("copyPhotonIndicesIntoTiles"));
+    raytraceLaunch = KernelLaunch(computeEngine, computeEngine.getKernelHandle("raytrace_one_ray_tile_indices"));
 }
 
 ///
 void
 OCLOptimizedTiledPhotonRaytracer::ocl_emitPhotons() {
-    double startTime = glfwGetTime();
+    double startTime = TSClock::now();
     float luminosityPerPhoton = (((float) config.lumensPerLight) / (float) config.raysPerLight);
 
-    computeEngine.setKernelArgs("emit_photon",
+    computeEngine.bind(emitPhotonKernel,
         (cl_uint) photonEmissionSeed,
         (cl_uint) config.brdfType,
         (cl_int) true, // dummy argument
         
-        computeEngine.getBuffer("spheres"),
+        spheresBuffer,
         (cl_uint) numSpheres,
-        computeEngine.getBuffer("planes"),
+        planesBuffer,
         (cl_uint) numPlanes,
-        computeEngine.getBuffer("lights"),
+        
+        trianglesBuffer,
+        (cl_uint) numTriangles,
+        lightsBuffer,
         (cl_uint) numLights,
         
         (cl_float) luminosityPerPhoton,
         (cl_float) config.photonBounceProbability,
         (cl_float) config.photonBounceEnergyMultipler,
         
-        computeEngine.getBuffer("photons"),
+        photonsBuffer,
         (cl_int) config.raysPerLight
     );
 
-    computeEngine.executeKernel("emit_photon", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
+    computeEngine.executeKernel(emitPhotonKernel, activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed emit time: ", endTime - startTime);
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+    
+    RenderStats stats;
+    stats.emit = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
 void
 OCLOptimizedTiledPhotonRaytracer::ocl_buildAndFillTiles() {
     
-    std::vector<cl_int> allZeros(photonTiler->tiles.size(), 0);
+    int numTiles = (int) photonTiler->tiles.size();
+    std::vector<cl_int> allZeros(numTiles + 1, 0);
     /// Generate tiles
     photonTiler->generateTiles(outputImage.width, outputImage.height, config.tile_width, config.tile_height,cachedCameraData.getLocation(), cachedCameraData.basisVectors());
     
@@ -135,52 +175,59 @@ OCLOptimizedTiledPhotonRaytracer::ocl_buildAndFillTiles() {
         tile.fromTile(photonTiler->tiles[tileItr]);
         memcpy(&tileData[tileItr * sizeof(PackedTile)/sizeof(cl_float)], &tile, sizeof(PackedTile));
     }
-    computeEngine.writeBuffer("tiles", activeDevice, 0, sizeof(PackedTile) * photonTiler->tiles.size(), &tileData[0]);
-    computeEngine.writeBuffer("tilePhotonCount", activeDevice, 0, sizeof(cl_int) * photonTiler->tiles.size(), &allZeros[0]);
+    computeEngine.writeBuffer(tilesBuffer, activeDevice, 0, sizeof(PackedTile) * numTiles, &tileData[0]);
+    computeEngine.writeBuffer(tilePhotonStartsBuffer, activeDevice, 0, sizeof(cl_int) * (numTiles + 1), &allZeros[0]);
     
-    /// Counting pass
-    computeEngine.setKernelArgs("countPhotonsInTile",
-        computeEngine.getBuffer("photons"),
+    /// Counting pass, straight into "tilePhotonStarts"
+    countPhotonsLaunch.setArgs(
+        photonsBuffer,
         (cl_int) config.raysPerLight,
 
-        computeEngine.getBuffer("tiles"),
-        (cl_int) photonTiler->tiles.size(),
+        tilesBuffer,
+        (cl_int) numTiles,
 
         (cl_float) config.tile_photonEffectRadius,
         
-        computeEngine.getBuffer("tilePhotonCount")
+        tilePhotonStartsBuffer
     );
     
-    computeEngine.executeKernel("countPhotonsInTile", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
+    countPhotonsLaunch.launch(activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     
-    /// Allocation
-    computeEngine.readBuffer("tilePhotonCount", activeDevice, 0, sizeof(cl_int) * photonTiler->tiles.size(), &tilePhotonCount[0]);
+    /// Offsets pass
+    scanTileCountsLaunch.setArgs(
+        tilePhotonStartsBuffer,
+        (cl_int) (numTiles + 1)
+    );
+    scanTileCountsLaunch.launch(activeDevice, std::vector<size_t> {(size_t) kTileScanGroupSize}, std::vector<size_t> {(size_t) kTileScanGroupSize});
     
-    for (int tileItr = 0; tileItr < photonTiler->tiles.size(); tileItr++) {
-        computeEngine.createBuffer(tilePhotonBufferName(tileItr).c_str(), ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(CLPackedPhoton) * std::max<int>(tilePhotonCount[tileItr], 1));
+    /// Allocation, only when this frame's photons don't fit
+    cl_int totalTilePhotons = 0;
+    computeEngine.readBuffer(tilePhotonStartsBuffer, activeDevice, sizeof(cl_int) * numTiles, sizeof(cl_int), &totalTilePhotons);
+    if (totalTilePhotons > tilePhotonIndicesCapacity) {
+        /// Leave room so a camera creeping forward doesn't grow it every frame
+        tilePhotonIndicesCapacity = totalTilePhotons + totalTilePhotons / 2;
+        computeEngine.createBuffer("tilePhotonIndices", ComputeEngine::MemFlags::MEM_READ_WRITE, sizeof(cl_int) * tilePhotonIndicesCapacity);
     }
+    TSProfiler::recordCounter("tile photons", (double) totalTilePhotons);
     
     /// Copy pass
-    computeEngine.writeBuffer("nextPhotonIndex", activeDevice, 0, sizeof(cl_int) * allZeros.size(), &allZeros[0]);
-    for (int tileItr = 0; tileItr < photonTiler->tiles.size(); tileItr++) {
-        
-        std::string bufferName = tilePhotonBufferName(tileItr);
-        assert(computeEngine.getBuffer(tilePhotonBufferName(tileItr).c_str()) != NULL);
-        computeEngine.setKernelArgs("copyPhotonsIntoOneTile",
-            computeEngine.getBuffer("photons"),
-            (cl_int) config.raysPerLight,
-            
-            (cl_float) config.tile_photonEffectRadius,
-            
-            (cl_int) tileItr,
-            computeEngine.getBuffer("tiles"),
-            computeEngine.getBuffer(tilePhotonBufferName(tileItr).c_str()),
-            computeEngine.getBuffer("nextPhotonIndex")
-        );
-        
-        computeEngine.executeKernel("copyPhotonsIntoOneTile", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
-    }
+    computeEngine.writeBuffer(nextPhotonIndexBuffer, activeDevice, 0, sizeof(cl_int) * numTiles, &allZeros[0]);
+    /// "tilePhotonIndices" is rebound only if it was just grown
+    copyPhotonIndicesLaunch.setArgs(
+        photonsBuffer,
+        (cl_int) config.raysPerLight,
+
+        tilesBuffer,
+        (cl_int) numTiles,
+
+        (cl_float) config.tile_photonEffectRadius,
+        tilePhotonStartsBuffer,
+
+        nextPhotonIndexBuffer,
+        tilePhotonIndicesBuffer
+    );
     
+    copyPhotonIndicesLaunch.launch(activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
 }
 
@@ -188,58 +235,61 @@ OCLOptimizedTiledPhotonRaytracer::ocl_buildAndFillTiles() {
 void
 OCLOptimizedTiledPhotonRaytracer::ocl_raytraceRays() {
     
-//    ocl_emitPhotons();//
-    
-    double fillT0 = glfwGetTime();
+    double fillT0 = TSClock::now();
     ocl_buildAndFillTiles();
-    double fillTf = glfwGetTime();
-    double tileT0 = glfwGetTime();
-
-    for (int tileItr = 0; tileItr < photonTiler->tiles.size(); tileItr++) {
-        int tileX = tileItr % (outputImage.width/config.tile_width);
-        int tileY = tileItr / (outputImage.width/config.tile_width);
-    
-        computeEngine.setKernelArgs("raytrace_one_ray_one_tile",
-            cachedCameraData.location,
-            cachedCameraData.up,
-            cachedCameraData.right,
-            cachedCameraData.lookAt,
-           
-            (cl_uint) config.brdfType,
-            
-            computeEngine.getBuffer("spheres"),
-            (cl_uint) numSpheres,
-            
-            computeEngine.getBuffer("planes"),
-            (cl_uint) numPlanes,
-            
-            computeEngine.getBuffer("lights"),
-            (cl_uint) numLights,
-            
-            ///
-            (cl_int) tileX,
-            (cl_int) tileY,
-            (cl_int) config.tile_width,
-            (cl_int) config.tile_height,
-            (cl_float) config.tile_photonEffectRadius,
-            (cl_float) config.tile_photonSampleRate,
-            computeEngine.getBuffer(tilePhotonBufferName(tileItr).c_str()),
-            (cl_int) tilePhotonCount[tileItr],
-            ///
-           
-            computeEngine.getBuffer("image_output"),
-            (cl_uint) outputImage.width,
-            (cl_uint) outputImage.height
-        );
-    
-        computeEngine.executeKernel("raytrace_one_ray_one_tile", activeDevice, std::vector<size_t> {(size_t) config.tile_width * config.tile_height});
-    }
+    double fillTf = TSClock::now();
+    double tileT0 = TSClock::now();
+
+    /// Tiles on the right and top edges may be cut short by the image
+    int tilesWide = (outputImage.width + config.tile_width - 1) / config.tile_width;
+    int tilesHigh = (outputImage.height + config.tile_height - 1) / config.tile_height;
+    
+    raytraceLaunch.setArgs(
+        cachedCameraData.location,
+        cachedCameraData.up,
+        cachedCameraData.right,
+        cachedCameraData.lookAt,
+       
+        (cl_uint) config.brdfType,
+        
+        spheresBuffer,
+        (cl_uint) numSpheres,
+        
+        planesBuffer,
+        (cl_uint) numPlanes,
+        
+        trianglesBuffer,
+        (cl_uint) numTriangles,
+        
+        lightsBuffer,
+        (cl_uint) numLights,
+        
+        ///
+        (cl_int) tilesWide,
+        (cl_int) config.tile_width,
+        (cl_int) config.tile_height,
+        (cl_float) config.tile_photonEffectRadius,
+        (cl_float) config.tile_photonSampleRate,
+        photonsBuffer,
+        tilePhotonIndicesBuffer,
+        tilePhotonStartsBuffer,
+        ///
+       
+        imageBuffer,
+        (cl_uint) outputImage.width,
+        (cl_uint) outputImage.height
+    );
     
+    raytraceLaunch.launch(activeDevice, std::vector<size_t> {(size_t) (tilesWide * config.tile_width), (size_t) (tilesHigh * config.tile_height)});
     computeEngine.finish(activeDevice);
     
-    double tileTf = glfwGetTime();
-    TSLoggerLog(std::cout, "build and fill time: ", fillTf - fillT0);
-    TSLoggerLog(std::cout, "render time: ", tileTf - tileT0);
+    double tileTf = TSClock::now();
+    TSProfiler::recordSpan("build and fill tiles", "build", fillT0, fillTf);
+    TSProfiler::recordSpan("trace tiles", "shade", tileT0, tileTf);
+    
+    RenderStats stats;
+    stats.buildMap = fillTf - fillT0;
+    addRenderStats(stats);
     
-    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, outputImage.width, outputImage.height, 1, 0, 0, outputImage.dataPtr());
+    ocl_tonemapAndReadImage();
 }
@@ -21,9 +21,12 @@ public:
     OCLOptimizedTiledPhotonRaytracer();
     
     ///
-    virtual void start();
-    ///
+    virtual void prepareFrames();
+    /// Both cache the camera before rendering, so moving it mid-frame has
+    ///     no effect until the next one.
     virtual void enqueueRaytrace();
+    ///
+    virtual void renderFrame();
     
     packed_struct PackedPlane {
         cl_float plane_normal_x, plane_normal_y, plane_normal_z;
@@ -46,21 +49,37 @@ public:
     ///
     void ocl_emitPhotons();
     
+    /// Lays out every tile's photon indices back to back in
+    ///     "tilePhotonIndices", with tile i's in
+    ///     [tilePhotonStarts[i], tilePhotonStarts[i + 1]).
     virtual void ocl_buildAndFillTiles();
     virtual void ocl_raytraceRays();
     
 private:
 
-    ///
-    std::string tilePhotonBufferName(int whichTile) const {
-        return std::string("tilePhotons_") + std::to_string(whichTile);
-    }
+    /// Work-items of the single group that scans the tile counts, which
+    ///     "radixsort_scan" needs to be in [16, 255]
+    static const int kTileScanGroupSize = 64;
     
     unsigned int photonEmissionSeed;
 
-    std::vector<cl_int> tilePhotonCount;
+    /// Photon indices "tilePhotonIndices" can hold before it has to grow
+    int tilePhotonIndicesCapacity;
     CLPovrayCameraData cachedCameraData;
     std::shared_ptr<PhotonTiler> photonTiler;
+    
+    /// Resolved in "ocl_raytraceSetup" so that a frame binds its arguments
+    ///     without looking anything up by name
+    ComputeEngine::BufferHandle spheresBuffer, planesBuffer, trianglesBuffer, lightsBuffer;
+    ComputeEngine::BufferHandle photonsBuffer, tilesBuffer, tilePhotonStartsBuffer, nextPhotonIndexBuffer, tilePhotonIndicesBuffer;
+    ComputeEngine::BufferHandle imageBuffer;
+    ComputeEngine::KernelHandle emitPhotonKernel;
+    
+    /// Only the arguments that differ from the previous frame are set again
+    KernelLaunch countPhotonsLaunch;
+    KernelLaunch scanTileCountsLaunch;
+    KernelLaunch copyPhotonIndicesLaunch;
+    KernelLaunch raytraceLaunch;
 };
 
 #endif /* OCLOptimizedTiledPhotonRaytracer_hpp */
@@ -9,6 +9,7 @@
 #include "OCLPhotonHashGridRaytracer.hpp"
 
 #include "TSLogger.hpp"
+#include "TSProfiler.hpp"
 #include "stl_extensions.hpp"
 
 #include "CLPovrayElementData.hpp"
@@ -31,20 +32,12 @@ OCLPhotonHashGridRaytracer::configure() {
 }
 
 ///
-void OCLPhotonHashGridRaytracer::start() {
-
-    configure();
+void
+OCLPhotonHashGridRaytracer::prepareFrames() {
 
-    jobPool.emplaceJob(JobPool::WorkItem("[GPU] setup ray trace", [=](){
-        ocl_raytraceSetup();
-        double t0 = glfwGetTime();
-        this->ocl_buildPhotonMap();
-        double tf = glfwGetTime();
-        TSLoggerLog(std::cout, "Done mapping photons: ", tf - t0);
-        
-    }, [=]() {
-        this->enqueueRaytrace();
-    }));
+    OpenCLRaytracer::prepareFrames();
+    
+    this->ocl_buildPhotonMap();
 }
 
 ///
@@ -53,7 +46,7 @@ OCLPhotonHashGridRaytracer::ocl_raytraceSetup() {
     
     OpenCLRaytracer::ocl_raytraceSetup();
     
-    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl");
+    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl", 0, raytraceBuildOptions().c_str());
     computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_hashgrid");
     
     /// Photon mapping kernels
@@ -87,15 +80,24 @@ OCLPhotonHashGridRaytracer::ocl_raytraceSetup() {
 void
 OCLPhotonHashGridRaytracer::ocl_buildPhotonMap() {
     ocl_emitPhotons();
+    
+    double startTime = TSClock::now();
     ocl_sortPhotons();
     ocl_mapPhotonsToGrid();
     ocl_computeGridFirstIndices();
+    
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("build photon map", "build", startTime, endTime);
+    
+    RenderStats stats;
+    stats.buildMap = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
 void
 OCLPhotonHashGridRaytracer::ocl_emitPhotons() {
-    double startTime = glfwGetTime();
+    double startTime = TSClock::now();
     float luminosityPerPhoton = (((float) config.lumensPerLight) / (float) config.raysPerLight);
     float randFloat = generator.randFloat();
     unsigned int randVal = (int) (100000.0f * randFloat);
@@ -109,6 +111,9 @@ OCLPhotonHashGridRaytracer::ocl_emitPhotons() {
         (cl_uint) numSpheres,
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
+        
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -123,15 +128,19 @@ OCLPhotonHashGridRaytracer::ocl_emitPhotons() {
     computeEngine.executeKernel("emit_photon", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed emit time: ", endTime - startTime);
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+    
+    RenderStats stats;
+    stats.emit = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
 void
 OCLPhotonHashGridRaytracer::ocl_sortPhotons() {
 
-    double startTime = glfwGetTime();
+    TSProfileScope("sort photons", "build");
     
     std::vector<CLPackedPhoton> photons(config.raysPerLight, CLPackedPhoton());
     computeEngine.readBuffer("photon_data", activeDevice, 0, sizeof(CLPackedPhoton) * config.raysPerLight, &photons[0]);
@@ -140,16 +149,13 @@ OCLPhotonHashGridRaytracer::ocl_sortPhotons() {
     });
     computeEngine.writeBuffer("photon_data", activeDevice, 0, sizeof(CLPackedPhoton) * config.raysPerLight, &photons[0]);
     ///
-    
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed sort time: ", endTime - startTime);
 }
 
 ///
 void
 OCLPhotonHashGridRaytracer::ocl_mapPhotonsToGrid() {
 
-    double startTime = glfwGetTime();
+    TSProfileScope("map photons to grid", "build");
 
     computeEngine.setKernelArgs("photonmap_mapPhotonToGrid",
         (cl_int) photonHashmap->spacing,
@@ -173,16 +179,13 @@ OCLPhotonHashGridRaytracer::ocl_mapPhotonsToGrid() {
 
     computeEngine.executeKernel("photonmap_mapPhotonToGrid", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
-    
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed toGrid time: ", endTime - startTime);
 }
 
 ///
 void
 OCLPhotonHashGridRaytracer::ocl_computeGridFirstIndices() {
 
-    double startTime = glfwGetTime();
+    TSProfileScope("find first photon per cell", "build");
 
     computeEngine.setKernelArgs("photonmap_initGridFirstPhoton",
         (cl_int) photonHashmap->xdim,
@@ -203,9 +206,6 @@ OCLPhotonHashGridRaytracer::ocl_computeGridFirstIndices() {
 
     computeEngine.executeKernel("photonmap_computeGridFirstPhoton", activeDevice, std::vector<size_t> { (size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
-    
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed first index time: ", endTime - startTime);
 }
 
 ///
@@ -214,7 +214,6 @@ OCLPhotonHashGridRaytracer::ocl_raytraceRays() {
     
     unsigned int imageWidth = outputImage.width;
     unsigned int imageHeight = outputImage.height;
-    void * imageData = outputImage.dataPtr();
     
     unsigned int rayCount = imageWidth * imageHeight;
     
@@ -235,6 +234,9 @@ OCLPhotonHashGridRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
         
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
+        
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -260,7 +262,7 @@ OCLPhotonHashGridRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("map_gridIndices"),
         computeEngine.getBuffer("map_gridFirstPhotonIndices"),
        
-       computeEngine.getBuffer("image_output"),
+       computeEngine.getBuffer("image_hdr"),
        (cl_uint) imageWidth,
        (cl_uint) imageHeight
     );
@@ -268,5 +270,5 @@ OCLPhotonHashGridRaytracer::ocl_raytraceRays() {
     computeEngine.executeKernel("raytrace_one_ray_hashgrid", activeDevice, std::vector<size_t> { (size_t) rayCount});
     computeEngine.finish(activeDevice);
     
-    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, imageWidth, imageHeight, 1, 0, 0, imageData);
+    ocl_tonemapAndReadImage();
 }
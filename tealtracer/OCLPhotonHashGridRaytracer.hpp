@@ -21,8 +21,9 @@ public:
     ///
     OCLPhotonHashGridRaytracer();
 
-    virtual void start();
     virtual void configure();
+    ///
+    virtual void prepareFrames();
     
     ///
     virtual void ocl_raytraceSetup();
@@ -7,6 +7,7 @@
 //
 
 #include "OCLTiledPhotonRaytracer.hpp"
+#include "TSProfiler.hpp"
 
 ///
 OCLTiledPhotonRaytracer::OCLTiledPhotonRaytracer() : OpenCLRaytracer() {
@@ -15,21 +16,11 @@ OCLTiledPhotonRaytracer::OCLTiledPhotonRaytracer() : OpenCLRaytracer() {
 
 ///
 void
-OCLTiledPhotonRaytracer::start() {
+OCLTiledPhotonRaytracer::prepareFrames() {
 
-    configure();
-
-    jobPool.emplaceJob(JobPool::WorkItem("[GPU] setup ray trace", [=](){
-        this->ocl_raytraceSetup();
-        
-        double t0 = glfwGetTime();
-        this->ocl_emitPhotons();
-        double tf = glfwGetTime();
-        TSLoggerLog(std::cout, "Done emitting photons: ", tf - t0);
-        
-    }, [=]() {
-        this->enqueueRaytrace();
-    }));
+    OpenCLRaytracer::prepareFrames();
+    
+    this->ocl_emitPhotons();
 }
 
 ///
@@ -39,6 +30,13 @@ OCLTiledPhotonRaytracer::enqueueRaytrace() {
     OpenCLRaytracer::enqueueRaytrace();
 }
 
+///
+void
+OCLTiledPhotonRaytracer::renderFrame() {
+    cachedCameraData = config.scene->camera()->data();
+    OpenCLRaytracer::renderFrame();
+}
+
 ///
 void
 OCLTiledPhotonRaytracer::PackedPlane::fromPlane(const PhotonTiler::Plane & plane) {
@@ -68,7 +66,7 @@ OCLTiledPhotonRaytracer::ocl_raytraceSetup() {
 
     OpenCLRaytracer::ocl_raytraceSetup();
 
-    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl");
+    computeEngine.createProgramFromFile("raytrace_prog", "raytrace.cl", 0, raytraceBuildOptions().c_str());
     computeEngine.createKernel("raytrace_prog", "raytrace_one_ray_tiled");
     
     /// Photon mapping kernels
@@ -91,7 +89,7 @@ OCLTiledPhotonRaytracer::ocl_raytraceSetup() {
 ///
 void
 OCLTiledPhotonRaytracer::ocl_emitPhotons() {
-    double startTime = glfwGetTime();
+    double startTime = TSClock::now();
     float luminosityPerPhoton = (((float) config.lumensPerLight) / (float) config.raysPerLight);
 
     computeEngine.setKernelArgs("emit_photon",
@@ -103,6 +101,9 @@ OCLTiledPhotonRaytracer::ocl_emitPhotons() {
         (cl_uint) numSpheres,
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
+        
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -117,8 +118,12 @@ OCLTiledPhotonRaytracer::ocl_emitPhotons() {
     computeEngine.executeKernel("emit_photon", activeDevice, std::vector<size_t> {(size_t) config.raysPerLight});
     computeEngine.finish(activeDevice);
     
-    double endTime = glfwGetTime();
-    TSLoggerLog(std::cout, "elapsed emit time: ", endTime - startTime);
+    double endTime = TSClock::now();
+    TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+    
+    RenderStats stats;
+    stats.emit = endTime - startTime;
+    addRenderStats(stats);
 }
 
 ///
@@ -192,12 +197,12 @@ OCLTiledPhotonRaytracer::ocl_buildAndFillTiles() {
 void
 OCLTiledPhotonRaytracer::ocl_raytraceRays() {
     
-    double fillT0 = glfwGetTime();
+    double fillT0 = TSClock::now();
     
     ocl_buildAndFillTiles();
     
-    double fillTf = glfwGetTime();
-    double tileT0 = glfwGetTime();
+    double fillTf = TSClock::now();
+    double tileT0 = TSClock::now();
 
     computeEngine.setKernelArgs("raytrace_one_ray_tiled",
         cachedCameraData.location,
@@ -213,6 +218,9 @@ OCLTiledPhotonRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("planes"),
         (cl_uint) numPlanes,
         
+        computeEngine.getBuffer("triangles"),
+        (cl_uint) numTriangles,
+        
         computeEngine.getBuffer("lights"),
         (cl_uint) numLights,
         
@@ -226,7 +234,7 @@ OCLTiledPhotonRaytracer::ocl_raytraceRays() {
         computeEngine.getBuffer("tilePhotonStarts"),
         ///
        
-        computeEngine.getBuffer("image_output"),
+        computeEngine.getBuffer("image_hdr"),
         (cl_uint) outputImage.width,
         (cl_uint) outputImage.height
     );
@@ -234,9 +242,13 @@ OCLTiledPhotonRaytracer::ocl_raytraceRays() {
     computeEngine.executeKernel("raytrace_one_ray_tiled", activeDevice, std::vector<size_t> {(size_t) outputImage.width * outputImage.height});
     computeEngine.finish(activeDevice);
     
-    double tileTf = glfwGetTime();
-    TSLoggerLog(std::cout, "build and fill time: ", fillTf - fillT0);
-    TSLoggerLog(std::cout, "render time: ", tileTf - tileT0);
+    double tileTf = TSClock::now();
+    TSProfiler::recordSpan("build and fill tiles", "build", fillT0, fillTf);
+    TSProfiler::recordSpan("trace tiles", "shade", tileT0, tileTf);
+    
+    RenderStats stats;
+    stats.buildMap = fillTf - fillT0;
+    addRenderStats(stats);
     
-    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, outputImage.width, outputImage.height, 1, 0, 0, outputImage.dataPtr());
+    ocl_tonemapAndReadImage();
 }
@@ -21,9 +21,12 @@ public:
     OCLTiledPhotonRaytracer();
     
     ///
-    virtual void start();
-    ///
+    virtual void prepareFrames();
+    /// Both cache the camera before rendering, so moving it mid-frame has
+    ///     no effect until the next one.
     virtual void enqueueRaytrace();
+    ///
+    virtual void renderFrame();
     
     packed_struct PackedPlane {
         cl_float plane_normal_x, plane_normal_y, plane_normal_z;
@@ -8,7 +8,10 @@
 
 #include "OpenCLRaytracer.hpp"
 
+#include <sstream>
+
 #include "TSLogger.hpp"
+#include "TSProfiler.hpp"
 #include "stl_extensions.hpp"
 
 #include "CLPovrayElementData.hpp"
@@ -20,7 +23,7 @@ OpenCLRaytracer::OpenCLRaytracer() : Raytracer() {
     realtimeSaved = 0.0;
     useGPU = false;
     
-    numSpheres = numPlanes = numLights = 0;
+    numSpheres = numPlanes = numTriangles = numLights = 0;
     activeDevice = 0;
 }
 
@@ -31,6 +34,10 @@ OpenCLRaytracer::configure() {
     if (useGPU) {
         activeDevice = 1;
     }
+    
+    if (config.randomSeed >= 0) {
+        generator.seed((unsigned int) config.randomSeed);
+    }
 }
 
 ///
@@ -40,24 +47,64 @@ OpenCLRaytracer::start() {
     configure();
 
     jobPool.emplaceJob(JobPool::WorkItem("[GPU] setup ray trace", [=](){
-        ocl_raytraceSetup();
+        this->prepareFrames();
     }, [=]() {
         this->enqueueRaytrace();
     }));
 }
 
+///
+void
+OpenCLRaytracer::prepareFrames() {
+    ocl_raytraceSetup();
+}
+
+///
+void
+OpenCLRaytracer::renderFrame() {
+    double startTime = TSClock::now();
+    double buildMapBefore = renderStats.buildMap;
+    
+    ocl_raytraceRays();
+    
+    /// Tiled raytracers rebuild their tiles in "ocl_raytraceRays" and count
+    ///     that as map building. Gathering happens inside the kernels, so it
+    ///     is part of "shade".
+    RenderStats stats;
+    stats.shade = (TSClock::now() - startTime) - (renderStats.buildMap - buildMapBefore);
+    stats.cameraRays = (long long) outputImage.width * outputImage.height;
+    addRenderStats(stats);
+    
+    recordKernelTimings();
+}
+
+///
+void
+OpenCLRaytracer::recordKernelTimings() {
+    if (!computeEngine.isProfilingEnabled()) {
+        return;
+    }
+    
+    std::vector<ComputeEngine::KernelTiming> timings = computeEngine.collectKernelTimings();
+    for (auto itr = timings.begin(); itr != timings.end(); itr++) {
+        TSProfiler::recordDeviceSpan(TSProfiler::persistentName(itr->kernelName), "kernel", itr->deviceIndex, itr->startSeconds, itr->endSeconds);
+    }
+}
+
 ///
 void
 OpenCLRaytracer::enqueueRaytrace() {
     jobPool.emplaceJob(JobPool::WorkItem("[GPU] raytrace", [=](){
-        auto startTime = glfwGetTime();
+        auto startTime = TSClock::now();
         this->ocl_raytraceRays();
-        auto endTime = glfwGetTime();
+        auto endTime = TSClock::now();
         lastRayTraceTime = endTime - startTime;
+        TSProfiler::recordSpan("frame", "frame", startTime, endTime);
+        this->recordKernelTimings();
     }, [=](){
         rayTraceElapsedTime = lastRayTraceTime;
         framesRendered++;
-        this->target.outputTexture->setNeedsUpdate();
+        this->target.markAllDirty();
         this->enqueueRaytrace();
     }));
 }
@@ -66,60 +113,116 @@ OpenCLRaytracer::enqueueRaytrace() {
 void
 OpenCLRaytracer::ocl_raytraceSetup() {
     
+    /// Kernels are only timed when someone is recording a trace
+    computeEngine.setProfilingEnabled(TSProfiler::isEnabled(), &TSClock::now);
+    
     if (useGPU) {
         computeEngine.connect(ComputeEngine::DEVICE_TYPE_GPU, 2, false, false);
     }
     else {
         computeEngine.connect(ComputeEngine::DEVICE_TYPE_CPU, 1, false, false);
     }
+    computeEngine.setProgramCacheDirectory(config.programCacheDirectory.c_str());
     
     ocl_pushSceneData();
     
+    /// Kernels write unclamped radiance to "image_hdr"; "tonemap_image"
+    ///     turns it into the display pixels of "image_output"
+    computeEngine.createImage2D("image_hdr", ComputeEngine::MemFlags::MEM_READ_WRITE, ComputeEngine::ChannelOrder::RGBA, ComputeEngine::ChannelType::HALF_FLOAT, outputImage.width, outputImage.height);
     computeEngine.createImage2D("image_output", ComputeEngine::MemFlags::MEM_WRITE_ONLY, ComputeEngine::ChannelOrder::RGBA, ComputeEngine::ChannelType::UNORM_INT8, outputImage.width, outputImage.height);
+    
+    computeEngine.createProgramFromFile("tonemap_prog", "tonemap.cl");
+    computeEngine.createKernel("tonemap_prog", "tonemap_image");
+}
+
+///
+std::string
+OpenCLRaytracer::raytraceBuildOptions() const {
+    std::ostringstream options;
+    options << "-D kBRDFType=" << (int) config.brdfType << " " << photonLayoutBuildOptions();
+    return options.str();
+}
+
+///
+std::string
+OpenCLRaytracer::photonLayoutBuildOptions() const {
+    std::ostringstream options;
+    options << "-D kJensenPhoton_floatStride=" << CLPackedPhoton_kNumFloats << "u";
+    return options.str();
+}
+
+///
+void
+OpenCLRaytracer::ocl_tonemapAndReadImage() {
+    computeEngine.setKernelArgs("tonemap_image",
+        computeEngine.getBuffer("image_hdr"),
+        (cl_uint) config.tonemap,
+        (cl_float) config.tonemapExposure,
+        
+        computeEngine.getBuffer("image_output")
+    );
+    
+    computeEngine.executeKernel("tonemap_image", activeDevice, std::vector<size_t> {(size_t) outputImage.width, (size_t) outputImage.height});
+    computeEngine.finish(activeDevice);
+    
+    computeEngine.readImage("image_output", activeDevice, 0, 0, 0, outputImage.width, outputImage.height, 1, 0, 0, outputImage.dataPtr());
 }
 
 ///
 void
 OpenCLRaytracer::ocl_pushSceneData() {
 
-    auto spheres = config.scene->findElements<PovraySphere>();
+    const auto & arrays = config.scene->arrays();
+    
     std::vector<cl_float> sphereData;
-    for (auto itr = spheres.begin(); itr != spheres.end(); itr++) {
-        CLPovraySphereData((*itr)->data()).writeOutData(sphereData);
+    for (int sphere = 0; sphere < arrays.spheres.size(); sphere++) {
+        CLPovraySphereData(arrays.sphereData(sphere)).writeOutData(sphereData);
     }
     
-    auto planes = config.scene->findElements<PovrayPlane>();
     std::vector<cl_float> planeData;
-    for (auto itr = planes.begin(); itr != planes.end(); itr++) {
-        CLPovrayPlaneData((*itr)->data()).writeOutData(planeData);
+    for (int plane = 0; plane < arrays.planes.size(); plane++) {
+        CLPovrayPlaneData(arrays.planeData(plane)).writeOutData(planeData);
+    }
+    
+    /// Mesh triangles are already listed one by one, like loose ones
+    std::vector<cl_float> triangleData;
+    for (int triangle = 0; triangle < arrays.triangles.size(); triangle++) {
+        CLPovrayTriangleData(arrays.triangleData(triangle)).writeOutData(triangleData);
     }
     
-    auto lights = config.scene->findElements<PovrayLightSource>();
     std::vector<cl_float> lightData;
-    for (auto itr = lights.begin(); itr != lights.end(); itr++) {
-        CLPovrayLightSourceData((*itr)->data()).writeOutData(lightData);
+    for (int light = 0; light < arrays.lights.size(); light++) {
+        CLPovrayLightSourceData(arrays.lightData(light)).writeOutData(lightData);
     }
 
-    numSpheres = (unsigned int) spheres.size();
-    numPlanes = (unsigned int) planes.size();
-    numLights = (unsigned int) lights.size();
+    numSpheres = (unsigned int) arrays.spheres.size();
+    numPlanes = (unsigned int) arrays.planes.size();
+    numTriangles = (unsigned int) arrays.triangles.size();
+    numLights = (unsigned int) arrays.lights.size();
     
     /// Fill the buffers
-    if (spheres.size() > 0) {
+    if (numSpheres > 0) {
         if (computeEngine.getBuffer("spheres") == nullptr) {
             computeEngine.createBuffer("spheres", ComputeEngine::MemFlags::MEM_READ_ONLY, sizeof(cl_float) * sphereData.size());
         }
     
         computeEngine.writeBuffer("spheres", activeDevice, 0, sizeof(cl_float) * sphereData.size(), &sphereData[0]);
     }
-    if (planes.size() > 0) {
+    if (numPlanes > 0) {
          if (computeEngine.getBuffer("planes") == nullptr) {
             computeEngine.createBuffer("planes", ComputeEngine::MemFlags::MEM_READ_ONLY, sizeof(cl_float) * planeData.size());
         }
     
         computeEngine.writeBuffer("planes", activeDevice, 0, sizeof(cl_float) * planeData.size(), &planeData[0]);
     }
-    if (lights.size() > 0) {
+    if (numTriangles > 0) {
+        if (computeEngine.getBuffer("triangles") == nullptr) {
+            computeEngine.createBuffer("triangles", ComputeEngine::MemFlags::MEM_READ_ONLY, sizeof(cl_float) * triangleData.size());
+        }
+    
+        computeEngine.writeBuffer("triangles", activeDevice, 0, sizeof(cl_float) * triangleData.size(), &triangleData[0]);
+    }
+    if (numLights > 0) {
         if (computeEngine.getBuffer("lights") == nullptr) {
             computeEngine.createBuffer("lights", ComputeEngine::MemFlags::MEM_READ_ONLY, sizeof(cl_float) * lightData.size());
         }
@@ -11,6 +11,7 @@
 
 
 #include <random>
+#include <string>
 
 #include "compute_engine.hpp"
 #include "Raytracer.hpp"
@@ -25,6 +26,10 @@ public:
 
     virtual void start();
     virtual void configure();
+    /// Calls "ocl_raytraceSetup".
+    virtual void prepareFrames();
+    /// Calls "ocl_raytraceRays" and records it as shading time.
+    virtual void renderFrame();
     
     /// Connects to computation device, creates buffers, and loads programs
     virtual void ocl_raytraceSetup();
@@ -42,8 +47,23 @@ protected:
     ///     https://developer.apple.com/library/mac/samplecode/OpenCL_Hello_World_Example/Listings/hello_c.html
     ComputeEngine computeEngine;
     
+    /// Hands the kernels timed by "computeEngine" to "TSProfiler". Kernels
+    ///     are only timed while the profiler is enabled.
+    void recordKernelTimings();
+    
+    /// Tonemaps the radiance the raytracing kernels wrote to "image_hdr"
+    ///     into "image_output", and reads that back into ".outputImage".
+    void ocl_tonemapAndReadImage();
+    
+    /// "-D" flags that fix the BRDF and photon layout of "raytrace.cl" at
+    ///     build time, so its kernels don't branch on them
+    std::string raytraceBuildOptions() const;
+    /// "-D" flag for the photon stride; every program that includes
+    ///     "photons.cl" must be built with it so they agree on the layout
+    std::string photonLayoutBuildOptions() const;
+    
     bool useGPU;
-    unsigned int numSpheres, numPlanes, numLights;
+    unsigned int numSpheres, numPlanes, numTriangles, numLights;
 
 };
 
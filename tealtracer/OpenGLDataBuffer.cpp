@@ -77,6 +77,12 @@ OpenGLDataBuffer::elementArrayBuffer(const OpenGLDataBufferMetaData & metaData)
     return std::shared_ptr<OpenGLDataBuffer>(new OpenGLDataBuffer(GLenum(GL_ELEMENT_ARRAY_BUFFER), metaData));
 }
 
+///
+std::shared_ptr<OpenGLDataBuffer>
+OpenGLDataBuffer::pixelUnpackBuffer(const OpenGLDataBufferMetaData & metaData) {
+    return std::shared_ptr<OpenGLDataBuffer>(new OpenGLDataBuffer(GLenum(GL_PIXEL_UNPACK_BUFFER), metaData));
+}
+
 ///
 GLint
 OpenGLDataBuffer::setAsActiveDBO() {
@@ -89,6 +95,9 @@ OpenGLDataBuffer::setAsActiveDBO() {
     else if (type == GLenum(GL_ELEMENT_ARRAY_BUFFER)) {
         glGetIntegerv(GLenum(GL_ELEMENT_ARRAY_BUFFER_BINDING), &savedBufferBinding);
     }
+    else if (type == GLenum(GL_PIXEL_UNPACK_BUFFER)) {
+        glGetIntegerv(GLenum(GL_PIXEL_UNPACK_BUFFER_BINDING), &savedBufferBinding);
+    }
 
     glBindBuffer(type, handle());
     return savedBufferBinding;
@@ -118,6 +127,19 @@ OpenGLDataBuffer::setNeedsUpdate() {
     dataIsSent_ = false;
 }
 
+///
+void *
+OpenGLDataBuffer::mapForWriting(GLsizeiptr numBytes) {
+    assert(numBytes <= GLsizeiptr(metaData_.numBytes()));
+    return glMapBufferRange(type, 0, numBytes, GLbitfield(GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+}
+
+///
+bool
+OpenGLDataBuffer::unmap() {
+    return glUnmapBuffer(type) == GLboolean(GL_TRUE);
+}
+
 
 
 ///
@@ -341,6 +363,10 @@ OpenGLTextureBuffer::sendData() {
         if (metaData_.mipMapped) {
             generateMipMap();
         }
+        else {
+            /// Only the base level exists, so don't let sampling look for more
+            glTexParameteri(metaData_.targetType, GLenum(GL_TEXTURE_MAX_LEVEL), 0);
+        }
         if (metaData_.linearlyInterpolated) {
             setLinearInterpolation();
         }
@@ -356,6 +382,17 @@ OpenGLTextureBuffer::setNeedsUpdate() {
     dataIsSent_ = false;
 }
 
+///
+void
+OpenGLTextureBuffer::sendSubData(GLint x, GLint y, GLsizei width, GLsizei height, const void * data) {
+    assert(metaData_.is2DTexture());
+    assert(allocated() && dataIsSent_);
+    
+    auto oldBindings = glBind();
+    glTexSubImage2D(metaData_.targetType, metaData_.mipmapLevel, x, y, width, height, metaData_.pixelFormat, metaData_.pixelType, data);
+    glUnbind(oldBindings);
+}
+
 ///
 void
 OpenGLTextureBuffer::generateMipMap() {
@@ -390,11 +427,11 @@ OpenGLTextureBuffer::setLinearInterpolation() {
         
         if (metaData_.bitMapped) {
             glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MAG_FILTER), GLfloat(GL_NEAREST));
-            glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MIN_FILTER), GLfloat(GL_NEAREST_MIPMAP_NEAREST));
+            glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MIN_FILTER), GLfloat(metaData_.mipMapped ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST));
         }
         else {
             glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MAG_FILTER), GLfloat(GL_LINEAR));
-            glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MIN_FILTER), GLfloat(GL_LINEAR_MIPMAP_LINEAR));
+            glTexParameterf(metaData_.targetType, GLenum(GL_TEXTURE_MIN_FILTER), GLfloat(metaData_.mipMapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
         }
         
         glUnbind(oldBindings);
@@ -34,14 +34,15 @@ struct OpenGLDataBufferMetaData {
 /// Represents a wrapper around data buffer objects in opengl. These are
 /// used send data to the GPU for use in your shaders. It can take any type,
 /// including Eigen types. All that is requires is that the objects have a
-/// default constructor. Data buffer objects come in two flavors:
-/// GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER. You are recommended to use
-/// the arrayBuffer(...) and elementArrayBuffer(..) static methods to create
-/// these two kinds of data buffer types.
+/// default constructor. Data buffer objects come in three flavors:
+/// GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER and GL_PIXEL_UNPACK_BUFFER. You
+/// are recommended to use the arrayBuffer(...), elementArrayBuffer(..) and
+/// pixelUnpackBuffer(...) static methods to create these data buffer types.
 class OpenGLDataBuffer : public OpenGLObject {
 public:
     
-    /// The type buffer, either GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER.
+    /// The type buffer, either GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or
+    /// GL_PIXEL_UNPACK_BUFFER.
     GLenum type;
     
     ///
@@ -58,6 +59,10 @@ public:
     /// Creates a GL_ELEMENT_ARRAY_BUFFER data buffer object with the given
     /// (optional) `metaData`.
     static std::shared_ptr<OpenGLDataBuffer> elementArrayBuffer(const OpenGLDataBufferMetaData & metaData);
+    /// Creates a GL_PIXEL_UNPACK_BUFFER data buffer object. Texture uploads
+    /// made while it is active read from the buffer instead of client memory,
+    /// so the copy to the GPU can happen after the upload call returns.
+    static std::shared_ptr<OpenGLDataBuffer> pixelUnpackBuffer(const OpenGLDataBufferMetaData & metaData);
     
     /// Makes this the current buffer in opengl and returns the last bound buffer
     /// of this `type`, `0` otherwise.
@@ -72,6 +77,15 @@ public:
     
     /// Call this to notify this buffer if the data needs to be re-sent to OpenGL
     void setNeedsUpdate();
+    
+    /// Maps the first `numBytes` of this buffer for writing and returns where
+    /// to write them, or `nullptr` on failure. The buffer's old contents are
+    /// discarded, so OpenGL can hand back fresh memory instead of waiting on
+    /// draws that still read the old data. Must be the active buffer.
+    void * mapForWriting(GLsizeiptr numBytes);
+    /// Ends a `mapForWriting`. Returns false if the contents were lost and
+    /// must be written again. Must be the active buffer.
+    bool unmap();
    
 protected:
     /// Override this to actuall allocated content
@@ -219,6 +233,12 @@ public:
     /// Call this to notify this buffer if the data needs to be re-sent to OpenGL
     void setNeedsUpdate();
     
+    /// Replaces the `width` x `height` pixels at (`x`, `y`) of an already sent
+    /// 2D texture without reallocating it. `data` is tightly packed rows in
+    /// this texture's pixel format, or an offset into the active
+    /// GL_PIXEL_UNPACK_BUFFER if there is one. Mipmaps are not regenerated.
+    void sendSubData(GLint x, GLint y, GLsizei width, GLsizei height, const void * data);
+    
     /// Generates the mip-map (multiple image layers) to speedup texture
     /// sampling when the texture is far away or close up.
     void generateMipMap();
@@ -0,0 +1,180 @@
+//
+//  PacketLanes.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PacketLanes_hpp
+#define PacketLanes_hpp
+
+#include <cmath>
+#include <cstdint>
+
+#include "RayPacket.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// One float per ray of a packet, or per triangle of a mesh's triangle pack.
+///     Comparisons produce masks that are only meant for "&", "|", "select"
+///     and "bits". Everything is static, so only include this from the
+///     translation units that run packet kernels.
+#if defined(__AVX__)
+
+struct PacketLanes {
+    __m256 v;
+};
+
+///
+static inline PacketLanes
+makeLanes(__m256 v) {
+    PacketLanes lanes;
+    lanes.v = v;
+    return lanes;
+}
+
+static inline PacketLanes load(const float * values) {return makeLanes(_mm256_loadu_ps(values));}
+static inline PacketLanes broadcast(float value) {return makeLanes(_mm256_set1_ps(value));}
+static inline void store(float * values, const PacketLanes & a) {_mm256_storeu_ps(values, a.v);}
+
+static inline PacketLanes operator+(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_add_ps(a.v, b.v));}
+static inline PacketLanes operator-(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_sub_ps(a.v, b.v));}
+static inline PacketLanes operator*(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_mul_ps(a.v, b.v));}
+static inline PacketLanes operator/(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_div_ps(a.v, b.v));}
+static inline PacketLanes squareRoot(const PacketLanes & a) {return makeLanes(_mm256_sqrt_ps(a.v));}
+/// "a" unless it is not smaller (or is NaN), in which case "b"
+static inline PacketLanes minimum(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_min_ps(a.v, b.v));}
+/// "a" unless it is not larger (or is NaN), in which case "b"
+static inline PacketLanes maximum(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_max_ps(a.v, b.v));}
+
+static inline PacketLanes operator<(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ));}
+static inline PacketLanes operator<=(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));}
+static inline PacketLanes operator>(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ));}
+static inline PacketLanes operator>=(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ));}
+static inline PacketLanes operator&(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_and_ps(a.v, b.v));}
+static inline PacketLanes operator|(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_or_ps(a.v, b.v));}
+/// "a" where "mask" is set, "b" elsewhere
+static inline PacketLanes select(const PacketLanes & mask, const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm256_blendv_ps(b.v, a.v, mask.v));}
+static inline unsigned int bits(const PacketLanes & mask) {return (unsigned int) _mm256_movemask_ps(mask.v);}
+
+///
+static inline PacketLanes
+maskFromBits(unsigned int mask) {
+    int32_t lanes[RayPacket::Size];
+    for (int i = 0; i < RayPacket::Size; i++) {
+        lanes[i] = (mask >> i) & 1u ? -1 : 0;
+    }
+    return makeLanes(_mm256_loadu_ps((const float *) lanes));
+}
+
+#elif defined(__SSE2__)
+
+struct PacketLanes {
+    __m128 lo, hi;
+};
+
+///
+static inline PacketLanes
+makeLanes(__m128 lo, __m128 hi) {
+    PacketLanes lanes;
+    lanes.lo = lo;
+    lanes.hi = hi;
+    return lanes;
+}
+
+static inline PacketLanes load(const float * values) {return makeLanes(_mm_loadu_ps(values), _mm_loadu_ps(values + 4));}
+static inline PacketLanes broadcast(float value) {return makeLanes(_mm_set1_ps(value), _mm_set1_ps(value));}
+static inline void store(float * values, const PacketLanes & a) {_mm_storeu_ps(values, a.lo); _mm_storeu_ps(values + 4, a.hi);}
+
+static inline PacketLanes operator+(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi));}
+static inline PacketLanes operator-(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi));}
+static inline PacketLanes operator*(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi));}
+static inline PacketLanes operator/(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi));}
+static inline PacketLanes squareRoot(const PacketLanes & a) {return makeLanes(_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi));}
+/// "a" unless it is not smaller (or is NaN), in which case "b"
+static inline PacketLanes minimum(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi));}
+/// "a" unless it is not larger (or is NaN), in which case "b"
+static inline PacketLanes maximum(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi));}
+
+static inline PacketLanes operator<(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi));}
+static inline PacketLanes operator<=(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi));}
+static inline PacketLanes operator>(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi));}
+static inline PacketLanes operator>=(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi));}
+static inline PacketLanes operator&(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi));}
+static inline PacketLanes operator|(const PacketLanes & a, const PacketLanes & b) {return makeLanes(_mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi));}
+/// "a" where "mask" is set, "b" elsewhere
+static inline PacketLanes select(const PacketLanes & mask, const PacketLanes & a, const PacketLanes & b) {
+    return makeLanes(_mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)), _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)));
+}
+static inline unsigned int bits(const PacketLanes & mask) {return (unsigned int) _mm_movemask_ps(mask.lo) | ((unsigned int) _mm_movemask_ps(mask.hi) << 4);}
+
+///
+static inline PacketLanes
+maskFromBits(unsigned int mask) {
+    int32_t lanes[RayPacket::Size];
+    for (int i = 0; i < RayPacket::Size; i++) {
+        lanes[i] = (mask >> i) & 1u ? -1 : 0;
+    }
+    return makeLanes(_mm_loadu_ps((const float *) lanes), _mm_loadu_ps((const float *) lanes + 4));
+}
+
+#else
+
+/// Masks hold 1 for set lanes and 0 otherwise.
+struct PacketLanes {
+    float v[RayPacket::Size];
+};
+
+#define PACKET_LANES_MAP(expression) \
+    PacketLanes result; \
+    for (int i = 0; i < RayPacket::Size; i++) { \
+        result.v[i] = (expression); \
+    } \
+    return result;
+
+static inline PacketLanes load(const float * values) {PACKET_LANES_MAP(values[i])}
+static inline PacketLanes broadcast(float value) {PACKET_LANES_MAP(value)}
+static inline void store(float * values, const PacketLanes & a) {for (int i = 0; i < RayPacket::Size; i++) {values[i] = a.v[i];}}
+
+static inline PacketLanes operator+(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] + b.v[i])}
+static inline PacketLanes operator-(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] - b.v[i])}
+static inline PacketLanes operator*(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] * b.v[i])}
+static inline PacketLanes operator/(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] / b.v[i])}
+static inline PacketLanes squareRoot(const PacketLanes & a) {PACKET_LANES_MAP(std::sqrt(a.v[i]))}
+/// "a" unless it is not smaller (or is NaN), in which case "b"
+static inline PacketLanes minimum(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] < b.v[i] ? a.v[i] : b.v[i])}
+/// "a" unless it is not larger (or is NaN), in which case "b"
+static inline PacketLanes maximum(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] > b.v[i] ? a.v[i] : b.v[i])}
+
+static inline PacketLanes operator<(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] < b.v[i] ? 1.0f : 0.0f)}
+static inline PacketLanes operator<=(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] <= b.v[i] ? 1.0f : 0.0f)}
+static inline PacketLanes operator>(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] > b.v[i] ? 1.0f : 0.0f)}
+static inline PacketLanes operator>=(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] >= b.v[i] ? 1.0f : 0.0f)}
+static inline PacketLanes operator&(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] != 0.0f && b.v[i] != 0.0f ? 1.0f : 0.0f)}
+static inline PacketLanes operator|(const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(a.v[i] != 0.0f || b.v[i] != 0.0f ? 1.0f : 0.0f)}
+/// "a" where "mask" is set, "b" elsewhere
+static inline PacketLanes select(const PacketLanes & mask, const PacketLanes & a, const PacketLanes & b) {PACKET_LANES_MAP(mask.v[i] != 0.0f ? a.v[i] : b.v[i])}
+static inline PacketLanes maskFromBits(unsigned int mask) {PACKET_LANES_MAP((mask >> i) & 1u ? 1.0f : 0.0f)}
+
+///
+static inline unsigned int
+bits(const PacketLanes & mask) {
+    unsigned int result = 0;
+    for (int i = 0; i < RayPacket::Size; i++) {
+        if (mask.v[i] != 0.0f) {
+            result |= 1u << i;
+        }
+    }
+    return result;
+}
+
+#undef PACKET_LANES_MAP
+
+#endif
+
+#endif /* PacketLanes_hpp */
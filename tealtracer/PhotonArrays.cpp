@@ -0,0 +1,153 @@
+//
+//  PhotonArrays.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/4/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "PhotonArrays.hpp"
+
+#include <cassert>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+///
+void
+PhotonArrays::clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+    geometryIds.clear();
+    energies.clear();
+    incomingDirections.clear();
+}
+
+///
+void
+PhotonArrays::append(const JensenPhoton & photon) {
+    x.push_back(photon.position.x());
+    y.push_back(photon.position.y());
+    z.push_back(photon.position.z());
+    geometryIds.push_back(photon.flags.geometryIndex);
+    energies.push_back(photon.energy);
+    incomingDirections.push_back(photon.incomingDirection);
+}
+
+///
+void
+PhotonArrays::assign(const std::vector<JensenPhoton> & photons) {
+    clear();
+
+    x.reserve(photons.size());
+    y.reserve(photons.size());
+    z.reserve(photons.size());
+    geometryIds.reserve(photons.size());
+    energies.reserve(photons.size());
+    incomingDirections.reserve(photons.size());
+
+    for (auto itr = photons.begin(); itr != photons.end(); itr++) {
+        append(*itr);
+    }
+}
+
+///
+void
+PhotonArrays::resize(int count) {
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    geometryIds.resize(count);
+    energies.resize(count);
+    incomingDirections.resize(count);
+}
+
+///
+unsigned int
+PhotonArrays::candidateMask8(int first, const Eigen::Vector3f & point, float maxSquareDistance, int geometryId, float * squareDistances) const {
+    assert(first >= 0 && first + 8 <= size());
+
+    /// Every path computes dx*dx + dy*dy + dz*dz in the same order (no fused
+    ///     multiply-adds), so it agrees exactly with the scalar tail below.
+#if defined(__AVX2__)
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&x[first]), _mm256_set1_ps(point.x()));
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&y[first]), _mm256_set1_ps(point.y()));
+    __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&z[first]), _mm256_set1_ps(point.z()));
+    __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    _mm256_storeu_ps(squareDistances, distance);
+
+    __m256 inside = _mm256_cmp_ps(distance, _mm256_set1_ps(maxSquareDistance), _CMP_LE_OQ);
+    unsigned int mask = (unsigned int) _mm256_movemask_ps(inside);
+    if (geometryId >= 0) {
+        __m256i ids = _mm256_loadu_si256((const __m256i *) &geometryIds[first]);
+        __m256i sameGeometry = _mm256_cmpeq_epi32(ids, _mm256_set1_epi32(geometryId));
+        mask &= (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(sameGeometry));
+    }
+    return mask;
+#elif defined(__SSE2__)
+    unsigned int mask = 0;
+    for (int half = 0; half < 2; half++) {
+        int offset = first + 4 * half;
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[offset]), _mm_set1_ps(point.x()));
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[offset]), _mm_set1_ps(point.y()));
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[offset]), _mm_set1_ps(point.z()));
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        _mm_storeu_ps(squareDistances + 4 * half, distance);
+
+        __m128 inside = _mm_cmple_ps(distance, _mm_set1_ps(maxSquareDistance));
+        unsigned int halfMask = (unsigned int) _mm_movemask_ps(inside);
+        if (geometryId >= 0) {
+            __m128i ids = _mm_loadu_si128((const __m128i *) &geometryIds[offset]);
+            __m128i sameGeometry = _mm_cmpeq_epi32(ids, _mm_set1_epi32(geometryId));
+            halfMask &= (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(sameGeometry));
+        }
+        mask |= halfMask << (4 * half);
+    }
+    return mask;
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < 8; i++) {
+        float dx = x[first + i] - point.x(), dy = y[first + i] - point.y(), dz = z[first + i] - point.z();
+        squareDistances[i] = dx * dx + dy * dy + dz * dz;
+        if (squareDistances[i] <= maxSquareDistance && (geometryId < 0 || geometryIds[first + i] == geometryId)) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+///
+int
+PhotonArrays::filterCandidates(int begin, int end, const Eigen::Vector3f & point, float maxSquareDistance, int geometryId, int * candidates, float * squareDistances) const {
+    int numCandidates = 0;
+    int index = begin;
+
+    float blockDistances[8];
+    for (; index + 8 <= end; index += 8) {
+        unsigned int mask = candidateMask8(index, point, maxSquareDistance, geometryId, blockDistances);
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            candidates[numCandidates] = index + bit;
+            squareDistances[numCandidates] = blockDistances[bit];
+            numCandidates++;
+            mask &= mask - 1;
+        }
+    }
+
+    for (; index < end; index++) {
+        float dx = x[index] - point.x(), dy = y[index] - point.y(), dz = z[index] - point.z();
+        float squareDistance = dx * dx + dy * dy + dz * dz;
+        if (squareDistance <= maxSquareDistance && (geometryId < 0 || geometryIds[index] == geometryId)) {
+            candidates[numCandidates] = index;
+            squareDistances[numCandidates] = squareDistance;
+            numCandidates++;
+        }
+    }
+
+    return numCandidates;
+}
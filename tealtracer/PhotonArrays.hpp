@@ -0,0 +1,74 @@
+//
+//  PhotonArrays.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/4/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PhotonArrays_hpp
+#define PhotonArrays_hpp
+
+#include <vector>
+#include <cstdint>
+#include <Eigen/Dense>
+
+#include "JensenPhoton.hpp"
+
+///
+/// The fields of a list of "JensenPhoton"s stored as separate arrays, so that
+///     the distance and geometry tests of a gather can run on 8 photons at a
+///     time (AVX2 when compiled with it, SSE2 otherwise) and only the photons
+///     that pass have their energy and direction read.
+///
+class PhotonArrays {
+public:
+
+    std::vector<float> x, y, z;
+    /// "JensenPhoton::flags.geometryIndex", widened for the SIMD compares
+    std::vector<int32_t> geometryIds;
+    std::vector<WardRGBE> energies;
+    std::vector<CompressedNormalVector3> incomingDirections;
+
+    ///
+    int size() const {
+        return (int) x.size();
+    }
+
+    ///
+    void clear();
+
+    /// Appends "photon".
+    void append(const JensenPhoton & photon);
+
+    /// Replaces the contents with a copy of "photons".
+    void assign(const std::vector<JensenPhoton> & photons);
+
+    /// Grows or shrinks every array to "count" photons.
+    void resize(int count);
+
+    /// Overwrites photon "index" with photon "sourceIndex" of "source".
+    void set(int index, const PhotonArrays & source, int sourceIndex) {
+        x[index] = source.x[sourceIndex];
+        y[index] = source.y[sourceIndex];
+        z[index] = source.z[sourceIndex];
+        geometryIds[index] = source.geometryIds[sourceIndex];
+        energies[index] = source.energies[sourceIndex];
+        incomingDirections[index] = source.incomingDirections[sourceIndex];
+    }
+
+    /// Returns a bit mask of which of the photons [first, first + 8) lie
+    ///     within "maxSquareDistance" (inclusive) of "point" and, unless
+    ///     "geometryId" is negative, on that geometry. Bit "i" is photon
+    ///     "first + i"; "first + 8" must not be past the end. The photons'
+    ///     square distances are written to "squareDistances".
+    unsigned int candidateMask8(int first, const Eigen::Vector3f & point, float maxSquareDistance, int geometryId, float * squareDistances) const;
+
+    /// Runs the same test over the photons [begin, end) and writes the
+    ///     indices and square distances of the ones that pass, in order.
+    ///     Both outputs need room for "end - begin" entries. Returns how
+    ///     many passed.
+    int filterCandidates(int begin, int end, const Eigen::Vector3f & point, float maxSquareDistance, int geometryId, int * candidates, float * squareDistances) const;
+};
+
+#endif /* PhotonArrays_hpp */
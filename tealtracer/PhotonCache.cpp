@@ -0,0 +1,250 @@
+//
+//  PhotonCache.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/8/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "PhotonCache.hpp"
+
+#include "RaytracingConfig.hpp"
+#include "PovraySceneElements.hpp"
+#include "JensenPhoton.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+///
+struct PhotonCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numSections;
+    uint64_t key;
+};
+
+///
+struct PhotonCacheSectionHeader {
+    uint32_t section;
+    uint32_t elementSize;
+    uint64_t count;
+    uint64_t offset;
+};
+
+static const char kPhotonCacheMagic[8] = {'T', 'T', 'P', 'H', 'O', 'T', 'O', 'N'};
+static const uint64_t kPhotonCacheAlignment = 16;
+
+///
+static uint64_t
+alignOffset(uint64_t offset) {
+    return (offset + kPhotonCacheAlignment - 1) & ~(kPhotonCacheAlignment - 1);
+}
+
+/// 64 bit FNV-1a
+static uint64_t
+hashString(const std::string & text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (uint8_t) text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+///
+bool
+PhotonCache::keyForConfig(const RaytracingConfig & config, const std::string & mapKind, uint64_t & key) {
+    if (config.photonCacheDirectory.empty() || config.scene == nullptr || config.randomSeed < 0) {
+        return false;
+    }
+    /// Serial emission draws from the raytracer's generator, so skipping it
+    ///     would change every random number drawn after it
+    if (!config.parallelPhotonEmission) {
+        return false;
+    }
+
+    std::ostringstream description;
+    description.precision(9);
+
+    /// The camera only matters once photons are gathered
+    auto elements = config.scene->findElements<PovraySceneElement>();
+    for (auto itr = elements.begin(); itr != elements.end(); itr++) {
+        if (std::dynamic_pointer_cast<PovrayCamera>(*itr) == nullptr) {
+            (*itr)->write(description);
+        }
+        /// A mesh loaded from a file is written as just its file name
+        if (auto mesh = std::dynamic_pointer_cast<PovrayTriangleMesh>(*itr)) {
+            description << "mesh " << mesh->mesh()->contentHash() << std::endl;
+        }
+    }
+
+    description << "version " << Version << " photon " << sizeof(JensenPhoton) << " map " << mapKind
+        << " rays " << config.raysPerLight << " lumens " << config.lumensPerLight
+        << " seed " << config.randomSeed
+        << " brdf " << (int) config.brdfType
+        << " bounce " << config.photonBounceProbability << " " << config.photonBounceEnergyMultipler
+        << " grid " << config.hashmapCellsize << " " << config.hashmapSpacing
+        << " " << config.hashmapGridStart.transpose() << " " << config.hashmapGridEnd.transpose();
+
+    key = hashString(description.str());
+    return true;
+}
+
+///
+std::string
+PhotonCache::pathForKey(const RaytracingConfig & config, const std::string & mapKind, uint64_t key) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) key);
+    return config.photonCacheDirectory + "/" + mapKind + "-" + hex + ".photons";
+}
+
+///
+PhotonCacheWriter::PhotonCacheWriter(uint64_t key) : key_(key) {}
+
+///
+void
+PhotonCacheWriter::addArray(PhotonCache::Section section, const void * data, size_t elementSize, size_t count) {
+    Array array;
+    array.section = section;
+    array.data = data;
+    array.elementSize = elementSize;
+    array.count = count;
+    arrays_.push_back(array);
+}
+
+///
+bool
+PhotonCacheWriter::write(const std::string & path) const {
+
+    PhotonCacheHeader header;
+    memcpy(header.magic, kPhotonCacheMagic, sizeof(header.magic));
+    header.version = PhotonCache::Version;
+    header.numSections = (uint32_t) arrays_.size();
+    header.key = key_;
+
+    std::vector<PhotonCacheSectionHeader> sections(arrays_.size());
+    uint64_t offset = alignOffset(sizeof(PhotonCacheHeader) + sizeof(PhotonCacheSectionHeader) * sections.size());
+    for (size_t i = 0; i < arrays_.size(); i++) {
+        sections[i].section = arrays_[i].section;
+        sections[i].elementSize = (uint32_t) arrays_[i].elementSize;
+        sections[i].count = arrays_[i].count;
+        sections[i].offset = offset;
+        offset = alignOffset(offset + arrays_[i].elementSize * arrays_[i].count);
+    }
+
+    /// The directory may not exist yet; if it still can't be created the
+    ///     open below fails.
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos && slash > 0) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+
+    std::string partialPath = path + ".partial";
+    std::ofstream out(partialPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out) {
+        return false;
+    }
+
+    static const char padding[kPhotonCacheAlignment] = {0};
+    out.write((const char *) &header, sizeof(header));
+    if (!sections.empty()) {
+        out.write((const char *) &sections[0], sizeof(PhotonCacheSectionHeader) * sections.size());
+    }
+    for (size_t i = 0; i < arrays_.size(); i++) {
+        out.write(padding, sections[i].offset - (uint64_t) out.tellp());
+        out.write((const char *) arrays_[i].data, arrays_[i].elementSize * arrays_[i].count);
+    }
+    out.close();
+
+    if (!out || rename(partialPath.c_str(), path.c_str()) != 0) {
+        remove(partialPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+///
+PhotonCacheReader::PhotonCacheReader() : mapping_(nullptr), size_(0) {}
+
+///
+PhotonCacheReader::~PhotonCacheReader() {
+    close();
+}
+
+///
+bool
+PhotonCacheReader::open(const std::string & path, uint64_t key) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(PhotonCacheHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void * mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    mapping_ = mapping;
+    size_ = (size_t) info.st_size;
+
+    const PhotonCacheHeader * header = static_cast<const PhotonCacheHeader *>(mapping_);
+    bool valid = memcmp(header->magic, kPhotonCacheMagic, sizeof(header->magic)) == 0
+        && header->version == PhotonCache::Version
+        && header->key == key
+        && sizeof(PhotonCacheHeader) + sizeof(PhotonCacheSectionHeader) * (uint64_t) header->numSections <= size_;
+
+    const PhotonCacheSectionHeader * sections = reinterpret_cast<const PhotonCacheSectionHeader *>(header + 1);
+    for (uint32_t i = 0; valid && i < header->numSections; i++) {
+        valid = sections[i].offset <= size_
+            && sections[i].count * sections[i].elementSize <= size_ - sections[i].offset;
+    }
+
+    if (!valid) {
+        close();
+    }
+    return valid;
+}
+
+///
+void
+PhotonCacheReader::close() {
+    if (mapping_ != nullptr) {
+        munmap(mapping_, size_);
+        mapping_ = nullptr;
+        size_ = 0;
+    }
+}
+
+///
+bool
+PhotonCacheReader::findArray(PhotonCache::Section section, size_t elementSize, const void *& data, size_t & count) const {
+    if (mapping_ == nullptr) {
+        return false;
+    }
+
+    const PhotonCacheHeader * header = static_cast<const PhotonCacheHeader *>(mapping_);
+    const PhotonCacheSectionHeader * sections = reinterpret_cast<const PhotonCacheSectionHeader *>(header + 1);
+    for (uint32_t i = 0; i < header->numSections; i++) {
+        if (sections[i].section == section && sections[i].elementSize == elementSize) {
+            data = static_cast<const uint8_t *>(mapping_) + sections[i].offset;
+            count = (size_t) sections[i].count;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,131 @@
+//
+//  PhotonCache.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/8/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PhotonCache_hpp
+#define PhotonCache_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class RaytracingConfig;
+
+///
+/// Emitted photons (and optionally the index a photon map built from them)
+///     saved to disk, so that a render with the same scene and emission
+///     settings can skip straight to shading.
+///
+/// A cache file is a header, a table of sections and then each section's
+///     array, 16 byte aligned, exactly as it is laid out in memory. Files are
+///     only valid on the machine (and build) that wrote them; anything that
+///     changes the layout of "JensenPhoton" or of a section must bump
+///     "PhotonCache::Version".
+///
+namespace PhotonCache {
+
+    ///
+    static const uint32_t Version = 1;
+
+    ///
+    enum Section : uint32_t {
+        Photons = 1,
+        KDTreeSplitAxes = 2,
+        HashmapGridIndices = 3,
+        HashmapGridFirstPhotonIndices = 4,
+        HashmapGridPhotonCounts = 5
+    };
+
+    /// Hash of everything emission and "mapKind" depend on: the scene minus
+    ///     its camera, the photon settings and the seed. Returns false (and
+    ///     the cache is not used) if "config" has no cache directory, no
+    ///     scene, no fixed "randomSeed" or emits photons serially.
+    bool keyForConfig(const RaytracingConfig & config, const std::string & mapKind, uint64_t & key);
+
+    /// "<photonCacheDirectory>/<mapKind>-<key in hex>.photons"
+    std::string pathForKey(const RaytracingConfig & config, const std::string & mapKind, uint64_t key);
+}
+
+///
+/// Collects arrays to write to a cache file. Only pointers are kept, so the
+///     arrays must outlive "write".
+///
+class PhotonCacheWriter {
+public:
+    explicit PhotonCacheWriter(uint64_t key);
+
+    ///
+    template <typename T>
+    void addArray(PhotonCache::Section section, const std::vector<T> & values) {
+        addArray(section, values.data(), sizeof(T), values.size());
+    }
+    ///
+    void addArray(PhotonCache::Section section, const void * data, size_t elementSize, size_t count);
+
+    /// Writes next to "path" and renames into place, so readers never see a
+    ///     partial file. Returns false if anything could not be written.
+    bool write(const std::string & path) const;
+
+private:
+
+    struct Array {
+        PhotonCache::Section section;
+        const void * data;
+        size_t elementSize;
+        size_t count;
+    };
+
+    uint64_t key_;
+    std::vector<Array> arrays_;
+};
+
+///
+/// Maps a cache file into memory; sections are read straight out of the
+///     mapping.
+///
+class PhotonCacheReader {
+public:
+    PhotonCacheReader();
+    ~PhotonCacheReader();
+
+    /// Returns false if "path" is missing, was written for another key or
+    ///     version, or is truncated.
+    bool open(const std::string & path, uint64_t key);
+    ///
+    void close();
+    ///
+    bool isOpen() const {return mapping_ != nullptr;}
+
+    /// Points "data" at the section's array inside the mapping. Returns false
+    ///     if there is no such section or its elements are not "elementSize"
+    ///     bytes wide.
+    bool findArray(PhotonCache::Section section, size_t elementSize, const void *& data, size_t & count) const;
+
+    /// Copies a section into "values".
+    template <typename T>
+    bool readArray(PhotonCache::Section section, std::vector<T> & values) const {
+        const void * data = nullptr;
+        size_t count = 0;
+        if (!findArray(section, sizeof(T), data, count)) {
+            return false;
+        }
+
+        const T * begin = static_cast<const T *>(data);
+        values.assign(begin, begin + count);
+        return true;
+    }
+
+private:
+
+    PhotonCacheReader(const PhotonCacheReader &);
+    PhotonCacheReader & operator=(const PhotonCacheReader &);
+
+    void * mapping_;
+    size_t size_;
+};
+
+#endif /* PhotonCache_hpp */
@@ -8,31 +8,108 @@
 
 #include "PhotonEmitter.hpp"
 
+#include <algorithm>
+
 ///
 void
 PhotonEmitter::emitPhotons(
+    SingleCoreRaytracer * raytracer,
+    std::vector<JensenPhoton> & photons,
+    unsigned int batch) {
+    
+    if (raytracer->config.parallelPhotonEmission) {
+        emitPhotonsInParallel(raytracer, photons, batch);
+    }
+    else {
+        emitPhotonsSerially(raytracer, photons);
+    }
+}
+
+///
+void
+PhotonEmitter::emitPhotonsSerially(
     SingleCoreRaytracer * raytracer,
     std::vector<JensenPhoton> & photons) {
     
     /// for each light, emit photons into the scene.
-    auto lights = raytracer->config.scene->findElements<PovrayLightSource>();
+    const auto & lights = raytracer->config.scene->arrays().lights;
     float lumens = raytracer->config.lumensPerLight;
     int numRays = raytracer->config.raysPerLight;
     float luminosityPerPhoton = lumens/(float)numRays;
     
+    photons.reserve(photons.size() + std::max<int>(0, numRays));
     for (int photonItr = 0; photonItr < numRays; photonItr++) {
-        bool photonStored = false;
-        while (!photonStored) {
-            auto light = lights[raytracer->generator.randUInt() % lights.size()];
-            
-            float u = raytracer->generator.randFloat(), v = raytracer->generator.randFloat();
-            
-            Ray ray;
-            ray.origin = light->position();
-            ray.direction = light->getSampleDirection(u, v);
-            
-            processEmittedPhoton(raytracer, photons, light->color().block<3,1>(0,0) * luminosityPerPhoton, ray, &photonStored);
+        emitPhoton(raytracer, raytracer->generator, lights, luminosityPerPhoton, photons);
+    }
+}
+
+///
+void
+PhotonEmitter::emitPhotonsInParallel(
+    SingleCoreRaytracer * raytracer,
+    std::vector<JensenPhoton> & photons,
+    unsigned int batch) {
+    
+    const auto & lights = raytracer->config.scene->arrays().lights;
+    float lumens = raytracer->config.lumensPerLight;
+    int numRays = raytracer->config.raysPerLight;
+    float luminosityPerPhoton = lumens/(float)numRays;
+    
+    if (numRays <= 0) {
+        return;
+    }
+    
+    /// Each task owns a fixed range of photons and its own buffer, so neither
+    ///     the random streams nor the final photon order depend on which
+    ///     worker ran which task.
+    int numTasks = (numRays + PhotonsPerTask - 1) / PhotonsPerTask;
+    std::vector<std::vector<JensenPhoton>> taskPhotons(numTasks);
+    
+    /// Without a fixed seed, draw the streams from the shared generator so
+    ///     that every run still differs like the serial path does.
+    unsigned int streamSeed = raytracer->config.randomSeed >= 0
+        ? (unsigned int) raytracer->config.randomSeed
+        : (unsigned int) raytracer->generator.randUInt();
+    streamSeed = (streamSeed * 2654435761u) ^ 0x85ebca6bu ^ (batch * 0x9e3779b9u);
+    
+    raytracer->parallelForSeeded(numTasks, streamSeed, [&](int taskIndex, int workerIndex, TSRandomValueGenerator & taskGenerator) {
+        int begin = taskIndex * PhotonsPerTask;
+        int end = std::min<int>(begin + PhotonsPerTask, numRays);
+        
+        std::vector<JensenPhoton> & buffer = taskPhotons[taskIndex];
+        buffer.reserve(end - begin);
+        for (int photonItr = begin; photonItr < end; photonItr++) {
+            emitPhoton(raytracer, taskGenerator, lights, luminosityPerPhoton, buffer);
         }
+    });
+    
+    photons.reserve(photons.size() + numRays);
+    for (int taskItr = 0; taskItr < numTasks; taskItr++) {
+        photons.insert(photons.end(), taskPhotons[taskItr].begin(), taskPhotons[taskItr].end());
+        std::vector<JensenPhoton>().swap(taskPhotons[taskItr]);
+    }
+}
+
+///
+void
+PhotonEmitter::emitPhoton(
+    SingleCoreRaytracer * raytracer,
+    TSRandomValueGenerator & generator,
+    const PovraySceneArrays::Lights & lights,
+    float luminosityPerPhoton,
+    std::vector<JensenPhoton> & photons) {
+    
+    bool photonStored = false;
+    while (!photonStored) {
+        int light = generator.randUInt() % lights.size();
+        
+        float u = generator.randFloat(), v = generator.randFloat();
+        
+        Ray ray;
+        ray.origin = lights.position(light);
+        ray.direction = PovrayLightSource::getSampleDirection(u, v);
+        
+        processEmittedPhoton(raytracer, generator, photons, lights.color(light).block<3,1>(0,0) * luminosityPerPhoton, ray, &photonStored);
     }
 }
 
@@ -40,6 +117,7 @@ PhotonEmitter::emitPhotons(
 void
 PhotonEmitter::processEmittedPhoton(
     SingleCoreRaytracer * raytracer,
+    TSRandomValueGenerator & generator,
     std::vector<JensenPhoton> & photons,
     
     ///
@@ -56,18 +134,17 @@ PhotonEmitter::processEmittedPhoton(
     ray.direction = initialRay.direction;
     RGBf energy = sourceLightEnergy;
     
-    auto hits = raytracer->config.scene->intersections(ray);
+    auto hit = raytracer->config.scene->closestIntersection(ray);
 
-    while (!*photonStored && hits.size() > 0) {
+    while (!*photonStored && hit.element >= 0) {
         struct JensenPhoton photon;
-        auto hit = hits[0];
         
         photon.position = hit.hit.locationOfIntersection();
         photon.incomingDirection = CompressedNormalVector3(ray.direction);
         photon.energy = rgb2rgbe(energy);
-        photon.flags.geometryIndex = hit.element->id();
+        photon.flags.geometryIndex = hit.element;
 
-        float value = raytracer->generator.randFloat();
+        float value = generator.randFloat();
         if (value < raytracer->config.photonBounceProbability) {
 
             Ray reflectedRay;
@@ -79,7 +156,7 @@ PhotonEmitter::processEmittedPhoton(
             //////
             
             /// Calculate intersection
-            hits = raytracer->config.scene->intersections(reflectedRay);
+            hit = raytracer->config.scene->closestIntersection(reflectedRay);
             ray.origin = reflectedRay.origin;
             ray.direction = reflectedRay.direction;
             energy = hitEnergy;
@@ -16,16 +16,46 @@
 
 struct PhotonEmitter {
 
-    ///
+    /// Shoots "config.raysPerLight" photons from the scene's lights and
+    ///     appends every stored photon to "photons". Each photon carries
+    ///     "config.lumensPerLight / config.raysPerLight" of its light's color.
+    ///     With "config.parallelPhotonEmission" set the work is split over
+    ///     the raytracer's worker threads. Parallel batches with different
+    ///     "batch" numbers draw independent random streams from the same
+    ///     "config.randomSeed".
     void emitPhotons(
         SingleCoreRaytracer * raytracer,
-        std::vector<JensenPhoton> & photons);
+        std::vector<JensenPhoton> & photons,
+        unsigned int batch = 0);
     
 private:
+
+    /// Number of photons each parallel task emits into its own buffer
+    static const int PhotonsPerTask = 4096;
+
+    ///
+    void emitPhotonsSerially(
+        SingleCoreRaytracer * raytracer,
+        std::vector<JensenPhoton> & photons);
+    
+    ///
+    void emitPhotonsInParallel(
+        SingleCoreRaytracer * raytracer,
+        std::vector<JensenPhoton> & photons,
+        unsigned int batch);
+    
+    /// Retries until one photon has been stored, drawing from "generator".
+    void emitPhoton(
+        SingleCoreRaytracer * raytracer,
+        TSRandomValueGenerator & generator,
+        const PovraySceneArrays::Lights & lights,
+        float luminosityPerPhoton,
+        std::vector<JensenPhoton> & photons);
     
     ///
     void processEmittedPhoton(
         SingleCoreRaytracer * raytracer,
+        TSRandomValueGenerator & generator,
         std::vector<JensenPhoton> & photons,
         
         ///
@@ -8,6 +8,9 @@
 
 #include "PhotonHashmap.hpp"
 
+#include <cassert>
+#include <functional>
+
 ///
 static bool pointInsideCube(
     const Eigen::Vector3f & point,
@@ -81,67 +84,138 @@ PhotonHashmap::findMaxDistancePhotonIndex(const std::vector<PhotonMap::PhotonInd
 }
 
 ///
-void PhotonHashmap::buildMap() {
-    std::sort(photons.begin(), photons.end(), [&](const JensenPhoton & lhs, const JensenPhoton & rhs) {
-        return getCellIndexHash(lhs.position) < getCellIndexHash(rhs.position);
-    });
-    
-    // calculate hash value for each photon.
-    mapPhotonsToGrid();
+int PhotonHashmap::getGridCell(const Eigen::Vector3f & position) const {
+    auto cellIndex = getCellIndex(position);
+
+    if (cellIndex.x() < 0 || cellIndex.x() >= xdim
+     || cellIndex.y() < 0 || cellIndex.y() >= ydim
+     || cellIndex.z() < 0 || cellIndex.z() >= zdim) {
+        return -1;
+    }
     
-    // calculate starting photon index for each hashID
-    computeGridFirstPhotons();
+    return photonHash(cellIndex);
 }
 
 ///
-void PhotonHashmap::mapPhotonsToGrid() {
-    gridIndices.clear();
-    gridIndices.resize(photons.size(), -1);
-    
-    ///
-    for (int index = 0; index < photons.size(); index++) {
-        const auto & photon = photons[index];
-        
-        // find which gridcell this photon is in
-        auto cellIndex = getCellIndex(photon.position);
-
-        if (cellIndex.x() < 0 || cellIndex.x() >= xdim
-         || cellIndex.y() < 0 || cellIndex.y() >= ydim
-         || cellIndex.z() < 0 || cellIndex.z() >= zdim) {
-            continue;
+static void
+runChunks(ThreadPool * pool, int numChunks, const std::function<void(int chunk)> & chunkTask) {
+    if (pool != nullptr && numChunks > 1) {
+        pool->parallelFor(numChunks, [&](int chunk, int workerIndex) {
+            chunkTask(chunk);
+        });
+    }
+    else {
+        for (int chunk = 0; chunk < numChunks; chunk++) {
+            chunkTask(chunk);
         }
-
-        //use hash funcion to assign a grid index to photon
-        gridIndices[index] = photonHash(cellIndex);
-        
     }
 }
 
-#include "TSLogger.hpp"
-
 ///
-void PhotonHashmap::computeGridFirstPhotons() {
-    gridFirstPhotonIndices.clear();
-    gridFirstPhotonIndices.resize(xdim * ydim * zdim, -1);
-
-    //
-    for (int index = 0; index < photons.size(); index++) {
+void PhotonHashmap::buildMap() {
+    int numPhotons = (int) photons.size();
+    int numCells = xdim * ydim * zdim;
+    /// One extra bucket at the end for photons outside the grid
+    int numBuckets = numCells + 1;
+    
+    ThreadPool * pool = numPhotons >= ParallelBuildThreshold ? threadPool.get() : nullptr;
+    int numWorkers = pool != nullptr ? pool->numWorkers() : 1;
+    
+    /// Every chunk keeps a histogram over all of the buckets, so use fewer
+    ///     chunks when the grid is large compared to the number of photons.
+    int numChunks = numWorkers;
+    while (numChunks > 1 && (long long) numChunks * numBuckets > 2LL * numPhotons) {
+        numChunks--;
+    }
+    
+    /// Hash every photon exactly once
+    std::vector<int> photonBuckets(numPhotons);
+    runChunks(pool, numWorkers, [&](int chunk) {
+        int begin = (int) (((long long) numPhotons * chunk) / numWorkers);
+        int end = (int) (((long long) numPhotons * (chunk + 1)) / numWorkers);
+        for (int index = begin; index < end; index++) {
+            int cell = getGridCell(photons[index].position);
+            photonBuckets[index] = cell >= 0 ? cell : numCells;
+        }
+    });
+    
+    /// Histogram each chunk separately
+    std::vector<int> chunkOffsets((size_t) numChunks * numBuckets, 0);
+    runChunks(pool, numChunks, [&](int chunk) {
+        int begin = (int) (((long long) numPhotons * chunk) / numChunks);
+        int end = (int) (((long long) numPhotons * (chunk + 1)) / numChunks);
+        int * counts = &chunkOffsets[(size_t) chunk * numBuckets];
+        for (int index = begin; index < end; index++) {
+            counts[photonBuckets[index]]++;
+        }
+    });
+    
+    /// Exclusive prefix sum, bucket by bucket and then chunk by chunk, so
+    ///     each chunk knows where its photons of every bucket go.
+    gridFirstPhotonIndices.assign(numCells, 0);
+    gridPhotonCounts.assign(numCells, 0);
+    int offset = 0;
+    for (int bucket = 0; bucket < numBuckets; bucket++) {
+        int bucketStart = offset;
+        for (int chunk = 0; chunk < numChunks; chunk++) {
+            int & chunkOffset = chunkOffsets[(size_t) chunk * numBuckets + bucket];
+            int count = chunkOffset;
+            chunkOffset = offset;
+            offset += count;
+        }
         
-        // First one always has to be stored
-        if (index == 0 && gridIndices[index] != -1) {
-            assert(gridIndices[index] < gridFirstPhotonIndices.size());
-            gridFirstPhotonIndices[gridIndices[index]] = index;
+        if (bucket < numCells) {
+            gridFirstPhotonIndices[bucket] = bucketStart;
+            gridPhotonCounts[bucket] = offset - bucketStart;
         }
-        else {
-            int currGrid = gridIndices[index];
-            int prevGrid = gridIndices[index-1];
-
-            if (currGrid != prevGrid && currGrid != -1) {
-                assert(currGrid < gridFirstPhotonIndices.size());
-                gridFirstPhotonIndices[currGrid] = index;
-            }
+    }
+    assert(offset == numPhotons);
+    
+    /// Scatter; chunks are walked in order, so the sort is stable
+    std::vector<JensenPhoton> sortedPhotons(numPhotons);
+    gridIndices.resize(numPhotons);
+    runChunks(pool, numChunks, [&](int chunk) {
+        int begin = (int) (((long long) numPhotons * chunk) / numChunks);
+        int end = (int) (((long long) numPhotons * (chunk + 1)) / numChunks);
+        int * offsets = &chunkOffsets[(size_t) chunk * numBuckets];
+        for (int index = begin; index < end; index++) {
+            int bucket = photonBuckets[index];
+            int destination = offsets[bucket]++;
+            sortedPhotons[destination] = photons[index];
+            gridIndices[destination] = bucket < numCells ? bucket : -1;
         }
+    });
+    
+    photons.swap(sortedPhotons);
+    photonArrays.assign(photons);
+}
+
+///
+void PhotonHashmap::saveIndex(PhotonCacheWriter & cache) const {
+    cache.addArray(PhotonCache::HashmapGridIndices, gridIndices);
+    cache.addArray(PhotonCache::HashmapGridFirstPhotonIndices, gridFirstPhotonIndices);
+    cache.addArray(PhotonCache::HashmapGridPhotonCounts, gridPhotonCounts);
+}
+
+///
+bool PhotonHashmap::loadIndex(const PhotonCacheReader & cache) {
+    size_t numCells = (size_t) (xdim * ydim * zdim);
+    bool loaded = cache.readArray(PhotonCache::HashmapGridIndices, gridIndices)
+        && cache.readArray(PhotonCache::HashmapGridFirstPhotonIndices, gridFirstPhotonIndices)
+        && cache.readArray(PhotonCache::HashmapGridPhotonCounts, gridPhotonCounts)
+        && gridIndices.size() == photons.size()
+        && gridFirstPhotonIndices.size() == numCells
+        && gridPhotonCounts.size() == numCells;
+    
+    if (!loaded) {
+        gridIndices.clear();
+        gridFirstPhotonIndices.clear();
+        gridPhotonCounts.clear();
+        return false;
     }
+    
+    photonArrays.assign(photons);
+    return true;
 }
 
 #include "TSLogger.hpp"
@@ -149,65 +223,41 @@ void PhotonHashmap::computeGridFirstPhotons() {
 ///
 void
 PhotonHashmap::gatherClosestPhotonsForGridIndex(
-    const int maxNumPhotonsToGather,
-    const float maxPhotonDistance,
     const Eigen::Vector3f & intersection,
     ///
     int i, int j, int k,
     
     // output
-    std::vector<PhotonIndexInfo> & neighborPhotons,
-    float * maxRadiusSqd
+    NearestPhotons & neighborPhotons
 ) {
 
     int gridIndex = photonHash(i, j, k);
-    // find the index of the first photon in the cell
-    assert(gridIndex <= gridFirstPhotonIndices.size());
-    if (gridFirstPhotonIndices[gridIndex] != -1) {
-        int pi = gridFirstPhotonIndices[gridIndex];
-        while (pi < photons.size() && gridIndices[pi] == gridIndex) {
-            const auto & p = photons[pi];
-            
-            // Check if the photon is on the same geometry as the intersection
-            // We only store K photons. If there are less than K photons stored in the array, add the current photon to the array
-            float distSqd = (p.position - intersection).dot(p.position - intersection);
-            if (neighborPhotons.size() < maxNumPhotonsToGather) {
-                if (distSqd < maxPhotonDistance * maxPhotonDistance) {
-                    neighborPhotons.push_back(PhotonIndexInfo(pi, distSqd));
-                    *maxRadiusSqd = std::max<float>(distSqd, *maxRadiusSqd);
-                }
-            }
-            // If the array is full, find the photon with the largest distance to the intersection. If current photon's distance
-            // to the intersection is smaller, replace the photon with the largest distance with the current photon
-            else {
-                auto index = findMaxDistancePhotonIndex(neighborPhotons);
-                auto searchResult = neighborPhotons[index];
-                if (distSqd < searchResult.squareDistance) {
-                    neighborPhotons[index].index = pi;
-                    neighborPhotons[index].squareDistance = distSqd;
-                    if (distSqd > *maxRadiusSqd
-                     || fabs(*maxRadiusSqd - searchResult.squareDistance) < epsilon) {
-                        *maxRadiusSqd = distSqd;
-                    }
-                }
-            }
-            pi++;
-        }
+    assert(gridIndex < gridFirstPhotonIndices.size());
+    int first = gridFirstPhotonIndices[gridIndex];
+    int last = first + gridPhotonCounts[gridIndex];
+    for (int pi = first; pi < last; pi++) {
+        const auto & p = photons[pi];
+        
+        // Keep the K closest photons within the gather distance; once K
+        // are stored, a photon replaces the farthest one if it is closer.
+        float distSqd = (p.position - intersection).dot(p.position - intersection);
+        neighborPhotons.consider(pi, distSqd);
     }
 
 }
 
 ///
-std::vector<PhotonMap::PhotonIndexInfo>
+int
 PhotonHashmap::gatherPhotonsIndices_v2(
     int maxNumPhotonsToGather,
     float maxPhotonDistance,
-    const Eigen::Vector3f & intersection) {
+    const Eigen::Vector3f & intersection,
+    PhotonIndexInfo * results) {
 
     auto gridIndex = getCellIndex(intersection);
     int px = gridIndex.x(), py = gridIndex.y(), pz = gridIndex.z();
     // Find photons in neighboring cells
-    std::vector<PhotonIndexInfo> neighborPhotons;
+    NearestPhotons neighborPhotons(results, maxNumPhotonsToGather, maxPhotonDistance * maxPhotonDistance);
     
     /// Only consider intersections within the grid
     if (px >= 0 && px < xdim
@@ -215,18 +265,16 @@ PhotonHashmap::gatherPhotonsIndices_v2(
      && pz >= 0 && pz < zdim
      && gridFirstPhotonIndices.size() > 0) {
         
-        float maxRadiusSqd = 0.0f;
-        
         for (int i = std::max(0, px - spacing); i < std::min(xdim, px+spacing+1); ++i) {
             for (int j = std::max(0, py - spacing); j < std::min(ydim, py+spacing+1); ++j) {
                 for (int k = std::max(0, pz - spacing); k < std::min(zdim, pz+spacing+1); ++k) {
                     
-                    gatherClosestPhotonsForGridIndex(maxNumPhotonsToGather, maxPhotonDistance, intersection, i, j, k, neighborPhotons, &maxRadiusSqd);
+                    gatherClosestPhotonsForGridIndex(intersection, i, j, k, neighborPhotons);
                 }
             }
         }
     }
-    return neighborPhotons;
+    return neighborPhotons.size();
 }
 
 ///
@@ -271,15 +319,16 @@ PhotonHashmap::getCellBoxEnd(
 }
 
 ///
-std::vector<PhotonMap::PhotonIndexInfo>
+int
 PhotonHashmap::gatherPhotonsIndices(
     int maxNumPhotonsToGather,
     float maxPhotonDistance,
-    const Eigen::Vector3f & intersection) {
+    const Eigen::Vector3f & intersection,
+    PhotonIndexInfo * results) {
     
     auto gridIndex = getCellIndex(intersection);
     int px = gridIndex.x(), py = gridIndex.y(), pz = gridIndex.z();
-    std::vector<PhotonIndexInfo> neighborPhotons;
+    NearestPhotons neighborPhotons(results, maxNumPhotonsToGather, maxPhotonDistance * maxPhotonDistance);
     
     /// Only consider intersections within the grid
     if (px >= 0 && px < xdim
@@ -287,10 +336,8 @@ PhotonHashmap::gatherPhotonsIndices(
      && pz >= 0 && pz < zdim
      && gridFirstPhotonIndices.size() > 0) {
         
-        float maxRadiusSqd = -1.0f;
-        
         /// Find initial set of photons
-        gatherClosestPhotonsForGridIndex(maxNumPhotonsToGather, maxPhotonDistance, intersection, px, py, pz, neighborPhotons, &maxRadiusSqd);
+        gatherClosestPhotonsForGridIndex(intersection, px, py, pz, neighborPhotons);
         
         int outerBoxWidthSize = 1;
         float outerBoxWidth = cellsize * (float) outerBoxWidthSize;
@@ -303,8 +350,8 @@ PhotonHashmap::gatherPhotonsIndices(
         ///     If You have reached the # of photons needed && the search cube encapsulates the sphere
         ///  OR If You have exceeded the max allowed search space
         
-        bool photonSphereInsideCube = sphereInsideCube(intersection, sqrt(maxRadiusSqd), searchBoxCenter, outerBoxWidth / 3.0f);
-        bool doneSearching = neighborPhotons.size() == maxNumPhotonsToGather && photonSphereInsideCube;
+        bool photonSphereInsideCube = sphereInsideCube(intersection, sqrt(neighborPhotons.largestSquareDistance()), searchBoxCenter, outerBoxWidth / 3.0f);
+        bool doneSearching = neighborPhotons.full() && photonSphereInsideCube;
         bool searchSpaceTooLarge = outerBoxWidthSize > largestDim || outerBoxWidth / 2.0f > maxPhotonDistance;// || outerBoxWidthSize > (2 * spacing + 1);
         
         while (!doneSearching && !searchSpaceTooLarge) {
@@ -330,15 +377,15 @@ PhotonHashmap::gatherPhotonsIndices(
                 int k = std::min<int>(std::max<int>(0, pz + bk), zdim - 1);
                 
                 if (i == (px + bi) && j == (py + bj) && k == (pz + bk)) {
-                    gatherClosestPhotonsForGridIndex(maxNumPhotonsToGather, maxPhotonDistance, intersection, i, j, k, neighborPhotons, &maxRadiusSqd);
+                    gatherClosestPhotonsForGridIndex(intersection, i, j, k, neighborPhotons);
                 }
             }
             
-            photonSphereInsideCube = sphereInsideCube(intersection, sqrt(maxRadiusSqd), searchBoxCenter, outerBoxWidth / 3.0f);
-            doneSearching = neighborPhotons.size() == maxNumPhotonsToGather && photonSphereInsideCube;
+            photonSphereInsideCube = sphereInsideCube(intersection, sqrt(neighborPhotons.largestSquareDistance()), searchBoxCenter, outerBoxWidth / 3.0f);
+            doneSearching = neighborPhotons.full() && photonSphereInsideCube;
             searchSpaceTooLarge = outerBoxWidthSize > largestDim || outerBoxWidth / 2.0f > maxPhotonDistance;
         }
     }
     
-    return neighborPhotons;
+    return neighborPhotons.size();
 }
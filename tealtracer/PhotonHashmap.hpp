@@ -10,10 +10,13 @@
 #define PhotonHashmap_hpp
 
 #include <vector>
+#include <memory>
 #include <Eigen/Dense>
 
 #include "PhotonMap.hpp"
 #include "JensenPhoton.hpp"
+#include "ThreadPool.hpp"
+#include "PhotonArrays.hpp"
 
 ///
 class PhotonHashmap : public PhotonMap {
@@ -26,6 +29,9 @@ public:
     
     const float epsilon;
     
+    /// Optional; when set, large maps are built on its workers.
+    std::shared_ptr<ThreadPool> threadPool;
+    
     ///
     PhotonHashmap();
     ///
@@ -65,36 +71,46 @@ public:
     int findMaxDistancePhotonIndex(const std::vector<PhotonMap::PhotonIndexInfo> & photonIndices);
     
     /// Call this after filling "photons" with the relevant content.
+    ///
+    /// Groups "photons" by grid cell with a counting sort: every photon's
+    ///     cell is computed once, the cells are histogrammed and prefix
+    ///     summed, and the photons are scattered into place. Photons outside
+    ///     the grid end up after every cell.
     virtual void buildMap();
+    ///
+    virtual void saveIndex(PhotonCacheWriter & cache) const;
+    /// Only succeeds if the cache was built for the same grid
+    virtual bool loadIndex(const PhotonCacheReader & cache);
     /// Call this after building the spatial hash.
     ///
     /// NOTE: flux = totalEnergy/(float)numPhotons;
-    virtual std::vector<PhotonIndexInfo> gatherPhotonsIndices(
+    virtual int gatherPhotonsIndices(
         int maxNumPhotonsToGather,
         float maxPhotonDistance,
-        const Eigen::Vector3f & intersection);
+        const Eigen::Vector3f & intersection,
+        PhotonIndexInfo * results);
+    using PhotonMap::gatherPhotonsIndices;
     ///
-    virtual std::vector<PhotonMap::PhotonIndexInfo> gatherPhotonsIndices_v2(
+    virtual int gatherPhotonsIndices_v2(
         int maxNumPhotonsToGather,
         float maxPhotonDistance,
-        const Eigen::Vector3f & intersection);
+        const Eigen::Vector3f & intersection,
+        PhotonIndexInfo * results);
     
 private:
-    ///
-    void mapPhotonsToGrid();
-    ///
-    void computeGridFirstPhotons();
+    /// Maps are only built on the ".threadPool" past this many photons
+    static const int ParallelBuildThreshold = 65536;
+    
+    /// Like "getCellIndexHash", but -1 for positions outside the grid
+    int getGridCell(const Eigen::Vector3f & position) const;
     ///
     void gatherClosestPhotonsForGridIndex(
-        int maxNumPhotonsToGather,
-        float maxPhotonDistance,
         const Eigen::Vector3f & intersection,
         ///
         int i, int j, int k,
         
         // output
-        std::vector<PhotonIndexInfo> & neighborPhotons,
-        float * maxRadiusSqd
+        NearestPhotons & neighborPhotons
     );
     
     Eigen::Vector3f getCellBoxStart(
@@ -105,8 +121,15 @@ private:
         int i, int j, int k);
     
 public:
+    /// Index of the first photon in each cell; the cell's photons are
+    ///     [gridFirstPhotonIndices[c], gridFirstPhotonIndices[c] + gridPhotonCounts[c]).
     std::vector<int> gridFirstPhotonIndices;
+    /// Number of photons in each cell
+    std::vector<int> gridPhotonCounts;
+    /// Cell of each photon, or -1 if it lies outside the grid
     std::vector<int> gridIndices;
+    /// "photons" in the same order, split into arrays for SIMD filtering
+    PhotonArrays photonArrays;
     
 };
 
@@ -8,6 +8,9 @@
 
 #include "PhotonKDTree.hpp"
 
+#include <algorithm>
+#include <cassert>
+
 ///
 PhotonKDTree::PhotonKDTree() {}
 
@@ -21,13 +24,14 @@ PhotonKDTree::buildMap() {
 }
 
 ///
-std::vector<PhotonKDTree::PhotonIndexInfo>
+int
 PhotonKDTree::gatherPhotonsIndices(
     int maxNumPhotonsToGather,
     float maxPhotonDistance,
-    const Eigen::Vector3f & intersection) {
+    const Eigen::Vector3f & intersection,
+    PhotonIndexInfo * results) {
 
-    return findClosestNPhotonIndices(intersection, maxNumPhotonsToGather, maxPhotonDistance);
+    return findClosestNPhotonIndices(intersection, maxNumPhotonsToGather, maxPhotonDistance * maxPhotonDistance, results);
 }
 
 ///
@@ -60,80 +64,154 @@ PhotonKDTree::upperRange(const Range & range) {
     return Range(middleIdx(range)+1, range.end);
 }
 
-///
-int
-PhotonKDTree::nextAxis(int axis) {
-    return (axis+1) % 3;
-}
+/// Deepest the search stack can get: one pending "far" subtree per level
+static const int kMaxSearchDepth = 64;
 
 /// 
 void
 PhotonKDTree::transformIntoKDTree() {
-    transformIntoKDTree<JensenPhoton>(photons, [](int axis, const JensenPhoton & lhs, const JensenPhoton & rhs) {
-        return sparseless(axis)(lhs.position,rhs.position);
-    }, nextAxis);
-}
-
-///
-std::vector<PhotonKDTree::SearchResult>
-PhotonKDTree::findClosestNPhotonIndices(const Eigen::Vector3f & position, int N, float maxSquareDistance) {\
-    std::vector<SearchResult> result;
-    search_queue candidates;
+    int numPhotons = (int) photons.size();
+    splitAxes_.assign(numPhotons, 0);
     
-    _knnOnPhtonKDTree(position, N, candidates, 0, lastIdx(), 0);
+    std::vector<Range> pending;
+    pending.push_back(Range(0, numPhotons));
     
-    while (!candidates.empty()) {
-        result.push_back(candidates.top());
-        candidates.pop();
+    while (!pending.empty()) {
+        Range range = pending.back();
+        pending.pop_back();
+        
+        if (range.end - range.begin <= 1) {
+            continue;
+        }
+        
+        /// From Jensen: the "root node among the data-set as the median element in the direction which represents the largest interval"
+        Eigen::Vector3f minExtent = photons[range.begin].position, maxExtent = minExtent;
+        for (int i = range.begin + 1; i < range.end; i++) {
+            minExtent = minExtent.cwiseMin(photons[i].position);
+            maxExtent = maxExtent.cwiseMax(photons[i].position);
+        }
+        
+        Eigen::Vector3f extent = maxExtent - minExtent;
+        int axis = 0;
+        if (extent.y() > extent(axis)) {
+            axis = 1;
+        }
+        if (extent.z() > extent(axis)) {
+            axis = 2;
+        }
+        
+        int middle = middleIdx(range);
+        std::nth_element(photons.begin() + range.begin, photons.begin() + middle, photons.begin() + range.end, [axis](const JensenPhoton & lhs, const JensenPhoton & rhs) {
+            return lhs.position(axis) < rhs.position(axis);
+        });
+        splitAxes_[middle] = (uint8_t) axis;
+        
+        pending.push_back(lowerRange(range));
+        pending.push_back(upperRange(range));
     }
     
-    return result;
+    copyPositions();
 }
 
 ///
 void
-PhotonKDTree::_knnOnPhtonKDTree(const Eigen::Vector3f & position, int N, PhotonKDTree::search_queue & candidates, int startIdx, int lastIdx, int axis) {
-
-    if (startIdx <= lastIdx) {
-        auto currIdx = middleIdx(Range(startIdx, lastIdx + 1));
-        auto photonPos = photons[currIdx].position;
-        Eigen::Vector3f dp = photonPos - position;
-        float sqrdist = dp.dot(dp);
-        
-        candidates.push(SearchResult(currIdx, sqrdist));
-        if (candidates.size() > N) {
-            candidates.pop();
+PhotonKDTree::copyPositions() {
+    int numPhotons = (int) photons.size();
+    for (int axis = 0; axis < 3; axis++) {
+        positions_[axis].resize(numPhotons);
+        for (int i = 0; i < numPhotons; i++) {
+            positions_[axis][i] = photons[i].position(axis);
         }
+    }
+}
+
+///
+void
+PhotonKDTree::saveIndex(PhotonCacheWriter & cache) const {
+    cache.addArray(PhotonCache::KDTreeSplitAxes, splitAxes_);
+}
+
+///
+bool
+PhotonKDTree::loadIndex(const PhotonCacheReader & cache) {
+    if (!cache.readArray(PhotonCache::KDTreeSplitAxes, splitAxes_) || splitAxes_.size() != photons.size()) {
+        splitAxes_.clear();
+        return false;
+    }
+    
+    copyPositions();
+    return true;
+}
+
+///
+int
+PhotonKDTree::findClosestNPhotonIndices(const Eigen::Vector3f & position, int N, float maxSquareDistance, PhotonKDTree::SearchResult * results) const {
+    NearestPhotons candidates(results, N, maxSquareDistance);
+    if (photons.size() == 0 || positions_[0].size() != photons.size()) {
+        return 0;
+    }
+    
+    const float * xs = positions_[0].data();
+    const float * ys = positions_[1].data();
+    const float * zs = positions_[2].data();
+    const float * axisPositions[3] = {xs, ys, zs};
+    
+    /// Subtrees still to visit, with the squared distance from "position" to
+    ///     their splitting plane so they can be skipped once the search
+    ///     sphere has shrunk past it.
+    struct PendingSubtree {
+        int begin, end;
+        float planeSquareDistance;
+    };
+    PendingSubtree stack[kMaxSearchDepth];
+    int stackSize = 0;
+    
+    stack[stackSize].begin = 0;
+    stack[stackSize].end = (int) photons.size();
+    stack[stackSize].planeSquareDistance = 0.0f;
+    stackSize++;
+    
+    while (stackSize > 0) {
+        PendingSubtree subtree = stack[--stackSize];
         
-        auto searchLeft = [&](){
-            auto newRange = lowerRange(Range(startIdx, lastIdx + 1));
-            this->_knnOnPhtonKDTree(position, N, candidates, newRange.begin, newRange.end - 1, nextAxis(axis));
-        };
-        auto searchRight = [&](){
-            auto newRange = upperRange(Range(startIdx, lastIdx + 1));
-            this->_knnOnPhtonKDTree(position, N, candidates, newRange.begin, newRange.end - 1, nextAxis(axis));
-        };
-        
-        bool searchedLeft = true;
-        if (sparseless(axis)(position, photonPos)) {
-            searchLeft();
-        }
-        else {
-            searchRight();
-            searchedLeft = false;
+        /// If the candidate hypersphere crosses the splitting plane, then
+        /// look "on the other side of the plane by examining the other subtree"
+        if (subtree.planeSquareDistance >= candidates.cutoffSquareDistance()) {
+            continue;
         }
         
-        /// If the candidate hypersphere crosses the splitting plane, then 
-        /// look "on the other side of the plane by examining the other subtree"
-        float farthestDist = candidates.top().squareDistance;
-        float diff = photonPos(axis) - position(axis);
-        if (candidates.size() < N || diff * diff < farthestDist) {
-            if (searchedLeft) {
-                searchRight();
+        int begin = subtree.begin, end = subtree.end;
+        while (begin < end) {
+            int middle = begin + (end - begin) / 2;
+            
+            float dx = xs[middle] - position.x();
+            float dy = ys[middle] - position.y();
+            float dz = zs[middle] - position.z();
+            candidates.consider(middle, dx * dx + dy * dy + dz * dz);
+            
+            int axis = splitAxes_[middle];
+            float diff = axisPositions[axis][middle] - position(axis);
+            
+            /// Descend into the side "position" is on and remember the other
+            int nearBegin = begin, nearEnd = middle;
+            int farBegin = middle + 1, farEnd = end;
+            if (diff <= 0.0f) {
+                std::swap(nearBegin, farBegin);
+                std::swap(nearEnd, farEnd);
             }
-            else {
-                searchLeft();
+            
+            if (farBegin < farEnd && diff * diff < candidates.cutoffSquareDistance()) {
+                assert(stackSize < kMaxSearchDepth);
+                stack[stackSize].begin = farBegin;
+                stack[stackSize].end = farEnd;
+                stack[stackSize].planeSquareDistance = diff * diff;
+                stackSize++;
             }
+            
+            begin = nearBegin;
+            end = nearEnd;
         }
     }
+    
+    return candidates.size();
 }
@@ -9,10 +9,12 @@
 #ifndef PhotonMap_hpp
 #define PhotonMap_hpp
 
+#include <algorithm>
 #include <vector>
 #include <Eigen/Dense>
 
 #include "JensenPhoton.hpp"
+#include "PhotonCache.hpp"
 
 ///
 class PhotonMap {
@@ -25,6 +27,13 @@ public:
     /// Call this after filling "photons" with the relevant content.
     virtual void buildMap() = 0;
     
+    /// Adds whatever "buildMap" derived from "photons" besides their order to
+    ///     "cache". Maps that add nothing are rebuilt when loaded.
+    virtual void saveIndex(PhotonCacheWriter & cache) const {}
+    /// Call this instead of "buildMap" after filling "photons" from a cache
+    ///     that "saveIndex" wrote to. Returns false if "buildMap" is needed.
+    virtual bool loadIndex(const PhotonCacheReader & cache) {return false;}
+    
     ///
     struct PhotonIndexInfo {
         int index;
@@ -34,12 +43,83 @@ public:
         PhotonIndexInfo(int index, float sqrDist) : index(index), squareDistance(sqrDist) {}
     };
     
-    /// Call this after building the spatial hash.
-    virtual std::vector<PhotonIndexInfo> gatherPhotonsIndices(
+    ///
+    /// Bounded max-heap of the closest photons seen so far, kept in storage
+    ///     owned by the caller so that gathering never allocates. Photons at
+    ///     or beyond "maxSquareDistance" are rejected outright; once the heap
+    ///     is full, a photon is only kept if it beats the current farthest.
+    ///
+    class NearestPhotons {
+    public:
+        NearestPhotons(PhotonIndexInfo * storage, int capacity, float maxSquareDistance)
+         : storage_(storage), capacity_(capacity), size_(0), maxSquareDistance_(maxSquareDistance) {}
+        
+        ///
+        void consider(int index, float squareDistance) {
+            if (squareDistance >= cutoffSquareDistance() || capacity_ <= 0) {
+                return;
+            }
+            
+            if (size_ < capacity_) {
+                storage_[size_++] = PhotonIndexInfo(index, squareDistance);
+            }
+            else {
+                std::pop_heap(storage_, storage_ + size_, closer);
+                storage_[size_ - 1] = PhotonIndexInfo(index, squareDistance);
+            }
+            std::push_heap(storage_, storage_ + size_, closer);
+        }
+        
+        /// A photon has to be strictly closer than this to be kept. Nothing
+        ///     can be kept without any capacity, so that cutoff is 0.
+        float cutoffSquareDistance() const {
+            if (capacity_ <= 0) {
+                return 0.0f;
+            }
+            return full() ? storage_[0].squareDistance : maxSquareDistance_;
+        }
+        
+        /// Square distance of the farthest photon kept, or 0 if none are
+        float largestSquareDistance() const {
+            return size_ > 0 ? storage_[0].squareDistance : 0.0f;
+        }
+        
+        int size() const {return size_;}
+        int capacity() const {return capacity_;}
+        bool full() const {return size_ >= capacity_;}
+        
+    private:
+        
+        static bool closer(const PhotonIndexInfo & lhs, const PhotonIndexInfo & rhs) {
+            return lhs.squareDistance < rhs.squareDistance;
+        }
+        
+        PhotonIndexInfo * storage_;
+        int capacity_;
+        int size_;
+        float maxSquareDistance_;
+    };
+    
+    /// Call this after building the spatial hash. Writes up to
+    ///     "maxNumPhotonsToGather" of the closest photons within
+    ///     "maxPhotonDistance" into "results" (which must have room for that
+    ///     many) and returns how many were written. Never allocates.
+    virtual int gatherPhotonsIndices(
         int maxNumPhotonsToGather,
         float maxPhotonDistance,
-        const Eigen::Vector3f & intersection) = 0;
+        const Eigen::Vector3f & intersection,
+        PhotonIndexInfo * results) = 0;
     
+    /// Convenience wrapper around the buffer version above.
+    std::vector<PhotonIndexInfo> gatherPhotonsIndices(
+        int maxNumPhotonsToGather,
+        float maxPhotonDistance,
+        const Eigen::Vector3f & intersection) {
+        
+        std::vector<PhotonIndexInfo> results(std::max<int>(0, maxNumPhotonsToGather));
+        results.resize(gatherPhotonsIndices(maxNumPhotonsToGather, maxPhotonDistance, intersection, results.data()));
+        return results;
+    }
     
     ///
     float gaussianWeight(float distSqrd, float radius);
@@ -0,0 +1,254 @@
+//
+//  PhotonSpatialHashmap.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/3/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "PhotonSpatialHashmap.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+///
+PhotonSpatialHashmap::PhotonSpatialHashmap() {
+    cellsize = 0.0f;
+    tableMask_ = 0;
+    numCells_ = 0;
+    origin_ = Eigen::Vector3f::Zero();
+    cellsize_ = 1.0f;
+    inverseCellsize_ = 1.0f;
+    minCell_ = Eigen::Vector3i::Zero();
+    maxCell_ = Eigen::Vector3i::Zero();
+}
+
+///
+unsigned int
+PhotonSpatialHashmap::hashCell(int i, int j, int k) {
+    /// Large primes from Teschner et al.
+    return ((unsigned int) i * 73856093u) ^ ((unsigned int) j * 19349663u) ^ ((unsigned int) k * 83492791u);
+}
+
+///
+Eigen::Vector3i
+PhotonSpatialHashmap::getCellIndex(const Eigen::Vector3f & position) const {
+    Eigen::Vector3f local = (position - origin_) * inverseCellsize_;
+    return Eigen::Vector3i((int) std::floor(local.x()), (int) std::floor(local.y()), (int) std::floor(local.z()));
+}
+
+///
+int
+PhotonSpatialHashmap::findCell(int i, int j, int k) const {
+    if (table_.empty()) {
+        return -1;
+    }
+
+    /// Linear probing; the table is never more than half full, so this
+    ///     always reaches an empty slot.
+    unsigned int slot = hashCell(i, j, k) & tableMask_;
+    while (table_[slot].first != -1) {
+        const Slot & entry = table_[slot];
+        if (entry.i == i && entry.j == j && entry.k == k) {
+            return (int) slot;
+        }
+        slot = (slot + 1) & tableMask_;
+    }
+
+    return -1;
+}
+
+///
+int
+PhotonSpatialHashmap::insertCell(int i, int j, int k) {
+    unsigned int slot = hashCell(i, j, k) & tableMask_;
+    while (table_[slot].first != -1) {
+        const Slot & entry = table_[slot];
+        if (entry.i == i && entry.j == j && entry.k == k) {
+            return (int) slot;
+        }
+        slot = (slot + 1) & tableMask_;
+    }
+
+    Slot & entry = table_[slot];
+    entry.i = i;
+    entry.j = j;
+    entry.k = k;
+    /// Claimed; the real first photon is filled in once all cells are known
+    entry.first = 0;
+    entry.count = 0;
+    numCells_++;
+    return (int) slot;
+}
+
+///
+void
+PhotonSpatialHashmap::buildMap() {
+    int numPhotons = (int) photons.size();
+
+    table_.clear();
+    tableMask_ = 0;
+    numCells_ = 0;
+    minCell_ = Eigen::Vector3i::Zero();
+    maxCell_ = Eigen::Vector3i::Zero();
+
+    if (numPhotons == 0) {
+        return;
+    }
+
+    Eigen::Vector3f minExtent = photons[0].position, maxExtent = photons[0].position;
+    for (int index = 1; index < numPhotons; index++) {
+        minExtent = minExtent.cwiseMin(photons[index].position);
+        maxExtent = maxExtent.cwiseMax(photons[index].position);
+    }
+
+    cellsize_ = cellsize;
+    if (cellsize_ <= 0.0f) {
+        /// Photons are stored on surfaces, so estimate their area from the
+        ///     bounding box and size the cells for "TargetPhotonsPerCell".
+        Eigen::Vector3f extent = maxExtent - minExtent;
+        float area = 2.0f * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+        cellsize_ = area > 0.0f ? std::sqrt(area * (float) TargetPhotonsPerCell / (float) numPhotons) : 1.0f;
+    }
+
+    origin_ = minExtent;
+    inverseCellsize_ = 1.0f / cellsize_;
+
+    unsigned int tableSize = 16;
+    while (tableSize < 2u * (unsigned int) numPhotons) {
+        tableSize *= 2;
+    }
+    Slot emptySlot;
+    emptySlot.i = emptySlot.j = emptySlot.k = 0;
+    emptySlot.first = -1;
+    emptySlot.count = 0;
+    table_.assign(tableSize, emptySlot);
+    tableMask_ = tableSize - 1;
+
+    /// Find every photon's slot once, counting photons per cell as we go
+    std::vector<int> photonSlots(numPhotons);
+    minCell_ = maxCell_ = getCellIndex(photons[0].position);
+    for (int index = 0; index < numPhotons; index++) {
+        Eigen::Vector3i cell = getCellIndex(photons[index].position);
+        minCell_ = minCell_.cwiseMin(cell);
+        maxCell_ = maxCell_.cwiseMax(cell);
+
+        int slot = insertCell(cell.x(), cell.y(), cell.z());
+        table_[slot].count++;
+        photonSlots[index] = slot;
+    }
+
+    /// Exclusive prefix sum in slot order
+    std::vector<int> slotCursors(tableSize, 0);
+    int offset = 0;
+    for (unsigned int slot = 0; slot < tableSize; slot++) {
+        if (table_[slot].first != -1) {
+            table_[slot].first = offset;
+            slotCursors[slot] = offset;
+            offset += table_[slot].count;
+        }
+    }
+    assert(offset == numPhotons);
+
+    std::vector<JensenPhoton> sortedPhotons(numPhotons);
+    for (int index = 0; index < numPhotons; index++) {
+        sortedPhotons[slotCursors[photonSlots[index]]++] = photons[index];
+    }
+    photons.swap(sortedPhotons);
+}
+
+///
+void
+PhotonSpatialHashmap::gatherClosestPhotonsForCell(
+    const Eigen::Vector3f & intersection,
+    ///
+    int i, int j, int k,
+
+    // output
+    NearestPhotons & neighborPhotons) const {
+
+    /// Skip cells that lie entirely outside the current search sphere
+    Eigen::Vector3f cellStart = origin_ + cellsize_ * Eigen::Vector3f((float) i, (float) j, (float) k);
+    Eigen::Vector3f cellEnd = cellStart + Eigen::Vector3f(cellsize_, cellsize_, cellsize_);
+    Eigen::Vector3f outside = (cellStart - intersection).cwiseMax(intersection - cellEnd).cwiseMax(Eigen::Vector3f::Zero());
+    if (outside.squaredNorm() >= neighborPhotons.cutoffSquareDistance()) {
+        return;
+    }
+
+    int slot = findCell(i, j, k);
+    if (slot == -1) {
+        return;
+    }
+
+    int first = table_[slot].first;
+    int last = first + table_[slot].count;
+    for (int pi = first; pi < last; pi++) {
+        Eigen::Vector3f toPhoton = photons[pi].position - intersection;
+        neighborPhotons.consider(pi, toPhoton.dot(toPhoton));
+    }
+}
+
+///
+int
+PhotonSpatialHashmap::gatherPhotonsIndices(
+    int maxNumPhotonsToGather,
+    float maxPhotonDistance,
+    const Eigen::Vector3f & intersection,
+    PhotonIndexInfo * results) {
+
+    NearestPhotons neighborPhotons(results, maxNumPhotonsToGather, maxPhotonDistance * maxPhotonDistance);
+    if (numCells_ == 0 || maxNumPhotonsToGather <= 0) {
+        return 0;
+    }
+
+    Eigen::Vector3i center = getCellIndex(intersection);
+
+    /// Everything within "faceDistance + ring * cellsize" of the intersection
+    ///     has been seen once shells 0...ring are searched.
+    Eigen::Vector3f local = (intersection - origin_) * inverseCellsize_ - center.cast<float>();
+    float faceDistance = cellsize_ * std::min<float>(local.minCoeff(), (Eigen::Vector3f::Ones() - local).minCoeff());
+    faceDistance = std::max<float>(0.0f, faceDistance);
+
+    /// Shells closer than "firstRing" miss the occupied cells entirely, and
+    ///     shells past "lastRing" are empty.
+    int firstRing = 0, lastRing = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        firstRing = std::max<int>(firstRing, std::max<int>(minCell_(axis) - center(axis), center(axis) - maxCell_(axis)));
+        lastRing = std::max<int>(lastRing, std::max<int>(center(axis) - minCell_(axis), maxCell_(axis) - center(axis)));
+    }
+
+    for (int ring = firstRing; ring <= lastRing; ring++) {
+        float searchedRadius = faceDistance + cellsize_ * (float) (ring - 1);
+        if (ring > firstRing && searchedRadius >= 0.0f
+         && searchedRadius * searchedRadius >= neighborPhotons.cutoffSquareDistance()) {
+            break;
+        }
+
+        int iStart = std::max<int>(center.x() - ring, minCell_.x()), iEnd = std::min<int>(center.x() + ring, maxCell_.x());
+        int jStart = std::max<int>(center.y() - ring, minCell_.y()), jEnd = std::min<int>(center.y() + ring, maxCell_.y());
+        int kStart = std::max<int>(center.z() - ring, minCell_.z()), kEnd = std::min<int>(center.z() + ring, maxCell_.z());
+
+        for (int i = iStart; i <= iEnd; i++) {
+            for (int j = jStart; j <= jEnd; j++) {
+                if (std::abs(i - center.x()) == ring || std::abs(j - center.y()) == ring) {
+                    /// On an i or j face of the shell: the whole k column
+                    for (int k = kStart; k <= kEnd; k++) {
+                        gatherClosestPhotonsForCell(intersection, i, j, k, neighborPhotons);
+                    }
+                }
+                else {
+                    /// Inside the shell: only its two k faces
+                    if (center.z() - ring >= minCell_.z()) {
+                        gatherClosestPhotonsForCell(intersection, i, j, center.z() - ring, neighborPhotons);
+                    }
+                    if (ring > 0 && center.z() + ring <= maxCell_.z()) {
+                        gatherClosestPhotonsForCell(intersection, i, j, center.z() + ring, neighborPhotons);
+                    }
+                }
+            }
+        }
+    }
+
+    return neighborPhotons.size();
+}
@@ -0,0 +1,127 @@
+//
+//  PhotonSpatialHashmap.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/3/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PhotonSpatialHashmap_hpp
+#define PhotonSpatialHashmap_hpp
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include "PhotonMap.hpp"
+#include "JensenPhoton.hpp"
+
+///
+/// A uniform grid over the photons that only stores the cells which actually
+///     hold photons. Cell coordinates are hashed (Teschner et al., "Optimized
+///     Spatial Hashing for Collision Detection of Deformable Objects") into an
+///     open-addressed table of about twice as many slots as photons, so the
+///     grid has no fixed bounds and its memory is O(photons) for any scene
+///     extent or cell size.
+///
+class PhotonSpatialHashmap : public PhotonMap {
+public:
+
+    /// Side length of a cell. Leave at 0 to pick one from the photons' bounds
+    ///     every time the map is built.
+    float cellsize;
+
+    ///
+    PhotonSpatialHashmap();
+    ///
+    virtual ~PhotonSpatialHashmap() {}
+
+    /// Call this after filling "photons" with the relevant content.
+    ///
+    /// Derives the bounds (and cell size, if unset) from the photons, inserts
+    ///     every occupied cell into the table and groups the photons by cell
+    ///     with a counting sort.
+    virtual void buildMap();
+
+    /// Call this after building the spatial hash.
+    ///
+    /// Searches outwards from the cell containing "intersection" one shell of
+    ///     cells at a time, until the searched cube holds the whole gather
+    ///     sphere or covers every photon.
+    virtual int gatherPhotonsIndices(
+        int maxNumPhotonsToGather,
+        float maxPhotonDistance,
+        const Eigen::Vector3f & intersection,
+        PhotonIndexInfo * results);
+    using PhotonMap::gatherPhotonsIndices;
+
+    ///
+    Eigen::Vector3i getCellIndex(const Eigen::Vector3f & position) const;
+
+    /// Returns the table slot holding cell (i, j, k), or -1 if it is empty.
+    int findCell(int i, int j, int k) const;
+
+    /// Side length of the cells of the last build, "cellsize" or the one
+    ///     picked for its photons
+    float builtCellsize() const {
+        return cellsize_;
+    }
+
+    /// Number of occupied cells
+    int numCells() const {
+        return numCells_;
+    }
+
+    /// Number of slots in the table
+    int tableSize() const {
+        return (int) table_.size();
+    }
+
+    /// Smallest and largest occupied cell coordinates
+    const Eigen::Vector3i & minCell() const {
+        return minCell_;
+    }
+    const Eigen::Vector3i & maxCell() const {
+        return maxCell_;
+    }
+
+private:
+
+    ///
+    struct Slot {
+        int i, j, k;
+        /// First photon of the cell, or -1 if the slot is empty
+        int first;
+        int count;
+    };
+
+    /// The cell size picked when none is given aims for this many photons
+    ///     per occupied cell.
+    static const int TargetPhotonsPerCell = 8;
+
+    ///
+    static unsigned int hashCell(int i, int j, int k);
+
+    /// Returns the slot of cell (i, j, k), claiming an empty one if needed.
+    int insertCell(int i, int j, int k);
+
+    ///
+    void gatherClosestPhotonsForCell(
+        const Eigen::Vector3f & intersection,
+        ///
+        int i, int j, int k,
+
+        // output
+        NearestPhotons & neighborPhotons) const;
+
+    std::vector<Slot> table_;
+    /// "table_.size() - 1"; the table size is always a power of two
+    unsigned int tableMask_;
+    int numCells_;
+
+    Eigen::Vector3f origin_;
+    float cellsize_;
+    float inverseCellsize_;
+    Eigen::Vector3i minCell_, maxCell_;
+};
+
+#endif /* PhotonSpatialHashmap_hpp */
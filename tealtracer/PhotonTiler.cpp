@@ -8,9 +8,17 @@
 
 #include "PhotonTiler.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 ///
 PhotonTiler::PhotonTiler() {
-
+    imageWidth_ = imageHeight_ = 0;
+    tileWidth_ = tileHeight_ = 1;
+    tilesWide_ = tilesHigh_ = 0;
+    cameraPosition_ = Eigen::Vector3f::Zero();
+    worldToView_ = Eigen::Matrix3f::Identity();
 }
     
 ///
@@ -86,15 +94,32 @@ PhotonTiler::generateTiles(
     const FrenetFrame & viewFrame) {
     
     tiles.clear();
-    tilePhotons.clear();
+    tilePhotonStarts.clear();
+    tilePhotonIndices.clear();
+    
+    imageWidth_ = imageWidth;
+    imageHeight_ = imageHeight;
+    tileWidth_ = tileWidth;
+    tileHeight_ = tileHeight;
+    tilesWide_ = (imageWidth + tileWidth - 1) / tileWidth;
+    tilesHigh_ = (imageHeight + tileHeight - 1) / tileHeight;
+    
+    cameraPosition_ = cameraPosition;
+    Eigen::Matrix3f viewToWorld;
+    viewToWorld.col(0) = viewFrame.forward;
+    viewToWorld.col(1) = viewFrame.right;
+    viewToWorld.col(2) = viewFrame.up;
+    worldToView_ = viewToWorld.inverse();
     
     for (int py = 0; py < imageHeight; py += tileHeight) {
         for (int px = 0; px < imageWidth; px += tileWidth) {
             Tile tile = Tile();
-            Eigen::Vector3f pixelOffset = (viewFrame.forward - 0.5*viewFrame.up - 0.5*viewFrame.right + viewFrame.right*(0.5+(double)(px+tileWidth/2))/(double)imageWidth + viewFrame.up*(0.5+(double)(py + tileHeight/2))/(double)imageHeight);
+            /// Tiles on the right and top edges may be cut short by the image
+            int pxEnd = std::min<int>(px + tileWidth, imageWidth), pyEnd = std::min<int>(py + tileHeight, imageHeight);
+            Eigen::Vector3f pixelOffset = (viewFrame.forward - 0.5*viewFrame.up - 0.5*viewFrame.right + viewFrame.right*(0.5*(double)(px + pxEnd))/(double)imageWidth + viewFrame.up*(0.5*(double)(py + pyEnd))/(double)imageHeight);
             Eigen::Vector3f tileCenter = cameraPosition + pixelOffset;
             
-            tile.frustum.setPlanesFromRayCast(cameraPosition, tileCenter, viewFrame.up, viewFrame.right, ((double)tileWidth)/((double)imageWidth), ((double)tileHeight)/((double)imageHeight));
+            tile.frustum.setPlanesFromRayCast(cameraPosition, tileCenter, viewFrame.up, viewFrame.right, ((double)(pxEnd - px))/((double)imageWidth), ((double)(pyEnd - py))/((double)imageHeight));
             
             tiles.push_back(tile);
         }
@@ -108,37 +133,114 @@ PhotonTiler::tileIndexForPixel(
     const int tileWidth, const int tileHeight,
     const int px, const int py) const {
     
-    return (px/tileWidth) + (py/tileHeight)*(imageWidth/tileWidth);
+    return (px/tileWidth) + (py/tileHeight)*((imageWidth + tileWidth - 1)/tileWidth);
+}
+
+/// Finds the values "a" for which the plane through the camera holding every
+///     pixel ray "forward + a * axis + ..." touches the sphere. "depth" and
+///     "offset" are the sphere center's view coordinates along forward and
+///     "axis", and "depthRow"/"offsetRow" the rows of the world-to-view
+///     matrix that produce them. Returns false if the sphere is behind the
+///     camera.
+static bool
+sweptPlaneRange(
+    float depth, float offset,
+    const Eigen::Vector3f & depthRow, const Eigen::Vector3f & offsetRow,
+    float radius,
+    float & minValue, float & maxValue) {
+    
+    /// The plane "offset - a * depth = 0" is within "radius" of the center when
+    ///     (offset - a depth)^2 <= radius^2 |offsetRow - a depthRow|^2.
+    float radiusSqd = radius * radius;
+    float A = depth * depth - radiusSqd * depthRow.squaredNorm();
+    float B = offset * depth - radiusSqd * offsetRow.dot(depthRow);
+    float C = offset * offset - radiusSqd * offsetRow.squaredNorm();
+    
+    if (A <= 0.0f) {
+        /// The sphere reaches the camera plane, so it can touch any pixel
+        minValue = -std::numeric_limits<float>::infinity();
+        maxValue = std::numeric_limits<float>::infinity();
+        return true;
+    }
+    else if (depth < 0.0f) {
+        return false;
+    }
+    
+    float root = std::sqrt(std::max<float>(0.0f, B * B - A * C));
+    minValue = (B - root) / A;
+    maxValue = (B + root) / A;
+    return true;
+}
+
+/// Converts the image-plane range [minValue, maxValue] (-0.5 to 0.5 across
+///     the image) to an inclusive range of tiles.
+static bool
+tilesForRange(float minValue, float maxValue, int imageSize, int tileSize, int & first, int & last) {
+    float minPixel = (minValue + 0.5f) * (float) imageSize;
+    float maxPixel = (maxValue + 0.5f) * (float) imageSize;
+    if (maxPixel < 0.0f || minPixel >= (float) imageSize) {
+        return false;
+    }
+    
+    first = (int) std::max<float>(0.0f, minPixel) / tileSize;
+    last = (int) std::min<float>((float) (imageSize - 1), maxPixel) / tileSize;
+    return true;
+}
+
+///
+bool
+PhotonTiler::tileRangeForSphere(const Eigen::Vector3f & center, float radius, int & x0, int & x1, int & y0, int & y1) const {
+    Eigen::Vector3f view = worldToView_ * (center - cameraPosition_);
+    
+    float minRight, maxRight, minUp, maxUp;
+    if (!sweptPlaneRange(view(0), view(1), worldToView_.row(0), worldToView_.row(1), radius, minRight, maxRight)
+     || !sweptPlaneRange(view(0), view(2), worldToView_.row(0), worldToView_.row(2), radius, minUp, maxUp)) {
+        return false;
+    }
+    
+    return tilesForRange(minRight, maxRight, imageWidth_, tileWidth_, x0, x1)
+     && tilesForRange(minUp, maxUp, imageHeight_, tileHeight_, y0, y1);
 }
 
 ///
 void
 PhotonTiler::buildMap(float photonEffectRadius) {
     int numberOfTiles = (int) tiles.size();
-    std::vector<int> photonCount(numberOfTiles, 0), nextPhotonIndex(numberOfTiles, 0);
-    tilePhotons = std::vector<std::vector<JensenPhoton>>(numberOfTiles, std::vector<JensenPhoton>());
-    
-    /// Counting pass
-    for (size_t photonItr = 0; photonItr < photons.size(); photonItr++) {
-        for (size_t tileItr = 0; tileItr < tiles.size(); tileItr++) {
-            if (tiles[tileItr].frustum.intersectsOrContainsSphere(photons[photonItr].position, photonEffectRadius)) {
-                photonCount[tileItr] += 1;
+    int numberOfPhotons = (int) photons.size();
+    assert(numberOfTiles == tilesWide_ * tilesHigh_);
+    
+    photonTileRanges_.resize(numberOfPhotons);
+    tilePhotonStarts.assign(numberOfTiles + 1, 0);
+    
+    /// Counting pass; each photon is projected once
+    for (int photonItr = 0; photonItr < numberOfPhotons; photonItr++) {
+        TileRange & range = photonTileRanges_[photonItr];
+        if (!tileRangeForSphere(photons[photonItr].position, photonEffectRadius, range.x0, range.x1, range.y0, range.y1)) {
+            range.x0 = range.y0 = 0;
+            range.x1 = range.y1 = -1;
+            continue;
+        }
+        
+        for (int ty = range.y0; ty <= range.y1; ty++) {
+            for (int tx = range.x0; tx <= range.x1; tx++) {
+                tilePhotonStarts[ty * tilesWide_ + tx + 1]++;
             }
         }
     }
     
     /// Allocation pass
-    for (size_t tileItr = 0; tileItr < tiles.size(); tileItr++) {
-        tilePhotons[tileItr] = std::vector<JensenPhoton>(photonCount[tileItr], JensenPhoton());
+    for (int tileItr = 0; tileItr < numberOfTiles; tileItr++) {
+        tilePhotonStarts[tileItr + 1] += tilePhotonStarts[tileItr];
     }
+    tilePhotonIndices.resize(tilePhotonStarts[numberOfTiles]);
+    tileCursors_.assign(tilePhotonStarts.begin(), tilePhotonStarts.end() - 1);
     
     /// Copy pass
-    for (size_t photonItr = 0; photonItr < photons.size(); photonItr++) {
-        for (size_t tileItr = 0; tileItr < tiles.size(); tileItr++) {
-            if (tiles[tileItr].frustum.intersectsOrContainsSphere(photons[photonItr].position, photonEffectRadius)) {
-            
-                int tilePhotonIdx = nextPhotonIndex[tileItr]++;
-                tilePhotons[tileItr][tilePhotonIdx] = photons[photonItr];
+    for (int photonItr = 0; photonItr < numberOfPhotons; photonItr++) {
+        const TileRange & range = photonTileRanges_[photonItr];
+        for (int ty = range.y0; ty <= range.y1; ty++) {
+            for (int tx = range.x0; tx <= range.x1; tx++) {
+                tilePhotonIndices[tileCursors_[ty * tilesWide_ + tx]++] = photonItr;
             }
         }
     }
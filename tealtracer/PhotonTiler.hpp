@@ -104,7 +104,10 @@ public:
     };
     
     std::vector<struct Tile> tiles;
-    std::vector<std::vector<JensenPhoton>> tilePhotons;
+    /// The photons that can affect tile "t" are "photons[tilePhotonIndices[i]]"
+    ///     for "i" in [tilePhotonStarts[t], tilePhotonStarts[t + 1]).
+    std::vector<int> tilePhotonStarts;
+    std::vector<int> tilePhotonIndices;
     
     ///
     virtual void generateTiles(
@@ -120,9 +123,35 @@ public:
         const int px, const int py) const;
     
     /// Before "buildMap" is called, the tiles must be configured with the current camera
+    ///
+    /// Projects every photon's effect sphere onto the image once, bins its
+    ///     index into each tile the projection overlaps, and packs the bins
+    ///     into "tilePhotonStarts"/"tilePhotonIndices".
     virtual void buildMap(float photonEffectRadius);
     
+    /// Computes the tiles [x0, x1] x [y0, y1] whose pixels' rays can pass
+    ///     within "radius" of "center". Returns false if there are none.
+    bool tileRangeForSphere(const Eigen::Vector3f & center, float radius, int & x0, int & x1, int & y0, int & y1) const;
+    
+private:
+
+    ///
+    struct TileRange {
+        int x0, x1, y0, y1;
+    };
+    
+    int imageWidth_, imageHeight_;
+    int tileWidth_, tileHeight_;
+    int tilesWide_, tilesHigh_;
+    
+    Eigen::Vector3f cameraPosition_;
+    /// Maps "point - cameraPosition" to (depth, right, up) coordinates, where
+    ///     pixel rays are "forward + right * a + up * b".
+    Eigen::Matrix3f worldToView_;
     
+    /// Scratch space reused by every "buildMap"
+    std::vector<TileRange> photonTileRanges_;
+    std::vector<int> tileCursors_;
 
 };
 
@@ -16,6 +16,52 @@ void
 PovrayScene::addElement(std::shared_ptr<PovraySceneElement> element) {
     element->id_ = (uint16_t) elements_.size();
     elements_.push_back(element);
+    accelerationStructureDirty_ = true;
+}
+
+///
+void
+PovrayScene::buildAccelerationStructure() {
+    bvh_.build(elements_);
+    arrays_.assign(elements_);
+    accelerationStructureDirty_ = false;
+}
+
+///
+void
+PovrayScene::closestIntersection(const RayPacket & packet, InstersectionResult * results) const {
+    assert(!accelerationStructureDirty_);
+    
+    RayPacketHits hits;
+    hits.reset();
+    bvh_.closestIntersection(elements_, arrays_, packet, hits);
+    
+    unsigned int mask = packet.activeMask;
+    while (mask != 0) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        
+        InstersectionResult & result = results[i];
+        result = InstersectionResult();
+        result.hit.timeOfIntersection = std::numeric_limits<float>::infinity();
+        result.hit.ray = packet.ray(i);
+        
+        if (hits.elementIndices[i] >= 0) {
+            /// The kernels only find the closest time, so redo the winning
+            ///     hit with a single ray for its normal. If the two disagree
+            ///     on a grazing hit, trace the ray on its own instead.
+            int index = hits.elementIndices[i];
+            auto hitTest = elements_[index]->intersect(result.hit.ray);
+            if (hitTest.intersected) {
+                result.element = index;
+                result.material = arrays_.elementMaterials[index];
+                result.hit = hitTest;
+            }
+            else {
+                result = closestIntersection(result.hit.ray);
+            }
+        }
+    }
 }
 
 ///
@@ -85,6 +131,8 @@ PovrayScene::loadScene(const std::string & file) {
     recognizedElements.push_back(std::make_pair("light_source",std::shared_ptr<PovraySceneElement>(new PovrayLightSource())));
     recognizedElements.push_back(std::make_pair("sphere",std::shared_ptr<PovraySceneElement>(new PovraySphere())));
     recognizedElements.push_back(std::make_pair("plane",std::shared_ptr<PovraySceneElement>(new PovrayPlane())));
+    recognizedElements.push_back(std::make_pair("mesh",std::shared_ptr<PovraySceneElement>(new PovrayTriangleMesh())));
+    recognizedElements.push_back(std::make_pair("triangle",std::shared_ptr<PovraySceneElement>(new PovrayTriangle())));
     
     while (content.length() > 0) {
         auto loc = content.find("{");
@@ -130,5 +178,6 @@ PovrayScene::loadScene(const std::string & file) {
     }
     
 //        TSLoggerLog(std::cout, "done");
+    scene->buildAccelerationStructure();
     return scene;
 }
@@ -19,13 +19,22 @@
 #include "TSLogger.hpp"
 #include "PovraySceneElement.hpp"
 #include "PovraySceneElements.hpp"
+#include "PovraySceneBVH.hpp"
+#include "PovraySceneArrays.hpp"
 
 ///
 class PovrayScene {
 public:
 
     ///
+    PovrayScene() : accelerationStructureDirty_(false) {}
+
+    /// Adds "element" to the scene. Call "buildAccelerationStructure" once
+    ///     all elements have been added.
     void addElement(std::shared_ptr<PovraySceneElement> element);
+    /// Rebuilds the BVH used by "closestIntersection" and "intersections",
+    ///     and the arrays returned by "arrays".
+    void buildAccelerationStructure();
     ///
     static std::shared_ptr<PovrayScene> loadScene(const std::string & file);
 
@@ -36,7 +45,8 @@ public:
         }
     }
     
-    ///
+    /// Searches every element, so prefer "arrays" for anything done per
+    ///     frame or per ray.
     template <class C>
     std::vector<std::shared_ptr<C>> findElements() const {
         std::vector<std::shared_ptr<C>> elements;
@@ -66,22 +76,65 @@ private:
 
 public:
     
+    ///
+    const PovraySceneArrays & arrays() const {
+        assert(!accelerationStructureDirty_);
+        return arrays_;
+    }
+    
     struct InstersectionResult {
-        std::shared_ptr<PovraySceneElement> element;
+        /// Index (and id) of the element hit, -1 for a miss
+        int element;
+        /// Index into "arrays().materials", -1 for a miss
+        int material;
         RayIntersectionResult hit;
+        
+        ///
+        InstersectionResult() : element(-1), material(-1) {}
     };
     
+    /// The material of a hit that isn't a miss
+    const PovrayMaterial & material(const InstersectionResult & result) const {
+        return material(result.material);
+    }
     ///
-    InstersectionResult closestIntersection(const Ray & ray) {
+    const PovrayMaterial & material(int material) const {
+        return arrays_.materials[material];
+    }
+    
+    ///
+    InstersectionResult closestIntersection(const Ray & ray) const {
+        assert(!accelerationStructureDirty_);
+        
         InstersectionResult result;
-        result.element = nullptr;
         result.hit.timeOfIntersection = std::numeric_limits<float>::infinity();
         result.hit.ray = ray;
         
-        for (auto itr = elements_.begin(); itr != elements_.end(); itr++) {
-            auto hitTest = (*itr)->intersect(ray);
+        int index = bvh_.closestIntersection(elements_, arrays_, ray, result.hit);
+        if (index >= 0) {
+            result.element = index;
+            result.material = arrays_.elementMaterials[index];
+        }
+        
+        return result;
+    }
+    
+    /// Packet version of "closestIntersection": fills in "results[i]" for
+    ///     every active ray "i" of "packet" (at most "RayPacket::Size").
+    void closestIntersection(const RayPacket & packet, InstersectionResult * results) const;
+    
+    /// Reference implementation of "closestIntersection" that tests every
+    ///     element in turn.
+    InstersectionResult closestIntersectionLinear(const Ray & ray) const {
+        InstersectionResult result;
+        result.hit.timeOfIntersection = std::numeric_limits<float>::infinity();
+        result.hit.ray = ray;
+        
+        for (int index = 0; index < (int) elements_.size(); index++) {
+            auto hitTest = elements_[index]->intersect(ray);
             if (hitTest.intersected && hitTest.timeOfIntersection < result.hit.timeOfIntersection) {
-                result.element = *itr;
+                result.element = index;
+                result.material = arrays_.elementMaterials[index];
                 result.hit = hitTest;
 //                result.hit.timeOfIntersection = hitTest.timeOfIntersection;
             }
@@ -90,24 +143,26 @@ public:
         return result;
     }
     
-    ///
-    std::vector<InstersectionResult> intersections(const Ray & ray) {
+    /// Returns every hit along "ray", with the closest one first.
+    std::vector<InstersectionResult> intersections(const Ray & ray) const {
+        assert(!accelerationStructureDirty_);
+        
+        std::vector<std::pair<int, RayIntersectionResult>> hits;
+        bvh_.allIntersections(elements_, arrays_, ray, hits);
+        
         std::vector<InstersectionResult> results;
+        for (auto itr = hits.begin(); itr != hits.end(); itr++) {
+            InstersectionResult result;
         
-        for (auto itr = elements_.begin(); itr != elements_.end(); itr++) {
-            auto hitTest = (*itr)->intersect(ray);
-            if (hitTest.intersected) {
-                InstersectionResult result;
+            result.element = itr->first;
+            result.material = arrays_.elementMaterials[itr->first];
+            result.hit = itr->second;
             
-                result.element = *itr;
-                result.hit = hitTest;
-                
-                int newIndex = (int) results.size();
-                results.push_back(result);
-                if (results[newIndex].hit.timeOfIntersection < results[0].hit.timeOfIntersection) {
-                    results[newIndex] = results[0];
-                    results[0] = result;
-                }
+            int newIndex = (int) results.size();
+            results.push_back(result);
+            if (results[newIndex].hit.timeOfIntersection < results[0].hit.timeOfIntersection) {
+                results[newIndex] = results[0];
+                results[0] = result;
             }
         }
         
@@ -123,6 +178,11 @@ private:
 
     ///
     std::vector<std::shared_ptr<PovraySceneElement>> elements_;
+    ///
+    PovraySceneBVH bvh_;
+    ///
+    PovraySceneArrays arrays_;
+    bool accelerationStructureDirty_;
 };
 
 #endif /* PovrayScene_hpp */
@@ -0,0 +1,150 @@
+//
+//  PovraySceneArrays.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "PovraySceneArrays.hpp"
+
+///
+void
+PovraySceneArrays::assign(const std::vector<std::shared_ptr<PovraySceneElement>> & elements) {
+    materials.clear();
+    elementMaterials.assign(elements.size(), -1);
+    elementPrimitives.assign(elements.size(), Primitive {NoPrimitive, -1});
+    spheres = Spheres();
+    planes = Planes();
+    triangles = Triangles();
+    lights = Lights();
+
+    for (int elementItr = 0; elementItr < (int) elements.size(); elementItr++) {
+        const PovraySceneElement * element = elements[elementItr].get();
+
+        if (auto light = dynamic_cast<const PovrayLightSource *>(element)) {
+            lights.positionX.push_back(light->position().x());
+            lights.positionY.push_back(light->position().y());
+            lights.positionZ.push_back(light->position().z());
+            lights.colorR.push_back(light->color().x());
+            lights.colorG.push_back(light->color().y());
+            lights.colorB.push_back(light->color().z());
+            lights.colorF.push_back(light->color().w());
+            continue;
+        }
+
+        if (element->pigment() == nullptr) {
+            continue;
+        }
+
+        int material = (int) materials.size();
+        PovrayMaterial elementMaterial;
+        elementMaterial.pigment = *element->pigment();
+        elementMaterial.finish = *element->finish();
+        materials.push_back(elementMaterial);
+        elementMaterials[elementItr] = material;
+
+        if (auto sphere = dynamic_cast<const PovraySphere *>(element)) {
+            auto data = sphere->data();
+            elementPrimitives[elementItr] = Primitive {SpherePrimitive, spheres.size()};
+            spheres.centerX.push_back(data.position.x());
+            spheres.centerY.push_back(data.position.y());
+            spheres.centerZ.push_back(data.position.z());
+            spheres.radius.push_back(data.radius);
+            spheres.material.push_back(material);
+            spheres.element.push_back(elementItr);
+        }
+        else if (auto plane = dynamic_cast<const PovrayPlane *>(element)) {
+            auto data = plane->data();
+            elementPrimitives[elementItr] = Primitive {PlanePrimitive, planes.size()};
+            planes.normalX.push_back(data.normal.x());
+            planes.normalY.push_back(data.normal.y());
+            planes.normalZ.push_back(data.normal.z());
+            planes.distance.push_back(data.distance);
+            planes.material.push_back(material);
+            planes.element.push_back(elementItr);
+        }
+        else if (auto triangle = dynamic_cast<const PovrayTriangle *>(element)) {
+            auto data = triangle->data();
+            elementPrimitives[elementItr] = Primitive {TrianglePrimitive, triangles.size()};
+            addTriangle(data.a, data.b, data.c, material, elementItr);
+        }
+        else if (auto mesh = dynamic_cast<const PovrayTriangleMesh *>(element)) {
+            auto triangleMesh = mesh->mesh();
+            elementPrimitives[elementItr] = Primitive {MeshPrimitive, triangles.size()};
+            for (int triangleItr = 0; triangleItr < triangleMesh->numTriangles(); triangleItr++) {
+                addTriangle(triangleMesh->vertex(triangleItr, 0), triangleMesh->vertex(triangleItr, 1), triangleMesh->vertex(triangleItr, 2), material, elementItr);
+            }
+        }
+    }
+}
+
+///
+void
+PovraySceneArrays::addTriangle(const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c, int material, int element) {
+    triangles.ax.push_back(a.x());
+    triangles.ay.push_back(a.y());
+    triangles.az.push_back(a.z());
+    triangles.bx.push_back(b.x());
+    triangles.by.push_back(b.y());
+    triangles.bz.push_back(b.z());
+    triangles.cx.push_back(c.x());
+    triangles.cy.push_back(c.y());
+    triangles.cz.push_back(c.z());
+    triangles.material.push_back(material);
+    triangles.element.push_back(element);
+}
+
+///
+PovraySphereData
+PovraySceneArrays::sphereData(int sphere) const {
+    PovraySphereData dat;
+
+    dat.position = Eigen::Vector3f(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]);
+    dat.radius = spheres.radius[sphere];
+    dat.pigment = materials[spheres.material[sphere]].pigment;
+    dat.finish = materials[spheres.material[sphere]].finish;
+    dat.id = spheres.element[sphere];
+
+    return dat;
+}
+
+///
+PovrayPlaneData
+PovraySceneArrays::planeData(int plane) const {
+    PovrayPlaneData dat;
+
+    dat.normal = Eigen::Vector3f(planes.normalX[plane], planes.normalY[plane], planes.normalZ[plane]);
+    dat.distance = planes.distance[plane];
+    dat.pigment = materials[planes.material[plane]].pigment;
+    dat.finish = materials[planes.material[plane]].finish;
+    dat.id = planes.element[plane];
+
+    return dat;
+}
+
+///
+PovrayTriangleData
+PovraySceneArrays::triangleData(int triangle) const {
+    PovrayTriangleData dat;
+
+    dat.a = triangleVertex(triangle, 0);
+    dat.b = triangleVertex(triangle, 1);
+    dat.c = triangleVertex(triangle, 2);
+    dat.pigment = materials[triangles.material[triangle]].pigment;
+    dat.finish = materials[triangles.material[triangle]].finish;
+    dat.id = triangles.element[triangle];
+
+    return dat;
+}
+
+///
+PovrayLightSourceData
+PovraySceneArrays::lightData(int light) const {
+    PovrayLightSourceData dat;
+
+    dat.position = lights.position(light);
+    dat.color = lights.color(light);
+
+    return dat;
+}
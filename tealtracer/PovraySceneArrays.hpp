@@ -0,0 +1,172 @@
+//
+//  PovraySceneArrays.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PovraySceneArrays_hpp
+#define PovraySceneArrays_hpp
+
+#include <memory>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "PovraySceneElement.hpp"
+#include "PovraySceneElements.hpp"
+
+///
+/// A finished scene's elements copied into one array per field and element
+///     type, with materials shared by index. Built once when the scene's
+///     acceleration structure is, so renderers and the OpenCL upload read
+///     lights, materials and primitives from here instead of searching and
+///     casting the scene's elements every frame. The BVH intersects spheres,
+///     planes and loose triangles straight out of these arrays.
+///
+class PovraySceneArrays {
+public:
+
+    ///
+    struct Spheres {
+        std::vector<float> centerX, centerY, centerZ, radius;
+        /// Index into "materials"
+        std::vector<int> material;
+        /// Index of the scene element, which is also its id
+        std::vector<int> element;
+
+        ///
+        int size() const {
+            return (int) radius.size();
+        }
+    };
+
+    ///
+    struct Planes {
+        std::vector<float> normalX, normalY, normalZ, distance;
+        std::vector<int> material;
+        std::vector<int> element;
+
+        ///
+        int size() const {
+            return (int) distance.size();
+        }
+    };
+
+    /// Loose triangles and every triangle of every mesh
+    struct Triangles {
+        std::vector<float> ax, ay, az, bx, by, bz, cx, cy, cz;
+        std::vector<int> material;
+        std::vector<int> element;
+
+        ///
+        int size() const {
+            return (int) ax.size();
+        }
+    };
+
+    ///
+    struct Lights {
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> colorR, colorG, colorB, colorF;
+
+        ///
+        int size() const {
+            return (int) positionX.size();
+        }
+        ///
+        Eigen::Vector3f position(int light) const {
+            return Eigen::Vector3f(positionX[light], positionY[light], positionZ[light]);
+        }
+        ///
+        Eigen::Vector4f color(int light) const {
+            return Eigen::Vector4f(colorR[light], colorG[light], colorB[light], colorF[light]);
+        }
+    };
+
+    /// Which array, if any, holds a scene element
+    enum PrimitiveType {
+        NoPrimitive,
+        SpherePrimitive,
+        PlanePrimitive,
+        TrianglePrimitive,
+        /// Meshes keep their own hierarchy, so they're intersected through
+        ///     the element even though their triangles are in "triangles"
+        MeshPrimitive,
+    };
+
+    ///
+    struct Primitive {
+        PrimitiveType type;
+        /// Index into the array "type" names
+        int index;
+    };
+
+    std::vector<PovrayMaterial> materials;
+    /// Index into "materials" of every scene element, -1 for the ones that
+    ///     aren't drawn (cameras and lights)
+    std::vector<int> elementMaterials;
+    /// Where every scene element ended up
+    std::vector<Primitive> elementPrimitives;
+
+    Spheres spheres;
+    Planes planes;
+    Triangles triangles;
+    Lights lights;
+
+    /// Replaces the contents with the elements of a scene, in scene order.
+    void assign(const std::vector<std::shared_ptr<PovraySceneElement>> & elements);
+
+    /// Hit tests against one sphere, plane or triangle, matching the
+    ///     elements' own "intersect" and "intersectPacket".
+    RayIntersectionResult intersectSphere(int sphere, const Ray & ray) const {
+        return PovraySphere::intersect(ray, Eigen::Vector3f(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]), spheres.radius[sphere]);
+    }
+    ///
+    RayIntersectionResult intersectPlane(int plane, const Ray & ray) const {
+        return PovrayPlane::intersect(ray, Eigen::Vector3f(planes.normalX[plane], planes.normalY[plane], planes.normalZ[plane]), planes.distance[plane]);
+    }
+    ///
+    RayIntersectionResult intersectTriangle(int triangle, const Ray & ray) const {
+        return PovrayTriangle::intersect(ray, triangleVertex(triangle, 0), triangleVertex(triangle, 1), triangleVertex(triangle, 2));
+    }
+    ///
+    void intersectSphere(int sphere, const RayPacket & packet, RayPacketHits & hits) const {
+        packet.intersectSphere(Eigen::Vector3f(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]), spheres.radius[sphere], spheres.element[sphere], hits);
+    }
+    ///
+    void intersectPlane(int plane, const RayPacket & packet, RayPacketHits & hits) const {
+        packet.intersectPlane(Eigen::Vector3f(planes.normalX[plane], planes.normalY[plane], planes.normalZ[plane]), planes.distance[plane], planes.element[plane], hits);
+    }
+    ///
+    void intersectTriangle(int triangle, const RayPacket & packet, RayPacketHits & hits) const {
+        packet.intersectTriangle(triangleVertex(triangle, 0), triangleVertex(triangle, 1), triangleVertex(triangle, 2), triangles.element[triangle], hits);
+    }
+
+    /// Vertex 0, 1 or 2 of a triangle
+    Eigen::Vector3f triangleVertex(int triangle, int vertex) const {
+        switch (vertex) {
+            case 0:
+                return Eigen::Vector3f(triangles.ax[triangle], triangles.ay[triangle], triangles.az[triangle]);
+            case 1:
+                return Eigen::Vector3f(triangles.bx[triangle], triangles.by[triangle], triangles.bz[triangle]);
+            default:
+                return Eigen::Vector3f(triangles.cx[triangle], triangles.cy[triangle], triangles.cz[triangle]);
+        }
+    }
+
+    /// The records uploaded to the OpenCL kernels
+    PovraySphereData sphereData(int sphere) const;
+    PovrayPlaneData planeData(int plane) const;
+    PovrayTriangleData triangleData(int triangle) const;
+    PovrayLightSourceData lightData(int light) const;
+
+private:
+
+    ///
+    void addTriangle(const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c, int material, int element);
+};
+
+#endif /* PovraySceneArrays_hpp */
@@ -0,0 +1,407 @@
+//
+//  PovraySceneBVH.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/2/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "PovraySceneBVH.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+/// Number of centroid bins evaluated per split
+static const int kNumBins = 16;
+/// Nodes with at most this many primitives may become leaves
+static const int kMaxLeafSize = 4;
+/// Past this depth we split at the median so the traversal stack stays bounded
+static const int kMaxSAHDepth = 48;
+/// Traversal stack size; median splits keep the depth well under this
+static const int kMaxStackSize = 128;
+/// Relative cost of visiting a node compared to intersecting a primitive
+static const float kTraversalCost = 1.0f;
+
+///
+static float
+halfSurfaceArea(const Eigen::Vector3f & minExtent, const Eigen::Vector3f & maxExtent) {
+    Eigen::Vector3f d = maxExtent - minExtent;
+    return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+}
+
+/// Tests one element, reading spheres, planes and triangles out of "arrays"
+static RayIntersectionResult
+intersectElement(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, int element, const Ray & ray) {
+    const PovraySceneArrays::Primitive & primitive = arrays.elementPrimitives[element];
+    switch (primitive.type) {
+        case PovraySceneArrays::SpherePrimitive:
+            return arrays.intersectSphere(primitive.index, ray);
+        case PovraySceneArrays::PlanePrimitive:
+            return arrays.intersectPlane(primitive.index, ray);
+        case PovraySceneArrays::TrianglePrimitive:
+            return arrays.intersectTriangle(primitive.index, ray);
+        default:
+            return elements[element]->intersect(ray);
+    }
+}
+
+/// Packet version of the above
+static void
+intersectElement(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, int element, const RayPacket & packet, RayPacketHits & hits) {
+    const PovraySceneArrays::Primitive & primitive = arrays.elementPrimitives[element];
+    switch (primitive.type) {
+        case PovraySceneArrays::SpherePrimitive:
+            arrays.intersectSphere(primitive.index, packet, hits);
+            break;
+        case PovraySceneArrays::PlanePrimitive:
+            arrays.intersectPlane(primitive.index, packet, hits);
+            break;
+        case PovraySceneArrays::TrianglePrimitive:
+            arrays.intersectTriangle(primitive.index, packet, hits);
+            break;
+        default:
+            elements[element]->intersectPacket(packet, element, hits);
+            break;
+    }
+}
+
+///
+PovraySceneBVH::PovraySceneBVH() {
+
+}
+
+///
+void
+PovraySceneBVH::build(const std::vector<std::shared_ptr<PovraySceneElement>> & elements) {
+    nodes_.clear();
+    primitiveIndices_.clear();
+    unboundedIndices_.clear();
+
+    std::vector<BuildPrimitive> primitives;
+    primitives.reserve(elements.size());
+
+    for (int i = 0; i < (int) elements.size(); i++) {
+        /// Elements without a material (cameras, lights) never report a hit
+        if (elements[i]->pigment() == nullptr) {
+            continue;
+        }
+
+        BuildPrimitive primitive;
+        if (elements[i]->boundingBox(primitive.minExtent, primitive.maxExtent)) {
+            primitive.centroid = 0.5f * (primitive.minExtent + primitive.maxExtent);
+            primitive.elementIndex = i;
+            primitives.push_back(primitive);
+        }
+        else {
+            unboundedIndices_.push_back(i);
+        }
+    }
+
+    if (primitives.size() > 0) {
+        nodes_.reserve(2 * primitives.size());
+        primitiveIndices_.reserve(primitives.size());
+        buildRecursive(primitives, 0, (int) primitives.size(), 0);
+    }
+}
+
+///
+int
+PovraySceneBVH::buildRecursive(std::vector<BuildPrimitive> & primitives, int begin, int end, int depth) {
+    int nodeIndex = (int) nodes_.size();
+    nodes_.push_back(Node());
+
+    Eigen::Vector3f minExtent = primitives[begin].minExtent, maxExtent = primitives[begin].maxExtent;
+    Eigen::Vector3f centroidMin = primitives[begin].centroid, centroidMax = primitives[begin].centroid;
+    for (int i = begin + 1; i < end; i++) {
+        minExtent = minExtent.cwiseMin(primitives[i].minExtent);
+        maxExtent = maxExtent.cwiseMax(primitives[i].maxExtent);
+        centroidMin = centroidMin.cwiseMin(primitives[i].centroid);
+        centroidMax = centroidMax.cwiseMax(primitives[i].centroid);
+    }
+
+    nodes_[nodeIndex].minExtent = minExtent;
+    nodes_[nodeIndex].maxExtent = maxExtent;
+    nodes_[nodeIndex].axis = 0;
+
+    int count = end - begin;
+
+    /// Split along the axis with the widest spread of centroids
+    Eigen::Vector3f centroidSpread = centroidMax - centroidMin;
+    int axis = 0;
+    if (centroidSpread.y() > centroidSpread(axis)) {
+        axis = 1;
+    }
+    if (centroidSpread.z() > centroidSpread(axis)) {
+        axis = 2;
+    }
+    float spread = centroidSpread(axis);
+
+    int middle = begin;
+    bool makeLeaf = count <= 1;
+
+    if (!makeLeaf && spread > 0.0f && depth < kMaxSAHDepth) {
+        int binCounts[kNumBins];
+        Eigen::Vector3f binMin[kNumBins], binMax[kNumBins];
+        for (int b = 0; b < kNumBins; b++) {
+            binCounts[b] = 0;
+            binMin[b] = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+            binMax[b] = Eigen::Vector3f::Constant(-std::numeric_limits<float>::infinity());
+        }
+
+        float binScale = (float) kNumBins / spread;
+        for (int i = begin; i < end; i++) {
+            int b = std::min<int>(kNumBins - 1, (int) ((primitives[i].centroid(axis) - centroidMin(axis)) * binScale));
+            binCounts[b]++;
+            binMin[b] = binMin[b].cwiseMin(primitives[i].minExtent);
+            binMax[b] = binMax[b].cwiseMax(primitives[i].maxExtent);
+        }
+
+        /// Sweep from the right to get the cost of everything past each split
+        float rightArea[kNumBins];
+        int rightCount[kNumBins];
+        Eigen::Vector3f sweepMin = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+        Eigen::Vector3f sweepMax = Eigen::Vector3f::Constant(-std::numeric_limits<float>::infinity());
+        int sweepCount = 0;
+        for (int b = kNumBins - 1; b > 0; b--) {
+            sweepMin = sweepMin.cwiseMin(binMin[b]);
+            sweepMax = sweepMax.cwiseMax(binMax[b]);
+            sweepCount += binCounts[b];
+            rightArea[b] = sweepCount > 0 ? halfSurfaceArea(sweepMin, sweepMax) : 0.0f;
+            rightCount[b] = sweepCount;
+        }
+
+        /// Then from the left, splitting between bin "b" and "b + 1"
+        int bestSplit = -1;
+        float bestCost = std::numeric_limits<float>::infinity();
+        sweepMin = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+        sweepMax = Eigen::Vector3f::Constant(-std::numeric_limits<float>::infinity());
+        sweepCount = 0;
+        for (int b = 0; b < kNumBins - 1; b++) {
+            sweepMin = sweepMin.cwiseMin(binMin[b]);
+            sweepMax = sweepMax.cwiseMax(binMax[b]);
+            sweepCount += binCounts[b];
+            if (sweepCount == 0 || rightCount[b + 1] == 0) {
+                continue;
+            }
+
+            float cost = sweepCount * halfSurfaceArea(sweepMin, sweepMax) + rightCount[b + 1] * rightArea[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        float nodeArea = halfSurfaceArea(minExtent, maxExtent);
+        float splitCost = nodeArea > 0.0f ? kTraversalCost + bestCost / nodeArea : kTraversalCost;
+
+        if (bestSplit < 0 || (count <= kMaxLeafSize && splitCost >= (float) count)) {
+            makeLeaf = count <= kMaxLeafSize;
+        }
+        else {
+            middle = (int) (std::partition(primitives.begin() + begin, primitives.begin() + end, [=](const BuildPrimitive & primitive) {
+                int b = std::min<int>(kNumBins - 1, (int) ((primitive.centroid(axis) - centroidMin(axis)) * binScale));
+                return b <= bestSplit;
+            }) - primitives.begin());
+        }
+    }
+    else if (!makeLeaf) {
+        makeLeaf = count <= kMaxLeafSize;
+    }
+
+    if (makeLeaf) {
+        nodes_[nodeIndex].offset = (int) primitiveIndices_.size();
+        nodes_[nodeIndex].count = count;
+        for (int i = begin; i < end; i++) {
+            primitiveIndices_.push_back(primitives[i].elementIndex);
+        }
+        return nodeIndex;
+    }
+
+    /// Fall back to a median split when binning could not separate anything
+    if (middle <= begin || middle >= end) {
+        middle = begin + count / 2;
+        std::nth_element(primitives.begin() + begin, primitives.begin() + middle, primitives.begin() + end, [=](const BuildPrimitive & lhs, const BuildPrimitive & rhs) {
+            return lhs.centroid(axis) < rhs.centroid(axis);
+        });
+    }
+
+    nodes_[nodeIndex].axis = axis;
+    nodes_[nodeIndex].count = 0;
+
+    buildRecursive(primitives, begin, middle, depth + 1);
+    int rightChild = buildRecursive(primitives, middle, end, depth + 1);
+    nodes_[nodeIndex].offset = rightChild;
+
+    return nodeIndex;
+}
+
+///
+bool
+PovraySceneBVH::rayHitsBox(const Eigen::Vector3f & origin, const Eigen::Vector3f & inverseDirection, const Eigen::Vector3f & minExtent, const Eigen::Vector3f & maxExtent, float maxTime) {
+    float tEnter = 0.0f, tExit = maxTime;
+    for (int a = 0; a < 3; a++) {
+        float tNear = (minExtent(a) - origin(a)) * inverseDirection(a);
+        float tFar = (maxExtent(a) - origin(a)) * inverseDirection(a);
+        if (tNear > tFar) {
+            std::swap(tNear, tFar);
+        }
+        tEnter = tNear > tEnter ? tNear : tEnter;
+        tExit = tFar < tExit ? tFar : tExit;
+        if (tEnter > tExit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+///
+int
+PovraySceneBVH::closestIntersection(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const Ray & ray, RayIntersectionResult & hit) const {
+    int closestIndex = -1;
+    float closestTime = std::numeric_limits<float>::infinity();
+
+    for (int i = 0; i < (int) unboundedIndices_.size(); i++) {
+        auto hitTest = intersectElement(elements, arrays, unboundedIndices_[i], ray);
+        if (hitTest.intersected && hitTest.timeOfIntersection < closestTime) {
+            closestIndex = unboundedIndices_[i];
+            closestTime = hitTest.timeOfIntersection;
+            hit = hitTest;
+        }
+    }
+
+    if (nodes_.size() == 0) {
+        return closestIndex;
+    }
+
+    Eigen::Vector3f inverseDirection = ray.direction.cwiseInverse();
+    int stack[kMaxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const Node & node = nodes_[nodeIndex];
+        if (!rayHitsBox(ray.origin, inverseDirection, node.minExtent, node.maxExtent, closestTime)) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                auto hitTest = intersectElement(elements, arrays, primitiveIndices_[i], ray);
+                if (hitTest.intersected && hitTest.timeOfIntersection < closestTime) {
+                    closestIndex = primitiveIndices_[i];
+                    closestTime = hitTest.timeOfIntersection;
+                    hit = hitTest;
+                }
+            }
+        }
+        else {
+            /// Push the far child first so the near child is visited first
+            ///     and can shrink "closestTime" before the far one is tested.
+            int leftChild = nodeIndex + 1;
+            assert(stackSize + 2 <= kMaxStackSize);
+            if (ray.direction(node.axis) > 0.0f) {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = leftChild;
+            }
+            else {
+                stack[stackSize++] = leftChild;
+                stack[stackSize++] = node.offset;
+            }
+        }
+    }
+
+    return closestIndex;
+}
+
+///
+void
+PovraySceneBVH::closestIntersection(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const RayPacket & packet, RayPacketHits & hits) const {
+
+    for (int i = 0; i < (int) unboundedIndices_.size(); i++) {
+        intersectElement(elements, arrays, unboundedIndices_[i], packet, hits);
+    }
+
+    if (nodes_.size() == 0 || packet.activeMask == 0) {
+        return;
+    }
+
+    /// Order children by the first active ray; the rays are expected to be
+    ///     roughly parallel.
+    int leadRay = __builtin_ctz(packet.activeMask);
+    float leadDirection[3] = {packet.directionX[leadRay], packet.directionY[leadRay], packet.directionZ[leadRay]};
+
+    int stack[kMaxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const Node & node = nodes_[nodeIndex];
+        if (packet.hitsBox(node.minExtent, node.maxExtent, hits) == 0) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                intersectElement(elements, arrays, primitiveIndices_[i], packet, hits);
+            }
+        }
+        else {
+            int leftChild = nodeIndex + 1;
+            assert(stackSize + 2 <= kMaxStackSize);
+            if (leadDirection[node.axis] > 0.0f) {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = leftChild;
+            }
+            else {
+                stack[stackSize++] = leftChild;
+                stack[stackSize++] = node.offset;
+            }
+        }
+    }
+}
+
+///
+void
+PovraySceneBVH::allIntersections(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const Ray & ray, std::vector<std::pair<int, RayIntersectionResult>> & hits) const {
+
+    for (int i = 0; i < (int) unboundedIndices_.size(); i++) {
+        auto hitTest = intersectElement(elements, arrays, unboundedIndices_[i], ray);
+        if (hitTest.intersected) {
+            hits.push_back(std::make_pair(unboundedIndices_[i], hitTest));
+        }
+    }
+
+    if (nodes_.size() == 0) {
+        return;
+    }
+
+    Eigen::Vector3f inverseDirection = ray.direction.cwiseInverse();
+    int stack[kMaxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const Node & node = nodes_[nodeIndex];
+        if (!rayHitsBox(ray.origin, inverseDirection, node.minExtent, node.maxExtent, std::numeric_limits<float>::infinity())) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                auto hitTest = intersectElement(elements, arrays, primitiveIndices_[i], ray);
+                if (hitTest.intersected) {
+                    hits.push_back(std::make_pair(primitiveIndices_[i], hitTest));
+                }
+            }
+        }
+        else {
+            assert(stackSize + 2 <= kMaxStackSize);
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+}
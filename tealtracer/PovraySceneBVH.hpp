@@ -0,0 +1,96 @@
+//
+//  PovraySceneBVH.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/2/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef PovraySceneBVH_hpp
+#define PovraySceneBVH_hpp
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "PovraySceneElement.hpp"
+#include "PovraySceneArrays.hpp"
+
+///
+/// Bounding volume hierarchy over the bounded elements of a scene (spheres,
+///     triangles, ...). Nodes are stored depth-first in one flat array so a
+///     node's left child always directly follows it. Elements without a
+///     bounding box (planes) are kept in a separate list and tested against
+///     every ray. Elements without a material (cameras, lights) can never be
+///     hit and are left out entirely. Spheres, planes and triangles are
+///     intersected from the scene's PovraySceneArrays; anything else (meshes)
+///     through its element.
+///
+class PovraySceneBVH {
+public:
+
+    ///
+    struct Node {
+        Eigen::Vector3f minExtent;
+        Eigen::Vector3f maxExtent;
+        /// Leaves: first index into "primitiveIndices". Interior nodes: index
+        ///     of the right child.
+        int offset;
+        /// Number of primitives in a leaf, 0 for interior nodes.
+        int count;
+        /// Axis the interior node was split along.
+        int axis;
+    };
+
+    ///
+    PovraySceneBVH();
+
+    /// Rebuilds the hierarchy with a binned surface area heuristic.
+    void build(const std::vector<std::shared_ptr<PovraySceneElement>> & elements);
+
+    /// Finds the closest hit along "ray" among "elements" (the same vector the
+    ///     hierarchy was built from, and "arrays" was assigned from) and
+    ///     returns its index, or -1 on a miss.
+    int closestIntersection(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const Ray & ray, RayIntersectionResult & hit) const;
+
+    /// Packet version of the above: records the closest hit of every active
+    ///     ray of "packet" in "hits". A node is visited as long as any of the
+    ///     rays still enters it, so coherent rays share one traversal.
+    void closestIntersection(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const RayPacket & packet, RayPacketHits & hits) const;
+
+    /// Appends every hit along "ray" as (element index, hit) pairs.
+    void allIntersections(const std::vector<std::shared_ptr<PovraySceneElement>> & elements, const PovraySceneArrays & arrays, const Ray & ray, std::vector<std::pair<int, RayIntersectionResult>> & hits) const;
+
+    ///
+    const std::vector<Node> & nodes() const {
+        return nodes_;
+    }
+
+    /// Slab test: whether the ray enters [minExtent, maxExtent] between 0 and
+    ///     "maxTime".
+    static bool rayHitsBox(const Eigen::Vector3f & origin, const Eigen::Vector3f & inverseDirection, const Eigen::Vector3f & minExtent, const Eigen::Vector3f & maxExtent, float maxTime);
+
+private:
+
+    ///
+    struct BuildPrimitive {
+        Eigen::Vector3f minExtent;
+        Eigen::Vector3f maxExtent;
+        Eigen::Vector3f centroid;
+        int elementIndex;
+    };
+
+    ///
+    int buildRecursive(std::vector<BuildPrimitive> & primitives, int begin, int end, int depth);
+
+    std::vector<Node> nodes_;
+    /// Element indices referenced by the leaves
+    std::vector<int> primitiveIndices_;
+    /// Element indices that have no bounding box
+    std::vector<int> unboundedIndices_;
+};
+
+#endif /* PovraySceneBVH_hpp */
@@ -30,6 +30,21 @@ static inline void trim(std::string &s) {
 ///
 PovraySceneElement::~PovraySceneElement() {}
 
+///
+void
+PovraySceneElement::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) {
+    unsigned int mask = packet.activeMask;
+    while (mask != 0) {
+        int i = __builtin_ctz(mask);
+        auto hitTest = intersect(packet.ray(i));
+        if (hitTest.intersected && hitTest.timeOfIntersection < hits.times[i]) {
+            hits.times[i] = hitTest.timeOfIntersection;
+            hits.elementIndices[i] = elementIndex;
+        }
+        mask &= mask - 1;
+    }
+}
+
 ///
 void
 PovraySceneElement::parseBody(std::string & body, const std::map<std::string, std::pair<ValueType, void *>> & contentMapping) {
@@ -18,6 +18,7 @@
 
 #include "TSLogger.hpp"
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 
 ///
 struct PovrayPigment {
@@ -38,6 +39,12 @@ struct PovrayFinish {
     PovrayFinish() : ambient(0), diffuse(0), specular(0), roughness(0) {}
 };
 
+/// Everything shading needs to know about a surface
+struct PovrayMaterial {
+    PovrayPigment pigment;
+    PovrayFinish finish;
+};
+
 ///
 
 
@@ -55,6 +62,17 @@ public:
     ///
     virtual RayIntersectionResult intersect(const Ray & ray) = 0;
     
+    /// Tests the active rays of "packet" against this element, which is
+    ///     "elementIndex" in its scene, and records any closer hits in "hits".
+    ///     Elements without a packet kernel test one ray at a time.
+    virtual void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits);
+    
+    /// Fills in an axis-aligned box around this element. Returns false for
+    ///     elements that are unbounded (planes) or have no extent at all.
+    virtual bool boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const {
+        return false;
+    }
+    
     ///
     virtual PovrayPigment const * pigment() const = 0;
     ///
@@ -8,6 +8,9 @@
 
 #include "PovraySceneElements.hpp"
 
+#include <sstream>
+#include <tuple>
+
 /// Sets this element's content to "body"
 void PovrayCamera::parse(const std::string & body) {
 //        TSLoggerLog(std::cout, "parsing camera");
@@ -186,17 +189,26 @@ void PovraySphere::write(std::ostream & out) const {
 
 ///
 RayIntersectionResult PovraySphere::intersect(const Ray & ray) {
+    return intersect(ray, position_, radius_);
+}
+
+///
+RayIntersectionResult PovraySphere::intersect(const Ray & ray, const Eigen::Vector3f & position, float radius) {
     RayIntersectionResult result;
     
+    /// Solves A t^2 + 2 halfB t + C = 0. "halfB^2 - A C" cancels badly for
+    ///     rays that pass near the silhouette, so it is computed from the
+    ///     distance between the center and the ray's line instead.
+    Eigen::Vector3f toOrigin = ray.origin - position;
     float A = ray.direction.dot(ray.direction);
-    float B = 2.0 * (ray.origin - position_).dot(ray.direction);
-    float C = (ray.origin - position_).dot(ray.origin - position_) - radius_ * radius_;
+    float halfB = toOrigin.dot(ray.direction);
+    Eigen::Vector3f toLine = toOrigin - (halfB / A) * ray.direction;
     
-    float radical = B*B - 4.0*A*C;
+    float radical = A * (radius * radius - toLine.dot(toLine));
     if (radical >= 0) {
         float sqrRadical = std::sqrt(radical);
-        float t0 = (-B + sqrRadical)/(2.0 * A);
-        float t1 = (-B - sqrRadical)/(2.0 * A);
+        float t0 = (sqrRadical - halfB) / A;
+        float t1 = (-halfB - sqrRadical) / A;
         result.intersected = t0 >= 0 || t1 >= 0;
         result.ray = ray;
         if (t0 >= 0 && t1 >= 0) {
@@ -210,13 +222,26 @@ RayIntersectionResult PovraySphere::intersect(const Ray & ray) {
         }
         
         if (result.timeOfIntersection > 0) {
-            result.surfaceNormal = (result.locationOfIntersection() - position_).normalized();
+            result.surfaceNormal = (result.locationOfIntersection() - position).normalized();
         }
     }
     
     return result;
 }
 
+///
+void PovraySphere::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) {
+    packet.intersectSphere(position_, radius_, elementIndex, hits);
+}
+
+///
+bool PovraySphere::boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const {
+    Eigen::Vector3f radius = Eigen::Vector3f::Constant(radius_);
+    minExtent = position_ - radius;
+    maxExtent = position_ + radius;
+    return true;
+}
+
 ///
 PovrayPigment const * PovraySphere::pigment() const {
     return &pigment_;
@@ -266,19 +291,29 @@ void PovrayPlane::write(std::ostream & out) const {
 
 ///
 RayIntersectionResult PovrayPlane::intersect(const Ray & ray) {
+    return intersect(ray, normal_, distance_);
+}
+
+///
+RayIntersectionResult PovrayPlane::intersect(const Ray & ray, const Eigen::Vector3f & normal, float distance) {
     RayIntersectionResult result;
     /// https://www.cs.princeton.edu/courses/archive/fall00/cs426/lectures/raycast/sld017.htm
-    float product = ray.direction.dot(normal_);
+    float product = ray.direction.dot(normal);
     if (product > 0.001 || product < -0.001) {
-        result.timeOfIntersection = -(ray.origin.dot(normal_) - distance_) / product;
+        result.timeOfIntersection = -(ray.origin.dot(normal) - distance) / product;
         result.ray = ray;
-        result.surfaceNormal = normal_;
+        result.surfaceNormal = normal;
     }
     
     result.intersected = result.timeOfIntersection > 0.0;
     return result;
 }
 
+///
+void PovrayPlane::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) {
+    packet.intersectPlane(normal_, distance_, elementIndex, hits);
+}
+
 ///
 PovrayPigment const * PovrayPlane::pigment() const {
     return &pigment_;
@@ -333,20 +368,47 @@ void PovrayTriangle::write(std::ostream & out) const {
 
 ///
 RayIntersectionResult PovrayTriangle::intersect(const Ray & ray) {
+    return intersect(ray, a_, b_, c_);
+}
+
+///
+RayIntersectionResult PovrayTriangle::intersect(const Ray & ray, const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c) {
     RayIntersectionResult result;
     
     Eigen::Matrix3f A;
-    A.block<3,1>(0,0) = a_ - b_;
-    A.block<3,1>(0,1) = a_ - c_;
+    A.block<3,1>(0,0) = a - b;
+    A.block<3,1>(0,1) = a - c;
     A.block<3,1>(0,2) = ray.direction;
-    Eigen::Vector3f b = a_ - ray.origin;
-    Eigen::Vector3f x = A.inverse() * b;
+    Eigen::Vector3f toA = a - ray.origin;
+    Eigen::Vector3f x = A.inverse() * toA;
     
     // now "x" has Beta, Gamma, and t
+    float beta = x(0), gamma = x(1), t = x(2);
+    if (beta >= 0 && gamma >= 0 && beta + gamma <= 1 && t > 0) {
+        result.intersected = true;
+        result.timeOfIntersection = t;
+        result.ray = ray;
+        result.surfaceNormal = (b - a).cross(c - a).normalized();
+        if (result.surfaceNormal.dot(ray.direction) > 0) {
+            result.surfaceNormal = -result.surfaceNormal;
+        }
+    }
 
     return result;
 }
 
+///
+void PovrayTriangle::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) {
+    packet.intersectTriangle(a_, b_, c_, elementIndex, hits);
+}
+
+///
+bool PovrayTriangle::boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const {
+    minExtent = a_.cwiseMin(b_).cwiseMin(c_);
+    maxExtent = a_.cwiseMax(b_).cwiseMax(c_);
+    return true;
+}
+
 ///
 PovrayPigment const * PovrayTriangle::pigment() const {
     return &pigment_;
@@ -357,3 +419,216 @@ PovrayFinish const * PovrayTriangle::finish() const {
     return &finish_;
 }
 
+
+//////////////////////////////////////////////////////////////////
+
+/// Cuts the first "keyword { ... }" out of "body" and sets "block" to what
+///     was between its braces. Returns false if there is none left.
+static bool takeBlock(std::string & body, const std::string & keyword, std::string & block) {
+    auto keywordLoc = body.find(keyword);
+    if (keywordLoc == std::string::npos) {
+        return false;
+    }
+    auto openLoc = body.find("{", keywordLoc);
+    if (openLoc == std::string::npos) {
+        return false;
+    }
+    
+    int depth = 0;
+    auto closeLoc = std::string::npos;
+    for (auto loc = openLoc; loc < body.length() && closeLoc == std::string::npos; loc++) {
+        if (body[loc] == '{') {
+            depth++;
+        }
+        else if (body[loc] == '}' && --depth == 0) {
+            closeLoc = loc;
+        }
+    }
+    if (closeLoc == std::string::npos) {
+        return false;
+    }
+    
+    block = body.substr(openLoc + 1, closeLoc - openLoc - 1);
+    body.erase(keywordLoc, closeLoc + 1 - keywordLoc);
+    return true;
+}
+
+/// "block" as a stream of plain numbers, without the commas and angle
+///     brackets around vectors
+static std::stringstream numbersInBlock(std::string block) {
+    for (auto itr = block.begin(); itr != block.end(); itr++) {
+        if (*itr == ',' || *itr == '<' || *itr == '>') {
+            *itr = ' ';
+        }
+    }
+    return std::stringstream(block);
+}
+
+/// Sets this element's content to "body"
+void PovrayTriangleMesh::parse(const std::string & body) {
+    std::map<std::string, std::pair<ValueType, void *>> content;
+    
+    pigment_ = PovrayPigment();
+    finish_ = PovrayFinish();
+    file_ = "";
+    content["pigment"] = std::make_pair(PovraySceneElement::ValueType::Pigment, &pigment_);
+    content["finish"] = std::make_pair(PovraySceneElement::ValueType::Finish, &finish_);
+    
+    auto mesh = std::shared_ptr<TriangleMesh>(new TriangleMesh());
+    std::string localBody = body;
+    std::string block;
+    
+    /// A model file replaces whatever the mesh had, so it goes first
+    auto fileLoc = localBody.find("file");
+    if (fileLoc != std::string::npos) {
+        auto openQuote = localBody.find("\"", fileLoc);
+        auto closeQuote = openQuote != std::string::npos ? localBody.find("\"", openQuote + 1) : std::string::npos;
+        if (closeQuote != std::string::npos) {
+            file_ = localBody.substr(openQuote + 1, closeQuote - openQuote - 1);
+            localBody.erase(fileLoc, closeQuote + 1 - fileLoc);
+            if (mesh->loadFile(file_)) {
+                TSLoggerLog(std::cout, "loaded triangles=", mesh->numTriangles(), " from=", file_);
+            }
+        }
+    }
+    
+    /// mesh2: "vertex_vectors { count, <x,y,z>, ... }" and
+    ///     "face_indices { count, <a,b,c>, ... }"
+    int firstVertex = (int) mesh->vertices.size();
+    if (takeBlock(localBody, "vertex_vectors", block)) {
+        auto stream = numbersInBlock(block);
+        int count = 0;
+        stream >> count;
+        Eigen::Vector3f vertex;
+        for (int i = 0; i < count && (stream >> vertex.x() >> vertex.y() >> vertex.z()); i++) {
+            mesh->vertices.push_back(vertex);
+        }
+    }
+    if (takeBlock(localBody, "face_indices", block)) {
+        auto stream = numbersInBlock(block);
+        int count = 0;
+        stream >> count;
+        int a, b, c;
+        for (int i = 0; i < count && (stream >> a >> b >> c); i++) {
+            int numVertices = (int) mesh->vertices.size() - firstVertex;
+            if (a < 0 || b < 0 || c < 0 || a >= numVertices || b >= numVertices || c >= numVertices) {
+                TSLoggerLog(std::cout, "skipping face with bad index=", i);
+                continue;
+            }
+            mesh->indices.push_back(firstVertex + a);
+            mesh->indices.push_back(firstVertex + b);
+            mesh->indices.push_back(firstVertex + c);
+        }
+    }
+    
+    /// mesh: every triangle lists its own corners, so equal ones are merged
+    std::map<std::tuple<float, float, float>, int> vertexIndices;
+    auto addCorner = [&](const Eigen::Vector3f & corner) {
+        auto key = std::make_tuple(corner.x(), corner.y(), corner.z());
+        auto found = vertexIndices.find(key);
+        if (found == vertexIndices.end()) {
+            found = vertexIndices.insert(std::make_pair(key, (int) mesh->vertices.size())).first;
+            mesh->vertices.push_back(corner);
+        }
+        mesh->indices.push_back(found->second);
+    };
+    /// Corners alternate with normals, which are left out
+    while (takeBlock(localBody, "smooth_triangle", block)) {
+        auto stream = numbersInBlock(block);
+        Eigen::Vector3f corner, normal;
+        for (int i = 0; i < 3 && (stream >> corner.x() >> corner.y() >> corner.z() >> normal.x() >> normal.y() >> normal.z()); i++) {
+            addCorner(corner);
+        }
+    }
+    while (takeBlock(localBody, "triangle", block)) {
+        auto stream = numbersInBlock(block);
+        Eigen::Vector3f corner;
+        for (int i = 0; i < 3 && (stream >> corner.x() >> corner.y() >> corner.z()); i++) {
+            addCorner(corner);
+        }
+    }
+    /// Drop the corners of a triangle cut short
+    mesh->indices.resize(mesh->indices.size() - mesh->indices.size() % 3);
+    
+    parseBody(localBody, content);
+    
+    mesh->build();
+    mesh_ = mesh;
+}
+
+///
+std::shared_ptr<PovraySceneElement> PovrayTriangleMesh::copy() const {
+    auto mesh = std::shared_ptr<PovrayTriangleMesh>(new PovrayTriangleMesh());
+    /// The triangles never change once parsed, so copies share them
+    mesh->mesh_ = mesh_;
+    mesh->file_ = file_;
+    
+    mesh->pigment_ = pigment_;
+    mesh->finish_ = finish_;
+    
+    return mesh;
+}
+
+///
+void PovrayTriangleMesh::write(std::ostream & out) const {
+    if (!file_.empty()) {
+        out << "mesh {" << std::endl;
+        out << "\tfile \"" << file_ << "\"" << std::endl;
+    }
+    else {
+        out << "mesh2 {" << std::endl;
+        out << "\tvertex_vectors { " << mesh_->vertices.size();
+        for (auto itr = mesh_->vertices.begin(); itr != mesh_->vertices.end(); itr++) {
+            out << ", ";
+            writeOut(out, *itr);
+        }
+        out << " }" << std::endl;
+        out << "\tface_indices { " << mesh_->numTriangles();
+        for (int triangle = 0; triangle < mesh_->numTriangles(); triangle++) {
+            out << ", <" << mesh_->indices[3 * triangle] << ", " << mesh_->indices[3 * triangle + 1] << ", " << mesh_->indices[3 * triangle + 2] << ">";
+        }
+        out << " }" << std::endl;
+    }
+    out << "\tpigment\t" << writeOut(out, pigment_) << std::endl;
+    out << "\tfinish\t" << writeOut(out, finish_) << std::endl;
+    out << "}" << std::endl;
+}
+
+///
+RayIntersectionResult PovrayTriangleMesh::intersect(const Ray & ray) {
+    RayIntersectionResult result;
+    
+    float time = std::numeric_limits<float>::infinity();
+    int triangle = mesh_->closestIntersection(ray, time);
+    if (triangle >= 0) {
+        result.intersected = true;
+        result.timeOfIntersection = time;
+        result.ray = ray;
+        result.surfaceNormal = mesh_->faceNormal(triangle).normalized();
+        if (result.surfaceNormal.dot(ray.direction) > 0) {
+            result.surfaceNormal = -result.surfaceNormal;
+        }
+    }
+    
+    return result;
+}
+
+///
+void PovrayTriangleMesh::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) {
+    mesh_->intersectPacket(packet, elementIndex, hits);
+}
+
+///
+bool PovrayTriangleMesh::boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const {
+    return mesh_->boundingBox(minExtent, maxExtent);
+}
+
+///
+PovrayPigment const * PovrayTriangleMesh::pigment() const {
+    return &pigment_;
+}
+
+///
+PovrayFinish const * PovrayTriangleMesh::finish() const {
+    return &finish_;
+}
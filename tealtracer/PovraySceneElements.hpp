@@ -18,6 +18,7 @@
 #include "PovraySceneElement.hpp"
 #include "FrenetFrame.hpp"
 #include "MatrixMath.hpp"
+#include "TriangleMesh.hpp"
 
 ///
 struct PovrayCameraData {
@@ -187,7 +188,7 @@ public:
     }
     
     ///
-    Eigen::Vector3f getSampleDirection(const float & u, const float & v) {
+    static Eigen::Vector3f getSampleDirection(const float & u, const float & v) {
         return uniformSampleSphere(u, v).block<3,1>(0,0);
     }
     
@@ -241,6 +242,12 @@ public:
 
     ///
     virtual RayIntersectionResult intersect(const Ray & ray);
+    /// The same test against a sphere stored elsewhere (PovraySceneArrays)
+    static RayIntersectionResult intersect(const Ray & ray, const Eigen::Vector3f & position, float radius);
+    ///
+    virtual void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits);
+    ///
+    virtual bool boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const;
     
     ///
     virtual PovrayPigment const * pigment() const;
@@ -295,6 +302,10 @@ public:
 
     ///
     virtual RayIntersectionResult intersect(const Ray & ray);
+    /// The same test against a plane stored elsewhere (PovraySceneArrays)
+    static RayIntersectionResult intersect(const Ray & ray, const Eigen::Vector3f & normal, float distance);
+    ///
+    virtual void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits);
     
     ///
     virtual PovrayPigment const * pigment() const;
@@ -345,6 +356,12 @@ public:
 
     ///
     virtual RayIntersectionResult intersect(const Ray & ray);
+    /// The same test against a triangle stored elsewhere (PovraySceneArrays)
+    static RayIntersectionResult intersect(const Ray & ray, const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c);
+    ///
+    virtual void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits);
+    ///
+    virtual bool boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const;
     
     ///
     virtual PovrayPigment const * pigment() const;
@@ -373,4 +390,49 @@ private:
     PovrayFinish finish_;
 };
 
+///
+/// Any number of triangles with one material, sharing their vertices. Reads
+///     POV-Ray's "mesh { triangle {...} ... }" and "mesh2 { vertex_vectors
+///     {...} face_indices {...} }", as well as "mesh { file "model.obj" }"
+///     (or ".ply") to load a model from disk, relative to the working
+///     directory like the scene file itself.
+///
+class PovrayTriangleMesh : public PovraySceneElement {
+public:
+
+    /// Sets this element's content to "body"
+    virtual void parse(const std::string & body);
+    ///
+    virtual std::shared_ptr<PovraySceneElement> copy() const;
+    ///
+    virtual void write(std::ostream & out) const;
+
+    /// The hit on the closest triangle
+    virtual RayIntersectionResult intersect(const Ray & ray);
+    ///
+    virtual void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits);
+    ///
+    virtual bool boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const;
+    
+    ///
+    virtual PovrayPigment const * pigment() const;
+    ///
+    virtual PovrayFinish const * finish() const;
+
+    ///
+    std::shared_ptr<const TriangleMesh> mesh() const {
+        return mesh_;
+    }
+
+private:
+
+    /// Shared between copies, and never changed once parsed
+    std::shared_ptr<const TriangleMesh> mesh_;
+    /// Empty unless the triangles came from a model file
+    std::string file_;
+    
+    PovrayPigment pigment_;
+    PovrayFinish finish_;
+};
+
 #endif /* PovraySceneElements_hpp */
@@ -0,0 +1,175 @@
+//
+//  RayPacket.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/5/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "RayPacket.hpp"
+#include "PacketLanes.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+///
+static inline PacketLanes
+dot(const PacketLanes & ax, const PacketLanes & ay, const PacketLanes & az, const Eigen::Vector3f & b) {
+    return ax * broadcast(b.x()) + ay * broadcast(b.y()) + az * broadcast(b.z());
+}
+
+/// Keeps "times" where "hit" is set and points those rays at "elementIndex".
+static inline void
+recordHits(const PacketLanes & hit, const PacketLanes & times, int elementIndex, RayPacketHits & hits) {
+    store(hits.times, select(hit, times, load(hits.times)));
+
+    unsigned int mask = bits(hit);
+    while (mask != 0) {
+        hits.elementIndices[__builtin_ctz(mask)] = elementIndex;
+        mask &= mask - 1;
+    }
+}
+
+///
+void
+RayPacketHits::reset() {
+    for (int i = 0; i < RayPacket::Size; i++) {
+        times[i] = std::numeric_limits<float>::infinity();
+        elementIndices[i] = -1;
+    }
+}
+
+///
+RayPacket::RayPacket() {
+    /// Inactive lanes still go through the arithmetic, so keep them finite
+    ///     instead of uninitialized.
+    for (int i = 0; i < Size; i++) {
+        originX[i] = originY[i] = originZ[i] = 0.0f;
+        directionX[i] = directionY[i] = directionZ[i] = 1.0f;
+        inverseDirectionX[i] = inverseDirectionY[i] = inverseDirectionZ[i] = 1.0f;
+    }
+    activeMask = 0;
+}
+
+///
+void
+RayPacket::setRay(int i, const Ray & ray) {
+    assert(i >= 0 && i < Size);
+
+    originX[i] = ray.origin.x();
+    originY[i] = ray.origin.y();
+    originZ[i] = ray.origin.z();
+    directionX[i] = ray.direction.x();
+    directionY[i] = ray.direction.y();
+    directionZ[i] = ray.direction.z();
+    inverseDirectionX[i] = 1.0f / ray.direction.x();
+    inverseDirectionY[i] = 1.0f / ray.direction.y();
+    inverseDirectionZ[i] = 1.0f / ray.direction.z();
+    activeMask |= 1u << i;
+}
+
+///
+Ray
+RayPacket::ray(int i) const {
+    assert(i >= 0 && i < Size);
+
+    Ray ray;
+    ray.origin = Eigen::Vector3f(originX[i], originY[i], originZ[i]);
+    ray.direction = Eigen::Vector3f(directionX[i], directionY[i], directionZ[i]);
+    return ray;
+}
+
+///
+unsigned int
+RayPacket::hitsBox(const Eigen::Vector3f & minExtent, const Eigen::Vector3f & maxExtent, const RayPacketHits & hits) const {
+    const float * origins[3] = {originX, originY, originZ};
+    const float * inverseDirections[3] = {inverseDirectionX, inverseDirectionY, inverseDirectionZ};
+
+    /// Same slab test as "PovraySceneBVH::rayHitsBox": a NaN from "0 * inf"
+    ///     leaves the running interval alone.
+    PacketLanes tEnter = broadcast(0.0f), tExit = load(hits.times);
+    for (int a = 0; a < 3; a++) {
+        PacketLanes origin = load(origins[a]), inverseDirection = load(inverseDirections[a]);
+        PacketLanes tNear = (broadcast(minExtent(a)) - origin) * inverseDirection;
+        PacketLanes tFar = (broadcast(maxExtent(a)) - origin) * inverseDirection;
+        tEnter = maximum(minimum(tNear, tFar), tEnter);
+        tExit = minimum(maximum(tNear, tFar), tExit);
+    }
+
+    return bits(tEnter <= tExit) & activeMask;
+}
+
+///
+void
+RayPacket::intersectSphere(const Eigen::Vector3f & center, float radius, int elementIndex, RayPacketHits & hits) const {
+    PacketLanes dx = load(directionX), dy = load(directionY), dz = load(directionZ);
+    PacketLanes ocx = load(originX) - broadcast(center.x());
+    PacketLanes ocy = load(originY) - broadcast(center.y());
+    PacketLanes ocz = load(originZ) - broadcast(center.z());
+    PacketLanes zero = broadcast(0.0f);
+
+    /// Same formulation as "PovraySphere::intersect", so both agree on rays
+    ///     that pass near the silhouette.
+    PacketLanes A = dx * dx + dy * dy + dz * dz;
+    PacketLanes halfB = ocx * dx + ocy * dy + ocz * dz;
+    PacketLanes alongRay = halfB / A;
+    PacketLanes lx = ocx - alongRay * dx, ly = ocy - alongRay * dy, lz = ocz - alongRay * dz;
+    PacketLanes radical = A * (broadcast(radius * radius) - (lx * lx + ly * ly + lz * lz));
+
+    PacketLanes sqrRadical = squareRoot(maximum(radical, zero));
+    PacketLanes t0 = (sqrRadical - halfB) / A;
+    PacketLanes t1 = (zero - halfB - sqrRadical) / A;
+
+    /// The smallest non-negative root
+    PacketLanes t0Valid = t0 >= zero, t1Valid = t1 >= zero;
+    PacketLanes times = select(t0Valid & t1Valid, minimum(t0, t1), select(t0Valid, t0, t1));
+
+    PacketLanes hit = maskFromBits(activeMask) & (radical >= zero) & (t0Valid | t1Valid) & (times < load(hits.times));
+    recordHits(hit, times, elementIndex, hits);
+}
+
+///
+void
+RayPacket::intersectPlane(const Eigen::Vector3f & normal, float distance, int elementIndex, RayPacketHits & hits) const {
+    PacketLanes product = dot(load(directionX), load(directionY), load(directionZ), normal);
+    PacketLanes times = (broadcast(distance) - dot(load(originX), load(originY), load(originZ), normal)) / product;
+
+    PacketLanes facing = (product > broadcast(0.001f)) | (product < broadcast(-0.001f));
+    PacketLanes hit = maskFromBits(activeMask) & facing & (times > broadcast(0.0f)) & (times < load(hits.times));
+    recordHits(hit, times, elementIndex, hits);
+}
+
+///
+void
+RayPacket::intersectTriangle(const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c, int elementIndex, RayPacketHits & hits) const {
+    /// Cramer's rule on the same system "PovrayTriangle::intersect" inverts:
+    ///     [a - b, a - c, direction] * (beta, gamma, t) = a - origin
+    Eigen::Vector3f e1 = a - b, e2 = a - c;
+    Eigen::Vector3f e1CrossE2 = e1.cross(e2);
+
+    PacketLanes dx = load(directionX), dy = load(directionY), dz = load(directionZ);
+    PacketLanes rx = broadcast(a.x()) - load(originX);
+    PacketLanes ry = broadcast(a.y()) - load(originY);
+    PacketLanes rz = broadcast(a.z()) - load(originZ);
+
+    /// e2 x direction
+    PacketLanes cx = broadcast(e2.y()) * dz - broadcast(e2.z()) * dy;
+    PacketLanes cy = broadcast(e2.z()) * dx - broadcast(e2.x()) * dz;
+    PacketLanes cz = broadcast(e2.x()) * dy - broadcast(e2.y()) * dx;
+    /// (a - origin) x direction
+    PacketLanes qx = ry * dz - rz * dy;
+    PacketLanes qy = rz * dx - rx * dz;
+    PacketLanes qz = rx * dy - ry * dx;
+
+    PacketLanes inverseDeterminant = broadcast(1.0f) / dot(cx, cy, cz, e1);
+    PacketLanes beta = (rx * cx + ry * cy + rz * cz) * inverseDeterminant;
+    PacketLanes gamma = dot(qx, qy, qz, e1) * inverseDeterminant;
+    PacketLanes times = dot(rx, ry, rz, e1CrossE2) * inverseDeterminant;
+
+    PacketLanes zero = broadcast(0.0f);
+    PacketLanes inside = (beta >= zero) & (gamma >= zero) & (beta + gamma <= broadcast(1.0f));
+    PacketLanes hit = maskFromBits(activeMask) & inside & (times > zero) & (times < load(hits.times));
+    recordHits(hit, times, elementIndex, hits);
+}
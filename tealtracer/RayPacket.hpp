@@ -0,0 +1,72 @@
+//
+//  RayPacket.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/5/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef RayPacket_hpp
+#define RayPacket_hpp
+
+#include <Eigen/Dense>
+
+#include "Ray.hpp"
+
+struct RayPacketHits;
+
+///
+/// Up to 8 rays stored as separate component arrays, so an element can be
+///     intersected with all of them at once (AVX when compiled with it, two
+///     SSE2 halves otherwise). Coherent rays, such as the camera rays of
+///     neighbouring pixels, also tend to visit the same BVH nodes, so the
+///     traversal is shared between them.
+///
+struct RayPacket {
+    ///
+    static const int Size = 8;
+
+    float originX[Size], originY[Size], originZ[Size];
+    float directionX[Size], directionY[Size], directionZ[Size];
+    /// "1 / direction", for the slab tests against BVH nodes
+    float inverseDirectionX[Size], inverseDirectionY[Size], inverseDirectionZ[Size];
+    /// Bit "i" is set if ray "i" is in use. Inactive rays never report hits.
+    unsigned int activeMask;
+
+    ///
+    RayPacket();
+
+    /// Stores "ray" as ray "i" and marks it active.
+    void setRay(int i, const Ray & ray);
+    ///
+    Ray ray(int i) const;
+
+    /// Returns the mask of active rays that enter the box [minExtent,
+    ///     maxExtent] before their time in "hits".
+    unsigned int hitsBox(const Eigen::Vector3f & minExtent, const Eigen::Vector3f & maxExtent, const RayPacketHits & hits) const;
+
+    /// Packet versions of "PovraySphere::intersect", "PovrayPlane::intersect"
+    ///     and "PovrayTriangle::intersect". Every active ray that hits the
+    ///     primitive closer than its current hit has that hit replaced by
+    ///     ("elementIndex", time).
+    void intersectSphere(const Eigen::Vector3f & center, float radius, int elementIndex, RayPacketHits & hits) const;
+    ///
+    void intersectPlane(const Eigen::Vector3f & normal, float distance, int elementIndex, RayPacketHits & hits) const;
+    ///
+    void intersectTriangle(const Eigen::Vector3f & a, const Eigen::Vector3f & b, const Eigen::Vector3f & c, int elementIndex, RayPacketHits & hits) const;
+};
+
+///
+/// The closest hit found so far for each ray of a "RayPacket".
+///
+struct RayPacketHits {
+    /// Time of the closest hit, or infinity if the ray has hit nothing
+    float times[RayPacket::Size];
+    /// Index of the element that was hit, or -1
+    int elementIndices[RayPacket::Size];
+
+    /// Marks every ray as having hit nothing.
+    void reset();
+};
+
+#endif /* RayPacket_hpp */
@@ -9,6 +9,7 @@
 #include "Raytracer.hpp"
 
 #include "TSLogger.hpp"
+#include "TSProfiler.hpp"
 #include "stl_extensions.hpp"
 
 #include "gl_include.h"
@@ -31,6 +32,70 @@ Raytracer::Raytracer() {
     lastY = std::numeric_limits<float>::infinity();
 }
 
+///
+Raytracer::RenderStats::RenderStats() {
+    emit = 0.0;
+    buildMap = 0.0;
+    gather = 0.0;
+    shade = 0.0;
+    cameraRays = 0;
+}
+
+///
+Raytracer::RenderStats &
+Raytracer::RenderStats::operator+=(const RenderStats & other) {
+    emit += other.emit;
+    buildMap += other.buildMap;
+    gather += other.gather;
+    shade += other.shade;
+    cameraRays += other.cameraRays;
+    return *this;
+}
+
+///
+void
+Raytracer::addRenderStats(const RenderStats & stats) {
+    std::lock_guard<std::mutex> lock(renderStatsMutex);
+    renderStats += stats;
+}
+
+///
+Raytracer::OfflineTimings
+Raytracer::renderOffline(int numFrames) {
+    OfflineTimings timings;
+    renderStats = RenderStats();
+    
+    outputImage.setDimensions(config.renderOutputWidth, config.renderOutputHeight);
+    hdrImage.setDimensions(config.renderOutputWidth, config.renderOutputHeight);
+    
+    double startTime = TSClock::now();
+    configure();
+    double endTime = TSClock::now();
+    timings.configure = endTime - startTime;
+    TSProfiler::recordSpan("configure", "frame", startTime, endTime);
+    
+    startTime = TSClock::now();
+    prepareFrames();
+    endTime = TSClock::now();
+    timings.prepare = endTime - startTime;
+    TSProfiler::recordSpan("prepare frames", "frame", startTime, endTime);
+    
+    for (int frame = 0; frame < numFrames; frame++) {
+        startTime = TSClock::now();
+        renderFrame();
+        endTime = TSClock::now();
+        lastRayTraceTime = endTime - startTime;
+        TSProfiler::recordSpan("frame", "frame", startTime, endTime);
+        
+        rayTraceElapsedTime = lastRayTraceTime;
+        framesRendered++;
+        timings.frames.push_back(lastRayTraceTime);
+    }
+    
+    timings.stats = renderStats;
+    return timings;
+}
+
 ///
 void
 Raytracer::setupDrawingInWindow(TSWindow * window) {
@@ -41,6 +106,7 @@ Raytracer::setupDrawingInWindow(TSWindow * window) {
     glDepthFunc(GLenum(GL_LESS));
     
     outputImage.setDimensions(config.renderOutputWidth, config.renderOutputHeight);
+    hdrImage.setDimensions(config.renderOutputWidth, config.renderOutputHeight);
     void * imageDataPtr = outputImage.dataPtr();
     target.init(outputImage.width, outputImage.height, imageDataPtr);
 }
@@ -78,31 +144,37 @@ Raytracer::keyDown(TSWindow * window, int key, int scancode, int mods) {
         case GLFW_KEY_A:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(-transform, 0, 0);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_S:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(0, -transform, 0);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_D:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(transform, 0, 0);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_W:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(0, transform, 0);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_Q:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(0, 0, -transform);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_E:
             if (config.controlsCamera) {
                 config.scene->camera()->orientedTransform(0, 0, transform);
+                cameraMoved();
             }
             break;
         case GLFW_KEY_B:
@@ -126,6 +198,7 @@ Raytracer::mouseMoved(TSWindow * window, double x, double y) {
             double dy = y - lastY;
             
             config.scene->camera()->rotate(config.Up, -transform * dy, -transform * dx);
+            cameraMoved();
         }
         
         lastX = x;
@@ -9,15 +9,19 @@
 #ifndef Raytracer_hpp
 #define Raytracer_hpp
 
+#include <mutex>
+
 #include "TSWindow.hpp"
 #include "JobPool.hpp"
 
 #include "Image.hpp"
+#include "HDRImage.hpp"
 #include "TextureRenderTarget.hpp"
 #include "RaytracingConfig.hpp"
 #include "PovrayScene.hpp"
 
 #include "TSRandomValueGenerator.hpp"
+#include "TSClock.hpp"
 
 class Raytracer : public TSWindowDrawingDelegate, public TSUserEventListener {
 public:
@@ -32,10 +36,63 @@ public:
     RaytracingConfig config;
     TSRandomValueGenerator generator;
 
+    /// What rendering spent its time on. Each raytracer adds to the phases
+    ///     it has and leaves the rest at zero. "gather" and "shade" are
+    ///     summed over the render threads; the others are wall-clock seconds.
+    struct RenderStats {
+        /// Emitting photons
+        double emit;
+        /// Building photon maps, tiles, or other per-frame acceleration data
+        double buildMap;
+        /// Finding the photons near each hit and estimating their radiance
+        double gather;
+        /// Everything else done with a traced camera ray: lighting, shadow
+        ///     rays, writing the pixel
+        double shade;
+        /// Camera rays traced
+        long long cameraRays;
+        
+        ///
+        RenderStats();
+        ///
+        RenderStats & operator+=(const RenderStats & other);
+    };
+    
+    /// Wall-clock seconds spent in each phase of "renderOffline"
+    struct OfflineTimings {
+        double configure;
+        double prepare;
+        std::vector<double> frames;
+        /// Totals over "prepareFrames" and every frame
+        RenderStats stats;
+    };
+
     Raytracer();
 
     /// Override this to provide ray tracing functionality
     virtual void start() {}
+    /// Reads ".config" into the raytracer's own state
+    virtual void configure() {}
+    /// One-time work before the first frame, such as device setup or
+    ///     building photon maps. "start" runs this on the ".jobPool".
+    virtual void prepareFrames() {}
+    /// Renders one frame into ".outputImage" on the calling thread.
+    virtual void renderFrame() {}
+    
+    /// Renders "numFrames" frames on the calling thread without a window or
+    ///     an OpenGL context: "configure", "prepareFrames", and then
+    ///     "renderFrame" once per frame.
+    OfflineTimings renderOffline(int numFrames);
+    
+    /// The most recently rendered frame
+    const Image<uint8_t> & renderedImage() const {
+        return outputImage;
+    }
+    /// The radiance behind "renderedImage", for raytracers that render on
+    ///     the CPU
+    const HDRImage & renderedRadiance() const {
+        return hdrImage;
+    }
     
     virtual void setupDrawingInWindow(TSWindow * window);
     virtual void drawInWindow(TSWindow * window);
@@ -43,6 +100,10 @@ public:
     virtual void keyDown(TSWindow * window, int key, int scancode, int mods);
     virtual void mouseMoved(TSWindow * window, double x, double y);
     
+    /// Called on the main thread after "keyDown" or "mouseMoved" moves the
+    ///     camera; frames rendered so far no longer match the view.
+    virtual void cameraMoved() {}
+    
 
     virtual void windowResize(TSWindow * window, int w, int h) {}
     virtual void framebufferResize(TSWindow * window, int w, int h) {}
@@ -54,10 +115,21 @@ public:
 
 protected:
 
+    /// Adds "stats" to ".renderStats". Safe to call from any thread.
+    void addRenderStats(const RenderStats & stats);
+
     JobPool jobPool;
     
+    /// Reset by "renderOffline"
+    RenderStats renderStats;
+    std::mutex renderStatsMutex;
+    
     TextureRenderTarget target;
+    /// What is displayed: ".hdrImage" after "config.tonemap", or whatever
+    ///     the device wrote for OpenCL raytracers
     Image<uint8_t> outputImage;
+    /// What CPU raytracers render into. Same size as ".outputImage".
+    HDRImage hdrImage;
 
     int framesRendered;
     double lastRayTraceTime, rayTraceElapsedTime;
@@ -20,6 +20,9 @@ RaytracingConfig::RaytracingConfig() {
 
     computationDevice = ComputationDevice::CPU;
     brdfType = SupportedBRDF::BlinnPhong;
+    
+    tonemap = SupportedTonemap::ClampTonemap;
+    tonemapExposure = 1.0f;
 
     numberOfPhotonsToGather = 0;
     maxPhotonGatherDistance = 0.0f;
@@ -28,6 +31,7 @@ RaytracingConfig::RaytracingConfig() {
 
     photonBounceProbability = 0.0f;
     photonBounceEnergyMultipler = 0.0f;
+    parallelPhotonEmission = true;
 
     usePhotonMappingForDirectIllumination = false;
 
@@ -39,11 +43,23 @@ RaytracingConfig::RaytracingConfig() {
     hashmapGridEnd = Eigen::Vector3f::Zero();
     hashmapSpacing = 0.0f;
     hashmapCellsize = 0.0f;
+    spatialHashCellsize = 0.0f;
+    
+    numberOfThreads = 0;
+    randomSeed = -1;
+    photonCacheDirectory = "";
+    programCacheDirectory = "";
     
     tile_height = 0;
     tile_width = 0;
     tile_photonEffectRadius = 0.0;
     tile_photonSampleRate = 0.0;
+    
+    progressive_enabled = false;
+    progressive_minSamples = 4;
+    progressive_maxSamples = 0;
+    progressive_noiseThreshold = 0.0;
+    progressive_radiusAlpha = 0.7;
 
     Up = Eigen::Vector3f::Zero();
     Forward = Eigen::Vector3f::Zero();
@@ -64,6 +80,8 @@ void RaytracingConfig::loadFromJSON(const nlohmann::json & config) {
     computationDevice = (ComputationDevice) config.get<int>("computationDevice");
     brdfType = (SupportedBRDF) config.get<int>("brdfType");
     supportedPhotonMap = (SupportedPhotonMap) config.get<int>("supportedPhotonMap");
+    tonemap = (SupportedTonemap) config.get<int>("tonemap", 0);
+    tonemapExposure = config.get<double>("tonemapExposure", 1.0);
     
     numberOfPhotonsToGather = config.get<int>("numberOfPhotonsToGather");
     raysPerLight = config.get<int>("raysPerLight");
@@ -79,6 +97,7 @@ void RaytracingConfig::loadFromJSON(const nlohmann::json & config) {
     
     photonBounceProbability = config.get<double>("photonBounceProbability");
     photonBounceEnergyMultipler = config.get<double>("photonBounceEnergyMultipler");
+    parallelPhotonEmission = config.get<bool>("parallelPhotonEmission", true);
     
     usePhotonMappingForDirectIllumination = config.get<bool>("usePhotonMappingForDirectIllumination");
     
@@ -86,6 +105,11 @@ void RaytracingConfig::loadFromJSON(const nlohmann::json & config) {
     indirectIlluminationEnabled = config.get<bool>("indirectIlluminationEnabled");
     shadowsEnabled = config.get<bool>("shadowsEnabled");
     
+    numberOfThreads = config.get<int>("numberOfThreads", 0);
+    randomSeed = config.get<int>("randomSeed", -1);
+    photonCacheDirectory = config.get<std::string>("photonCacheDirectory", "");
+    programCacheDirectory = config.get<std::string>("programCacheDirectory", "");
+    
     if (config.has("Hashmap_properties")) {
         hashmapCellsize = config["Hashmap_properties"].get<double>("cellsize");
         hashmapSpacing = config["Hashmap_properties"].get<int>("spacing");
@@ -93,6 +117,10 @@ void RaytracingConfig::loadFromJSON(const nlohmann::json & config) {
         hashmapGridEnd = vec3FromData(config["Hashmap_properties"].get<std::vector<double>>("gridEnd", make_vector<double>(0,0,0)));
     }
     
+    if (config.has("SpatialHash_properties")) {
+        spatialHashCellsize = config["SpatialHash_properties"].get<double>("cellsize", 0.0);
+    }
+    
     if (config.has("Tile_properties")) {
         tile_width = config["Tile_properties"].get<int>("tileHeight");
         tile_height = config["Tile_properties"].get<int>("tileWidth");
@@ -101,6 +129,14 @@ void RaytracingConfig::loadFromJSON(const nlohmann::json & config) {
         tile_photonSampleRate = config["Tile_properties"].get<double>("photonSampleRate");
     }
     
+    if (config.has("Progressive_properties")) {
+        progressive_enabled = config["Progressive_properties"].get<bool>("enabled", true);
+        progressive_minSamples = config["Progressive_properties"].get<int>("minSamples", 4);
+        progressive_maxSamples = config["Progressive_properties"].get<int>("maxSamples", 0);
+        progressive_noiseThreshold = config["Progressive_properties"].get<double>("noiseThreshold", 0.0);
+        progressive_radiusAlpha = config["Progressive_properties"].get<double>("radiusAlpha", 0.7);
+    }
+    
     if (config.has("photonEffectRadius")) {
         this->maxPhotonGatherDistance = config.get<double>("photonEffectRadius", 1.0);
         tile_photonEffectRadius = this->maxPhotonGatherDistance;
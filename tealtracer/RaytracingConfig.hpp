@@ -33,7 +33,9 @@ public:
     enum SupportedPhotonMap {
         KDTree = 0,
         HashGrid = 1,
-        TileFrustum = 2
+        TileFrustum = 2,
+        /// Unbounded grid, used by "SCSpatialHashRaytracer"
+        SpatialHash = 3
     };
     
     enum ComputationDevice {
@@ -41,10 +43,22 @@ public:
         GPU = 1
     };
     
+    /// How rendered radiance (1 is display white) becomes display bytes
+    enum SupportedTonemap {
+        /// Anything at or above 1 is white
+        ClampTonemap = 0,
+        /// c / (1 + c) per channel; never saturates
+        ReinhardTonemap = 1
+    };
+    
     ComputationDevice computationDevice;
     SupportedBRDF brdfType;
     SupportedPhotonMap supportedPhotonMap;
     
+    SupportedTonemap tonemap;
+    /// Radiance is multiplied by this before "tonemap" is applied
+    float tonemapExposure;
+    
     int numberOfPhotonsToGather;
     float maxPhotonGatherDistance;
     int raysPerLight;
@@ -52,6 +66,8 @@ public:
     
     float photonBounceProbability;
     float photonBounceEnergyMultipler;
+    /// Emit photons on every CPU worker thread instead of one at a time.
+    bool parallelPhotonEmission;
     
     bool usePhotonMappingForDirectIllumination;
     
@@ -61,11 +77,39 @@ public:
     
     Eigen::Vector3f hashmapGridStart, hashmapGridEnd;
     float hashmapSpacing, hashmapCellsize;
+    /// "SpatialHash_properties.cellsize"; 0 (the default) sizes the cells
+    ///     from each frame's photons
+    float spatialHashCellsize;
+    
+    /// Number of CPU worker threads; 0 uses every hardware thread.
+    int numberOfThreads;
+    /// Seed for all CPU random sampling; -1 seeds from the random device.
+    int randomSeed;
+    /// Directory photon maps are cached in, see "PhotonCache"; empty (the
+    ///     default) never caches.
+    std::string photonCacheDirectory;
+    /// Directory OpenCL program binaries are cached in, see
+    ///     "ComputeEngine::setProgramCacheDirectory"; empty (the default)
+    ///     always builds from source.
+    std::string programCacheDirectory;
     
     int tile_height, tile_width;
     float tile_photonEffectRadius;
     float tile_photonSampleRate;
     
+    /// Accumulate samples across frames until the camera moves; only
+    ///     "SCMonteCarloRaytracer" supports this.
+    bool progressive_enabled;
+    /// A tile stops taking samples once it has "progressive_minSamples"
+    ///     and the standard error of its pixels, relative to their
+    ///     brightness, is below "progressive_noiseThreshold", or once it has
+    ///     "progressive_maxSamples" (0 never stops).
+    int progressive_minSamples, progressive_maxSamples;
+    float progressive_noiseThreshold;
+    /// Fraction of each pass's photons a progressive photon mapper keeps
+    ///     when it shrinks its gather radius, in (0, 1].
+    float progressive_radiusAlpha;
+    
     Eigen::Vector3f Up;
     Eigen::Vector3f Forward;
     Eigen::Vector3f Right;
@@ -0,0 +1,219 @@
+//
+//  RenderBenchmarks.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/6/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "RenderBenchmarks.hpp"
+
+#include <iostream>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "TSLogger.hpp"
+#include "TSClock.hpp"
+#include "stl_extensions.hpp"
+
+using json = nlohmann::json;
+
+/// The most memory this process has had resident, in bytes
+static long long
+peakResidentBytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (long long) usage.ru_maxrss;
+#else
+    /// Linux reports kilobytes
+    return (long long) usage.ru_maxrss * 1024;
+#endif
+}
+
+/// One render of the suite
+struct RenderBenchmarkCase {
+    std::string raytracerName, configName, sceneFile;
+    int photons, width, height, frames, randomSeed;
+    
+    ///
+    json describe() const {
+        json description;
+        description["raytracer"] = raytracerName;
+        description["config"] = configName;
+        description["scene"] = sceneFile;
+        description["photons"] = photons;
+        description["width"] = width;
+        description["height"] = height;
+        description["frames"] = frames;
+        description["randomSeed"] = randomSeed;
+        return description;
+    }
+};
+
+///
+static json
+runBenchmarkCase(const RenderBenchmarkCase & benchmarkCase, const RaytracerFactory & createRaytracer) {
+    json result = benchmarkCase.describe();
+    
+    std::shared_ptr<Raytracer> raytracer = createRaytracer(benchmarkCase.raytracerName, benchmarkCase.configName);
+    if (raytracer == nullptr) {
+        result["status"] = "unknown raytracer or config";
+        return result;
+    }
+    
+    raytracer->config.enabled = true;
+    raytracer->config.raysPerLight = benchmarkCase.photons;
+    raytracer->config.renderOutputWidth = benchmarkCase.width;
+    raytracer->config.renderOutputHeight = benchmarkCase.height;
+    raytracer->config.randomSeed = benchmarkCase.randomSeed;
+    
+    double startTime = TSClock::now();
+    raytracer->config.scene = PovrayScene::loadScene(benchmarkCase.sceneFile);
+    double sceneTime = TSClock::now() - startTime;
+    
+    Raytracer::OfflineTimings timings = raytracer->renderOffline(benchmarkCase.frames);
+    
+    double renderTime = 0.0;
+    json frameTimes = json::array();
+    for (auto itr = timings.frames.begin(); itr != timings.frames.end(); itr++) {
+        renderTime += *itr;
+        frameTimes.push_back(*itr);
+    }
+    
+    json seconds;
+    seconds["loadScene"] = sceneTime;
+    seconds["configure"] = timings.configure;
+    seconds["prepare"] = timings.prepare;
+    seconds["emit"] = timings.stats.emit;
+    seconds["buildMap"] = timings.stats.buildMap;
+    seconds["render"] = renderTime;
+    seconds["frames"] = frameTimes;
+    result["seconds"] = seconds;
+    
+    /// Summed over render threads, so these can exceed "render"
+    json threadSeconds;
+    threadSeconds["gather"] = timings.stats.gather;
+    threadSeconds["shade"] = timings.stats.shade;
+    result["threadSeconds"] = threadSeconds;
+    
+    result["cameraRays"] = timings.stats.cameraRays;
+    result["raysPerSecond"] = renderTime > 0.0 ? (double) timings.stats.cameraRays / renderTime : 0.0;
+    result["peakRSSBytes"] = peakResidentBytes();
+    result["status"] = "ok";
+    
+    return result;
+}
+
+/// Runs "benchmarkCase" in a forked child and returns its result
+static json
+runBenchmarkCaseIsolated(const RenderBenchmarkCase & benchmarkCase, const RaytracerFactory & createRaytracer) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        json result = benchmarkCase.describe();
+        result["status"] = "could not create a pipe";
+        return result;
+    }
+    
+    /// Anything still buffered would otherwise be written by both processes
+    std::cout.flush();
+    std::cerr.flush();
+    
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        /// Keep the raytracers' logging out of the results on stdout
+        std::cout.rdbuf(std::cerr.rdbuf());
+        
+        std::string text = runBenchmarkCase(benchmarkCase, createRaytracer).dump();
+        size_t written = 0;
+        while (written < text.size()) {
+            ssize_t count = write(fds[1], text.data() + written, text.size() - written);
+            if (count <= 0) {
+                _exit(1);
+            }
+            written += (size_t) count;
+        }
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    
+    std::string text;
+    char buffer[4096];
+    ssize_t count;
+    while (child > 0 && (count = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, (size_t) count);
+    }
+    close(fds[0]);
+    
+    int status = 0;
+    if (child > 0) {
+        waitpid(child, &status, 0);
+    }
+    
+    if (child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 && !text.empty()) {
+        return json::parse(text);
+    }
+    
+    json result = benchmarkCase.describe();
+    if (child < 0) {
+        result["status"] = "could not fork";
+    }
+    else if (WIFSIGNALED(status)) {
+        result["status"] = make_string("crashed (signal ", WTERMSIG(status), ")");
+    }
+    else {
+        result["status"] = make_string("failed (exit status ", WEXITSTATUS(status), ")");
+    }
+    return result;
+}
+
+///
+int
+runRenderBenchmarks(const json & suite, const RaytracerFactory & createRaytracer, std::ostream & out) {
+    
+    std::string configName = suite.get<std::string>("config");
+    int frames = suite.get<int>("frames", 1);
+    int randomSeed = suite.get<int>("randomSeed", 0);
+    std::vector<std::string> raytracerNames = suite.get<std::vector<std::string>>("raytracers");
+    std::vector<std::string> sceneFiles = suite.get<std::vector<std::string>>("scenes");
+    std::vector<int> photonCounts = suite.get<std::vector<int>>("photonCounts");
+    std::vector<std::vector<int>> resolutions = suite.get<std::vector<std::vector<int>>>("resolutions");
+    
+    json results = json::array();
+    bool allFinished = true;
+    
+    for (auto raytracerItr = raytracerNames.begin(); raytracerItr != raytracerNames.end(); raytracerItr++) {
+        for (auto sceneItr = sceneFiles.begin(); sceneItr != sceneFiles.end(); sceneItr++) {
+            for (auto photonItr = photonCounts.begin(); photonItr != photonCounts.end(); photonItr++) {
+                for (auto resolutionItr = resolutions.begin(); resolutionItr != resolutions.end(); resolutionItr++) {
+                    assert(resolutionItr->size() == 2);
+                    
+                    RenderBenchmarkCase benchmarkCase;
+                    benchmarkCase.raytracerName = *raytracerItr;
+                    benchmarkCase.configName = configName;
+                    benchmarkCase.sceneFile = *sceneItr;
+                    benchmarkCase.photons = *photonItr;
+                    benchmarkCase.width = (*resolutionItr)[0];
+                    benchmarkCase.height = (*resolutionItr)[1];
+                    benchmarkCase.frames = std::max(1, frames);
+                    benchmarkCase.randomSeed = randomSeed;
+                    
+                    TSLoggerLog(std::cerr, "benchmarking ", benchmarkCase.describe().dump());
+                    json result = runBenchmarkCaseIsolated(benchmarkCase, createRaytracer);
+                    allFinished = allFinished && result["status"].get<std::string>() == "ok";
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+    
+    json report;
+    report["suite"] = suite;
+    report["results"] = results;
+    out << report.dump(4) << std::endl;
+    
+    return allFinished ? 0 : 1;
+}
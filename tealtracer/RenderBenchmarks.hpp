@@ -0,0 +1,46 @@
+//
+//  RenderBenchmarks.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/6/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef RenderBenchmarks_hpp
+#define RenderBenchmarks_hpp
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "json.hpp"
+#include "Raytracer.hpp"
+
+/// Returns the raytracer called "raytracerName" loaded with the configuration
+///     "configName", or nullptr if either does not exist.
+typedef std::function<std::shared_ptr<Raytracer>(const std::string & raytracerName, const std::string & configName)> RaytracerFactory;
+
+///
+/// Renders every combination of raytracer, scene, photon count and resolution
+///     listed in "suite" without a window and writes what each phase took to
+///     "out" as JSON, so runs from two builds can be diffed. "suite" looks like:
+///
+///     {
+///         "config" : "12kPhoton_QuarterSD_BestFit",
+///         "raytracers" : ["SCKDTreeRaytracer", "SCTilePhotonRaytracer"],
+///         "scenes" : ["GIRefScene1.pov", "planes.pov"],
+///         "photonCounts" : [12000, 200000],
+///         "resolutions" : [[160, 160], [320, 320]],
+///         "frames" : 3,
+///         "randomSeed" : 1
+///     }
+///
+///     "photonCounts" replaces "raysPerLight" of the configuration. Every
+///     combination runs in a child process of its own, so one crashing only
+///     loses its own result and "peakRSSBytes" is the high-water mark of that
+///     render alone. Returns 0 if every render finished.
+///
+int runRenderBenchmarks(const nlohmann::json & suite, const RaytracerFactory & createRaytracer, std::ostream & out);
+
+#endif /* RenderBenchmarks_hpp */
@@ -9,6 +9,8 @@
 #include "SCHashGridRaytracer.hpp"
 #include "PhotonHashmap.hpp"
 
+#include <cmath>
+
 ///
 SCHashGridRaytracer::SCHashGridRaytracer() : SCPhotonMapper() {
 
@@ -20,6 +22,9 @@ SCHashGridRaytracer::configure() {
 
     config.supportedPhotonMap = RaytracingConfig::HashGrid;
     SCPhotonMapper::configure();
+    
+    candidateScratch.resize(threadPool->numWorkers());
+    candidateDistanceScratch.resize(threadPool->numWorkers());
 }
 
 ///
@@ -27,7 +32,8 @@ RGBf
 SCHashGridRaytracer::computeOutputEnergyForHitUsingPhotonMap(
     const PovrayScene::InstersectionResult & hitResult,
     const Eigen::Vector3f & toViewer,
-    const RGBf & sourceEnergy)
+    const RGBf & sourceEnergy,
+    int workerIndex)
 {
     
     auto intersection = hitResult.hit.locationOfIntersection();
@@ -47,29 +53,34 @@ SCHashGridRaytracer::computeOutputEnergyForHitUsingPhotonMap(
         float maxRadiusSqd = 0.0f;
         int halfSideLength = ceil(maxGatherDistance / map->cellsize);
         
+        const PhotonArrays & arrays = map->photonArrays;
+        std::vector<int> & candidates = candidateScratch[workerIndex];
+        std::vector<float> & candidateDistances = candidateDistanceScratch[workerIndex];
+        int geometryId = hitResult.element;
+        BRDFAccumulator brdf(config.brdfType, BRDFHit(config.scene->material(hitResult), hitResult.hit.surfaceNormal, toViewer));
+        /// The filter keeps distances <= its bound; photons must be strictly inside
+        float maxSquareDistance = std::nextafter(maxGatherDistance * maxGatherDistance, 0.0f);
+        
         for (int i = std::max<int>(0, px - halfSideLength); i < std::min<int>(map->xdim, px+halfSideLength+1); ++i) {
             for (int j = std::max<int>(0, py - halfSideLength); j < std::min<int>(map->ydim, py+halfSideLength+1); ++j) {
                 for (int k = std::max<int>(0, pz - halfSideLength); k < std::min<int>(map->zdim, pz+halfSideLength+1); ++k) {
                     
                     
                     int gridHash = map->photonHash(i,j,k);
-                    // find the index of the first photon in the cell
-                    if (map->gridFirstPhotonIndices[gridHash] > 0) {
-                        int pi = map->gridFirstPhotonIndices[gridHash];
-                        while (pi < map->photons.size() && map->gridIndices[pi] == gridHash) {
-                            auto & p = map->photons[pi];
-                            // Check if the photon is on the same geometry as the intersection and within the effect sphere
-                            float distSqd = (p.position - intersection).dot(p.position - intersection);
-                            if (hitResult.element->id() == p.flags.geometryIndex
-                             && distSqd < maxGatherDistance * maxGatherDistance) {
-                                
-                                photonEnergy += computeOutputEnergyForHit(hitResult, -p.incomingDirection.vector(), toViewer, rgbe2rgb(p.energy));
-                                photonsSampled++;
-                                maxRadiusSqd = std::max<float>(distSqd, maxRadiusSqd);
-                            }
-                            
-                            pi++;
-                        }
+                    int first = map->gridFirstPhotonIndices[gridHash];
+                    int count = map->gridPhotonCounts[gridHash];
+                    if (count > (int) candidates.size()) {
+                        candidates.resize(count);
+                        candidateDistances.resize(count);
+                    }
+                    
+                    // Keep the photons on the same geometry as the intersection and within the effect sphere
+                    int numCandidates = arrays.filterCandidates(first, first + count, intersection, maxSquareDistance, geometryId, candidates.data(), candidateDistances.data());
+                    for (int c = 0; c < numCandidates; c++) {
+                        int pi = candidates[c];
+                        brdf.add(-arrays.incomingDirections[pi].vector(), rgbe2rgb(arrays.energies[pi]));
+                        photonsSampled++;
+                        maxRadiusSqd = std::max<float>(candidateDistances[c], maxRadiusSqd);
                     }
                     ///
                 }
@@ -77,7 +88,7 @@ SCHashGridRaytracer::computeOutputEnergyForHitUsingPhotonMap(
         }
         
         if (photonsSampled > 0) {
-            photonEnergy = photonEnergy * (float) (1.0f/(M_PI * maxRadiusSqd));
+            photonEnergy = brdf.total() * (float) (1.0f/(M_PI * maxRadiusSqd));
         }
     }
         
@@ -20,7 +20,13 @@ public:
     virtual void configure();
     
     ///
-    virtual RGBf computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy);
+    virtual RGBf computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy, int workerIndex);
+    
+protected:
+
+    /// Per-worker output of "PhotonArrays::filterCandidates", grown as needed
+    std::vector<std::vector<int>> candidateScratch;
+    std::vector<std::vector<float>> candidateDistanceScratch;
 };
 
 #endif /* SCHashGridRaytracer_hpp */
@@ -8,13 +8,84 @@
 
 #include "SCMonteCarloRaytracer.hpp"
 
+#include "TSLogger.hpp"
+#include "TSProfiler.hpp"
+
+///
+void SCMonteCarloRaytracer::configure() {
+    SingleCoreRaytracer::configure();
+    accumulationReset_ = true;
+}
+
+///
+void SCMonteCarloRaytracer::cameraMoved() {
+    accumulationReset_ = true;
+}
+
+///
+bool SCMonteCarloRaytracer::hasConverged() const {
+    return config.progressive_enabled && !accumulationReset_ && activeTiles_ == 0;
+}
+
+///
+void SCMonteCarloRaytracer::beginProgressiveFrame() {
+    int numPixels = outputImage.width * outputImage.height;
+    int tileCount = numTiles();
+    
+    if (accumulationReset_.exchange(false) || (int) accumulatedColor_.size() != numPixels || (int) tileSamples_.size() != tileCount) {
+        accumulatedColor_.assign(numPixels, RGBf(0,0,0));
+        accumulatedLuminanceSquared_.assign(numPixels, 0.0f);
+        tileSamples_.assign(tileCount, 0);
+        tileConverged_.assign(tileCount, 0);
+    }
+    
+    activeTiles_ = 0;
+    for (int tileItr = 0; tileItr < tileCount; tileItr++) {
+        activeTiles_ += tileConverged_[tileItr] ? 0 : 1;
+    }
+    
+    /// Keep every frame about as expensive as one sample of the whole image
+    tilePasses_ = activeTiles_ > 0 ? std::max(1, std::min(MaxTilePassesPerFrame, tileCount / activeTiles_)) : 0;
+}
+
+///
+void SCMonteCarloRaytracer::finishProgressiveTile(const RenderTile & tile) {
+    int samples = tileSamples_[tile.index];
+    if (samples <= 0) {
+        return;
+    }
+    
+    /// Standard error of every pixel's average, relative to the tile's
+    ///     brightness (but at least one 8-bit display step)
+    double sumVarianceOfMean = 0.0, sumLuminance = 0.0;
+    int numPixels = 0;
+    for (int py = tile.y0; py < tile.y1; py++) {
+        for (int px = tile.x0; px < tile.x1; px++) {
+            int pixel = py * outputImage.width + px;
+            RGBf mean = accumulatedColor_[pixel] / (float) samples;
+            float meanLuminance = 0.2126f * mean.x() + 0.7152f * mean.y() + 0.0722f * mean.z();
+            float variance = std::max(0.0f, accumulatedLuminanceSquared_[pixel] / (float) samples - meanLuminance * meanLuminance);
+            sumVarianceOfMean += variance / (double) samples;
+            sumLuminance += meanLuminance;
+            numPixels++;
+            
+            hdrImage.setRadiance(px, py, mean);
+        }
+    }
+    
+    double relativeError = std::sqrt(sumVarianceOfMean / numPixels) / std::max(1.0 / 255.0, sumLuminance / numPixels);
+    bool settled = samples >= config.progressive_minSamples && relativeError < config.progressive_noiseThreshold;
+    bool exhausted = config.progressive_maxSamples > 0 && samples >= config.progressive_maxSamples;
+    tileConverged_[tile.index] = settled || exhausted;
+}
+
 ///
 void SCMonteCarloRaytracer::raytraceScene() {
     assert(config.scene != nullptr);
     
     /// Get the camera
     auto camera = config.scene->camera();
-    auto lights = config.scene->findElements<PovrayLightSource>();
+    const auto & lights = config.scene->arrays().lights;
     
     /// TODO: build the photon map
     
@@ -25,46 +96,121 @@ void SCMonteCarloRaytracer::raytraceScene() {
     Eigen::Vector3f up = (viewTransform * Eigen::Vector4f(config.Up.x(), config.Up.y(), config.Up.z(), 0.0)).block<3,1>(0,0) * camera->up().norm();
     Eigen::Vector3f right = (viewTransform * Eigen::Vector4f(config.Right.x(), config.Right.y(), config.Right.z(), 0.0)).block<3,1>(0,0) * camera->right().norm();
     
-    for (int px = 0; px < outputImage.width; px++) {
-        for (int py = 0; py < outputImage.height; py++) {
-            Ray ray;
-            ray.origin = camPos;
-            ray.direction = (forward - 0.5*up - 0.5*right + right*(0.5+(double)px)/(double)outputImage.width + up*(0.5+(double)py)/(double)outputImage.height).normalized();
-            
-            auto hitTest = config.scene->closestIntersection(ray);
-            Image<uint8_t>::Vector4 color = Image<uint8_t>::Vector4(0, 0, 0, 255);
-            
-            if (hitTest.element != nullptr && hitTest.element->pigment() != nullptr) {
-                /// Get indirect lighting
-                RGBf result = RGBf(0,0,0);
+    bool progressive = config.progressive_enabled;
+    if (progressive) {
+        beginProgressiveFrame();
+        TSProfiler::recordCounter("active tiles", (double) activeTiles_);
+        if (activeTiles_ == 0) {
+            return;
+        }
+    }
+    
+    raytraceTiles([&](const RenderTile & tile, TSRandomValueGenerator & tileGenerator) {
+        if (progressive && tileConverged_[tile.index]) {
+            markTileUnchanged(tile);
+            return;
+        }
+        
+        RenderStats tileStats;
+        int numPasses = progressive ? tilePasses_ : 1;
+        if (progressive && config.progressive_maxSamples > 0) {
+            numPasses = std::min(numPasses, config.progressive_maxSamples - tileSamples_[tile.index]);
+        }
+        
+        for (int pass = 0; pass < numPasses; pass++) {
+            tileStats += traceCameraRays(tile, [&](int px, int py) -> Ray {
+                /// Progressive frames jitter the sample inside the pixel
+                double jitterX = progressive ? tileGenerator.randDouble() : 0.5;
+                double jitterY = progressive ? tileGenerator.randDouble() : 0.5;
+                
+                Ray ray;
+                ray.origin = camPos;
+                ray.direction = (forward - 0.5*up - 0.5*right + right*(jitterX+(double)px)/(double)outputImage.width + up*(jitterY+(double)py)/(double)outputImage.height).normalized();
+                return ray;
+            }, [&](const CameraRayPacket & packet) {
+                RGBf results[RayPacket::Size];
+                /// Rays that hit something that can be shaded
+                unsigned int shadedMask = 0;
+                for (int i = 0; i < RayPacket::Size; i++) {
+                    results[i] = RGBf(0,0,0);
+                    if ((packet.rays.activeMask & (1u << i)) && packet.hits[i].material >= 0) {
+                        shadedMask |= 1u << i;
+                    }
+                }
                 
-                /// Get direct lighting
-                for (auto lightItr = lights.begin(); lightItr != lights.end(); lightItr++) {
-                    auto light = *lightItr;
-                    Eigen::Vector3f hitLoc = hitTest.hit.locationOfIntersection();
-                    Eigen::Vector3f toLight = light->position() - hitLoc;
-                    Eigen::Vector3f toLightDir = toLight.normalized();
-                    Ray shadowRay;
-                    shadowRay.origin = hitLoc + 0.01f * toLightDir;
-                    shadowRay.direction = toLightDir;
-                    auto shadowHitTest = config.scene->closestIntersection(shadowRay);
+                /// Get direct lighting, with one packet of shadow rays per light
+                for (int light = 0; light < lights.size(); light++) {
+                    Eigen::Vector3f lightPosition = lights.position(light);
                     
-                    bool isShadowed = !(!shadowHitTest.hit.intersected
-                     || (shadowHitTest.hit.intersected && shadowHitTest.hit.timeOfIntersection > toLight.norm()));
+                    RayPacket shadowRays;
+                    Eigen::Vector3f toLights[RayPacket::Size];
+                    for (int i = 0; i < RayPacket::Size; i++) {
+                        if (!(shadedMask & (1u << i))) {
+                            continue;
+                        }
+                        
+                        Eigen::Vector3f hitLoc = packet.hits[i].hit.locationOfIntersection();
+                        toLights[i] = lightPosition - hitLoc;
+                        Eigen::Vector3f toLightDir = toLights[i].normalized();
+                        Ray shadowRay;
+                        shadowRay.origin = hitLoc + 0.01f * toLightDir;
+                        shadowRay.direction = toLightDir;
+                        shadowRays.setRay(i, shadowRay);
+                    }
+                    
+                    PovrayScene::InstersectionResult shadowHitTests[RayPacket::Size];
+                    config.scene->closestIntersection(shadowRays, shadowHitTests);
                     
-                    if (!isShadowed) {
-                        result += 255.0 * computeOutputEnergyForHit(hitTest, toLightDir, (camPos - hitLoc).normalized(), light->color().block<3,1>(0,0));
+                    for (int i = 0; i < RayPacket::Size; i++) {
+                        if (!(shadedMask & (1u << i))) {
+                            continue;
+                        }
+                        
+                        const auto & shadowHitTest = shadowHitTests[i];
+                        bool isShadowed = !(!shadowHitTest.hit.intersected
+                         || (shadowHitTest.hit.intersected && shadowHitTest.hit.timeOfIntersection > toLights[i].norm()));
+                        
+                        if (!isShadowed) {
+                            Eigen::Vector3f hitLoc = packet.hits[i].hit.locationOfIntersection();
+                            results[i] += computeOutputEnergyForHit(packet.hits[i], toLights[i].normalized(), (camPos - hitLoc).normalized(), lights.color(light).block<3,1>(0,0));
+                        }
                     }
                 }
                 
-                for (int i = 0; i < 3; i++) {
-                    result(i) = std::min<float>(255.0, result(i));
+                for (int i = 0; i < RayPacket::Size; i++) {
+                    if (!(packet.rays.activeMask & (1u << i))) {
+                        continue;
+                    }
+                    
+                    if (progressive) {
+                        int pixel = packet.py[i] * outputImage.width + packet.px[i];
+                        float luminance = 0.2126f * results[i].x() + 0.7152f * results[i].y() + 0.0722f * results[i].z();
+                        accumulatedColor_[pixel] += results[i];
+                        accumulatedLuminanceSquared_[pixel] += luminance * luminance;
+                        continue;
+                    }
+                    
+                    hdrImage.setRadiance(packet.px[i], packet.py[i], results[i]);
                 }
-                
-                color.block<3,1>(0,0) = result.cast<uint8_t>();
-            }
-            
-            outputImage.pixel(px, py) = color;
+            });
+        }
+        
+        if (progressive) {
+            tileSamples_[tile.index] += numPasses;
+            finishProgressiveTile(tile);
+        }
+        
+        addRenderStats(tileStats);
+    });
+    
+    if (progressive) {
+        int wasActive = activeTiles_;
+        activeTiles_ = 0;
+        for (auto itr = tileConverged_.begin(); itr != tileConverged_.end(); itr++) {
+            activeTiles_ += *itr ? 0 : 1;
+        }
+        if (wasActive > 0 && activeTiles_ == 0) {
+            TSLoggerLog(std::cout, "converged after frames=", framesRendered + 1);
         }
     }
 }
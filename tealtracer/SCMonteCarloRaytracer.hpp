@@ -9,15 +9,59 @@
 #ifndef SCMonteCarloRaytracer_hpp
 #define SCMonteCarloRaytracer_hpp
 
+#include <atomic>
+
 #include "SingleCoreRaytracer.hpp"
 
+///
+/// Direct lighting only. With "config.progressive_enabled" every frame adds
+///     jittered samples to a running average per pixel instead of starting
+///     over; tiles whose average has settled stop taking samples, and the
+///     frame's samples go to the tiles that are still noisy.
+///
 class SCMonteCarloRaytracer : public SingleCoreRaytracer {
 public:
-    SCMonteCarloRaytracer() {
-    
+    SCMonteCarloRaytracer() : accumulationReset_(true), activeTiles_(0) {
+
     }
-    
+
+    ///
+    virtual void configure();
+    ///
     virtual void raytraceScene();
+
+    /// Starts accumulating over
+    virtual void cameraMoved();
+    /// True once every tile has stopped taking samples
+    virtual bool hasConverged() const;
+
+private:
+
+    /// A still-noisy tile takes at most this many samples per pixel a frame
+    static const int MaxTilePassesPerFrame = 8;
+
+    /// Clears the accumulation if needed and decides how many samples each
+    ///     unconverged tile takes this frame.
+    void beginProgressiveFrame();
+    /// Writes the averaged tile into ".hdrImage" and checks whether it
+    ///     has converged.
+    void finishProgressiveTile(const RenderTile & tile);
+
+    /// Sum of the samples of each pixel, before clamping
+    std::vector<RGBf> accumulatedColor_;
+    /// Sum of the squared luminance of each pixel's samples
+    std::vector<float> accumulatedLuminanceSquared_;
+    /// Samples every pixel of each tile has taken
+    std::vector<int> tileSamples_;
+    /// Non-zero once a tile has converged
+    std::vector<uint8_t> tileConverged_;
+
+    /// Set from the main thread by "cameraMoved"
+    std::atomic<bool> accumulationReset_;
+    /// Unconverged tiles after the last frame
+    int activeTiles_;
+    /// Samples per pixel each unconverged tile takes this frame
+    int tilePasses_;
 };
 
 #endif /* SCMonteCarloRaytracer_hpp */
@@ -10,7 +10,10 @@
 
 #include "PhotonHashmap.hpp"
 #include "PhotonKDTree.hpp"
+#include "PhotonSpatialHashmap.hpp"
 #include "PhotonEmitter.hpp"
+#include "TSLogger.hpp"
+#include "TSProfiler.hpp"
 
 ///
 void
@@ -29,6 +32,13 @@ SCPhotonMapper::configure() {
         map->cellsize = config.hashmapCellsize;
         map->spacing = config.hashmapSpacing;
         map->setDimensions(config.hashmapGridStart, config.hashmapGridEnd);
+        map->threadPool = threadPool;
+        photonMap = std::shared_ptr<PhotonMap>(map);
+        break;
+    }
+    case RaytracingConfig::SpatialHash: {
+        auto * map = new PhotonSpatialHashmap();
+        map->cellsize = config.spatialHashCellsize;
         photonMap = std::shared_ptr<PhotonMap>(map);
         break;
     }
@@ -36,26 +46,81 @@ SCPhotonMapper::configure() {
         assert(false);
         break;
     }
+    
+    gatherScratch.resize(threadPool->numWorkers());
+    for (auto itr = gatherScratch.begin(); itr != gatherScratch.end(); itr++) {
+        itr->resize(std::max<int>(0, config.numberOfPhotonsToGather));
+    }
 }
 
 ///
 void
-SCPhotonMapper::start() {
+SCPhotonMapper::prepareFrames() {
 
-    configure();
+    assert(photonMap != nullptr);
+    
+    uint64_t cacheKey = 0;
+    std::string cachePath;
+    if (PhotonCache::keyForConfig(config, photonMapKind(), cacheKey)) {
+        cachePath = PhotonCache::pathForKey(config, photonMapKind(), cacheKey);
+    }
     
-    jobPool.emplaceJob(JobPool::WorkItem("[CPU] Build photon map", [=]() {
-        TSLoggerLog(std::cout, "[", glfwGetTime(), "] Started building photon map");
-        assert(photonMap != nullptr);
+    RenderStats stats;
+    double startTime = TSClock::now();
+    PhotonCacheReader cache;
+    bool photonsLoaded = !cachePath.empty()
+        && cache.open(cachePath, cacheKey)
+        && cache.readArray(PhotonCache::Photons, photonMap->photons);
+    bool mapLoaded = photonsLoaded && photonMap->loadIndex(cache);
+    cache.close();
+    double endTime = TSClock::now();
+    if (photonsLoaded) {
+        TSProfiler::recordSpan("load photon cache", "emit", startTime, endTime);
+        TSLoggerLog(std::cout, "loaded photons=", photonMap->photons.size(), " from=", cachePath);
+    }
+    else {
+        photonMap->photons.clear();
+        startTime = TSClock::now();
         PhotonEmitter().emitPhotons(this, photonMap->photons);
+        endTime = TSClock::now();
+        TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+    }
+    stats.emit = endTime - startTime;
+    TSProfiler::recordCounter("photons", (double) photonMap->photons.size());
+    
+    if (!mapLoaded) {
+        startTime = TSClock::now();
         photonMap->buildMap();
-        TSLoggerLog(std::cout, "Done emplacing");
-    }, [=]() {
-        TSLoggerLog(std::cout, "[", glfwGetTime(), "] Finished building photon map");
-        this->enqueRayTrace();
-    }));
+        endTime = TSClock::now();
+        stats.buildMap = endTime - startTime;
+        TSProfiler::recordSpan("build photon map", "build", startTime, endTime);
+    }
+    addRenderStats(stats);
+    
+    if (!cachePath.empty() && !photonsLoaded) {
+        PhotonCacheWriter writer(cacheKey);
+        writer.addArray(PhotonCache::Photons, photonMap->photons);
+        photonMap->saveIndex(writer);
+        if (!writer.write(cachePath)) {
+            TSLoggerLog(std::cout, "could not write file=", cachePath);
+        }
+    }
 }
 
+///
+std::string
+SCPhotonMapper::photonMapKind() const {
+    switch (config.supportedPhotonMap) {
+    case RaytracingConfig::KDTree:
+        return "kdtree";
+    case RaytracingConfig::HashGrid:
+        return "hashgrid";
+    case RaytracingConfig::SpatialHash:
+        return "spatialhash";
+    default:
+        return "unknown";
+    }
+}
 
 ///
 void
@@ -64,64 +129,67 @@ SCPhotonMapper::raytraceScene() {
     
     /// Get the camera
     auto camera = config.scene->camera();
-    auto lights = config.scene->findElements<PovrayLightSource>();
     
     /// Create all of the rays
     auto camPos = camera->location();    
     auto frame = camera->basisVectors();
     
-    for (int px = 0; px < outputImage.width; px++) {
-        for (int py = 0; py < outputImage.height; py++) {
+    raytraceTiles([&](const RenderTile & tile, TSRandomValueGenerator & tileGenerator) {
+        double gatherTime = 0.0;
+        RenderStats tileStats = traceCameraRays(tile, [&](int px, int py) -> Ray {
             Ray ray;
             ray.origin = camPos;
             ray.direction = (frame.forward - 0.5*frame.up - 0.5*frame.right + frame.right*(0.5+(double)px)/(double)outputImage.width + frame.up*(0.5+(double)py)/(double)outputImage.height).normalized();
-            
-            auto hitTest = config.scene->closestIntersection(ray);
-            Image<uint8_t>::Vector4 color = Image<uint8_t>::Vector4(0, 0, 0, 255);
-            
-            if (hitTest.element != nullptr && hitTest.element->pigment() != nullptr) {
-                /// Get indirect lighting
+            return ray;
+        }, [&](const CameraRayPacket & packet) {
+            for (int i = 0; i < RayPacket::Size; i++) {
+                if (!(packet.rays.activeMask & (1u << i))) {
+                    continue;
+                }
+                
+                const auto & hitTest = packet.hits[i];
                 RGBf result = RGBf(0,0,0);
-                result += 255.0 * computeOutputEnergyForHitUsingPhotonMap(hitTest, -ray.direction, RGBf(1,1,1));
                 
-                for (int i = 0; i < 3; i++) {
-                    result(i) = std::min<float>(255.0, result(i));
+                if (hitTest.material >= 0) {
+                    /// Get indirect lighting
+                    double gatherStart = TSClock::now();
+                    result += computeOutputEnergyForHitUsingPhotonMap(hitTest, -hitTest.hit.ray.direction, RGBf(1,1,1), tile.workerIndex);
+                    gatherTime += TSClock::now() - gatherStart;
                 }
                 
-                color.block<3,1>(0,0) = result.cast<uint8_t>();
+                hdrImage.setRadiance(packet.px[i], packet.py[i], result);
             }
-            
-            outputImage.pixel(px, py) = color;
-        }
-    }
+        });
+        
+        tileStats.gather = gatherTime;
+        tileStats.shade -= gatherTime;
+        addRenderStats(tileStats);
+    });
 }
 
 ///
 RGBf
-SCPhotonMapper::computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy) {
+SCPhotonMapper::computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy, int workerIndex) {
     
     RGBf output = RGBf::Zero();
-    brdf->pigment = *hitResult.element->pigment();
-    brdf->finish = *hitResult.element->finish();
     
-    auto photonInfo = photonMap->gatherPhotonsIndices(config.numberOfPhotonsToGather, config.maxPhotonGatherDistance, hitResult.hit.locationOfIntersection());
+    PhotonMap::PhotonIndexInfo * photonInfo = gatherScratch[workerIndex].data();
+    int numPhotons = photonMap->gatherPhotonsIndices(config.numberOfPhotonsToGather, config.maxPhotonGatherDistance, hitResult.hit.locationOfIntersection(), photonInfo);
     
     float maxSqrDist = 0.001;
+    BRDFAccumulator brdf(config.brdfType, BRDFHit(config.scene->material(hitResult), hitResult.hit.surfaceNormal, toViewer));
     //  Accumulate radiance of the K nearest photons
-    for (int i = 0; i < photonInfo.size(); ++i) {
+    for (int i = 0; i < numPhotons; ++i) {
         
         const auto & p = photonMap->photons[photonInfo[i].index];
         
-        RGBf photonEnergy = RGBf::Zero();
         if (photonInfo[i].squareDistance > maxSqrDist) {
             maxSqrDist = photonInfo[i].squareDistance;
         }
         
-        photonEnergy = brdf->computeColor(rgbe2rgb(p.energy), -p.incomingDirection.vector(), toViewer, hitResult.hit.surfaceNormal);
-        
-        output += photonEnergy;
+        brdf.add(-p.incomingDirection.vector(), rgbe2rgb(p.energy));
     }
     
-    output = output / (M_PI * maxSqrDist);
+    output = brdf.total() / (M_PI * maxSqrDist);
     return output;
 }
@@ -19,21 +19,26 @@ public:
     
     }
     
-    ///
-    virtual void start();
+    /// Loads the photons and map from "config.photonCacheDirectory" when
+    ///     it has them, and saves them there otherwise.
+    virtual void prepareFrames();
     ///
     virtual void configure();
 
     ///
     virtual void raytraceScene();
     
-    ///
-    virtual RGBf computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy);
+    /// "workerIndex" picks the scratch buffer the photon gather writes into
+    virtual RGBf computeOutputEnergyForHitUsingPhotonMap(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy, int workerIndex);
     
 protected:
     
+    /// Names "photonMap"'s type in cache files
+    std::string photonMapKind() const;
     ///
     std::shared_ptr<PhotonMap> photonMap;
+    /// One gather buffer of "config.numberOfPhotonsToGather" entries per worker
+    std::vector<std::vector<PhotonMap::PhotonIndexInfo>> gatherScratch;
 };
 
 #endif /* SCPhotonMapper_hpp */
@@ -0,0 +1,207 @@
+//
+//  SCProgressivePhotonMapper.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/9/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "SCProgressivePhotonMapper.hpp"
+#include "PhotonHashmap.hpp"
+#include "PhotonEmitter.hpp"
+#include "TSProfiler.hpp"
+
+#include <cmath>
+
+///
+SCProgressivePhotonMapper::SCProgressivePhotonMapper() : SCHashGridRaytracer(), passes_(0), visiblePointsReset_(true) {
+
+}
+
+///
+void
+SCProgressivePhotonMapper::configure() {
+    SCHashGridRaytracer::configure();
+    visiblePointsReset_ = true;
+}
+
+///
+void
+SCProgressivePhotonMapper::prepareFrames() {
+    assert(photonMap != nullptr);
+}
+
+///
+void
+SCProgressivePhotonMapper::cameraMoved() {
+    visiblePointsReset_ = true;
+}
+
+///
+bool
+SCProgressivePhotonMapper::hasConverged() const {
+    return !visiblePointsReset_ && config.progressive_maxSamples > 0 && passes_ >= config.progressive_maxSamples;
+}
+
+///
+void
+SCProgressivePhotonMapper::traceVisiblePoints() {
+    assert(config.scene != nullptr);
+
+    auto camera = config.scene->camera();
+    auto camPos = camera->location();
+    auto frame = camera->basisVectors();
+    float initialRadiusSquared = config.maxPhotonGatherDistance * config.maxPhotonGatherDistance;
+
+    visiblePoints_.resize(outputImage.width * outputImage.height);
+    raytraceTiles([&](const RenderTile & tile, TSRandomValueGenerator & tileGenerator) {
+        RenderStats tileStats = traceCameraRays(tile, [&](int px, int py) -> Ray {
+            Ray ray;
+            ray.origin = camPos;
+            ray.direction = (frame.forward - 0.5*frame.up - 0.5*frame.right + frame.right*(0.5+(double)px)/(double)outputImage.width + frame.up*(0.5+(double)py)/(double)outputImage.height).normalized();
+            return ray;
+        }, [&](const CameraRayPacket & packet) {
+            for (int i = 0; i < RayPacket::Size; i++) {
+                if (!(packet.rays.activeMask & (1u << i))) {
+                    continue;
+                }
+
+                const auto & hitTest = packet.hits[i];
+                VisiblePoint & point = visiblePoints_[packet.py[i] * outputImage.width + packet.px[i]];
+                point.element = hitTest.element;
+                point.material = hitTest.material;
+                if (hitTest.material >= 0) {
+                    point.position = hitTest.hit.locationOfIntersection();
+                    point.surfaceNormal = hitTest.hit.surfaceNormal;
+                    point.toViewer = -hitTest.hit.ray.direction;
+                }
+
+                point.radiusSquared = initialRadiusSquared;
+                point.photonCount = 0.0f;
+                point.flux = RGBf(0,0,0);
+            }
+        });
+
+        addRenderStats(tileStats);
+    });
+
+    passes_ = 0;
+}
+
+///
+void
+SCProgressivePhotonMapper::updateVisiblePoint(const PhotonHashmap * map, VisiblePoint & point, int workerIndex) {
+    if (point.material < 0) {
+        return;
+    }
+
+    auto gridIndex = map->getCellIndex(point.position);
+    int px = gridIndex.x(), py = gridIndex.y(), pz = gridIndex.z();
+
+    /// Only consider points within the grid
+    if (px < 0 || px >= map->xdim
+     || py < 0 || py >= map->ydim
+     || pz < 0 || pz >= map->zdim) {
+        return;
+    }
+
+    const PhotonArrays & arrays = map->photonArrays;
+    std::vector<int> & candidates = candidateScratch[workerIndex];
+    std::vector<float> & candidateDistances = candidateDistanceScratch[workerIndex];
+    int geometryId = point.element;
+    int halfSideLength = (int) ceil(std::sqrt(point.radiusSquared) / map->cellsize);
+    /// The filter keeps distances <= its bound; photons must be strictly inside
+    float maxSquareDistance = std::nextafter(point.radiusSquared, 0.0f);
+
+    int photonsFound = 0;
+    BRDFAccumulator brdf(config.brdfType, BRDFHit(config.scene->material(point.material), point.surfaceNormal, point.toViewer));
+    for (int i = std::max<int>(0, px - halfSideLength); i < std::min<int>(map->xdim, px+halfSideLength+1); ++i) {
+        for (int j = std::max<int>(0, py - halfSideLength); j < std::min<int>(map->ydim, py+halfSideLength+1); ++j) {
+            for (int k = std::max<int>(0, pz - halfSideLength); k < std::min<int>(map->zdim, pz+halfSideLength+1); ++k) {
+
+                int gridHash = map->photonHash(i,j,k);
+                int first = map->gridFirstPhotonIndices[gridHash];
+                int count = map->gridPhotonCounts[gridHash];
+                if (count > (int) candidates.size()) {
+                    candidates.resize(count);
+                    candidateDistances.resize(count);
+                }
+
+                int numCandidates = arrays.filterCandidates(first, first + count, point.position, maxSquareDistance, geometryId, candidates.data(), candidateDistances.data());
+                for (int c = 0; c < numCandidates; c++) {
+                    int pi = candidates[c];
+                    brdf.add(-arrays.incomingDirections[pi].vector(), rgbe2rgb(arrays.energies[pi]));
+                }
+                photonsFound += numCandidates;
+            }
+        }
+    }
+
+    if (photonsFound == 0) {
+        return;
+    }
+
+    /// Keep "alpha" of the new photons and shrink the disc to match, so the
+    ///     photon density within it stays the same
+    float keptCount = point.photonCount + config.progressive_radiusAlpha * photonsFound;
+    float shrink = keptCount / (point.photonCount + photonsFound);
+    point.radiusSquared *= shrink;
+    point.flux = (point.flux + brdf.total()) * shrink;
+    point.photonCount = keptCount;
+}
+
+///
+void
+SCProgressivePhotonMapper::raytraceScene() {
+
+    if (visiblePointsReset_.exchange(false) || (int) visiblePoints_.size() != outputImage.width * outputImage.height) {
+        traceVisiblePoints();
+    }
+    if (hasConverged()) {
+        return;
+    }
+
+    /// One pass of photons, indexed by the hash grid
+    RenderStats stats;
+    double startTime = TSClock::now();
+    photonMap->photons.clear();
+    PhotonEmitter().emitPhotons(this, photonMap->photons, (unsigned int) passes_);
+    double endTime = TSClock::now();
+    stats.emit = endTime - startTime;
+    TSProfiler::recordSpan("emit photons", "emit", startTime, endTime);
+
+    startTime = TSClock::now();
+    photonMap->buildMap();
+    endTime = TSClock::now();
+    stats.buildMap = endTime - startTime;
+    TSProfiler::recordSpan("build photon map", "build", startTime, endTime);
+    addRenderStats(stats);
+
+    passes_++;
+    float fluxScale = (float) (1.0 / (M_PI * passes_));
+    const PhotonHashmap * map = dynamic_cast<const PhotonHashmap *>(photonMap.get());
+
+    raytraceTiles([&](const RenderTile & tile, TSRandomValueGenerator & tileGenerator) {
+        RenderStats tileStats;
+        double gatherStart = TSClock::now();
+        for (int py = tile.y0; py < tile.y1; py++) {
+            for (int px = tile.x0; px < tile.x1; px++) {
+                VisiblePoint & point = visiblePoints_[py * outputImage.width + px];
+                updateVisiblePoint(map, point, tile.workerIndex);
+
+                RGBf result = RGBf(0,0,0);
+                if (point.material >= 0) {
+                    result = point.flux * (fluxScale / point.radiusSquared);
+                }
+
+                hdrImage.setRadiance(px, py, result);
+            }
+        }
+        tileStats.gather = TSClock::now() - gatherStart;
+        addRenderStats(tileStats);
+    });
+
+    /// This pass's photons are no longer needed
+    photonMap->photons.clear();
+    TSProfiler::recordCounter("photon passes", (double) passes_);
+}
@@ -0,0 +1,85 @@
+//
+//  SCProgressivePhotonMapper.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/9/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef SCProgressivePhotonMapper_hpp
+#define SCProgressivePhotonMapper_hpp
+
+#include <atomic>
+
+#include "SCHashGridRaytracer.hpp"
+#include "PhotonHashmap.hpp"
+
+///
+/// Stochastic progressive photon mapping, after Hachisuka and Jensen's
+///     "Stochastic Progressive Photon Mapping" (2009).
+///
+/// The camera rays are traced once and the point each pixel sees is kept.
+///     Every frame is then one photon pass: "config.raysPerLight" photons are
+///     emitted into the ".photonMap" hash grid, every visible point collects
+///     the photons within its own radius, shrinks that radius and rescales
+///     its flux, and the pass's photons are thrown away. Memory stays that of
+///     one pass while the estimate keeps converging.
+///
+/// "config.maxPhotonGatherDistance" is the starting radius,
+///     "config.progressive_radiusAlpha" the fraction of new photons each
+///     point keeps, and "config.progressive_maxSamples" (if positive) the
+///     number of passes after which it stops.
+///
+class SCProgressivePhotonMapper : public SCHashGridRaytracer {
+public:
+
+    SCProgressivePhotonMapper();
+
+    ///
+    virtual void configure();
+    /// Nothing to prepare; photons are emitted a pass at a time
+    virtual void prepareFrames();
+    ///
+    virtual void raytraceScene();
+
+    /// Re-traces the visible points and starts over
+    virtual void cameraMoved();
+    /// True once "config.progressive_maxSamples" passes have been made
+    virtual bool hasConverged() const;
+
+private:
+
+    ///
+    struct VisiblePoint {
+        Eigen::Vector3f position;
+        Eigen::Vector3f surfaceNormal;
+        Eigen::Vector3f toViewer;
+        /// Element and material hit, both -1 if the pixel's ray missed
+        int element;
+        int material;
+
+        /// Current gather radius, squared
+        float radiusSquared;
+        /// Photons the point has kept so far ("N" in the paper)
+        float photonCount;
+        /// Flux gathered within the current radius ("tau" in the paper)
+        RGBf flux;
+    };
+
+    /// Traces one ray through the center of every pixel and resets every
+    ///     point's statistics.
+    void traceVisiblePoints();
+    /// Gathers this pass's photons in "map" around "point" and updates its
+    ///     radius and flux.
+    void updateVisiblePoint(const PhotonHashmap * map, VisiblePoint & point, int workerIndex);
+
+    /// One per pixel of ".outputImage", row by row
+    std::vector<VisiblePoint> visiblePoints_;
+    /// Photon passes since the visible points were traced
+    int passes_;
+
+    /// Set from the main thread by "cameraMoved"
+    std::atomic<bool> visiblePointsReset_;
+};
+
+#endif /* SCProgressivePhotonMapper_hpp */
@@ -0,0 +1,22 @@
+//
+//  SCSpatialHashRaytracer.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "SCSpatialHashRaytracer.hpp"
+
+///
+SCSpatialHashRaytracer::SCSpatialHashRaytracer() : SCPhotonMapper() {
+
+}
+
+///
+void
+SCSpatialHashRaytracer::configure() {
+
+    config.supportedPhotonMap = RaytracingConfig::SpatialHash;
+    SCPhotonMapper::configure();
+}
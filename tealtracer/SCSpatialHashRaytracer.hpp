@@ -0,0 +1,27 @@
+//
+//  SCSpatialHashRaytracer.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef SCSpatialHashRaytracer_hpp
+#define SCSpatialHashRaytracer_hpp
+
+#include "SCPhotonMapper.hpp"
+
+///
+/// Gathers the nearest photons like "SCKDTreeRaytracer", but out of a
+///     "PhotonSpatialHashmap", which has no grid bounds to configure.
+///
+class SCSpatialHashRaytracer : public SCPhotonMapper {
+public:
+
+    SCSpatialHashRaytracer();
+    
+    ///
+    virtual void configure();
+};
+
+#endif /* SCSpatialHashRaytracer_hpp */
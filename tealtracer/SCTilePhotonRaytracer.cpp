@@ -7,7 +7,10 @@
 //
 
 #include "SCTilePhotonRaytracer.hpp"
+#include "TSProfiler.hpp"
 #include "PhotonEmitter.hpp"
+#include "PhotonCache.hpp"
+#include "TSLogger.hpp"
 
 ///
 SCTilePhotonRaytracer::SCTilePhotonRaytracer() : SingleCoreRaytracer() {
@@ -29,18 +32,49 @@ SCTilePhotonRaytracer::step(double x) {
 
 ///
 void
-SCTilePhotonRaytracer::start() {
-    configure();
-
-    jobPool.emplaceJob(JobPool::WorkItem("[CPU] Build photon map", [=]() {
-        double t0 = glfwGetTime();
-        TSLoggerLog(std::cout, "Started emitting photons");
+SCTilePhotonRaytracer::prepareFrames() {
+    /// Tiles follow the camera, so only the photons are cached
+    uint64_t cacheKey = 0;
+    std::string cachePath;
+    if (PhotonCache::keyForConfig(config, "tiles", cacheKey)) {
+        cachePath = PhotonCache::pathForKey(config, "tiles", cacheKey);
+    }
+    
+    double t0 = TSClock::now();
+    PhotonCacheReader cache;
+    bool photonsLoaded = !cachePath.empty()
+        && cache.open(cachePath, cacheKey)
+        && cache.readArray(PhotonCache::Photons, photonTiler->photons);
+    cache.close();
+    if (photonsLoaded) {
+        TSLoggerLog(std::cout, "loaded photons=", photonTiler->photons.size(), " from=", cachePath);
+    }
+    else {
+        photonTiler->photons.clear();
         PhotonEmitter().emitPhotons(this, photonTiler->photons);
-        double tf = glfwGetTime();
-        TSLoggerLog(std::cout, "Done emitting photons (t=", tf - t0, ")");
-    }, [=]() {
-        this->enqueRayTrace();
-    }));
+    }
+    double tf = TSClock::now();
+    TSProfiler::recordSpan(photonsLoaded ? "load photon cache" : "emit photons", "emit", t0, tf);
+    TSProfiler::recordCounter("photons", (double) photonTiler->photons.size());
+    
+    if (!cachePath.empty() && !photonsLoaded) {
+        PhotonCacheWriter writer(cacheKey);
+        writer.addArray(PhotonCache::Photons, photonTiler->photons);
+        if (!writer.write(cachePath)) {
+            TSLoggerLog(std::cout, "could not write file=", cachePath);
+        }
+    }
+    
+    /// Tiling only ever reorders indices, so this stays valid every frame
+    double arraysStart = TSClock::now();
+    photonArrays.assign(photonTiler->photons);
+    double arraysEnd = TSClock::now();
+    TSProfiler::recordSpan("build photon arrays", "build", arraysStart, arraysEnd);
+    
+    RenderStats stats;
+    stats.emit = tf - t0;
+    stats.buildMap = arraysEnd - arraysStart;
+    addRenderStats(stats);
 }
 
 ///
@@ -54,57 +88,100 @@ SCTilePhotonRaytracer::raytraceScene() {
     Eigen::Vector3f cameraPosition = config.scene->camera()->location();
     FrenetFrame frame = config.scene->camera()->basisVectors();
     
+    double buildStart = TSClock::now();
     photonTiler->generateTiles(outputImage.width, outputImage.height, tileWidth, tileHeight, config.scene->camera()->location(), config.scene->camera()->basisVectors());
     photonTiler->buildMap(photonEffectRadius);
     
-    for (int py = 0; py < outputImage.height; py++) {
-        for (int px = 0; px < outputImage.width; px++) {
+    /// Tiles sample every "photonSampleStep"th of their photons (a fractional
+    ///     rate used to be added to an int index, truncating it each step)
+    int photonSampleStep = std::max<int>(1, (int) photonSampleRate);
+    int numTiles = (int) photonTiler->tiles.size();
+    int maxTileSamples = 0;
+    tileArrayStarts.assign(numTiles + 1, 0);
+    for (int tileItr = 0; tileItr < numTiles; tileItr++) {
+        int count = photonTiler->tilePhotonStarts[tileItr + 1] - photonTiler->tilePhotonStarts[tileItr];
+        int numSamples = (count + photonSampleStep - 1) / photonSampleStep;
+        tileArrayStarts[tileItr + 1] = tileArrayStarts[tileItr] + numSamples;
+        maxTileSamples = std::max<int>(maxTileSamples, numSamples);
+    }
+    
+    /// Then copy them out tile by tile, so that pixels can filter them 8 at
+    ///     a time. Every tile writes its own range, so tiles run in parallel.
+    tileArrays.resize(tileArrayStarts[numTiles]);
+    threadPool->parallelFor(numTiles, [&](int tileItr, int workerIndex) {
+        const int * indices = photonTiler->tilePhotonIndices.data() + photonTiler->tilePhotonStarts[tileItr];
+        for (int to = tileArrayStarts[tileItr], i = 0; to < tileArrayStarts[tileItr + 1]; to++, i += photonSampleStep) {
+            tileArrays.set(to, photonArrays, indices[i]);
+        }
+    });
+    
+    candidateScratch.resize(threadPool->numWorkers());
+    candidateDistanceScratch.resize(threadPool->numWorkers());
+    for (int workerItr = 0; workerItr < threadPool->numWorkers(); workerItr++) {
+        candidateScratch[workerItr].resize(std::max<int>(maxTileSamples, (int) candidateScratch[workerItr].size()));
+        candidateDistanceScratch[workerItr].resize(candidateScratch[workerItr].size());
+    }
+    
+    double buildEnd = TSClock::now();
+    TSProfiler::recordSpan("build tiles", "build", buildStart, buildEnd);
+    
+    RenderStats buildStats;
+    buildStats.buildMap = buildEnd - buildStart;
+    addRenderStats(buildStats);
+    
+    raytraceTiles([&](const RenderTile & tile, TSRandomValueGenerator & tileGenerator) {
+        double gatherTime = 0.0;
+        RenderStats tileStats = traceCameraRays(tile, [&](int px, int py) -> Ray {
             Ray ray;
             ray.origin = cameraPosition;
             ray.direction = (frame.forward - 0.5*frame.up - 0.5*frame.right + frame.right*(0.5+(double)px)/(double)outputImage.width + frame.up*(0.5+(double)py)/(double)outputImage.height).normalized();
-            
-            auto hitTest = config.scene->closestIntersection(ray);
-            
-            RGBf totalEnergy = RGBf::Zero();
-            
-            if (hitTest.hit.intersected) {
-            
-                Eigen::Vector3f intersection = hitTest.hit.locationOfIntersection();
-                int tileIndex = photonTiler->tileIndexForPixel(outputImage.width, outputImage.height, tileWidth, tileHeight, px, py);
+            return ray;
+        }, [&](const CameraRayPacket & packet) {
+            for (int rayItr = 0; rayItr < RayPacket::Size; rayItr++) {
+                if (!(packet.rays.activeMask & (1u << rayItr))) {
+                    continue;
+                }
                 
-                brdf->pigment = *hitTest.element->pigment();
-                brdf->finish = *hitTest.element->finish();
+                int px = packet.px[rayItr], py = packet.py[rayItr];
+                const auto & hitTest = packet.hits[rayItr];
                 
-                auto & photons = photonTiler->tilePhotons[tileIndex];
+                RGBf totalEnergy = RGBf::Zero();
                 
-                int i = 0;
-                int numPhotonsSampled = 0;
-                float maxDistanceSqd = -std::numeric_limits<float>::infinity();
+                if (hitTest.hit.intersected) {
+                    double gatherStart = TSClock::now();
                 
-                /// Sample the collection of photons
-                while (i < photons.size()) {
-                    const JensenPhoton & photon = photons[i];
-                    float distanceSqrd = (photon.position - intersection).dot(photon.position - intersection);
-                    if (hitTest.element->id() == photon.flags.geometryIndex
-                     && distanceSqrd <= photonEffectRadius * photonEffectRadius) {
+                    Eigen::Vector3f intersection = hitTest.hit.locationOfIntersection();
+                    int tileIndex = photonTiler->tileIndexForPixel(outputImage.width, outputImage.height, tileWidth, tileHeight, px, py);
+                    
+                    int * candidates = candidateScratch[tile.workerIndex].data();
+                    float * candidateDistances = candidateDistanceScratch[tile.workerIndex].data();
+                    
+                    int numPhotonsSampled = 0;
+                    float maxDistanceSqd = -std::numeric_limits<float>::infinity();
+                    
+                    /// Sample the collection of photons
+                    BRDFAccumulator brdf(config.brdfType, BRDFHit(config.scene->material(hitTest), hitTest.hit.surfaceNormal, -hitTest.hit.ray.direction));
+                    int numCandidates = tileArrays.filterCandidates(tileArrayStarts[tileIndex], tileArrayStarts[tileIndex + 1], intersection, photonEffectRadius * photonEffectRadius, hitTest.element, candidates, candidateDistances);
+                    for (int c = 0; c < numCandidates; c++) {
+                        int i = candidates[c];
                         ++numPhotonsSampled;
-                        totalEnergy += brdf->computeColor(rgbe2rgb(photon.energy), -photon.incomingDirection.vector(), -ray.direction, hitTest.hit.surfaceNormal);
-                        maxDistanceSqd = std::max<float>(maxDistanceSqd, distanceSqrd);
+                        brdf.add(-tileArrays.incomingDirections[i].vector(), rgbe2rgb(tileArrays.energies[i]));
+                        maxDistanceSqd = std::max<float>(maxDistanceSqd, candidateDistances[c]);
                     }
-                    i += photonSampleRate;
-                }
-                
-                if (numPhotonsSampled > 0) {
-                    totalEnergy = 255.0f * totalEnergy * (1.0f/(M_PI * maxDistanceSqd));
                     
-                    for (int i = 0; i < 3; i++) {
-                        totalEnergy(i) = std::min<float>(255.0, totalEnergy(i));
+                    if (numPhotonsSampled > 0) {
+                        totalEnergy = brdf.total() * (1.0f/(M_PI * maxDistanceSqd));
                     }
+                    
+                    gatherTime += TSClock::now() - gatherStart;
                 }
+                
+                hdrImage.setRadiance(px, py, totalEnergy);
             }
-            
-            outputImage.pixel(px, py).block<3,1>(0,0) = totalEnergy.cast<uint8_t>();
-        }
-    }
-    
+        });
+        
+        tileStats.gather = gatherTime;
+        tileStats.shade -= gatherTime;
+        addRenderStats(tileStats);
+    });
 }
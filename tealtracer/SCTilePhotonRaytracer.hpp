@@ -11,6 +11,7 @@
 
 #include "SCPhotonMapper.hpp"
 #include "PhotonTiler.hpp"
+#include "PhotonArrays.hpp"
 
 class SCTilePhotonRaytracer : public SingleCoreRaytracer {
 public:
@@ -24,7 +25,7 @@ public:
     int step(double x);
     
     ///
-    virtual void start();
+    virtual void prepareFrames();
     
     ///
     virtual void raytraceScene();
@@ -32,6 +33,16 @@ public:
 protected:
 
     std::shared_ptr<PhotonTiler> photonTiler;
+    
+    /// "photonTiler->photons" in the same order, built once they are emitted
+    PhotonArrays photonArrays;
+    /// The photons each tile samples, gathered out of "photonArrays" every
+    ///     frame: tile "t" owns [tileArrayStarts[t], tileArrayStarts[t + 1]).
+    PhotonArrays tileArrays;
+    std::vector<int> tileArrayStarts;
+    /// Per-worker output of "PhotonArrays::filterCandidates"
+    std::vector<std::vector<int>> candidateScratch;
+    std::vector<std::vector<float>> candidateDistanceScratch;
 
 };
 
@@ -8,14 +8,19 @@
 
 #include "SingleCoreRaytracer.hpp"
 
+#include <chrono>
+#include <thread>
+
 #include "opengl_errors.hpp"
 #include "stl_extensions.hpp"
 
 #include "TSLogger.hpp"
+#include "TSProfiler.hpp"
+#include "Tonemapper.hpp"
 
 ///
 SingleCoreRaytracer::SingleCoreRaytracer() {
-    brdf = nullptr;
+    threadPool = nullptr;
 }
 
 ///
@@ -23,20 +28,27 @@ void
 SingleCoreRaytracer::configure() {
     
     switch (config.brdfType) {
-    case RaytracingConfig::BlinnPhong: {
-        brdf = std::shared_ptr<BRDF>(new BlinnPhongBRDF());
-        break;
-    }
-    case RaytracingConfig::OrenNayar: {
-        brdf = std::shared_ptr<BRDF>(new OrenNayarBRDF());
+    case RaytracingConfig::BlinnPhong:
+    case RaytracingConfig::OrenNayar:
         break;
-    }
     default:
         assert(false);
         break;
     }
     
-    lastRayTraceTime = glfwGetTime();
+    if (config.randomSeed >= 0) {
+        generator.seed((unsigned int) config.randomSeed);
+    }
+    
+    if (threadPool == nullptr) {
+        threadPool = std::shared_ptr<ThreadPool>(new ThreadPool(config.numberOfThreads));
+        tileGenerators.clear();
+        for (int i = 0; i < threadPool->numWorkers(); i++) {
+            tileGenerators.push_back(std::shared_ptr<TSRandomValueGenerator>(new TSRandomValueGenerator()));
+        }
+    }
+    
+    lastRayTraceTime = TSClock::now();
     rayTraceElapsedTime = 0.0;
     framesRendered = 0;
 }
@@ -46,7 +58,18 @@ void
 SingleCoreRaytracer::start() {
 
     configure();
-    this->enqueRayTrace();
+    
+    jobPool.emplaceJob(JobPool::WorkItem("[CPU] Prepare frames", [=]() {
+        this->prepareFrames();
+    }, [=]() {
+        this->enqueRayTrace();
+    }));
+}
+
+///
+void
+SingleCoreRaytracer::renderFrame() {
+    raytraceScene();
 }
 
 ///
@@ -54,25 +77,186 @@ void
 SingleCoreRaytracer::enqueRayTrace() {
     jobPool.emplaceJob(JobPool::WorkItem("[CPU] Raytrace", [=](){
 //        TSLoggerLog(std::cout, "Beginning ray trace");
-        auto startTime = glfwGetTime();
+        if (this->hasConverged()) {
+            /// Don't spin the job thread until there is something to refine
+            std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        }
+        auto startTime = TSClock::now();
         this->raytraceScene();
-        auto endTime = glfwGetTime();
+        auto endTime = TSClock::now();
         lastRayTraceTime = endTime - startTime;
+        TSProfiler::recordSpan("frame", "frame", startTime, endTime);
     }, [=](){
 //        TSLoggerLog(std::cout, "Finished ray trace");
         rayTraceElapsedTime = lastRayTraceTime;
         framesRendered++;
-        this->target.outputTexture->setNeedsUpdate();
+        this->markDirtyTilesForUpload();
         this->enqueRayTrace();
     }));
 }
 
+///
+void
+SingleCoreRaytracer::tileGrid(int & tileWidth, int & tileHeight, int & tilesWide, int & tilesHigh) const {
+    tileWidth = config.tile_width > 0 ? config.tile_width : 32;
+    tileHeight = config.tile_height > 0 ? config.tile_height : 32;
+    tilesWide = (outputImage.width + tileWidth - 1) / tileWidth;
+    tilesHigh = (outputImage.height + tileHeight - 1) / tileHeight;
+}
+
+///
+int
+SingleCoreRaytracer::numTiles() const {
+    int tileWidth, tileHeight, tilesWide, tilesHigh;
+    tileGrid(tileWidth, tileHeight, tilesWide, tilesHigh);
+    return tilesWide * tilesHigh;
+}
+
+///
+void
+SingleCoreRaytracer::raytraceTiles(const std::function<void(const RenderTile & tile, TSRandomValueGenerator & tileGenerator)> & renderTile) {
+    assert(threadPool != nullptr);
+    
+    int tileWidth, tileHeight, tilesWide, tilesHigh;
+    tileGrid(tileWidth, tileHeight, tilesWide, tilesHigh);
+    
+    unsigned int frameSeed = (unsigned int) (config.randomSeed >= 0 ? config.randomSeed : 0);
+    frameSeed = frameSeed * 2654435761u + (unsigned int) framesRendered;
+    
+    if ((int) dirtyTiles_.size() != tilesWide * tilesHigh) {
+        dirtyTiles_.assign(tilesWide * tilesHigh, 1);
+    }
+    
+    Tonemapper tonemapper(config.tonemap, config.tonemapExposure);
+    
+    parallelForSeeded(tilesWide * tilesHigh, frameSeed, [&](int tileIndex, int workerIndex, TSRandomValueGenerator & tileGenerator) {
+        TSProfileScope("render tile", "shade");
+        
+        RenderTile tile;
+        tile.index = tileIndex;
+        tile.workerIndex = workerIndex;
+        tile.x0 = (tileIndex % tilesWide) * tileWidth;
+        tile.y0 = (tileIndex / tilesWide) * tileHeight;
+        tile.x1 = std::min<int>(tile.x0 + tileWidth, outputImage.width);
+        tile.y1 = std::min<int>(tile.y0 + tileHeight, outputImage.height);
+        
+        dirtyTiles_[tileIndex] = 1;
+        renderTile(tile, tileGenerator);
+        
+        if (dirtyTiles_[tileIndex]) {
+            tonemapper.apply(hdrImage, outputImage, tile.x0, tile.y0, tile.x1, tile.y1);
+        }
+    });
+}
+
+///
+void
+SingleCoreRaytracer::markTileUnchanged(const RenderTile & tile) {
+    dirtyTiles_[tile.index] = 0;
+}
+
+///
+void
+SingleCoreRaytracer::markDirtyTilesForUpload() {
+    int tileWidth, tileHeight, tilesWide, tilesHigh;
+    tileGrid(tileWidth, tileHeight, tilesWide, tilesHigh);
+    if ((int) dirtyTiles_.size() != tilesWide * tilesHigh) {
+        target.markAllDirty();
+        return;
+    }
+    
+    for (int tileY = 0; tileY < tilesHigh; tileY++) {
+        int tileX = 0;
+        while (tileX < tilesWide) {
+            if (!dirtyTiles_[tileY * tilesWide + tileX]) {
+                tileX++;
+                continue;
+            }
+            
+            /// Extend the rect over the run of dirty tiles that follows
+            int runStart = tileX;
+            while (tileX < tilesWide && dirtyTiles_[tileY * tilesWide + tileX]) {
+                dirtyTiles_[tileY * tilesWide + tileX] = 0;
+                tileX++;
+            }
+            
+            TextureRenderTarget::Rect rect;
+            rect.x = runStart * tileWidth;
+            rect.y = tileY * tileHeight;
+            rect.width = std::min<int>(tileX * tileWidth, outputImage.width) - rect.x;
+            rect.height = std::min<int>(rect.y + tileHeight, outputImage.height) - rect.y;
+            
+            /// Whole rows stack onto the rect of the row above
+            auto & rects = target.dirtyRects;
+            if (rect.width == outputImage.width && !rects.empty()
+             && rects.back().width == outputImage.width && rects.back().y + rects.back().height == rect.y) {
+                rects.back().height += rect.height;
+            }
+            else {
+                target.markDirty(rect);
+            }
+        }
+    }
+}
+
+///
+void
+SingleCoreRaytracer::parallelForSeeded(int numTasks, unsigned int streamSeed, const std::function<void(int taskIndex, int workerIndex, TSRandomValueGenerator & taskGenerator)> & task) {
+    assert(threadPool != nullptr);
+    
+    threadPool->parallelFor(numTasks, [&](int taskIndex, int workerIndex) {
+        TSRandomValueGenerator & taskGenerator = *tileGenerators[workerIndex];
+        taskGenerator.seed(streamSeed * 2246822519u + (unsigned int) taskIndex);
+        
+        task(taskIndex, workerIndex, taskGenerator);
+    });
+}
+
+///
+Raytracer::RenderStats
+SingleCoreRaytracer::traceCameraRays(const RenderTile & tile, const std::function<Ray(int px, int py)> & cameraRay, const std::function<void(const CameraRayPacket & packet)> & shade) const {
+    assert(config.scene != nullptr);
+    
+    RenderStats stats;
+    CameraRayPacket packet;
+    int numRays = 0;
+    for (int py = tile.y0; py < tile.y1; py++) {
+        for (int px = tile.x0; px < tile.x1; px++) {
+            packet.px[numRays] = px;
+            packet.py[numRays] = py;
+            packet.rays.setRay(numRays, cameraRay(px, py));
+            numRays++;
+            
+            bool lastPixel = px + 1 == tile.x1 && py + 1 == tile.y1;
+            if (numRays == RayPacket::Size || lastPixel) {
+                config.scene->closestIntersection(packet.rays, packet.hits);
+                
+                double shadeStart = TSClock::now();
+                shade(packet);
+                stats.shade += TSClock::now() - shadeStart;
+                stats.cameraRays += numRays;
+                
+                packet.rays.activeMask = 0;
+                numRays = 0;
+            }
+        }
+    }
+    
+    return stats;
+}
+
 ///
 RGBf
-SingleCoreRaytracer::computeOutputEnergyForHit(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy) {
+SingleCoreRaytracer::computeBRDF(const PovrayMaterial & material, const RGBf & source, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const Eigen::Vector3f & surfaceNormal) const {
     
-    brdf->pigment = *hitResult.element->pigment();
-    brdf->finish = *hitResult.element->finish();
+    BRDFAccumulator brdf(config.brdfType, BRDFHit(material, surfaceNormal, toViewer));
+    brdf.add(toLight, source);
+    return brdf.total();
+}
+
+///
+RGBf
+SingleCoreRaytracer::computeOutputEnergyForHit(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy) {
     
-    return brdf->computeColor(sourceEnergy, toLight, toViewer, hitResult.hit.surfaceNormal);
+    return computeBRDF(config.scene->material(hitResult), sourceEnergy, toLight, toViewer, hitResult.hit.surfaceNormal);
 }
@@ -15,11 +15,28 @@
 #include "BRDF.hpp"
 #include "Raytracer.hpp"
 #include "MatrixMath.hpp"
+#include "ThreadPool.hpp"
+#include "RayPacket.hpp"
 
 ///
 class SingleCoreRaytracer : public Raytracer {
 public:
     
+    /// A rectangle of ".outputImage" covering pixels [x0, x1) x [y0, y1)
+    struct RenderTile {
+        int index;
+        int x0, y0, x1, y1;
+        /// Worker rendering this tile, for indexing per-worker scratch space
+        int workerIndex;
+    };
+    
+    /// Camera rays through the pixels ("px[i]", "py[i]") and what they hit
+    struct CameraRayPacket {
+        RayPacket rays;
+        int px[RayPacket::Size], py[RayPacket::Size];
+        PovrayScene::InstersectionResult hits[RayPacket::Size];
+    };
+    
     ///
     SingleCoreRaytracer();
 
@@ -29,6 +46,34 @@ public:
     
     ///
     virtual void raytraceScene() = 0;
+    /// Raytracers that refine one image over many frames return true once
+    ///     further frames would not change it; "enqueRayTrace" then idles.
+    virtual bool hasConverged() const {return false;}
+    
+    /// Splits ".outputImage" into "config.tile_width" x "config.tile_height"
+    ///     tiles and calls "renderTile" for each of them on the ".threadPool".
+    ///     The generator handed to "renderTile" is seeded from the tile index,
+    ///     the frame number, and "config.randomSeed", so the output does not
+    ///     depend on which thread picks up which tile. Tiles render into
+    ///     ".hdrImage" and are tonemapped into ".outputImage" as they finish.
+    void raytraceTiles(const std::function<void(const RenderTile & tile, TSRandomValueGenerator & tileGenerator)> & renderTile);
+    /// Call from a "raytraceTiles" callback that leaves its tile's pixels as
+    ///     they were, so the tile is not uploaded to the window again.
+    void markTileUnchanged(const RenderTile & tile);
+    /// Number of tiles "raytraceTiles" splits ".outputImage" into; tile
+    ///     indices are in [0, numTiles()).
+    int numTiles() const;
+    
+    /// Runs "task" for every index in [0, numTasks) on the ".threadPool". The
+    ///     generator handed to "task" is re-seeded from "streamSeed" and the
+    ///     task index, so results are reproducible for any number of threads.
+    void parallelForSeeded(int numTasks, unsigned int streamSeed, const std::function<void(int taskIndex, int workerIndex, TSRandomValueGenerator & taskGenerator)> & task);
+    
+    /// Traces the camera ray "cameraRay" makes for every pixel of "tile",
+    ///     "RayPacket::Size" neighbouring pixels of a row at a time, and
+    ///     hands each traced packet to "shade". Returns the number of rays
+    ///     traced and the time spent in "shade".
+    RenderStats traceCameraRays(const RenderTile & tile, const std::function<Ray(int px, int py)> & cameraRay, const std::function<void(const CameraRayPacket & packet)> & shade) const;
     
     ///
     virtual RGBf computeOutputEnergyForHit(const PovrayScene::InstersectionResult & hitResult, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const RGBf & sourceEnergy);
@@ -37,11 +82,31 @@ public:
     virtual void start();
     /// called in "start" to setup parameters from ".config"
     virtual void configure();
+    /// Calls "raytraceScene".
+    virtual void renderFrame();
     
 protected:
 
-    std::shared_ptr<BRDF> brdf;
+    /// Size of each tile and how many tiles cover ".outputImage"
+    void tileGrid(int & tileWidth, int & tileHeight, int & tilesWide, int & tilesHigh) const;
+
+    /// Evaluates the configured BRDF for "element" with a single sample.
+    ///     Loops over many samples at one hit should use a "BRDFAccumulator".
+    RGBf computeBRDF(const PovrayMaterial & material, const RGBf & source, const Eigen::Vector3f & toLight, const Eigen::Vector3f & toViewer, const Eigen::Vector3f & surfaceNormal) const;
+    
+    std::shared_ptr<ThreadPool> threadPool;
+    /// One generator per worker, re-seeded for every tile (or seeded task)
+    std::vector<std::shared_ptr<TSRandomValueGenerator>> tileGenerators;
+    
+private:
+
+    /// Hands the tiles rendered since the last call to ".target", merging
+    ///     neighbouring tiles of a row into one rect. Main thread only.
+    void markDirtyTilesForUpload();
     
+    /// Non-zero for every tile "raytraceTiles" has rendered since the last
+    ///     upload. Each entry is only written by the worker rendering it.
+    std::vector<uint8_t> dirtyTiles_;
 };
 
 #endif /* SingleCoreRaytracer_hpp */
@@ -0,0 +1,25 @@
+//
+//  TSClock.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/6/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef TSClock_hpp
+#define TSClock_hpp
+
+#include <chrono>
+
+class TSClock {
+public:
+    /// Seconds since the first call, from a monotonic clock. Unlike
+    ///     "glfwGetTime" this does not need "glfwInit", so it works in
+    ///     headless renders and benchmarks.
+    static double now() {
+        static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif /* TSClock_hpp */
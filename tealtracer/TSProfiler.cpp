@@ -0,0 +1,285 @@
+//
+//  TSProfiler.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/7/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "TSProfiler.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+std::atomic<bool> TSProfiler::enabled_(false);
+
+///
+namespace {
+
+    ///
+    enum EventType {
+        SpanEvent = 0,
+        CounterEvent,
+        DeviceSpanEvent
+    };
+    
+    ///
+    struct Event {
+        const char * name;
+        const char * category;
+        double start;
+        /// The end of a span, or the value of a counter
+        double endOrValue;
+        int type;
+        int deviceIndex;
+    };
+    
+    /// Only the owning thread writes to "events"; "written" counts every event
+    ///     ever recorded, so the ring holds the last min(written, size).
+    struct ThreadEvents {
+        int threadIndex;
+        std::string threadName;
+        std::vector<Event> events;
+        unsigned long long written;
+        /// False once the owning thread has exited
+        bool inUse;
+    };
+    
+    ///
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadEvents>> threads;
+        std::set<std::string> names;
+    };
+    
+    /// Never destroyed, so threads still recording at exit are safe
+    Registry & registry() {
+        static Registry * registry = new Registry();
+        return *registry;
+    }
+    
+    /// Hands the thread's ring back when the thread exits, so that threads
+    ///     started per job (see "JobPool") reuse rings instead of each
+    ///     allocating one
+    struct CurrentThread {
+        ThreadEvents * events;
+        std::string name;
+        
+        CurrentThread() : events(nullptr) {}
+        ~CurrentThread() {
+            if (events != nullptr) {
+                std::lock_guard<std::mutex> lock(registry().mutex);
+                events->inUse = false;
+            }
+        }
+    };
+    
+    thread_local CurrentThread currentThread;
+    
+    ///
+    ThreadEvents &
+    threadEvents() {
+        if (currentThread.events == nullptr) {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            
+            std::vector<std::shared_ptr<ThreadEvents>> & threads = registry().threads;
+            for (auto itr = threads.begin(); itr != threads.end() && currentThread.events == nullptr; itr++) {
+                if (!(*itr)->inUse) {
+                    currentThread.events = itr->get();
+                }
+            }
+            
+            if (currentThread.events == nullptr) {
+                std::shared_ptr<ThreadEvents> events(new ThreadEvents());
+                events->threadIndex = (int) threads.size();
+                events->events.resize(TSProfiler::kEventsPerThread);
+                events->written = 0;
+                threads.push_back(events);
+                currentThread.events = events.get();
+            }
+            
+            currentThread.events->inUse = true;
+            if (!currentThread.name.empty()) {
+                currentThread.events->threadName = currentThread.name;
+            }
+        }
+        return *currentThread.events;
+    }
+    
+    ///
+    void
+    record(const Event & event) {
+        ThreadEvents & events = threadEvents();
+        events.events[events.written % events.events.size()] = event;
+        events.written++;
+    }
+    
+    /// Event names are ours, but escape them anyway so the JSON stays valid
+    void
+    writeString(std::ostream & out, const char * text) {
+        out << '"';
+        for (const char * c = text; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\' << *c;
+            }
+            else if ((unsigned char) *c < 0x20) {
+                out << ' ';
+            }
+            else {
+                out << *c;
+            }
+        }
+        out << '"';
+    }
+}
+
+/// Trace "pid"s, so host threads and devices are grouped apart
+static const int kHostProcess = 1;
+static const int kDeviceProcess = 2;
+
+///
+void
+TSProfiler::recordSpan(const char * name, const char * category, double startSeconds, double endSeconds) {
+    if (!isEnabled()) {
+        return;
+    }
+    
+    Event event = {name, category, startSeconds, endSeconds, SpanEvent, 0};
+    record(event);
+}
+
+///
+void
+TSProfiler::recordCounter(const char * name, double value) {
+    if (!isEnabled()) {
+        return;
+    }
+    
+    Event event = {name, "counter", TSClock::now(), value, CounterEvent, 0};
+    record(event);
+}
+
+///
+void
+TSProfiler::recordDeviceSpan(const char * name, const char * category, int deviceIndex, double startSeconds, double endSeconds) {
+    if (!isEnabled()) {
+        return;
+    }
+    
+    Event event = {name, category, startSeconds, endSeconds, DeviceSpanEvent, deviceIndex};
+    record(event);
+}
+
+///
+void
+TSProfiler::setThreadName(const std::string & name) {
+    /// Applied once the thread records something, so naming a thread does not
+    ///     allocate its ring
+    currentThread.name = name;
+    if (currentThread.events != nullptr) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        currentThread.events->threadName = name;
+    }
+}
+
+///
+const char *
+TSProfiler::persistentName(const std::string & name) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    return registry().names.insert(name).first->c_str();
+}
+
+///
+void
+TSProfiler::clear() {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (auto itr = registry().threads.begin(); itr != registry().threads.end(); itr++) {
+        (*itr)->written = 0;
+    }
+}
+
+///
+void
+TSProfiler::writeChromeTrace(std::ostream & out) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    
+    /// Chrome wants microseconds
+    const double kMicroseconds = 1000000.0;
+    std::set<int> devices;
+    bool first = true;
+    
+    /// Timestamps are large, so the default 6 significant digits would round
+    ///     them to tens of microseconds
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    
+    for (auto threadItr = registry().threads.begin(); threadItr != registry().threads.end(); threadItr++) {
+        const ThreadEvents & thread = **threadItr;
+        
+        out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << kHostProcess << ",\"tid\":" << thread.threadIndex << ",\"args\":{\"name\":";
+        writeString(out, thread.threadName.empty() ? ("thread " + std::to_string(thread.threadIndex)).c_str() : thread.threadName.c_str());
+        out << "}}";
+        first = false;
+        
+        unsigned long long capacity = thread.events.size();
+        unsigned long long begin = thread.written > capacity ? thread.written - capacity : 0;
+        for (unsigned long long i = begin; i < thread.written; i++) {
+            const Event & event = thread.events[i % capacity];
+            
+            out << ",\n{\"name\":";
+            writeString(out, event.name);
+            out << ",\"cat\":";
+            writeString(out, event.category);
+            out << ",\"ts\":" << event.start * kMicroseconds;
+            
+            switch (event.type) {
+            case SpanEvent:
+                out << ",\"ph\":\"X\",\"dur\":" << (event.endOrValue - event.start) * kMicroseconds
+                    << ",\"pid\":" << kHostProcess << ",\"tid\":" << thread.threadIndex << "}";
+                break;
+            case CounterEvent:
+                out << ",\"ph\":\"C\",\"pid\":" << kHostProcess << ",\"args\":{\"value\":" << event.endOrValue << "}}";
+                break;
+            case DeviceSpanEvent:
+                out << ",\"ph\":\"X\",\"dur\":" << (event.endOrValue - event.start) * kMicroseconds
+                    << ",\"pid\":" << kDeviceProcess << ",\"tid\":" << event.deviceIndex << "}";
+                devices.insert(event.deviceIndex);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    
+    out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << kHostProcess << ",\"args\":{\"name\":\"host\"}}";
+    if (!devices.empty()) {
+        out << ",\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << kDeviceProcess << ",\"args\":{\"name\":\"OpenCL\"}}";
+    }
+    for (auto itr = devices.begin(); itr != devices.end(); itr++) {
+        out << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << kDeviceProcess << ",\"tid\":" << *itr << ",\"args\":{\"name\":\"device " << *itr << "\"}}";
+    }
+    
+    out << "\n]}\n";
+    
+    out.flags(flags);
+    out.precision(precision);
+}
+
+///
+bool
+TSProfiler::writeChromeTrace(const std::string & path) {
+    std::ofstream out(path.c_str(), std::ios_base::out);
+    if (!out) {
+        return false;
+    }
+    
+    writeChromeTrace(out);
+    return (bool) out;
+}
@@ -0,0 +1,106 @@
+//
+//  TSProfiler.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/7/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef TSProfiler_hpp
+#define TSProfiler_hpp
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+#include "TSClock.hpp"
+
+#define TSProfilerConcat_(a, b) a##b
+#define TSProfilerConcat(a, b) TSProfilerConcat_(a, b)
+/// Times the rest of the enclosing block. "name" and "category" must outlive
+///     the profiler, e.g. string literals.
+#define TSProfileScope(name, category) TSProfiler::Scope TSProfilerConcat(tsProfileScope, __LINE__)(name, category)
+
+///
+/// Records timed events into a ring buffer owned by the thread that records
+///     them, so recording never takes a lock or writes to a stream. Once a
+///     ring is full its oldest events are overwritten. Recording is off until
+///     "setEnabled(true)"; while off, a scope costs one atomic load.
+///
+/// "writeChromeTrace" exports everything recorded so far in the Chrome trace
+///     event format (load it in chrome://tracing). It should be called while
+///     no other thread is recording, e.g. after a render has finished.
+///
+class TSProfiler {
+public:
+
+    /// Events each thread keeps
+    static const int kEventsPerThread = 1 << 15;
+    
+    ///
+    static void setEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+    
+    ///
+    static bool isEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+    
+    /// Records [startSeconds, endSeconds) on TSClock as one event on the
+    ///     calling thread's row of the trace
+    static void recordSpan(const char * name, const char * category, double startSeconds, double endSeconds);
+    
+    /// Records the value of a counter, which the trace draws as a graph
+    static void recordCounter(const char * name, double value);
+    
+    /// Records work that ran on a device rather than a host thread, e.g. an
+    ///     OpenCL kernel. Each device gets a row of its own. Times are on
+    ///     TSClock.
+    static void recordDeviceSpan(const char * name, const char * category, int deviceIndex, double startSeconds, double endSeconds);
+    
+    /// Labels the calling thread's row of the trace
+    static void setThreadName(const std::string & name);
+    
+    /// Returns a copy of "name" that lives as long as the profiler, for names
+    ///     that are built at runtime
+    static const char * persistentName(const std::string & name);
+    
+    /// Forgets every recorded event
+    static void clear();
+    
+    ///
+    static void writeChromeTrace(std::ostream & out);
+    /// Returns false if "path" could not be written
+    static bool writeChromeTrace(const std::string & path);
+    
+    ///
+    class Scope {
+    public:
+        Scope(const char * name, const char * category) : name_(name), category_(category), startSeconds_(-1.0) {
+            if (TSProfiler::isEnabled()) {
+                startSeconds_ = TSClock::now();
+            }
+        }
+        
+        ~Scope() {
+            if (startSeconds_ >= 0.0) {
+                TSProfiler::recordSpan(name_, category_, startSeconds_, TSClock::now());
+            }
+        }
+        
+    private:
+        Scope(const Scope & other);
+        Scope & operator=(const Scope & other);
+    
+        const char * name_;
+        const char * category_;
+        double startSeconds_;
+    };
+    
+private:
+
+    static std::atomic<bool> enabled_;
+};
+
+#endif /* TSProfiler_hpp */
@@ -27,6 +27,14 @@ struct TSRandomValueGenerator {
         uintDistribution = std::uniform_int_distribution<unsigned int>(0, std::numeric_limits<unsigned int>::max() - 1);
     }
     
+    /// Restarts the sequence so that it is reproducible for the given seed
+    void seed(unsigned int value) {
+        generator.seed(value);
+        floatDistribution.reset();
+        doubleDistribution.reset();
+        uintDistribution.reset();
+    }
+    
     /// Generates a random float in the interval [0.0, 1.0]
     float randFloat() {
         return floatDistribution(generator);
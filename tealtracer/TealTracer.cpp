@@ -8,6 +8,8 @@
 
 #include "TealTracer.hpp"
 #include "TSLogger.hpp"
+#include "TSClock.hpp"
+#include "TSProfiler.hpp"
 
 #include <cassert>
 
@@ -16,11 +18,16 @@ using json = nlohmann::json;
 
 #include "gl_include.h"
 #include "RaytracingConfig.hpp"
+#include "Benchmarks.hpp"
+#include "ImageWriter.hpp"
+#include "RenderBenchmarks.hpp"
 
 #include "SCMonteCarloRaytracer.hpp" // Single Core: Direct
 #include "SCKDTreeRaytracer.hpp" // Single Core: KDTree
 #include "SCHashGridRaytracer.hpp" // Single Core: HashGrid
+#include "SCSpatialHashRaytracer.hpp" // Single Core: spatially hashed grid
 #include "SCTilePhotonRaytracer.hpp" // Single Core: Tiled
+#include "SCProgressivePhotonMapper.hpp" // Single Core: Progressive HashGrid
 
 
 #include "OCLMonteCarloRaytracer.hpp" // OpenCL: Direct
@@ -51,15 +58,34 @@ TealTracer::rightWindow() {
     return this->getWindow(RightWindow);
 }
 
-///
-int
-TealTracer::run(const std::vector<std::string> & args) {
-    assert(glfwInit());
-    for (int i = 0; i < NumWindows; i++) {
-        this->createNewWindow(i);
+/// Writes what "TSProfiler" recorded to "traceFile", if one was asked for
+static void
+writeTraceIfRequested(const std::string & traceFile) {
+    if (traceFile.empty()) {
+        return;
     }
     
-    std::string file("config.json");
+    if (TSProfiler::writeChromeTrace(traceFile)) {
+        TSLoggerLog(std::cout, "wrote trace=", traceFile);
+    }
+    else {
+        TSLoggerLog(std::cout, "could not write trace=", traceFile);
+    }
+}
+
+/// Returns the argument following "flag", or "fallback" if there is none
+static std::string
+argumentAfter(const std::vector<std::string> & args, const std::string & flag, const std::string & fallback) {
+    auto flagArg = std::find(args.begin(), args.end(), flag);
+    if (flagArg != args.end() && (flagArg + 1) != args.end()) {
+        return *(flagArg + 1);
+    }
+    return fallback;
+}
+
+///
+static json
+loadConfigJSON(const std::string & file) {
     std::ifstream source;
     source.open(file.c_str(), std::ios_base::in);
     if (!source) {
@@ -74,21 +100,20 @@ TealTracer::run(const std::vector<std::string> & args) {
         content.append(line);
     }
     
-    auto monitor = glfwGetPrimaryMonitor();
-    auto videoMode = glfwGetVideoMode(monitor);
-    json config = json::parse(content);
-    
-    Eigen::Vector3f Up, Forward, Right;
-    Up = RaytracingConfig::vec3FromData(config["Up"].get<std::vector<double>>());
-    Forward = RaytracingConfig::vec3FromData(config["Forward"].get<std::vector<double>>());
-    Right = RaytracingConfig::vec3FromData(config["Right"].get<std::vector<double>>());
-    
+    return json::parse(content);
+}
+
+///
+static std::map<std::string, std::shared_ptr<Raytracer>>
+createAvailableRaytracers() {
     std::map<std::string, std::shared_ptr<Raytracer>> availableRaytracers;
     
     availableRaytracers["SCMonteCarloRaytracer"] = std::shared_ptr<SCMonteCarloRaytracer>(new SCMonteCarloRaytracer());
     availableRaytracers["SCKDTreeRaytracer"] = std::shared_ptr<SCKDTreeRaytracer>(new SCKDTreeRaytracer());
     availableRaytracers["SCHashGridRaytracer"] = std::shared_ptr<SCHashGridRaytracer>(new SCHashGridRaytracer());
+    availableRaytracers["SCSpatialHashRaytracer"] = std::shared_ptr<SCSpatialHashRaytracer>(new SCSpatialHashRaytracer());
     availableRaytracers["SCTilePhotonRaytracer"] = std::shared_ptr<SCTilePhotonRaytracer>(new SCTilePhotonRaytracer());
+    availableRaytracers["SCProgressivePhotonMapper"] = std::shared_ptr<SCProgressivePhotonMapper>(new SCProgressivePhotonMapper());
     
     availableRaytracers["OCLMonteCarloRaytracer"] = std::shared_ptr<OCLMonteCarloRaytracer>(new OCLMonteCarloRaytracer());
     availableRaytracers["OCLPhotonHashGridRaytracer"] = std::shared_ptr<OCLPhotonHashGridRaytracer>(new OCLPhotonHashGridRaytracer());
@@ -96,6 +121,76 @@ TealTracer::run(const std::vector<std::string> & args) {
     availableRaytracers["OCLTiledPhotonRaytracer"] = std::shared_ptr<OCLTiledPhotonRaytracer>(new OCLTiledPhotonRaytracer());
     availableRaytracers["OCLOptimizedTiledPhotonRaytracer"] = std::shared_ptr<OCLOptimizedTiledPhotonRaytracer>(new OCLOptimizedTiledPhotonRaytracer());
     
+    return availableRaytracers;
+}
+
+/// Returns the raytracer "raytracerName" loaded with the configuration
+///     "configName" of "config", or nullptr if either does not exist.
+static std::shared_ptr<Raytracer>
+createConfiguredRaytracer(const json & config, const std::string & raytracerName, const std::string & configName) {
+    std::map<std::string, std::shared_ptr<Raytracer>> availableRaytracers = createAvailableRaytracers();
+    if (availableRaytracers.find(raytracerName) == availableRaytracers.end()) {
+        TSLoggerLog(std::cout, "unknown raytracer=", raytracerName);
+        return nullptr;
+    }
+    if (config.find(configName) == config.end()) {
+        TSLoggerLog(std::cout, "unknown config=", configName);
+        return nullptr;
+    }
+    
+    std::shared_ptr<Raytracer> raytracer = availableRaytracers[raytracerName];
+    raytracer->config.loadFromJSON(config[configName]);
+    raytracer->config.Up = RaytracingConfig::vec3FromData(config["Up"].get<std::vector<double>>());
+    raytracer->config.Forward = RaytracingConfig::vec3FromData(config["Forward"].get<std::vector<double>>());
+    raytracer->config.Right = RaytracingConfig::vec3FromData(config["Right"].get<std::vector<double>>());
+    return raytracer;
+}
+
+///
+int
+TealTracer::run(const std::vector<std::string> & args) {
+    
+    /// "--benchmark <name>" runs one of the micro-benchmarks instead of the viewer
+    auto benchmarkArg = std::find(args.begin(), args.end(), "--benchmark");
+    if (benchmarkArg != args.end() && (benchmarkArg + 1) != args.end()) {
+        return runBenchmark(*(benchmarkArg + 1), std::cout);
+    }
+    
+    /// "--benchmark-suite <suite.json>" renders a matrix of raytracers and
+    ///     scenes, see "runBenchmarkSuite"
+    if (std::find(args.begin(), args.end(), "--benchmark-suite") != args.end()) {
+        return runBenchmarkSuite(args);
+    }
+    
+    /// "--trace <file.json>" records a Chrome trace of the render, see "TSProfiler"
+    std::string traceFile = argumentAfter(args, "--trace", "");
+    TSProfiler::setEnabled(!traceFile.empty());
+    TSProfiler::setThreadName("main");
+    
+    /// "--render <raytracer> <config>" renders to a file instead, see "runHeadless"
+    if (std::find(args.begin(), args.end(), "--render") != args.end()) {
+        int result = runHeadless(args);
+        writeTraceIfRequested(traceFile);
+        return result;
+    }
+    
+    assert(glfwInit());
+    
+    for (int i = 0; i < NumWindows; i++) {
+        this->createNewWindow(i);
+    }
+    
+    auto monitor = glfwGetPrimaryMonitor();
+    auto videoMode = glfwGetVideoMode(monitor);
+    json config = loadConfigJSON("config.json");
+    
+    Eigen::Vector3f Up, Forward, Right;
+    Up = RaytracingConfig::vec3FromData(config["Up"].get<std::vector<double>>());
+    Forward = RaytracingConfig::vec3FromData(config["Forward"].get<std::vector<double>>());
+    Right = RaytracingConfig::vec3FromData(config["Right"].get<std::vector<double>>());
+    
+    std::map<std::string, std::shared_ptr<Raytracer>> availableRaytracers = createAvailableRaytracers();
+    
     std::string leftRaytracerName = config["LeftRaytracer"]["name"].get<std::string>();
     std::string leftRaytracerConfigName = config["LeftRaytracer"]["config"].get<std::string>();
     std::string rightRaytracerName = config["RightRaytracer"]["name"].get<std::string>();
@@ -154,13 +249,13 @@ TealTracer::run(const std::vector<std::string> & args) {
     TSLoggerLog(std::cout, glGetString(GL_VERSION));
     
     while (leftWindow()->opened() && rightWindow()->opened()) {
-        double startTime = glfwGetTime();
+        double startTime = TSClock::now();
 //        TSLoggerLog(std::cout, "Starting iteration");
         glfwPollEvents();
         for (auto windowItr = windowsBegin(); windowItr != windowsEnd(); windowItr++) {
             windowItr->second->draw();
         }
-        double endTime = glfwGetTime();
+        double endTime = TSClock::now();
         double dt = (endTime - startTime); // dt = time in milliseconds
 //        TSLoggerLog(std::cout, "Time elapsed=", dt);
         if (dt < (1.0 / 60.0)) {
@@ -170,9 +265,111 @@ TealTracer::run(const std::vector<std::string> & args) {
     }
     
     glfwTerminate();
+    writeTraceIfRequested(traceFile);
+    return 0;
+}
+
+/// Arguments, all but the first optional:
+///     --render <raytracer> <config>   a key of "createAvailableRaytracers" and a
+///                                     configuration in "config.json"
+///     --scene <file.pov>              defaults to "povrayScene"
+///     --width <w> --height <h>        default to the configuration's output size
+///     --frames <n>                    frames (samples) to render, default 1
+///     --output <file.png>             default "render.png"
+///     --trace <file.json>             also write a Chrome trace of the render
+///     --photon-cache <directory>      overrides "photonCacheDirectory"
+///     --program-cache <directory>     overrides "programCacheDirectory"
+int
+TealTracer::runHeadless(const std::vector<std::string> & args) {
+    
+    auto renderArg = std::find(args.begin(), args.end(), "--render");
+    if (renderArg + 1 == args.end() || renderArg + 2 == args.end()) {
+        TSLoggerLog(std::cout, "usage: --render <raytracer> <config> [--scene file.pov] [--width w] [--height h] [--frames n] [--output file.png] [--trace file.json] [--photon-cache directory]");
+        return 1;
+    }
+    std::string raytracerName = *(renderArg + 1);
+    std::string configName = *(renderArg + 2);
+    
+    json config = loadConfigJSON("config.json");
+    
+    std::shared_ptr<Raytracer> raytracer = createConfiguredRaytracer(config, raytracerName, configName);
+    if (raytracer == nullptr) {
+        return 1;
+    }
+    
+    raytracer->config.renderOutputWidth = std::stoi(argumentAfter(args, "--width", std::to_string(raytracer->config.renderOutputWidth)));
+    raytracer->config.renderOutputHeight = std::stoi(argumentAfter(args, "--height", std::to_string(raytracer->config.renderOutputHeight)));
+    raytracer->config.photonCacheDirectory = argumentAfter(args, "--photon-cache", raytracer->config.photonCacheDirectory);
+    raytracer->config.programCacheDirectory = argumentAfter(args, "--program-cache", raytracer->config.programCacheDirectory);
+    
+    int numFrames = std::max(1, std::stoi(argumentAfter(args, "--frames", "1")));
+    std::string sceneFile = argumentAfter(args, "--scene", config["povrayScene"].get<std::string>());
+    std::string outputFile = argumentAfter(args, "--output", "render.png");
+    
+    double startTime = TSClock::now();
+    scene_ = PovrayScene::loadScene(sceneFile);
+    raytracer->config.scene = scene_;
+    double sceneTime = TSClock::now() - startTime;
+    
+    Raytracer::OfflineTimings timings = raytracer->renderOffline(numFrames);
+    
+    startTime = TSClock::now();
+    bool written = ImageWriter::writePNG(outputFile, raytracer->renderedImage());
+    double writeTime = TSClock::now() - startTime;
+    if (!written) {
+        TSLoggerLog(std::cout, "could not write file=", outputFile);
+        return 1;
+    }
+    
+    double framesTime = 0.0;
+    for (auto itr = timings.frames.begin(); itr != timings.frames.end(); itr++) {
+        framesTime += *itr;
+    }
+    
+    std::cout << "[render] raytracer=" << raytracerName << " config=" << configName << " scene=" << sceneFile
+        << " size=" << raytracer->config.renderOutputWidth << "x" << raytracer->config.renderOutputHeight
+        << " frames=" << numFrames << " output=" << outputFile << std::endl;
+    std::cout << "[render] phase=loadScene seconds=" << sceneTime << std::endl;
+    std::cout << "[render] phase=configure seconds=" << timings.configure << std::endl;
+    std::cout << "[render] phase=prepare seconds=" << timings.prepare << std::endl;
+    std::cout << "[render] phase=frames seconds=" << framesTime << " perFrame=" << framesTime / numFrames << std::endl;
+    std::cout << "[render] phase=write seconds=" << writeTime << std::endl;
+    
     return 0;
 }
 
+/// Arguments:
+///     --benchmark-suite <suite.json>  see "runRenderBenchmarks" for the format
+///     --output <results.json>         optional, results go to stdout otherwise
+int
+TealTracer::runBenchmarkSuite(const std::vector<std::string> & args) {
+    
+    std::string suiteFile = argumentAfter(args, "--benchmark-suite", "");
+    if (suiteFile.empty()) {
+        TSLoggerLog(std::cout, "usage: --benchmark-suite <suite.json> [--output results.json]");
+        return 1;
+    }
+    
+    json suite = loadConfigJSON(suiteFile);
+    json config = loadConfigJSON("config.json");
+    
+    RaytracerFactory createRaytracer = [&](const std::string & raytracerName, const std::string & configName) {
+        return createConfiguredRaytracer(config, raytracerName, configName);
+    };
+    
+    std::string outputFile = argumentAfter(args, "--output", "");
+    if (outputFile.empty()) {
+        return runRenderBenchmarks(suite, createRaytracer, std::cout);
+    }
+    
+    std::ofstream output(outputFile.c_str(), std::ios_base::out);
+    if (!output) {
+        TSLoggerLog(std::cout, "could not write file=", outputFile);
+        return 1;
+    }
+    return runRenderBenchmarks(suite, createRaytracer, output);
+}
+
 ///
 std::shared_ptr<TSWindow>
 TealTracer::newWindow() {
@@ -27,6 +27,12 @@ protected:
 
     ///
     virtual int run(const std::vector<std::string> & args);
+    /// Renders one raytracer to an image file without opening any windows.
+    ///     See "run" for the arguments.
+    int runHeadless(const std::vector<std::string> & args);
+    /// Renders every combination in a benchmark suite file and reports the
+    ///     timings as JSON. See "runRenderBenchmarks".
+    int runBenchmarkSuite(const std::vector<std::string> & args);
     ///
     virtual std::shared_ptr<TSWindow> newWindow();
     ///
@@ -7,10 +7,17 @@
 //
 
 #include "TextureRenderTarget.hpp"
+#include "TSProfiler.hpp"
+
+#include <cstring>
 
 ///
 void TextureRenderTarget::init(int texWidth, int texHeight, void * texData) {
     firstDraw = false;
+    imageData = (const uint8_t *) texData;
+    imageWidth = texWidth;
+    imageHeight = texHeight;
+    dirtyRects.clear();
     
     this->points = make_vector<GLfloat>(
         -1.0, -1.0, 0.0,
@@ -61,14 +68,96 @@ void TextureRenderTarget::init(int texWidth, int texHeight, void * texData) {
     textureFormat.width = texWidth;
     textureFormat.height = texHeight;
     textureFormat.linearlyInterpolated = true;
-    textureFormat.mipMapped = true;
+    /// The image is drawn at about its own size, and a mip chain would have
+    ///     to be rebuilt on every upload
+    textureFormat.mipMapped = false;
     textureFormat.dataPointer = texData;
     
     this->outputTexture = std::shared_ptr<OpenGLTextureBuffer>(new OpenGLTextureBuffer(0, textureFormat));
     this->outputTexture->sendData();
     
-    this->swapTexture = std::shared_ptr<OpenGLTextureBuffer>(new OpenGLTextureBuffer(0, textureFormat));
-    this->swapTexture->sendData();
+    auto bufferFormat = OpenGLDataBufferMetaData(nullptr, GLuint(4), GLuint(texWidth * texHeight));
+    for (int i = 0; i < 2; i++) {
+        this->uploadBuffers[i] = OpenGLDataBuffer::pixelUnpackBuffer(bufferFormat);
+        this->uploadBuffers[i]->sendData(GLenum(GL_STREAM_DRAW));
+    }
+    this->nextUploadBuffer = 0;
+}
+
+///
+void TextureRenderTarget::markDirty(const Rect & rect) {
+    dirtyRects.push_back(rect);
+}
+
+///
+void TextureRenderTarget::markAllDirty() {
+    Rect rect;
+    rect.x = 0;
+    rect.y = 0;
+    rect.width = imageWidth;
+    rect.height = imageHeight;
+    
+    dirtyRects.clear();
+    dirtyRects.push_back(rect);
+}
+
+///
+void TextureRenderTarget::uploadDirtyRects() {
+    if (dirtyRects.empty() || imageData == nullptr) {
+        return;
+    }
+    
+    TSProfileScope("upload texture", "present");
+    
+    const size_t bytesPerPixel = 4;
+    size_t imageBytes = bytesPerPixel * size_t(imageWidth * imageHeight);
+    size_t uploadBytes = 0;
+    for (auto itr = dirtyRects.begin(); itr != dirtyRects.end(); itr++) {
+        uploadBytes += bytesPerPixel * size_t(itr->width * itr->height);
+    }
+    /// Overlapping rects could add up to more than the buffer holds
+    if (uploadBytes > imageBytes) {
+        markAllDirty();
+        uploadBytes = imageBytes;
+    }
+    
+    auto buffer = this->uploadBuffers[nextUploadBuffer];
+    nextUploadBuffer = 1 - nextUploadBuffer;
+    
+    auto oldBufferBinding = buffer->setAsActiveDBO();
+    uint8_t * staging = (uint8_t *) buffer->mapForWriting(GLsizeiptr(uploadBytes));
+    
+    if (staging != nullptr) {
+        /// Pack every rect's rows one after the other
+        size_t offset = 0;
+        for (auto itr = dirtyRects.begin(); itr != dirtyRects.end(); itr++) {
+            size_t rowBytes = bytesPerPixel * size_t(itr->width);
+            for (int row = 0; row < itr->height; row++) {
+                std::memcpy(staging + offset + row * rowBytes, imageData + bytesPerPixel * (size_t(itr->y + row) * imageWidth + itr->x), rowBytes);
+            }
+            offset += rowBytes * itr->height;
+        }
+    }
+    
+    if (staging != nullptr && buffer->unmap()) {
+        size_t offset = 0;
+        for (auto itr = dirtyRects.begin(); itr != dirtyRects.end(); itr++) {
+            this->outputTexture->sendSubData(itr->x, itr->y, itr->width, itr->height, (const void *) offset);
+            offset += bytesPerPixel * size_t(itr->width * itr->height);
+        }
+        buffer->restoreActiveDBO(oldBufferBinding);
+    }
+    else {
+        /// Fall back to uploading straight from the image
+        buffer->restoreActiveDBO(oldBufferBinding);
+        for (auto itr = dirtyRects.begin(); itr != dirtyRects.end(); itr++) {
+            glPixelStorei(GLenum(GL_UNPACK_ROW_LENGTH), imageWidth);
+            this->outputTexture->sendSubData(itr->x, itr->y, itr->width, itr->height, imageData + bytesPerPixel * (size_t(itr->y) * imageWidth + itr->x));
+            glPixelStorei(GLenum(GL_UNPACK_ROW_LENGTH), 0);
+        }
+    }
+    
+    dirtyRects.clear();
 }
 
 ///
@@ -79,7 +168,7 @@ void TextureRenderTarget::draw() {
     auto texture = this->outputTexture;
     
     if (!firstDraw) {
-        texture->sendData();
+        uploadDirtyRects();
         oldTextureState = texture->glBind();
         this->program->attach("tex", texture.get());
     }
@@ -17,8 +17,17 @@
 
 #include "stl_extensions.hpp"
 
+///
+/// Draws an RGBA8 image over the whole window. The texture is allocated once
+///     in "init"; after that only the parts marked dirty are streamed into it,
+///     staged through two pixel buffers that are filled on alternate frames.
+///
 struct TextureRenderTarget {
-    std::shared_ptr<OpenGLTextureBuffer> swapTexture;
+    /// A region of the image, in pixels
+    struct Rect {
+        int x, y, width, height;
+    };
+    
     std::shared_ptr<OpenGLTextureBuffer> outputTexture;
     std::shared_ptr<OpenGLProgram> program;
     
@@ -29,12 +38,32 @@ struct TextureRenderTarget {
     std::shared_ptr<OpenGLDataBuffer> positionDBO;
     std::shared_ptr<OpenGLDataBuffer> texcoordDBO;
     
+    std::shared_ptr<OpenGLDataBuffer> uploadBuffers[2];
+    /// Which of ".uploadBuffers" the next upload is staged in
+    int nextUploadBuffer;
+    
+    /// The image "init" was given; it must stay alive and keep its size
+    const uint8_t * imageData;
+    int imageWidth, imageHeight;
+    /// Parts of ".imageData" changed since the last upload
+    std::vector<Rect> dirtyRects;
+    
     bool firstDraw;
     
     /// Call this only when you have a valid OpenGL context available.
     void init(int texWidth, int texHeight, void * texData);
     /// Call only within a valid OpenGL context
     void draw();
+    
+    /// The pixels in "rect" will be uploaded on the next "draw"
+    void markDirty(const Rect & rect);
+    /// The whole image will be uploaded on the next "draw"
+    void markAllDirty();
+    
+private:
+    /// Copies ".dirtyRects" into the next upload buffer and from there into
+    ///     ".outputTexture".
+    void uploadDirtyRects();
 };
 
 #endif /* TextureRenderTarget_hpp */
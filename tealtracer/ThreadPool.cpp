@@ -0,0 +1,150 @@
+//
+//  ThreadPool.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/1/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "ThreadPool.hpp"
+#include "TSProfiler.hpp"
+
+///
+ThreadPool::ThreadPool(int numThreads) : queuedItems_(0), stopping_(false) {
+    if (numThreads <= 0) {
+        numThreads = std::max<int>(1, (int) std::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+
+    /// Only start the threads once every deque exists, since workers look at
+    ///     each other's deques when stealing.
+    for (int i = 0; i < numThreads; i++) {
+        workers_[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+///
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wakeUp_.notify_all();
+
+    for (int i = 0; i < (int) workers_.size(); i++) {
+        workers_[i]->thread.join();
+    }
+}
+
+///
+int
+ThreadPool::numWorkers() const {
+    return (int) workers_.size();
+}
+
+///
+void
+ThreadPool::parallelFor(int numTasks, const Task & task) {
+    if (numTasks <= 0) {
+        return;
+    }
+
+    Batch batch;
+    batch.task = &task;
+    batch.remaining = numTasks;
+
+    /// Hand each worker one contiguous run of indices.
+    int numThreads = numWorkers();
+    for (int w = 0; w < numThreads; w++) {
+        int begin = (int) (((long long) numTasks * w) / numThreads);
+        int end = (int) (((long long) numTasks * (w + 1)) / numThreads);
+
+        if (begin < end) {
+            std::unique_lock<std::mutex> lock(workers_[w]->mutex);
+            for (int i = begin; i < end; i++) {
+                WorkItem item;
+                item.batch = &batch;
+                item.index = i;
+                workers_[w]->items.push_back(item);
+            }
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        queuedItems_ += numTasks;
+    }
+    wakeUp_.notify_all();
+
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.finished.wait(lock, [&](){ return batch.remaining == 0; });
+}
+
+///
+bool
+ThreadPool::popOwnItem(int workerIndex, WorkItem & item) {
+    Worker & worker = *workers_[workerIndex];
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    if (worker.items.empty()) {
+        return false;
+    }
+
+    item = worker.items.front();
+    worker.items.pop_front();
+    queuedItems_--;
+    return true;
+}
+
+///
+bool
+ThreadPool::stealItem(int thiefIndex, WorkItem & item) {
+    int numThreads = numWorkers();
+    for (int offset = 1; offset < numThreads; offset++) {
+        Worker & victim = *workers_[(thiefIndex + offset) % numThreads];
+        std::unique_lock<std::mutex> lock(victim.mutex);
+        if (!victim.items.empty()) {
+            item = victim.items.back();
+            victim.items.pop_back();
+            queuedItems_--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+///
+void
+ThreadPool::finishItem(const WorkItem & item) {
+    Batch & batch = *item.batch;
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    if (--batch.remaining == 0) {
+        /// Notify while holding the lock: "batch" lives on the caller's stack
+        ///     and disappears as soon as "parallelFor" observes zero.
+        batch.finished.notify_all();
+    }
+}
+
+///
+void
+ThreadPool::workerLoop(int workerIndex) {
+    TSProfiler::setThreadName("worker " + std::to_string(workerIndex));
+    
+    while (true) {
+        WorkItem item;
+        if (popOwnItem(workerIndex, item) || stealItem(workerIndex, item)) {
+            (*item.batch->task)(item.index, workerIndex);
+            finishItem(item);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wakeUp_.wait(lock, [&](){ return stopping_ || queuedItems_ > 0; });
+        if (stopping_) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+//
+//  ThreadPool.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/1/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// A persistent pool of worker threads with one task deque per worker.
+///     Work submitted through "parallelFor" is split into contiguous runs, one
+///     per worker; a worker pops from the front of its own deque and, once it
+///     runs dry, steals from the back of another worker's deque. This keeps
+///     neighbouring tasks (e.g. neighbouring image tiles) on the same core
+///     while still balancing uneven work.
+///
+class ThreadPool {
+public:
+
+    /// (taskIndex, workerIndex). "workerIndex" is in [0, numWorkers()) and can
+    ///     be used to index per-worker scratch storage.
+    typedef std::function<void(int, int)> Task;
+
+    /// Creates "numThreads" workers, or one per hardware thread if <= 0.
+    ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+
+    ///
+    int numWorkers() const;
+
+    /// Runs "task" for every index in [0, numTasks) and blocks until all of
+    ///     them have completed. Several threads may call this concurrently, but
+    ///     it must not be called from inside a task running on this pool.
+    void parallelFor(int numTasks, const Task & task);
+
+private:
+
+    ThreadPool(const ThreadPool & other);
+    ThreadPool & operator=(const ThreadPool & other);
+
+    ///
+    struct Batch {
+        const Task * task;
+        int remaining;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    ///
+    struct WorkItem {
+        Batch * batch;
+        int index;
+    };
+
+    ///
+    struct Worker {
+        std::deque<WorkItem> items;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    ///
+    void workerLoop(int workerIndex);
+    bool popOwnItem(int workerIndex, WorkItem & item);
+    bool stealItem(int thiefIndex, WorkItem & item);
+    void finishItem(const WorkItem & item);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    std::mutex sleepMutex_;
+    std::condition_variable wakeUp_;
+    std::atomic<int> queuedItems_;
+    bool stopping_;
+};
+
+#endif /* ThreadPool_hpp */
@@ -0,0 +1,113 @@
+//
+//  Tonemapper.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "Tonemapper.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// 2^(exponent - 136), the weight of a mantissa step in "rgbe2rgb", built
+///     straight from its bits. Exponents under 10 would need a denormal;
+///     anything that dark shows up as black anyway, so they give 0 (as
+///     does 0, which means black).
+static inline uint32_t ns_rgbeScaleBits(uint32_t exponent) {
+    return exponent >= 10 ? (exponent - 9) << 23 : 0;
+}
+
+///
+Tonemapper::Tonemapper(RaytracingConfig::SupportedTonemap tonemap, float exposure) : tonemap_(tonemap), exposure_(exposure) {
+    
+}
+
+///
+void
+Tonemapper::apply(const HDRImage & source, Image<uint8_t> & display, int x0, int y0, int x1, int y1) const {
+    assert(source.width == display.width && source.height == display.height);
+    assert(0 <= x0 && x0 <= x1 && x1 <= source.width);
+    assert(0 <= y0 && y0 <= y1 && y1 <= source.height);
+    
+    for (int y = y0; y < y1; y++) {
+        applyRow(&source.pixels[x0 + source.width * y], &display.pixels[x0 + display.width * y], x1 - x0);
+    }
+}
+
+///
+void
+Tonemapper::apply(const HDRImage & source, Image<uint8_t> & display) const {
+    apply(source, display, 0, 0, source.width, source.height);
+}
+
+///
+void
+Tonemapper::applyRow(const WardRGBE * source, Image<uint8_t>::Vector4 * display, int count) const {
+    int index = 0;
+    
+    /// Both paths do the same float operations in the same order, so they
+    ///     agree exactly.
+#if defined(__SSE2__)
+    /// One pixel per register, a channel per lane, 4 pixels at a time
+    const __m128 exposure = _mm_set1_ps(exposure_);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 maxByte = _mm_set1_ps(255.0f);
+    const __m128i rgbMask = _mm_set_epi32(0, -1, -1, -1);
+    const __m128i opaque = _mm_set_epi32(255, 0, 0, 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i minExponent = _mm_set1_epi32(10 - 1);
+    const bool reinhard = tonemap_ == RaytracingConfig::ReinhardTonemap;
+    
+    for (; index + 4 <= count; index += 4) {
+        __m128i packed = _mm_loadu_si128((const __m128i *) &source[index]);
+        __m128i words[2] = {_mm_unpacklo_epi8(packed, zero), _mm_unpackhi_epi8(packed, zero)};
+        
+        __m128i bytes[4];
+        for (int p = 0; p < 4; p++) {
+            __m128i rgbe = (p % 2 == 0) ? _mm_unpacklo_epi16(words[p / 2], zero) : _mm_unpackhi_epi16(words[p / 2], zero);
+            
+            __m128i e = _mm_shuffle_epi32(rgbe, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i scaleBits = _mm_and_si128(_mm_slli_epi32(_mm_sub_epi32(e, _mm_set1_epi32(9)), 23), _mm_cmpgt_epi32(e, minExponent));
+            
+            __m128 c = _mm_mul_ps(_mm_cvtepi32_ps(rgbe), _mm_castsi128_ps(scaleBits));
+            c = _mm_mul_ps(c, exposure);
+            if (reinhard) {
+                c = _mm_div_ps(c, _mm_add_ps(one, c));
+            }
+            c = _mm_min_ps(_mm_mul_ps(c, maxByte), maxByte);
+            
+            bytes[p] = _mm_or_si128(_mm_and_si128(_mm_cvttps_epi32(c), rgbMask), opaque);
+        }
+        
+        __m128i result = _mm_packus_epi16(_mm_packs_epi32(bytes[0], bytes[1]), _mm_packs_epi32(bytes[2], bytes[3]));
+        _mm_storeu_si128((__m128i *) &display[index], result);
+    }
+#endif
+    
+    for (; index < count; index++) {
+        const WardRGBE & rgbe = source[index];
+        uint32_t scaleBits = ns_rgbeScaleBits(rgbe(3));
+        float scale;
+        std::memcpy(&scale, &scaleBits, sizeof(scale));
+        
+        Image<uint8_t>::Vector4 & pixel = display[index];
+        for (int ch = 0; ch < 3; ch++) {
+            float c = float(rgbe(ch)) * scale;
+            c = c * exposure_;
+            if (tonemap_ == RaytracingConfig::ReinhardTonemap) {
+                c = c / (1.0f + c);
+            }
+            /// Argument order matches "_mm_min_ps", so a NaN (inf / inf from
+            ///     Reinhard) comes out white on both paths
+            pixel(ch) = uint8_t(std::min<float>(255.0f, c * 255.0f));
+        }
+        pixel(3) = 255;
+    }
+}
@@ -0,0 +1,43 @@
+//
+//  Tonemapper.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef Tonemapper_hpp
+#define Tonemapper_hpp
+
+#include "HDRImage.hpp"
+#include "Image.hpp"
+#include "RaytracingConfig.hpp"
+
+///
+/// Turns the radiance of an "HDRImage" into 8-bit display pixels. Each
+///     channel is scaled by the exposure, mapped by the operator, and then
+///     quantized as min(255, 255 * c) rounded down; alpha is always 255.
+///
+class Tonemapper {
+public:
+    ///
+    Tonemapper(RaytracingConfig::SupportedTonemap tonemap, float exposure);
+    
+    /// Writes the pixels [x0, x1) x [y0, y1) of "source" into the same
+    ///     pixels of "display", which must be the same size. Different
+    ///     regions can be mapped from different threads at once.
+    void apply(const HDRImage & source, Image<uint8_t> & display, int x0, int y0, int x1, int y1) const;
+    
+    /// Maps every pixel of "source" into "display"
+    void apply(const HDRImage & source, Image<uint8_t> & display) const;
+    
+private:
+    
+    /// One run of "count" pixels
+    void applyRow(const WardRGBE * source, Image<uint8_t>::Vector4 * display, int count) const;
+    
+    RaytracingConfig::SupportedTonemap tonemap_;
+    float exposure_;
+};
+
+#endif /* Tonemapper_hpp */
@@ -0,0 +1,653 @@
+//
+//  TriangleMesh.cpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#include "TriangleMesh.hpp"
+#include "PacketLanes.hpp"
+#include "PovraySceneBVH.hpp"
+#include "TSLogger.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+/// Traversal stack size; median splits keep the depth near
+///     log2(triangles / PackSize), well under this
+static const int kMaxStackSize = 64;
+
+///
+struct TriangleMesh::WatertightRay {
+    Eigen::Vector3f origin;
+    /// The axis the ray travels along the most becomes "kz"
+    int kx, ky, kz;
+    /// Shear that turns the ray into the "kz" axis
+    float Sx, Sy, Sz;
+};
+
+///
+TriangleMesh::WatertightRay
+TriangleMesh::makeWatertightRay(const Ray & ray) {
+    WatertightRay result;
+    result.origin = ray.origin;
+
+    Eigen::Vector3f absDirection = ray.direction.cwiseAbs();
+    int kz = 0;
+    if (absDirection.y() > absDirection(kz)) {
+        kz = 1;
+    }
+    if (absDirection.z() > absDirection(kz)) {
+        kz = 2;
+    }
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    /// Keep the winding the same whichever way the ray points along "kz"
+    if (ray.direction(kz) < 0.0f) {
+        std::swap(kx, ky);
+    }
+
+    result.kx = kx;
+    result.ky = ky;
+    result.kz = kz;
+    result.Sx = ray.direction(kx) / ray.direction(kz);
+    result.Sy = ray.direction(ky) / ray.direction(kz);
+    result.Sz = 1.0f / ray.direction(kz);
+    return result;
+}
+
+///
+TriangleMesh::TriangleMesh() {
+
+}
+
+///
+Eigen::Vector3f
+TriangleMesh::faceNormal(int triangle) const {
+    Eigen::Vector3f a = vertex(triangle, 0);
+    return (vertex(triangle, 1) - a).cross(vertex(triangle, 2) - a);
+}
+
+///
+void
+TriangleMesh::build() {
+    nodes_.clear();
+    packs_.clear();
+
+    int count = numTriangles();
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<int> triangles(count);
+    std::vector<Eigen::Vector3f> centroids(count);
+    for (int t = 0; t < count; t++) {
+        triangles[t] = t;
+        centroids[t] = (vertex(t, 0) + vertex(t, 1) + vertex(t, 2)) / 3.0f;
+    }
+
+    nodes_.reserve(2 * (count / PackSize + 1));
+    packs_.reserve(count / PackSize + 1);
+    buildRecursive(triangles, centroids, 0, count);
+}
+
+///
+int
+TriangleMesh::buildRecursive(std::vector<int> & triangles, std::vector<Eigen::Vector3f> & centroids, int begin, int end) {
+    int nodeIndex = (int) nodes_.size();
+    nodes_.push_back(Node());
+
+    Eigen::Vector3f minExtent = vertex(triangles[begin], 0), maxExtent = minExtent;
+    Eigen::Vector3f centroidMin = centroids[triangles[begin]], centroidMax = centroidMin;
+    for (int i = begin; i < end; i++) {
+        for (int corner = 0; corner < 3; corner++) {
+            minExtent = minExtent.cwiseMin(vertex(triangles[i], corner));
+            maxExtent = maxExtent.cwiseMax(vertex(triangles[i], corner));
+        }
+        centroidMin = centroidMin.cwiseMin(centroids[triangles[i]]);
+        centroidMax = centroidMax.cwiseMax(centroids[triangles[i]]);
+    }
+
+    nodes_[nodeIndex].minExtent = minExtent;
+    nodes_[nodeIndex].maxExtent = maxExtent;
+    nodes_[nodeIndex].axis = 0;
+
+    if (end - begin <= PackSize) {
+        TrianglePack pack;
+        pack.count = end - begin;
+        for (int lane = 0; lane < PackSize; lane++) {
+            int triangle = begin + lane < end ? triangles[begin + lane] : -1;
+            pack.triangles[lane] = triangle;
+            for (int axis = 0; axis < 3; axis++) {
+                pack.a[axis][lane] = triangle >= 0 ? vertex(triangle, 0)(axis) : 0.0f;
+                pack.b[axis][lane] = triangle >= 0 ? vertex(triangle, 1)(axis) : 0.0f;
+                pack.c[axis][lane] = triangle >= 0 ? vertex(triangle, 2)(axis) : 0.0f;
+            }
+        }
+
+        nodes_[nodeIndex].offset = (int) packs_.size();
+        nodes_[nodeIndex].count = 1;
+        packs_.push_back(pack);
+        return nodeIndex;
+    }
+
+    /// Median split along the axis with the widest spread of centroids
+    Eigen::Vector3f centroidSpread = centroidMax - centroidMin;
+    int axis = 0;
+    if (centroidSpread.y() > centroidSpread(axis)) {
+        axis = 1;
+    }
+    if (centroidSpread.z() > centroidSpread(axis)) {
+        axis = 2;
+    }
+
+    int middle = begin + (end - begin) / 2;
+    std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end, [&](int lhs, int rhs) {
+        return centroids[lhs](axis) < centroids[rhs](axis);
+    });
+
+    nodes_[nodeIndex].axis = axis;
+    nodes_[nodeIndex].count = 0;
+
+    buildRecursive(triangles, centroids, begin, middle);
+    int rightChild = buildRecursive(triangles, centroids, middle, end);
+    nodes_[nodeIndex].offset = rightChild;
+
+    return nodeIndex;
+}
+
+///
+bool
+TriangleMesh::boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const {
+    if (nodes_.size() == 0) {
+        return false;
+    }
+
+    minExtent = nodes_[0].minExtent;
+    maxExtent = nodes_[0].maxExtent;
+    return true;
+}
+
+///
+unsigned int
+TriangleMesh::intersectPack(const TrianglePack & pack, const WatertightRay & ray, float maxTime, float * times) {
+    PacketLanes ox = broadcast(ray.origin(ray.kx)), oy = broadcast(ray.origin(ray.ky)), oz = broadcast(ray.origin(ray.kz));
+    PacketLanes Sx = broadcast(ray.Sx), Sy = broadcast(ray.Sy), Sz = broadcast(ray.Sz);
+
+    /// Corners relative to the origin, sheared so the ray runs along z
+    PacketLanes az = load(pack.a[ray.kz]) - oz;
+    PacketLanes bz = load(pack.b[ray.kz]) - oz;
+    PacketLanes cz = load(pack.c[ray.kz]) - oz;
+    PacketLanes ax = load(pack.a[ray.kx]) - ox - Sx * az, ay = load(pack.a[ray.ky]) - oy - Sy * az;
+    PacketLanes bx = load(pack.b[ray.kx]) - ox - Sx * bz, by = load(pack.b[ray.ky]) - oy - Sy * bz;
+    PacketLanes cx = load(pack.c[ray.kx]) - ox - Sx * cz, cy = load(pack.c[ray.ky]) - oy - Sy * cz;
+
+    /// Scaled barycentrics: twice the signed areas the ray makes with each
+    ///     edge. A shared edge gives both of its triangles the same value
+    ///     (negated), so no ray slips between them.
+    PacketLanes U = cx * by - cy * bx;
+    PacketLanes V = ax * cy - ay * cx;
+    PacketLanes W = bx * ay - by * ax;
+
+    PacketLanes zero = broadcast(0.0f);
+    PacketLanes inside = ((U >= zero) & (V >= zero) & (W >= zero)) | ((U <= zero) & (V <= zero) & (W <= zero));
+    PacketLanes determinant = U + V + W;
+    PacketLanes t = (U * (Sz * az) + V * (Sz * bz) + W * (Sz * cz)) / determinant;
+
+    PacketLanes hit = inside & ((determinant > zero) | (determinant < zero)) & (t > zero) & (t < broadcast(maxTime));
+    store(times, t);
+    return bits(hit) & ((1u << pack.count) - 1u);
+}
+
+///
+int
+TriangleMesh::closestIntersection(const Ray & ray, float & time) const {
+    if (nodes_.size() == 0) {
+        return -1;
+    }
+
+    WatertightRay watertightRay = makeWatertightRay(ray);
+    Eigen::Vector3f inverseDirection = ray.direction.cwiseInverse();
+    int closestTriangle = -1;
+    float times[PackSize];
+
+    int stack[kMaxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const Node & node = nodes_[nodeIndex];
+        if (!PovraySceneBVH::rayHitsBox(ray.origin, inverseDirection, node.minExtent, node.maxExtent, time)) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            const TrianglePack & pack = packs_[node.offset];
+            unsigned int mask = intersectPack(pack, watertightRay, time, times);
+            while (mask != 0) {
+                int lane = __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (times[lane] < time) {
+                    time = times[lane];
+                    closestTriangle = pack.triangles[lane];
+                }
+            }
+        }
+        else {
+            /// Near child first, so it can shrink "time" before the far one
+            int leftChild = nodeIndex + 1;
+            assert(stackSize + 2 <= kMaxStackSize);
+            if (ray.direction(node.axis) > 0.0f) {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = leftChild;
+            }
+            else {
+                stack[stackSize++] = leftChild;
+                stack[stackSize++] = node.offset;
+            }
+        }
+    }
+
+    return closestTriangle;
+}
+
+///
+void
+TriangleMesh::intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) const {
+    if (nodes_.size() == 0 || packet.activeMask == 0) {
+        return;
+    }
+
+    WatertightRay watertightRays[RayPacket::Size];
+    unsigned int mask = packet.activeMask;
+    while (mask != 0) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        watertightRays[i] = makeWatertightRay(packet.ray(i));
+    }
+
+    /// Order children by the first active ray, like the scene's BVH
+    int leadRay = __builtin_ctz(packet.activeMask);
+    float leadDirection[3] = {packet.directionX[leadRay], packet.directionY[leadRay], packet.directionZ[leadRay]};
+    float times[PackSize];
+
+    int stack[kMaxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const Node & node = nodes_[nodeIndex];
+        unsigned int entering = packet.hitsBox(node.minExtent, node.maxExtent, hits);
+        if (entering == 0) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            /// Every ray that reaches the leaf is tested against all of its
+            ///     triangles at once
+            const TrianglePack & pack = packs_[node.offset];
+            while (entering != 0) {
+                int i = __builtin_ctz(entering);
+                entering &= entering - 1;
+
+                unsigned int hitMask = intersectPack(pack, watertightRays[i], hits.times[i], times);
+                while (hitMask != 0) {
+                    int lane = __builtin_ctz(hitMask);
+                    hitMask &= hitMask - 1;
+                    if (times[lane] < hits.times[i]) {
+                        hits.times[i] = times[lane];
+                        hits.elementIndices[i] = elementIndex;
+                    }
+                }
+            }
+        }
+        else {
+            int leftChild = nodeIndex + 1;
+            assert(stackSize + 2 <= kMaxStackSize);
+            if (leadDirection[node.axis] > 0.0f) {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = leftChild;
+            }
+            else {
+                stack[stackSize++] = leftChild;
+                stack[stackSize++] = node.offset;
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////
+
+///
+uint64_t
+TriangleMesh::contentHash() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto hashBytes = [&](const void * data, size_t size) {
+        const uint8_t * bytes = (const uint8_t *) data;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    
+    uint64_t numVertices = vertices.size(), numIndices = indices.size();
+    hashBytes(&numVertices, sizeof(numVertices));
+    hashBytes(&numIndices, sizeof(numIndices));
+    if (!vertices.empty()) {
+        hashBytes(vertices.data(), sizeof(Eigen::Vector3f) * vertices.size());
+    }
+    if (!indices.empty()) {
+        hashBytes(indices.data(), sizeof(int) * indices.size());
+    }
+    return hash;
+}
+
+///
+bool
+TriangleMesh::loadFile(const std::string & path) {
+    std::ifstream in;
+    in.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in) {
+        TSLoggerLog(std::cout, "could not find file=", path);
+        return false;
+    }
+
+    auto dotLoc = path.rfind(".");
+    std::string extension = dotLoc != std::string::npos ? path.substr(dotLoc + 1) : "";
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    bool loaded = false;
+    if (extension == "obj") {
+        loaded = loadOBJ(in);
+    }
+    else if (extension == "ply") {
+        loaded = loadPLY(in);
+    }
+    else {
+        TSLoggerLog(std::cout, "unsupported mesh file=", path);
+        return false;
+    }
+
+    if (!loaded) {
+        TSLoggerLog(std::cout, "could not read mesh file=", path);
+        vertices.clear();
+        indices.clear();
+    }
+    return loaded;
+}
+
+/// Splits a face with "corners.size()" corners into a fan of triangles.
+///     Returns false if any corner is out of range.
+static bool
+addFace(const std::vector<int> & corners, int numVertices, std::vector<int> & indices) {
+    for (auto itr = corners.begin(); itr != corners.end(); itr++) {
+        if (*itr < 0 || *itr >= numVertices) {
+            return false;
+        }
+    }
+
+    for (int i = 1; i + 1 < (int) corners.size(); i++) {
+        indices.push_back(corners[0]);
+        indices.push_back(corners[i]);
+        indices.push_back(corners[i + 1]);
+    }
+    return true;
+}
+
+///
+bool
+TriangleMesh::loadOBJ(std::istream & in) {
+    vertices.clear();
+    indices.clear();
+
+    /// Faces may come before the vertices they use, so they're checked at
+    ///     the end
+    std::vector<std::vector<int>> faces;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "v") {
+            Eigen::Vector3f position;
+            stream >> position[0] >> position[1] >> position[2];
+            if (!stream) {
+                return false;
+            }
+            vertices.push_back(position);
+        }
+        else if (keyword == "f") {
+            std::vector<int> corners;
+            std::string corner;
+            while (stream >> corner) {
+                /// "v", "v/vt", "v//vn" or "v/vt/vn", where negative indices
+                ///     count back from the latest vertex
+                int index = std::atoi(corner.c_str());
+                corners.push_back(index < 0 ? (int) vertices.size() + index : index - 1);
+            }
+            faces.push_back(corners);
+        }
+    }
+
+    for (auto itr = faces.begin(); itr != faces.end(); itr++) {
+        if (!addFace(*itr, (int) vertices.size(), indices)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+///
+enum PLYFormat {
+    PLYAscii,
+    PLYBinaryLittleEndian,
+    PLYBinaryBigEndian
+};
+
+///
+enum PLYType {
+    PLYInt8, PLYUInt8,
+    PLYInt16, PLYUInt16,
+    PLYInt32, PLYUInt32,
+    PLYFloat32, PLYFloat64,
+    PLYUnknownType
+};
+
+///
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    /// Lists store "countType" first, then that many "type"s
+    bool isList;
+    PLYType countType;
+};
+
+///
+struct PLYElement {
+    std::string name;
+    int count;
+    std::vector<PLYProperty> properties;
+};
+
+///
+static PLYType
+plyTypeForName(const std::string & name) {
+    if (name == "char" || name == "int8") return PLYInt8;
+    if (name == "uchar" || name == "uint8") return PLYUInt8;
+    if (name == "short" || name == "int16") return PLYInt16;
+    if (name == "ushort" || name == "uint16") return PLYUInt16;
+    if (name == "int" || name == "int32") return PLYInt32;
+    if (name == "uint" || name == "uint32") return PLYUInt32;
+    if (name == "float" || name == "float32") return PLYFloat32;
+    if (name == "double" || name == "float64") return PLYFloat64;
+    return PLYUnknownType;
+}
+
+/// Reads one value of "type". Binary files are assumed to be read on a
+///     little endian machine.
+static bool
+readPLYValue(std::istream & in, PLYFormat format, PLYType type, double & value) {
+    if (format == PLYAscii) {
+        in >> value;
+        return (bool) in;
+    }
+
+    static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    char bytes[8];
+    int size = sizes[type];
+    in.read(bytes, size);
+    if (!in) {
+        return false;
+    }
+    if (format == PLYBinaryBigEndian) {
+        std::reverse(bytes, bytes + size);
+    }
+
+    switch (type) {
+    case PLYInt8: {int8_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYUInt8: {uint8_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYInt16: {int16_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYUInt16: {uint16_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYInt32: {int32_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYUInt32: {uint32_t v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYFloat32: {float v; memcpy(&v, bytes, size); value = v; break;}
+    case PLYFloat64: {double v; memcpy(&v, bytes, size); value = v; break;}
+    default:
+        return false;
+    }
+    return true;
+}
+
+///
+bool
+TriangleMesh::loadPLY(std::istream & in) {
+    vertices.clear();
+    indices.clear();
+
+    PLYFormat format = PLYAscii;
+    std::vector<PLYElement> elements;
+
+    std::string line;
+    if (!std::getline(in, line) || line.compare(0, 3, "ply") != 0) {
+        return false;
+    }
+
+    bool headerEnded = false;
+    while (!headerEnded && std::getline(in, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "format") {
+            std::string name;
+            stream >> name;
+            if (name == "ascii") {
+                format = PLYAscii;
+            }
+            else if (name == "binary_little_endian") {
+                format = PLYBinaryLittleEndian;
+            }
+            else if (name == "binary_big_endian") {
+                format = PLYBinaryBigEndian;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (keyword == "element") {
+            PLYElement element;
+            stream >> element.name >> element.count;
+            if (!stream || element.count < 0) {
+                return false;
+            }
+            elements.push_back(element);
+        }
+        else if (keyword == "property") {
+            if (elements.size() == 0) {
+                return false;
+            }
+
+            PLYProperty property;
+            std::string typeName;
+            stream >> typeName;
+            property.isList = typeName == "list";
+            if (property.isList) {
+                std::string countTypeName;
+                stream >> countTypeName >> typeName;
+                property.countType = plyTypeForName(countTypeName);
+            }
+            else {
+                property.countType = PLYUnknownType;
+            }
+            property.type = plyTypeForName(typeName);
+            stream >> property.name;
+
+            if (property.type == PLYUnknownType || (property.isList && property.countType == PLYUnknownType)) {
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (keyword == "end_header") {
+            headerEnded = true;
+        }
+    }
+
+    if (!headerEnded) {
+        return false;
+    }
+
+    std::vector<int> corners;
+    for (auto element = elements.begin(); element != elements.end(); element++) {
+        bool isVertex = element->name == "vertex", isFace = element->name == "face";
+
+        for (int row = 0; row < element->count; row++) {
+            Eigen::Vector3f position = Eigen::Vector3f::Zero();
+            corners.clear();
+
+            for (auto property = element->properties.begin(); property != element->properties.end(); property++) {
+                double value = 0.0;
+                if (!property->isList) {
+                    if (!readPLYValue(in, format, property->type, value)) {
+                        return false;
+                    }
+                    if (isVertex && property->name.size() == 1 && property->name[0] >= 'x' && property->name[0] <= 'z') {
+                        position[property->name[0] - 'x'] = (float) value;
+                    }
+                    continue;
+                }
+
+                double listSize = 0.0;
+                if (!readPLYValue(in, format, property->countType, listSize) || listSize < 0.0) {
+                    return false;
+                }
+                bool isCorners = isFace && (property->name == "vertex_indices" || property->name == "vertex_index");
+                for (int i = 0; i < (int) listSize; i++) {
+                    if (!readPLYValue(in, format, property->type, value)) {
+                        return false;
+                    }
+                    if (isCorners) {
+                        corners.push_back((int) value);
+                    }
+                }
+            }
+
+            if (isVertex) {
+                vertices.push_back(position);
+            }
+            else if (isFace && !addFace(corners, (int) vertices.size(), indices)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
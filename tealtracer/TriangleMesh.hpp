@@ -0,0 +1,123 @@
+//
+//  TriangleMesh.hpp
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef TriangleMesh_hpp
+#define TriangleMesh_hpp
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+
+///
+/// Triangles that share one vertex array, with a BVH of their own so that a
+///     whole mesh is a single element of the scene's BVH. Every leaf keeps its
+///     triangles in one "TrianglePack", which a ray is tested against all at
+///     once (eight triangles with AVX, two halves of four with SSE2).
+///
+/// Hits use the watertight test of Woop, Benthin and Wald, "Watertight
+///     Ray/Triangle Intersection" (JCGT 2013): rays through an edge or vertex
+///     shared by two triangles hit at least one of them.
+///
+class TriangleMesh {
+public:
+
+    /// Triangles per leaf and per intersection test
+    static const int PackSize = RayPacket::Size;
+
+    ///
+    std::vector<Eigen::Vector3f> vertices;
+    /// Three indices into "vertices" per triangle
+    std::vector<int> indices;
+
+    ///
+    TriangleMesh();
+
+    ///
+    int numTriangles() const {
+        return (int) indices.size() / 3;
+    }
+    ///
+    Eigen::Vector3f vertex(int triangle, int corner) const {
+        return vertices[indices[3 * triangle + corner]];
+    }
+    /// Not normalized, and facing whichever way the winding gives it
+    Eigen::Vector3f faceNormal(int triangle) const;
+    /// 64-bit FNV-1a of "vertices" and "indices", which changes whenever the
+    ///     geometry does, e.g. when the model file it came from is edited
+    uint64_t contentHash() const;
+
+    /// Loads a ".obj" or ".ply" file, picked by its extension, replacing
+    ///     what was there. Returns false if the file couldn't be read.
+    bool loadFile(const std::string & path);
+    /// Only "v" and "f" lines are read; faces with more than three corners
+    ///     are split into a fan.
+    bool loadOBJ(std::istream & in);
+    /// ASCII and binary PLY, reading "x", "y", "z" of every "vertex" and the
+    ///     "vertex_indices" list of every "face".
+    bool loadPLY(std::istream & in);
+
+    /// Rebuilds the hierarchy. Call once "vertices" and "indices" are set.
+    void build();
+
+    /// False for a mesh without triangles
+    bool boundingBox(Eigen::Vector3f & minExtent, Eigen::Vector3f & maxExtent) const;
+
+    /// Returns the triangle "ray" hits first, before "time", and sets "time"
+    ///     to when it does. Returns -1 on a miss.
+    int closestIntersection(const Ray & ray, float & time) const;
+
+    /// Records a hit on "elementIndex" for every active ray of "packet" that
+    ///     hits a triangle before its time in "hits".
+    void intersectPacket(const RayPacket & packet, int elementIndex, RayPacketHits & hits) const;
+
+private:
+
+    ///
+    struct Node {
+        Eigen::Vector3f minExtent;
+        Eigen::Vector3f maxExtent;
+        /// Leaves: index into "packs_". Interior nodes: index of the right
+        ///     child, the left one directly follows its parent.
+        int offset;
+        /// 1 for leaves, 0 for interior nodes
+        int count;
+        /// Axis the interior node was split along
+        int axis;
+    };
+
+    ///
+    /// Up to "PackSize" triangles, one array per corner and axis. Unused
+    ///     lanes are degenerate and never hit.
+    ///
+    struct TrianglePack {
+        float a[3][PackSize], b[3][PackSize], c[3][PackSize];
+        int triangles[PackSize];
+        int count;
+    };
+
+    /// A ray set up for the watertight test
+    struct WatertightRay;
+    static WatertightRay makeWatertightRay(const Ray & ray);
+
+    ///
+    int buildRecursive(std::vector<int> & triangles, std::vector<Eigen::Vector3f> & centroids, int begin, int end);
+    /// Returns the mask of the triangles in "pack" that "ray" hits between 0
+    ///     and "maxTime", and sets "times" to when it hits each of them.
+    static unsigned int intersectPack(const TrianglePack & pack, const WatertightRay & ray, float maxTime, float * times);
+
+    std::vector<Node> nodes_;
+    std::vector<TrianglePack> packs_;
+};
+
+#endif /* TriangleMesh_hpp */
@@ -106,6 +106,10 @@ RGBf computeOutputEnergyForBRDF(
     RGBf source, float3 toLight, float3 toViewer, float3 surfaceNormal) {
 
     RGBf output = (float3) {0.0f, 0.0f, 0.0f};
+#ifdef kBRDFType
+    /// Built for one BRDF, which lets the compiler drop the other
+    brdf = (enum BRDFType) kBRDFType;
+#endif
     switch (brdf) {
         case BlinnPhong : {
             output = computeBlinnPhongOutputEnergy(pigment, finish, source, toLight, toViewer, surfaceNormal);
@@ -144,6 +148,12 @@ RGBf computeOutputEnergyForHit(
             finish = data.finish;
             break;
         };
+        case TriangleObjectType: {
+            struct PovrayTriangleData data = PovrayTriangleData_fromData(hitResult.dataPtr);
+            pigment = data.pigment;
+            finish = data.finish;
+            break;
+        }
         default: {
             break;
         }
@@ -54,6 +54,8 @@ struct RayIntersectionResult closest_intersection(
 void sphere_intersect(__global float * dataPtr, float3 rayOrigin, float3 rayDirection, struct RayIntersectionResult * result);
 ///
 void plane_intersect(__global float * dataPtr, float3 rayOrigin, float3 rayDirection, struct RayIntersectionResult * result);
+///
+void triangle_intersect(__global float * dataPtr, float3 rayOrigin, float3 rayDirection, struct RayIntersectionResult * result);
 
 ///
 void next_intersection(
@@ -92,6 +94,9 @@ void next_intersection(
         case PlaneObjectType:
             plane_intersect(dataStart, rayOrigin, rayDirection, result);
             break;
+        case TriangleObjectType:
+            triangle_intersect(dataStart, rayOrigin, rayDirection, result);
+            break;
         default:
             break;
     }
@@ -178,4 +183,69 @@ void plane_intersect(__global float * dataPtr, float3 rayOrigin, float3 rayDirec
     result->geomId = data.id;
 }
 
+/// Watertight test (Woop, Benthin and Wald), the same one TriangleMesh uses
+///     on the CPU: the corners are sheared into a space where the ray runs
+///     along z, so an edge shared by two triangles gives both of them the
+///     same (negated) scaled barycentric and no ray slips between them.
+void triangle_intersect(__global float * dataPtr, float3 rayOrigin, float3 rayDirection, struct RayIntersectionResult * result) {
+    /// Contracting the edge products into fmas would round the two
+    ///     triangles of a shared edge differently again
+    #pragma OPENCL FP_CONTRACT OFF
+    
+    struct PovrayTriangleData data = PovrayTriangleData_fromData(dataPtr);
+    
+    /// The axis the ray travels along the most becomes "kz"
+    float direction[3] = {rayDirection.x, rayDirection.y, rayDirection.z};
+    float3 absDirection = fabs(rayDirection);
+    int kz = 0;
+    if (absDirection.y > absDirection.x) {
+        kz = 1;
+    }
+    if (absDirection.z > (kz == 0 ? absDirection.x : absDirection.y)) {
+        kz = 2;
+    }
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    /// Keep the winding the same whichever way the ray points along "kz"
+    if (direction[kz] < 0.0f) {
+        int swap = kx;
+        kx = ky;
+        ky = swap;
+    }
+    
+    float Sx = direction[kx] / direction[kz];
+    float Sy = direction[ky] / direction[kz];
+    float Sz = 1.0f / direction[kz];
+    
+    /// Corners relative to the origin, sheared so the ray runs along z
+    float3 a3 = data.a - rayOrigin, b3 = data.b - rayOrigin, c3 = data.c - rayOrigin;
+    float a[3] = {a3.x, a3.y, a3.z}, b[3] = {b3.x, b3.y, b3.z}, c[3] = {c3.x, c3.y, c3.z};
+    float ax = a[kx] - Sx * a[kz], ay = a[ky] - Sy * a[kz];
+    float bx = b[kx] - Sx * b[kz], by = b[ky] - Sy * b[kz];
+    float cx = c[kx] - Sx * c[kz], cy = c[ky] - Sy * c[kz];
+    
+    /// Scaled barycentrics: twice the signed areas the ray makes with each edge
+    float U = cx * by - cy * bx;
+    float V = ax * cy - ay * cx;
+    float W = bx * ay - by * ax;
+    
+    bool inside = (U >= 0.0f && V >= 0.0f && W >= 0.0f) || (U <= 0.0f && V <= 0.0f && W <= 0.0f);
+    float determinant = U + V + W;
+    if (!inside || determinant == 0.0f) {
+        return;
+    }
+    
+    float t = (U * (Sz * a[kz]) + V * (Sz * b[kz]) + W * (Sz * c[kz])) / determinant;
+    if (t > 0.0f) {
+        result->intersected = true;
+        result->timeOfIntersection = t;
+        result->rayOrigin = rayOrigin;
+        result->rayDirection = rayDirection;
+        result->surfaceNormal = normalize(cross(data.b - data.a, data.c - data.a));
+        if (dot(result->surfaceNormal, rayDirection) > 0.0f) {
+            result->surfaceNormal = -result->surfaceNormal;
+        }
+        result->geomId = data.id;
+    }
+}
+
 #endif /* intersection_h */
@@ -476,6 +476,12 @@ RGBf computeOutputEnergyForHitWithPhotonMap(
             finish = data.finish;
             break;
         };
+        case TriangleObjectType: {
+            struct PovrayTriangleData data = PovrayTriangleData_fromData(hitResult.dataPtr);
+            pigment = data.pigment;
+            finish = data.finish;
+            break;
+        }
         default: {
             break;
         }
@@ -542,6 +548,12 @@ RGBf computeOutputEnergyForHitWithPhotonMap_modified(
             finish = data.finish;
             break;
         };
+        case TriangleObjectType: {
+            struct PovrayTriangleData data = PovrayTriangleData_fromData(hitResult.dataPtr);
+            pigment = data.pigment;
+            finish = data.finish;
+            break;
+        }
         default: {
             break;
         }
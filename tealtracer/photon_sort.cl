@@ -0,0 +1,83 @@
+//
+//  photon_sort.cl
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/5/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef photon_sort_h
+#define photon_sort_h
+
+#include "photon_hashmap.cl"
+#include "radix_sort.cl"
+
+//////////////////////////////////////////////////////////////////////////////
+///
+/// Sorts the photons of a hashmap by grid cell without leaving the device:
+///     "photonsort_makeKeys" pairs every photon with its cell, the pairs go
+///     through the radix sort in "radix_sort.cl", and
+///     "photonsort_permutePhotons" gathers the photons into their new order.
+///
+
+/// NOTE: called over "map_numPhotons" photons
+///
+kernel void photonsort_makeKeys(
+    // Grid specification
+    PHOTON_HASHMAP_BASIC_PARAMS,
+    PHOTON_HASHMAP_PHOTON_PARAMS,
+    // output
+    global uint * keys,
+    global uint * values
+) {
+
+    int index = (int) get_global_id(0);
+    if (index >= map_numPhotons) {
+        return;
+    }
+
+    struct PhotonHashmap map;
+    PHOTON_HASHMAP_SET_BASIC_PARAMS((&map));
+    PHOTON_HASHMAP_SET_PHOTON_PARAMS((&map));
+
+    struct JensenPhoton photon = JensenPhoton_fromData(map.photon_data, index);
+    int hash = PhotonHashmap_clampedCellIndexHash(&map, photon.position);
+
+    /// Photons outside of the grid get the first key past the last cell, so
+    ///     they end up after every photon that is in it
+    keys[index] = hash >= 0 ? (uint) hash : (uint) (map.xdim * map.ydim * map.zdim);
+    values[index] = (uint) index;
+}
+
+/// SYNOPSIS: Called after the keys from "photonsort_makeKeys" are sorted.
+///     Also fills in the hashmap's grid indices, -1 for photons outside of
+///     the grid, so "photonmap_mapPhotonToGrid" does not need to be run.
+/// NOTE: called over "numPhotons" photons
+///
+kernel void photonsort_permutePhotons(
+    global const float * photonsIn,
+    global const uint * sortedKeys,
+    global const uint * sortedValues,
+    const int numPhotons,
+    const int numCells,
+    // output
+    global float * photonsOut,
+    global int * gridIndices
+) {
+
+    int index = (int) get_global_id(0);
+    if (index >= numPhotons) {
+        return;
+    }
+
+    global const float * source = &(photonsIn[sortedValues[index] * kJensenPhoton_floatStride]);
+    global float * destination = &(photonsOut[index * kJensenPhoton_floatStride]);
+    for (unsigned int i = 0; i < kJensenPhoton_floatStride; i++) {
+        destination[i] = source[i];
+    }
+
+    uint key = sortedKeys[index];
+    gridIndices[index] = key < (uint) numCells ? (int) key : -1;
+}
+
+#endif /* photon_sort_h */
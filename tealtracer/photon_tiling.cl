@@ -182,6 +182,12 @@ RGBf PhotonTiler_computeOutputEnergyForHit(
             finish = data.finish;
             break;
         };
+        case TriangleObjectType: {
+            struct PovrayTriangleData data = PovrayTriangleData_fromData(hitResult->dataPtr);
+            pigment = data.pigment;
+            finish = data.finish;
+            break;
+        }
         default: {
             break;
         }
@@ -221,21 +227,20 @@ RGBf PhotonTiler_computeOutputEnergyForHit(
 ////////////////////////////////////////////////////////////////////////////
 
 ///
-struct PhotonTilerSingle {
-    int tileX;
-    int tileY;
+struct PhotonTileIndices {
+    int tilesWide;
     int tileWidth;
     int tileHeight;
     float photonEffectRadius;
     float photonSampleRate;
-    const global float * tilePhotons; // contains a sum("photonCount")*sizeof(Photon)/sizeof(float) photons slots
-    int tilePhotonCount; // a "tiles_size" number of photon counts
+    const global float * photons;
+    const global int * tilePhotonIndices; // every tile's photon indices, back to back
+    const global int * tilePhotonStarts; // "tiles_size + 1" offsets into "tilePhotonIndices"
 };
 
 ///
-RGBf PhotonTilerSingle_computeOutputEnergyForHit(
-    struct PhotonTilerSingle * tiler,
-    const int imageWidth, const int imageHeight,
+RGBf PhotonTileIndices_computeOutputEnergyForHit(
+    struct PhotonTileIndices * tiler,
     const int px, const int py,
     
     enum BRDFType brdf,
@@ -243,9 +248,8 @@ RGBf PhotonTilerSingle_computeOutputEnergyForHit(
 );
 
 ///
-RGBf PhotonTilerSingle_computeOutputEnergyForHit(
-    struct PhotonTilerSingle * tiler,
-    const int imageWidth, const int imageHeight,
+RGBf PhotonTileIndices_computeOutputEnergyForHit(
+    struct PhotonTileIndices * tiler,
     const int px, const int py,
     
     enum BRDFType brdf,
@@ -269,13 +273,21 @@ RGBf PhotonTilerSingle_computeOutputEnergyForHit(
             finish = data.finish;
             break;
         };
+        case TriangleObjectType: {
+            struct PovrayTriangleData data = PovrayTriangleData_fromData(hitResult->dataPtr);
+            pigment = data.pigment;
+            finish = data.finish;
+            break;
+        }
         default: {
             break;
         }
     }
     
-    int photonCount = tiler->tilePhotonCount;
-    const global float * photons = tiler->tilePhotons;
+    int tileIndex = (px/tiler->tileWidth) + (py/tiler->tileHeight)*tiler->tilesWide;
+    int photonStart = tiler->tilePhotonStarts[tileIndex];
+    int photonCount = tiler->tilePhotonStarts[tileIndex + 1] - photonStart;
+    const global int * photonIndices = &tiler->tilePhotonIndices[photonStart];
     float3 intersection = RayIntersectionResult_locationOfIntersection(hitResult);
     
     int i = 0;
@@ -284,7 +296,7 @@ RGBf PhotonTilerSingle_computeOutputEnergyForHit(
     
     /// Sample the collection of photons
     while (i < photonCount) {
-        struct JensenPhoton photon = JensenPhoton_fromData(photons, i);
+        struct JensenPhoton photon = JensenPhoton_fromData(tiler->photons, photonIndices[i]);
         float distanceSqrd = dot(photon.position - intersection, photon.position - intersection);
         if (hitResult->geomId < photon.geomId + 0.01f && hitResult->geomId > photon.geomId - 0.01f
          && distanceSqrd <= tiler->photonEffectRadius * tiler->photonEffectRadius) {
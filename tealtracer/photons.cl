@@ -25,7 +25,11 @@ struct JensenPhoton {
     float geomId;
 };
 
-__constant const unsigned int kJensenPhoton_floatStride = 10;
+/// Floats per photon; the host passes "-D kJensenPhoton_floatStride" built
+///     from "CLPackedPhoton" so the two can't disagree
+#ifndef kJensenPhoton_floatStride
+#define kJensenPhoton_floatStride 10u
+#endif
 
 struct JensenPhoton JensenPhoton_fromData(
     global const float * photon_data,
@@ -184,6 +188,12 @@ void processEmittedPhoton(
                     finish = data.finish;
                     break;
                 };
+                case TriangleObjectType: {
+                    struct PovrayTriangleData data = PovrayTriangleData_fromData(hit.dataPtr);
+                    pigment = data.pigment;
+                    finish = data.finish;
+                    break;
+                }
                 default: {
                     break;
                 }
@@ -0,0 +1,225 @@
+//
+//  radix_sort.cl
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/5/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+#ifndef radix_sort_h
+#define radix_sort_h
+
+//////////////////////////////////////////////////////////////////////////////
+///
+/// Stable least-significant-digit radix sort of (uint key, uint value) pairs,
+///     "RADIX_SORT_BITS" bits per pass. Each pass runs three kernels:
+///
+///     radixsort_histogram:  every work-group counts the digits of its block
+///                           of "RADIX_SORT_BLOCK_SIZE" keys in local memory
+///     radixsort_scan:       one work-group turns those counts, stored digit
+///                           by digit, into each block's first output slot
+///     radixsort_scatter:    every work-group ranks its keys per digit with a
+///                           local prefix scan and writes them out in order
+///
+/// The histogram and scatter kernels are run over one work-group per block,
+///     and the scan kernel over a single work-group, all with
+///     "RADIX_SORT_GROUP_SIZE" work-items.
+///
+
+/// The host passes its own values for these when it builds the program.
+#ifndef RADIX_SORT_GROUP_SIZE
+#define RADIX_SORT_GROUP_SIZE 64
+#endif
+#ifndef RADIX_SORT_BLOCK_SIZE
+#define RADIX_SORT_BLOCK_SIZE 256
+#endif
+
+#define RADIX_SORT_BITS 4
+#define RADIX_SORT_BUCKETS (1 << RADIX_SORT_BITS)
+
+/// Per-digit counts are packed four to a uint, a byte each, so the group
+///     size has to stay below 256.
+#if RADIX_SORT_GROUP_SIZE < RADIX_SORT_BUCKETS || RADIX_SORT_GROUP_SIZE > 255
+#error "RADIX_SORT_GROUP_SIZE must be in [RADIX_SORT_BUCKETS, 255]"
+#endif
+#if RADIX_SORT_BLOCK_SIZE % RADIX_SORT_GROUP_SIZE != 0
+#error "RADIX_SORT_BLOCK_SIZE must be a multiple of RADIX_SORT_GROUP_SIZE"
+#endif
+
+uint4 RadixSort_digitFlag(uint digit);
+uint RadixSort_digitCount(uint4 packedCounts, uint digit);
+uint4 RadixSort_groupExclusiveScan(local uint4 * scratch, uint4 value, uint4 * total);
+
+/// A packed count of 1 for "digit"
+uint4 RadixSort_digitFlag(uint digit) {
+    uint4 flag = (uint4)(0);
+    uint byte = 1u << (8u * (digit & 3u));
+
+    switch (digit >> 2) {
+        case 0: flag.x = byte; break;
+        case 1: flag.y = byte; break;
+        case 2: flag.z = byte; break;
+        default: flag.w = byte; break;
+    }
+
+    return flag;
+}
+
+/// The count for "digit" out of four packed words
+uint RadixSort_digitCount(uint4 packedCounts, uint digit) {
+    uint word;
+
+    switch (digit >> 2) {
+        case 0: word = packedCounts.x; break;
+        case 1: word = packedCounts.y; break;
+        case 2: word = packedCounts.z; break;
+        default: word = packedCounts.w; break;
+    }
+
+    return (word >> (8u * (digit & 3u))) & 0xFFu;
+}
+
+/// Returns the sum of "value" over the work-items before this one in the
+///     group and sets "total" to the sum over the whole group. Every
+///     work-item of the group has to call this.
+uint4 RadixSort_groupExclusiveScan(local uint4 * scratch, uint4 value, uint4 * total) {
+    int lid = (int) get_local_id(0);
+
+    scratch[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /// Hillis-Steele inclusive scan
+    for (int offset = 1; offset < RADIX_SORT_GROUP_SIZE; offset <<= 1) {
+        uint4 addend = lid >= offset ? scratch[lid - offset] : (uint4)(0);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += addend;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    uint4 inclusive = scratch[lid];
+    *total = scratch[RADIX_SORT_GROUP_SIZE - 1];
+    /// Let everyone read the results before "scratch" is reused
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return inclusive - value;
+}
+
+/// NOTE: called over one work-group per block of keys
+///
+kernel void radixsort_histogram(
+    global const uint * keys,
+    const int numKeys,
+    const int shift,
+    // output: "RADIX_SORT_BUCKETS * get_num_groups(0)" counts, digit-major
+    global uint * blockHistograms
+) {
+
+    local uint histogram[RADIX_SORT_BUCKETS];
+
+    int lid = (int) get_local_id(0);
+    int group = (int) get_group_id(0);
+    int numGroups = (int) get_num_groups(0);
+
+    if (lid < RADIX_SORT_BUCKETS) {
+        histogram[lid] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int blockStart = group * RADIX_SORT_BLOCK_SIZE;
+    for (int i = lid; i < RADIX_SORT_BLOCK_SIZE; i += RADIX_SORT_GROUP_SIZE) {
+        int index = blockStart + i;
+        if (index < numKeys) {
+            atomic_inc(&histogram[(keys[index] >> shift) & (RADIX_SORT_BUCKETS - 1)]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /// Digit-major, so one scan over the whole array orders the blocks by
+    ///     digit first and block second
+    if (lid < RADIX_SORT_BUCKETS) {
+        blockHistograms[lid * numGroups + group] = histogram[lid];
+    }
+}
+
+/// SYNOPSIS: Exclusive prefix sum of "data" in place.
+/// NOTE: called over a single work-group
+///
+kernel void radixsort_scan(
+    global uint * data,
+    const int count
+) {
+
+    local uint4 scratch[RADIX_SORT_GROUP_SIZE];
+
+    int lid = (int) get_local_id(0);
+    uint carry = 0;
+
+    for (int chunkStart = 0; chunkStart < count; chunkStart += RADIX_SORT_GROUP_SIZE) {
+        int index = chunkStart + lid;
+        uint value = index < count ? data[index] : 0;
+
+        uint4 packed = (uint4)(0);
+        packed.x = value;
+
+        uint4 total;
+        uint4 before = RadixSort_groupExclusiveScan(scratch, packed, &total);
+        if (index < count) {
+            data[index] = carry + before.x;
+        }
+        carry += total.x;
+    }
+}
+
+/// SYNOPSIS: Called after "radixsort_scan" has been run on the histograms.
+/// NOTE: called over one work-group per block of keys
+///
+kernel void radixsort_scatter(
+    global const uint * keysIn,
+    global const uint * valuesIn,
+    const int numKeys,
+    const int shift,
+    global const uint * blockOffsets,
+    // output
+    global uint * keysOut,
+    global uint * valuesOut
+) {
+
+    local uint4 scratch[RADIX_SORT_GROUP_SIZE];
+    local uint digitOffsets[RADIX_SORT_BUCKETS];
+
+    int lid = (int) get_local_id(0);
+    int group = (int) get_group_id(0);
+    int numGroups = (int) get_num_groups(0);
+
+    if (lid < RADIX_SORT_BUCKETS) {
+        digitOffsets[lid] = blockOffsets[lid * numGroups + group];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /// One key per work-item at a time, in order, so equal digits keep their
+    ///     relative order
+    int blockStart = group * RADIX_SORT_BLOCK_SIZE;
+    for (int tileStart = 0; tileStart < RADIX_SORT_BLOCK_SIZE; tileStart += RADIX_SORT_GROUP_SIZE) {
+        int index = blockStart + tileStart + lid;
+        bool valid = index < numKeys;
+        uint key = valid ? keysIn[index] : 0;
+        uint digit = (key >> shift) & (RADIX_SORT_BUCKETS - 1);
+
+        uint4 tileCounts;
+        uint4 before = RadixSort_groupExclusiveScan(scratch, valid ? RadixSort_digitFlag(digit) : (uint4)(0), &tileCounts);
+
+        if (valid) {
+            uint destination = digitOffsets[digit] + RadixSort_digitCount(before, digit);
+            keysOut[destination] = key;
+            valuesOut[destination] = valuesIn[index];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (lid < RADIX_SORT_BUCKETS) {
+            digitOffsets[lid] += RadixSort_digitCount(tileCounts, (uint) lid);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+#endif /* radix_sort_h */
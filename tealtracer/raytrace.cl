@@ -27,6 +27,9 @@ kernel void emit_photon(
     __global float * planeData,
     const unsigned int numPlanes,
 
+    __global float * triangleData,
+    const unsigned int numTriangles,
+
     // light data
     __global float * lightData,
     const unsigned int numLights,
@@ -52,6 +55,8 @@ kernel void emit_photon(
     config.numSpheres = numSpheres;
     config.planeData = planeData;
     config.numPlanes = numPlanes;
+    config.triangleData = triangleData;
+    config.numTriangles = numTriangles;
     
     config.lightData = lightData;
     config.numLights = numLights;
@@ -94,12 +99,15 @@ kernel void raytrace_one_ray_direct(
 
     __global float * planeData,
     const unsigned int numPlanes,
+
+    __global float * triangleData,
+    const unsigned int numTriangles,
     
     __global float * lightData,
     const unsigned int numLights,
     
     /// output
-    __write_only image2d_t image_output,
+    __write_only image2d_t image_hdr,
     const unsigned int imageWidth,
     const unsigned int imageHeight
     ) {
@@ -125,6 +133,8 @@ kernel void raytrace_one_ray_direct(
     scene.numSpheres = numSpheres;
     scene.planeData = planeData;
     scene.numPlanes = numPlanes;
+    scene.triangleData = triangleData;
+    scene.numTriangles = numTriangles;
     scene.lightData = lightData;
     scene.numLights = numLights;
     
@@ -156,12 +166,7 @@ kernel void raytrace_one_ray_direct(
         }
     }
     
-    write_imagef(image_output, (int2) {px, py}, (float4) {
-        min(energy.x, 1.0f),
-        min(energy.y, 1.0f),
-        min(energy.z, 1.0f),
-        1.0f
-    });
+    write_imagef(image_hdr, (int2) {px, py}, (float4) {energy, 1.0f});
 }
 
 /// SYNOPSIS: Called after sorting all of the photon data.
@@ -242,6 +247,9 @@ kernel void raytrace_one_ray_hashgrid(
 
     __global float * planeData,
     const unsigned int numPlanes,
+
+    __global float * triangleData,
+    const unsigned int numTriangles,
     
     __global float * lightData,
     const unsigned int numLights,
@@ -257,7 +265,7 @@ kernel void raytrace_one_ray_hashgrid(
     PHOTON_HASHMAP_META_PARAMS,
     
     /// output
-    __write_only image2d_t image_output,
+    __write_only image2d_t image_hdr,
     const unsigned int imageWidth,
     const unsigned int imageHeight
     ) {
@@ -289,6 +297,8 @@ kernel void raytrace_one_ray_hashgrid(
     scene.numSpheres = numSpheres;
     scene.planeData = planeData;
     scene.numPlanes = numPlanes;
+    scene.triangleData = triangleData;
+    scene.numTriangles = numTriangles;
     scene.lightData = lightData;
     scene.numLights = numLights;
     
@@ -301,12 +311,7 @@ kernel void raytrace_one_ray_hashgrid(
         energy = computeOutputEnergyForHitWithPhotonMap(brdf, bestIntersection, &map, maxNumPhotonsToGather, maxPhotonGatherDistance, -bestIntersection.rayDirection, photon_indices);
     }
     
-    write_imagef(image_output, (int2) {px, py}, (float4) {
-        min(energy.x, 1.0f),
-        min(energy.y, 1.0f),
-        min(energy.z, 1.0f),
-        1.0f
-    });
+    write_imagef(image_hdr, (int2) {px, py}, (float4) {energy, 1.0f});
 }
 
 /// NOTE: called over imageWidth * imageHeight pixels
@@ -325,6 +330,9 @@ kernel void raytrace_one_ray_hashgrid_modified(
 
     __global float * planeData,
     const unsigned int numPlanes,
+
+    __global float * triangleData,
+    const unsigned int numTriangles,
     
     __global float * lightData,
     const unsigned int numLights,
@@ -338,7 +346,7 @@ kernel void raytrace_one_ray_hashgrid_modified(
     PHOTON_HASHMAP_META_PARAMS,
     
     /// output
-    __write_only image2d_t image_output,
+    __write_only image2d_t image_hdr,
     const unsigned int imageWidth,
     const unsigned int imageHeight
     ) {
@@ -370,6 +378,8 @@ kernel void raytrace_one_ray_hashgrid_modified(
     scene.numSpheres = numSpheres;
     scene.planeData = planeData;
     scene.numPlanes = numPlanes;
+    scene.triangleData = triangleData;
+    scene.numTriangles = numTriangles;
     scene.lightData = lightData;
     scene.numLights = numLights;
     
@@ -381,12 +391,7 @@ kernel void raytrace_one_ray_hashgrid_modified(
         energy = computeOutputEnergyForHitWithPhotonMap_modified(brdf, bestIntersection, &map, maxPhotonGatherDistance);
     }
     
-    write_imagef(image_output, (int2) {px, py}, (float4) {
-        min(energy.x, 1.0f),
-        min(energy.y, 1.0f),
-        min(energy.z, 1.0f),
-        1.0f
-    });
+    write_imagef(image_hdr, (int2) {px, py}, (float4) {energy, 1.0f});
 }
 
 /// NOTE: Instanced over every photon
@@ -473,6 +478,9 @@ kernel void raytrace_one_ray_tiled(
 
     __global float * planeData,
     const unsigned int numPlanes,
+
+    __global float * triangleData,
+    const unsigned int numTriangles,
     
     __global float * lightData,
     const unsigned int numLights,
@@ -488,7 +496,7 @@ kernel void raytrace_one_ray_tiled(
     ///
     
     /// output
-    __write_only image2d_t image_output,
+    __write_only image2d_t image_hdr,
     const unsigned int imageWidth,
     const unsigned int imageHeight
     ) {
@@ -513,6 +521,8 @@ kernel void raytrace_one_ray_tiled(
     scene.numSpheres = numSpheres;
     scene.planeData = planeData;
     scene.numPlanes = numPlanes;
+    scene.triangleData = triangleData;
+    scene.numTriangles = numTriangles;
     scene.lightData = lightData;
     scene.numLights = numLights;
     
@@ -535,29 +545,28 @@ kernel void raytrace_one_ray_tiled(
         energy = PhotonTiler_computeOutputEnergyForHit(&tiler, imageWidth, imageHeight, px, py, brdf, &bestIntersection);
     }
     
-    write_imagef(image_output, (int2) {px, py}, (float4) {
-        min(energy.x, 1.0f),
-        min(energy.y, 1.0f),
-        min(energy.z, 1.0f),
-        1.0f
-    });
+    write_imagef(image_hdr, (int2) {px, py}, (float4) {energy, 1.0f});
 }
 
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+/// SYNOPSIS: Called after "tilePhotonStarts" holds each tile's photon count
+///     and has been turned into offsets by an exclusive scan.
 /// NOTE: Instanced over every photon
 ///
-kernel void copyPhotonsIntoOneTile(
+kernel void copyPhotonIndicesIntoTiles(
     global const float * photons,
     const int photons_size,
     
+    global const float * tiles,
+    const int tiles_size,
+    
     const float photonEffectRadius,
+    const global int * tilePhotonStarts, // "tiles_size + 1" offsets into "tilePhotonIndices"
     
-    const int whichTile,
-    const global float * tiles, // "tile_size" number of photons
-    global float * tilePhotons,
-    volatile global int * nextPhotonIndex // a "tile_size" number of indices
+    volatile global int * nextPhotonIndex, // a "tiles_size" number of indices
+    global int * tilePhotonIndices // "tilePhotonStarts[tiles_size]" photon indices
 ) {
 
     int threadId = (int) get_global_id(0);
@@ -568,18 +577,21 @@ kernel void copyPhotonsIntoOneTile(
     size_t photonIdx = threadId;
     struct JensenPhoton photon = JensenPhoton_fromData(photons, photonIdx);
 
-    struct Tile tile;
-    Tile_fromData(&tile, tiles, whichTile);
-
-    if (Frustum_intersectsOrContainsSphere(&tile.frustum, photon.position, photonEffectRadius)) {
-        int tilePhotonIdx = atomic_add(&nextPhotonIndex[whichTile], 1);
-        JensenPhoton_setData(&photon, tilePhotons, tilePhotonIdx);
+    for (int tileItr = 0; tileItr < tiles_size; tileItr++) {
+        struct Tile tile;
+        Tile_fromData(&tile, tiles, tileItr);
+    
+        if (Frustum_intersectsOrContainsSphere(&tile.frustum, photon.position, photonEffectRadius)) {
+            int tilePhotonIdx = atomic_add(&nextPhotonIndex[tileItr], 1);
+            tilePhotonIndices[tilePhotonStarts[tileItr] + tilePhotonIdx] = threadId;
+        }
     }
 }
 
-/// NOTE: called over tileWidth * tileHeight pixels
+/// NOTE: called over a 2D range of tilesWide * tileWidth by
+///     tilesHigh * tileHeight pixels
 ///
-kernel void raytrace_one_ray_one_tile(
+kernel void raytrace_one_ray_tile_indices(
     /// input
     const float3 camera_location,
     const float3 camera_up,
@@ -593,36 +605,37 @@ kernel void raytrace_one_ray_one_tile(
 
     __global float * planeData,
     const unsigned int numPlanes,
+
+    __global float * triangleData,
+    const unsigned int numTriangles,
     
     __global float * lightData,
     const unsigned int numLights,
     
     ///
-    const int tileX,
-    const int tileY,
+    const int tilesWide,
     const int tileWidth,
     const int tileHeight,
     const float photonEffectRadius,
     const float photonSampleRate,
-    const global float * tilePhotons, // contains a tilePhotonCount*sizeof(Photon)/sizeof(float) photons slots
-    const int tilePhotonCount,
+    const global float * photons,
+    const global int * tilePhotonIndices, // every tile's photon indices, back to back
+    const global int * tilePhotonStarts, // "tiles_size + 1" offsets into "tilePhotonIndices"
     ///
     
     /// output
-    __write_only image2d_t image_output,
+    __write_only image2d_t image_hdr,
     const unsigned int imageWidth,
     const unsigned int imageHeight
     ) {
     
-    int threadId = get_global_id(0);
-    if (threadId >= tileWidth * tileHeight) {
+    /// Tiles on the right and top edges may be cut short by the image
+    int px = (int) get_global_id(0);
+    int py = (int) get_global_id(1);
+    if (px >= (int) imageWidth || py >= (int) imageHeight) {
         return;
     }
     
-    /// Create the ray for this given pixel
-    int px = (threadId % tileWidth) + tileWidth * tileX;
-    int py = (threadId / tileWidth) + tileHeight * tileY;
-    
     float3 rayOrigin = camera_location;
     float3 rayDirection = normalize(camera_forward - 0.5f*camera_up - 0.5f*camera_right
         + camera_right * ((0.5f+(float)px)/(float)imageWidth)
@@ -634,6 +647,8 @@ kernel void raytrace_one_ray_one_tile(
     scene.numSpheres = numSpheres;
     scene.planeData = planeData;
     scene.numPlanes = numPlanes;
+    scene.triangleData = triangleData;
+    scene.numTriangles = numTriangles;
     scene.lightData = lightData;
     scene.numLights = numLights;
         
@@ -643,24 +658,19 @@ kernel void raytrace_one_ray_one_tile(
     /// Calculate color
     if (bestIntersection.intersected) {
     
-        struct PhotonTilerSingle tiler;
+        struct PhotonTileIndices tiler;
         
-        tiler.tileX = tileX;
-        tiler.tileY = tileY;
+        tiler.tilesWide = tilesWide;
         tiler.tileWidth = tileWidth;
         tiler.tileHeight = tileHeight;
         tiler.photonEffectRadius = photonEffectRadius;
         tiler.photonSampleRate = photonSampleRate;
-        tiler.tilePhotons = tilePhotons;
-        tiler.tilePhotonCount = tilePhotonCount;
+        tiler.photons = photons;
+        tiler.tilePhotonIndices = tilePhotonIndices;
+        tiler.tilePhotonStarts = tilePhotonStarts;
         
-        energy = PhotonTilerSingle_computeOutputEnergyForHit(&tiler, imageWidth, imageHeight, px, py, brdf, &bestIntersection);
+        energy = PhotonTileIndices_computeOutputEnergyForHit(&tiler, px, py, brdf, &bestIntersection);
     }
     
-    write_imagef(image_output, (int2) {px, py}, (float4) {
-        min(energy.x, 1.0f),
-        min(energy.y, 1.0f),
-        min(energy.z, 1.0f),
-        1.0f
-    });
+    write_imagef(image_hdr, (int2) {px, py}, (float4) {energy, 1.0f});
 }
@@ -27,6 +27,9 @@ struct SceneConfig {
     __global float * planeData;
     unsigned int numPlanes;
     
+    __global float * triangleData;
+    unsigned int numTriangles;
+    
     // light data
     __global float * lightData;
     unsigned int numLights;
@@ -48,9 +51,9 @@ struct RayIntersectionResult SceneConfig_findClosestIntersection(struct SceneCon
     bestIntersection.intersected = false;
     bestIntersection.timeOfIntersection = INFINITY;
     
-    __global float * dataPtrs[2] = { config->sphereData, config->planeData };
-    unsigned int dataCounts[2] = { config->numSpheres, config->numPlanes };
-    unsigned int dataStrides[2] = { kPovraySphereStride, kPovrayPlaneStride };
+    __global float * dataPtrs[3] = { config->sphereData, config->planeData, config->triangleData };
+    unsigned int dataCounts[3] = { config->numSpheres, config->numPlanes, config->numTriangles };
+    unsigned int dataStrides[3] = { kPovraySphereStride, kPovrayPlaneStride, kPovrayTriangleStride };
     
     for (unsigned int i = 0; i < (unsigned int) NumObjectTypes; i++) {
         struct RayIntersectionResult intersection = closest_intersection(
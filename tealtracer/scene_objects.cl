@@ -49,7 +49,8 @@ __constant const unsigned int kPovrayFinishStride = 4;
 enum ObjectType {
     SphereObjectType = 0,
     PlaneObjectType = 1,
-    NumObjectTypes = 2
+    TriangleObjectType = 2,
+    NumObjectTypes = 3
 };
 
 ///
@@ -84,6 +85,21 @@ __constant unsigned int kPovrayPlaneStride = 3 + 1 + kPovrayPigmentStride + kPov
 ///
 struct PovrayPlaneData PovrayPlaneData_fromData(__global float * data);
 
+/// Loose triangles and the triangles of meshes alike
+struct PovrayTriangleData {
+    float3 a, b, c;
+    
+    struct PovrayPigment pigment;
+    struct PovrayFinish finish;
+    
+    float id;
+};
+
+__constant unsigned int kPovrayTriangleStride = 3 + 3 + 3 + kPovrayPigmentStride + kPovrayFinishStride + 1;
+
+///
+struct PovrayTriangleData PovrayTriangleData_fromData(__global float * data);
+
 ////////////////////////////////////////////////////////////////////////////
 
 ///
@@ -128,4 +144,21 @@ struct PovrayPlaneData PovrayPlaneData_fromData(__global float * data) {
     return result;
 }
 
+///
+struct PovrayTriangleData PovrayTriangleData_fromData(__global float * data) {
+    struct PovrayTriangleData result;
+    
+    result.a = (float3) { data[0], data[1], data[2] };
+    result.b = (float3) { data[3], data[4], data[5] };
+    result.c = (float3) { data[6], data[7], data[8] };
+    result.pigment.color = (float4) { data[9], data[10], data[11], data[12] };
+    result.finish.ambient = data[13];
+    result.finish.diffuse = data[14];
+    result.finish.specular = data[15];
+    result.finish.roughness= data[16];
+    result.id = data[17];
+    
+    return result;
+}
+
 #endif /* scene_objects_h */
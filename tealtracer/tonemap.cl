@@ -0,0 +1,40 @@
+//
+//  tonemap.cl
+//  tealtracer
+//
+//  Created by Nikolai Shkurkin on 6/10/16.
+//  Copyright © 2016 Teal Sunset Studios. All rights reserved.
+//
+
+/// Matches "RaytracingConfig::SupportedTonemap"
+enum TonemapType {
+    ClampTonemap = 0,
+    ReinhardTonemap = 1
+};
+
+constant sampler_t tonemapSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+///
+/// SYNOPSIS: Turns the unclamped radiance the raytracing kernels wrote into
+///     "image_hdr" into display pixels, the same way "Tonemapper" does on the
+///     CPU (up to rounding).
+/// NOTE: Called over (imageWidth, imageHeight)
+///
+kernel void tonemap_image(
+    __read_only image2d_t image_hdr,
+    const unsigned int tonemap,
+    const float exposure,
+    
+    /// output
+    __write_only image2d_t image_output
+    ) {
+    
+    int2 pixel = (int2) {get_global_id(0), get_global_id(1)};
+    
+    float3 color = read_imagef(image_hdr, tonemapSampler, pixel).xyz * exposure;
+    if (tonemap == ReinhardTonemap) {
+        color = color / (1.0f + color);
+    }
+    
+    write_imagef(image_output, pixel, (float4) {min(color, 1.0f), 1.0f});
+}